@@ -4,18 +4,69 @@
 
 #include "bench.h"
 
+#include "clientversion.h"
 #include "key.h"
 #include "main.h"
+#include "policy/fees.h"
+#include "script/sigcache.h"
+#include "streams.h"
 #include "util.h"
 
+#include <boost/bind.hpp>
+
+// Print what each horizon estimates for a few targets after every block, as CSV
+static void PrintFeeEstimates(CBlockPolicyEstimator& estimator, unsigned int nHeight)
+{
+    static const int targets[] = {1, 2, 6, 12, 25, 144};
+    const FeeEstimateHorizon horizons[] = {SHORT_HALFLIFE, MED_HALFLIFE, LONG_HALFLIFE};
+    std::string strLine = strprintf("%u", nHeight);
+    for (int h = 0; h < 3; h++) {
+        for (int t = 0; t < 6; t++) {
+            if ((unsigned int)targets[t] > estimator.HighestTargetTracked(horizons[h]))
+                continue;
+            strLine += strprintf(",%d", estimator.estimateRawFee(targets[t], 0.95, horizons[h]).GetFeePerK());
+        }
+    }
+    printf("%s\n", strLine.c_str());
+}
+
+// Replay a file written with bitcoind -feeestimatesrecord, so changes to the
+// estimator can be compared offline against what a node really saw
+static int ReplayFeeEstimates(const std::string& strFile)
+{
+    CAutoFile filein(fopen(strFile.c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        fprintf(stderr, "Error: cannot open %s\n", strFile.c_str());
+        return 1;
+    }
+    CFeeRate minRelayFee(DEFAULT_MIN_RELAY_TX_FEE);
+    CBlockPolicyEstimator estimator(minRelayFee);
+    printf("height,short1,short2,short6,short12,medium1,medium2,medium6,medium12,medium25,long1,long2,long6,long12,long25,long144\n");
+    try {
+        ReplayFeeEstimatorRecord(filein, estimator, boost::bind(PrintFeeEstimates, boost::ref(estimator), _1));
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
+
 int
 main(int argc, char** argv)
 {
     ECC_Start();
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
+    ParseParameters(argc, argv);
+    InitSignatureCache();
+    InitScriptExecutionCache();
 
-    benchmark::BenchRunner::RunAll();
+    int ret = 0;
+    if (mapArgs.count("-replayfeeestimates"))
+        ret = ReplayFeeEstimates(GetArg("-replayfeeestimates", ""));
+    else
+        benchmark::BenchRunner::RunAll();
 
     ECC_Stop();
+    return ret;
 }
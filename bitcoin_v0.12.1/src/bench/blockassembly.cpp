@@ -0,0 +1,121 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "hash.h"
+#include "main.h"
+#include "miner.h"
+#include "random.h"
+#include "txdb.h"
+#include "txmempool.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <boost/filesystem.hpp>
+
+// Dynamic memory usage the mempool is filled to before timing starts
+static const size_t MEMPOOL_TARGET_USAGE = 300 * 1000000;
+
+// Longest chain of unconfirmed transactions generated in one package
+static const int MAX_PACKAGE_DEPTH = 5;
+
+// A regtest chain containing only the genesis block, with the block tree and
+// coins databases held in memory, the same way the unit tests set it up.
+class BenchChainSetup
+{
+private:
+    boost::filesystem::path pathTemp;
+    CCoinsViewDB* pcoinsdbview;
+
+public:
+    BenchChainSetup()
+    {
+        SelectParams(CBaseChainParams::REGTEST);
+        ClearDatadirCache();
+        pathTemp = GetTempPath() / strprintf("bench_bitcoin_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+        boost::filesystem::create_directories(pathTemp);
+        mapArgs["-datadir"] = pathTemp.string();
+        pblocktree = new CBlockTreeDB(1 << 20, true);
+        pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        InitBlockIndex(Params());
+    }
+
+    ~BenchChainSetup()
+    {
+        mempool.clear();
+        UnloadBlockIndex();
+        delete pcoinsTip;
+        delete pcoinsdbview;
+        delete pblocktree;
+        boost::filesystem::remove_all(pathTemp);
+        mapArgs.erase("-datadir");
+    }
+};
+
+// Adds a confirmed anyone-can-spend output to the coins view and returns it.
+static COutPoint AddConfirmedCoin(uint32_t n, CAmount nValue)
+{
+    uint256 hash = Hash(BEGIN(n), END(n));
+    CCoinsModifier coins = pcoinsTip->ModifyCoins(hash);
+    coins->fCoinBase = false;
+    coins->nVersion = 1;
+    coins->nHeight = 1;
+    coins->vout.resize(1);
+    coins->vout[0].nValue = nValue;
+    coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return COutPoint(hash, 0);
+}
+
+// Fills the mempool with packages of one to MAX_PACKAGE_DEPTH chained
+// transactions spending anyone-can-spend outputs, so the template built from
+// it passes TestBlockValidity. Fees are random, so low fee parents with high
+// fee children (which only ancestor feerate selection picks up) are common.
+static void FillMempool()
+{
+    LOCK2(cs_main, mempool.cs);
+    seed_insecure_rand(true);
+    const unsigned int nHeight = chainActive.Height();
+    const CAmount nCoinValue = 50 * COIN;
+    std::vector<unsigned char> vPadding(100, 0x5a);
+    uint32_t nCoins = 0;
+    while (mempool.DynamicMemoryUsage() < MEMPOOL_TARGET_USAGE) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = AddConfirmedCoin(nCoins++, nCoinValue);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        CAmount nValueIn = nCoinValue;
+        int nDepth = 1 + insecure_rand() % MAX_PACKAGE_DEPTH;
+        for (int i = 0; i < nDepth; i++) {
+            tx.vin[0].scriptSig = CScript() << vPadding << i;
+            CAmount nFee = insecure_rand() % 40000;
+            tx.vout[0].nValue = nValueIn - nFee;
+            CTransaction txFinal(tx);
+            mempool.addUnchecked(txFinal.GetHash(), CTxMemPoolEntry(txFinal, nFee, GetTime(), 0, nHeight,
+                                 i == 0, i == 0 ? nValueIn : 0, false, 0, LockPoints()));
+            tx.vin[0].prevout = COutPoint(txFinal.GetHash(), 0);
+            nValueIn = tx.vout[0].nValue;
+        }
+    }
+}
+
+// Build a block template from a full mempool: ancestor feerate package
+// selection, then coinbase creation and TestBlockValidity.
+static void AssembleBlock300MB(benchmark::State& state)
+{
+    BenchChainSetup setup;
+    FillMempool();
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    while (state.KeepRunning()) {
+        CBlockTemplate* pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptPubKey);
+        assert(pblocktemplate->block.vtx.size() > 1);
+        delete pblocktemplate;
+    }
+}
+
+BENCHMARK(AssembleBlock300MB);
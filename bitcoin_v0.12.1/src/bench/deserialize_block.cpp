@@ -0,0 +1,56 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "version.h"
+
+// Transactions shaped like typical P2PKH spends, enough for about 1MB
+static const int BLOCK_TXS = 2000;
+
+static CDataStream SerializedBlock()
+{
+    CBlock block;
+    for (int i = 0; i < BLOCK_TXS; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(2);
+        tx.vout.resize(2);
+        for (int j = 0; j < 2; j++) {
+            tx.vin[j].prevout.n = j;
+            tx.vin[j].scriptSig = CScript() << std::vector<unsigned char>(72, i) << std::vector<unsigned char>(33, j);
+            tx.vout[j].nValue = i;
+            tx.vout[j].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+        }
+        block.vtx.push_back(CTransaction(tx));
+    }
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    return ss;
+}
+
+static void DeserializeBlock(benchmark::State& state)
+{
+    CDataStream ssBlock = SerializedBlock();
+    while (state.KeepRunning()) {
+        CDataStream ss(ssBlock);
+        CBlock block;
+        ss >> block;
+    }
+}
+
+// Same, with all scripts in one arena sized from the message
+static void DeserializeBlockArena(benchmark::State& state)
+{
+    CDataStream ssBlock = SerializedBlock();
+    while (state.KeepRunning()) {
+        CDataStream ss(ssBlock);
+        CBlock block;
+        UnserializeBlockWithArena(ss, block, ss.size());
+    }
+}
+
+BENCHMARK(DeserializeBlock);
+BENCHMARK(DeserializeBlockArena);
@@ -0,0 +1,84 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "amount.h"
+#include "hash.h"
+#include "policy/fees.h"
+#include "random.h"
+#include "utilstrencodings.h"
+
+// Transactions entering the mempool, and confirming, every block
+static const int TXS_PER_BLOCK = 2000;
+
+// Blocks processed before timing starts, so every horizon has data
+static const unsigned int WARMUP_BLOCKS = 200;
+
+// Feeds estimator a block's worth of new transactions with random fees, then
+// confirms TXS_PER_BLOCK of the waiting ones, preferring higher fees.
+static void ProcessOneBlock(CBlockPolicyEstimator& estimator, unsigned int nHeight,
+                            uint32_t& nTx, std::vector<FeeEstimatorTx>& vWaiting)
+{
+    for (int i = 0; i < TXS_PER_BLOCK; i++, nTx++) {
+        FeeEstimatorTx tx;
+        tx.hash = Hash(BEGIN(nTx), END(nTx));
+        tx.nHeight = nHeight - 1;
+        tx.nTxSize = 250;
+        tx.nFee = 250 + insecure_rand() % 50000;
+        tx.fClearAtEntry = true;
+        estimator.processTransaction(tx, true);
+        vWaiting.push_back(tx);
+    }
+    std::vector<FeeEstimatorTx> vConfirmed;
+    for (size_t i = 0; i < vWaiting.size() && vConfirmed.size() < (size_t)TXS_PER_BLOCK; ) {
+        if (insecure_rand() % 50000 < (uint32_t)vWaiting[i].nFee) {
+            estimator.removeTx(vWaiting[i].hash);
+            vConfirmed.push_back(vWaiting[i]);
+            vWaiting[i] = vWaiting.back();
+            vWaiting.pop_back();
+        } else {
+            i++;
+        }
+    }
+    estimator.processBlock(nHeight, vConfirmed, true);
+}
+
+// Track and confirm a block of 2000 transactions, as a node does for every
+// block connected while synced.
+static void FeeEstimatorProcessBlock(benchmark::State& state)
+{
+    CBlockPolicyEstimator estimator(CFeeRate(1000));
+    seed_insecure_rand(true);
+    std::vector<FeeEstimatorTx> vWaiting;
+    uint32_t nTx = 0;
+    unsigned int nHeight = 1;
+    for (; nHeight <= WARMUP_BLOCKS; nHeight++)
+        ProcessOneBlock(estimator, nHeight, nTx, vWaiting);
+    while (state.KeepRunning())
+        ProcessOneBlock(estimator, nHeight++, nTx, vWaiting);
+}
+
+// Answer estimaterawfee for every target and horizon, right after a block
+// changed the data they are computed from.
+static void FeeEstimatorEstimate(benchmark::State& state)
+{
+    CBlockPolicyEstimator estimator(CFeeRate(1000));
+    seed_insecure_rand(true);
+    std::vector<FeeEstimatorTx> vWaiting;
+    uint32_t nTx = 0;
+    unsigned int nHeight = 1;
+    for (; nHeight <= WARMUP_BLOCKS; nHeight++)
+        ProcessOneBlock(estimator, nHeight, nTx, vWaiting);
+    const FeeEstimateHorizon horizons[] = {SHORT_HALFLIFE, MED_HALFLIFE, LONG_HALFLIFE};
+    while (state.KeepRunning()) {
+        estimator.processBlock(nHeight++, std::vector<FeeEstimatorTx>(), true);
+        for (int h = 0; h < 3; h++) {
+            for (unsigned int i = 1; i <= estimator.HighestTargetTracked(horizons[h]); i++)
+                estimator.estimateRawFee(i, 0.95, horizons[h]);
+        }
+    }
+}
+
+BENCHMARK(FeeEstimatorProcessBlock);
+BENCHMARK(FeeEstimatorEstimate);
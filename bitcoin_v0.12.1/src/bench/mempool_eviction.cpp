@@ -0,0 +1,65 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "amount.h"
+#include "hash.h"
+#include "random.h"
+#include "txmempool.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+
+// Dynamic memory usage the mempool is filled to before timing starts
+static const size_t MEMPOOL_TARGET_USAGE = 1000 * 1000000;
+
+// Memory freed by every TrimToSize call that is timed
+static const size_t TRIM_STEP = 1000000;
+
+// Longest chain of unconfirmed transactions generated in one package
+static const int MAX_PACKAGE_DEPTH = 5;
+
+// Fills pool with packages of one to MAX_PACKAGE_DEPTH chained transactions
+// with random fees, so that evicting the lowest descendant score package
+// often takes a high fee child along with its low fee parents.
+static void FillMempool(CTxMemPool& pool)
+{
+    LOCK(pool.cs);
+    seed_insecure_rand(true);
+    std::vector<unsigned char> vPadding(100, 0x5a);
+    uint32_t nPackages = 0;
+    while (pool.DynamicMemoryUsage() < MEMPOOL_TARGET_USAGE) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(Hash(BEGIN(nPackages), END(nPackages)), 0);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        tx.vout[0].nValue = 50 * COIN;
+        int nDepth = 1 + insecure_rand() % MAX_PACKAGE_DEPTH;
+        for (int i = 0; i < nDepth; i++) {
+            tx.vin[0].scriptSig = CScript() << vPadding << i;
+            CAmount nFee = insecure_rand() % 40000;
+            CTransaction txFinal(tx);
+            pool.addUnchecked(txFinal.GetHash(), CTxMemPoolEntry(txFinal, nFee, GetTime(), 0, 1,
+                              i == 0, 0, false, 1, LockPoints()));
+            tx.vin[0].prevout = COutPoint(txFinal.GetHash(), 0);
+        }
+        nPackages++;
+    }
+}
+
+// Evict TRIM_STEP worth of the lowest feerate packages from a full 1GB
+// mempool, as LimitMempoolSize does after a transaction takes it over the
+// limit.
+static void MempoolEviction1GB(benchmark::State& state)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    FillMempool(pool);
+    while (state.KeepRunning()) {
+        size_t nUsage = pool.DynamicMemoryUsage();
+        assert(nUsage > TRIM_STEP);
+        pool.TrimToSize(nUsage - TRIM_STEP);
+    }
+}
+
+BENCHMARK(MempoolEviction1GB);
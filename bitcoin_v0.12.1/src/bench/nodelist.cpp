@@ -0,0 +1,118 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "net.h"
+#include "sync.h"
+#include "tinyformat.h"
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+// Number of simulated peers
+static const int NODE_COUNT = 1000;
+
+static volatile size_t nSink = 0;
+
+// Adds NODE_COUNT inbound nodes without a socket to vNodes for the duration
+// of a benchmark. With fChurn, a background thread keeps connecting and
+// disconnecting one more node, as connection churn does on a busy listener.
+class FakeConnections
+{
+private:
+    std::vector<CNode*> vFake;
+    CNode* pnodeChurn;
+    boost::thread threadChurn;
+
+    void Churn()
+    {
+        while (!boost::this_thread::interruption_requested()) {
+            {
+                LOCK(cs_vNodes);
+                vNodes.push_back(pnodeChurn);
+                PublishNodeSnapshot();
+            }
+            {
+                LOCK(cs_vNodes);
+                vNodes.pop_back();
+                PublishNodeSnapshot();
+            }
+            boost::this_thread::yield();
+        }
+    }
+
+public:
+    FakeConnections(bool fChurn)
+    {
+        for (int i = 0; i < NODE_COUNT + 1; i++) {
+            CAddress addr(CService(CNetAddr(strprintf("10.%d.%d.1", i / 256, i % 256)), 8333));
+            vFake.push_back(new CNode(INVALID_SOCKET, addr, "", true));
+        }
+        pnodeChurn = vFake.back();
+        {
+            LOCK(cs_vNodes);
+            vNodes.assign(vFake.begin(), vFake.end() - 1);
+            PublishNodeSnapshot();
+        }
+        if (fChurn)
+            threadChurn = boost::thread(&FakeConnections::Churn, this);
+    }
+
+    ~FakeConnections()
+    {
+        threadChurn.interrupt();
+        if (threadChurn.joinable())
+            threadChurn.join();
+        {
+            LOCK(cs_vNodes);
+            vNodes.clear();
+            PublishNodeSnapshot();
+        }
+        BOOST_FOREACH(CNode* pnode, vFake)
+            delete pnode;
+    }
+};
+
+// What every reader of the connection list used to do: copy it under
+// cs_vNodes, take a reference on each node, and give them back afterwards.
+static void CopyNodeList(benchmark::State& state, bool fChurn)
+{
+    FakeConnections connections(fChurn);
+    while (state.KeepRunning()) {
+        std::vector<CNode*> vNodesCopy;
+        {
+            LOCK(cs_vNodes);
+            vNodesCopy = vNodes;
+            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+                pnode->AddRef();
+        }
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            nSink += pnode->nSendSize;
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+                pnode->Release();
+        }
+    }
+}
+
+static void SnapshotNodeList(benchmark::State& state, bool fChurn)
+{
+    FakeConnections connections(fChurn);
+    while (state.KeepRunning()) {
+        NodeSnapshot vNodesCopy = GetNodeSnapshot();
+        BOOST_FOREACH(CNode* pnode, *vNodesCopy)
+            nSink += pnode->nSendSize;
+    }
+}
+
+static void NodeListCopy(benchmark::State& state) { CopyNodeList(state, false); }
+static void NodeListCopyChurn(benchmark::State& state) { CopyNodeList(state, true); }
+static void NodeListSnapshot(benchmark::State& state) { SnapshotNodeList(state, false); }
+static void NodeListSnapshotChurn(benchmark::State& state) { SnapshotNodeList(state, true); }
+
+BENCHMARK(NodeListCopy);
+BENCHMARK(NodeListCopyChurn);
+BENCHMARK(NodeListSnapshot);
+BENCHMARK(NodeListSnapshotChurn);
@@ -0,0 +1,73 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "amount.h"
+#include "hash.h"
+#include "primitives/transaction.h"
+#include "script/interpreter.h"
+#include "script/script.h"
+#include "uint256.h"
+#include "utilstrencodings.h"
+
+// Inputs of the transaction being signed, about the most a standard
+// transaction of 100kB can have with P2PKH scriptSigs
+static const unsigned int LARGE_TX_INPUTS = 5000;
+
+// A transaction spending LARGE_TX_INPUTS P2PKH outputs into two outputs, with
+// realistically sized scriptSigs
+static CTransaction MakeLargeTransaction()
+{
+    CMutableTransaction tx;
+    tx.vin.resize(LARGE_TX_INPUTS);
+    for (uint32_t i = 0; i < LARGE_TX_INPUTS; i++) {
+        tx.vin[i].prevout = COutPoint(Hash(BEGIN(i), END(i)), i % 4);
+        tx.vin[i].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+    }
+    tx.vout.resize(2);
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        tx.vout[i].nValue = 50 * COIN;
+        tx.vout[i].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    return tx;
+}
+
+static const CScript scriptCode = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0x5a) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+// SIGHASH_ALL hash of one input of the large transaction, reserializing the
+// whole transaction every time
+static void SignatureHashLargeTx(benchmark::State& state)
+{
+    CTransaction tx = MakeLargeTransaction();
+    unsigned int nIn = 0;
+    while (state.KeepRunning()) {
+        SignatureHash(scriptCode, tx, nIn, SIGHASH_ALL);
+        nIn = (nIn + 1) % LARGE_TX_INPUTS;
+    }
+}
+
+// Same, resuming from the transaction's precomputed data shared by all inputs
+static void SignatureHashLargeTxPrecomputed(benchmark::State& state)
+{
+    CTransaction tx = MakeLargeTransaction();
+    PrecomputedTransactionData txdata(tx);
+    unsigned int nIn = 0;
+    while (state.KeepRunning()) {
+        SignatureHash(scriptCode, tx, nIn, SIGHASH_ALL, &txdata);
+        nIn = (nIn + 1) % LARGE_TX_INPUTS;
+    }
+}
+
+// Computing the precomputed data, paid once per transaction
+static void PrecomputeLargeTx(benchmark::State& state)
+{
+    CTransaction tx = MakeLargeTransaction();
+    while (state.KeepRunning()) {
+        PrecomputedTransactionData txdata(tx);
+    }
+}
+
+BENCHMARK(SignatureHashLargeTx);
+BENCHMARK(SignatureHashLargeTxPrecomputed);
+BENCHMARK(PrecomputeLargeTx);
@@ -0,0 +1,35 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "key.h"
+#include "pubkey.h"
+#include "uint256.h"
+
+#include <vector>
+
+// One ECDSA verification through CPubKey::Verify, which is what every
+// signature check in script validation ends up calling.
+static void VerifyECDSA(benchmark::State& state)
+{
+    ECCVerifyHandle verifyHandle;
+    unsigned char vchKey[32];
+    for (int i = 0; i < 32; i++)
+        vchKey[i] = 33 + i;
+    CKey key;
+    key.Set(vchKey, vchKey + 32, true);
+    CPubKey pubkey = key.GetPubKey();
+
+    uint256 hash;
+    for (int i = 0; i < 32; i++)
+        hash.begin()[i] = 1 + i;
+    std::vector<unsigned char> vchSig;
+    assert(key.Sign(hash, vchSig));
+
+    while (state.KeepRunning()) {
+        assert(pubkey.Verify(hash, vchSig));
+    }
+}
+
+BENCHMARK(VerifyECDSA);
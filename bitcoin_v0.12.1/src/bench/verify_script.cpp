@@ -0,0 +1,96 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "hash.h"
+#include "pubkey.h"
+#include "script/interpreter.h"
+#include "script/script.h"
+#include "script/standard.h"
+
+#include <vector>
+
+// Accepts every signature, so that only the interpreter itself is measured
+class AcceptingSignatureChecker : public BaseSignatureChecker
+{
+public:
+    bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const
+    {
+        return true;
+    }
+};
+
+static std::vector<unsigned char> DummySignature()
+{
+    std::vector<unsigned char> vchSig(72, 0x30);
+    vchSig.back() = SIGHASH_ALL;
+    return vchSig;
+}
+
+static std::vector<unsigned char> DummyPubKey(unsigned char c)
+{
+    std::vector<unsigned char> vchPubKey(33, c);
+    vchPubKey[0] = 0x02;
+    return vchPubKey;
+}
+
+static void VerifyP2PKH(benchmark::State& state, CScriptArena* parena)
+{
+    std::vector<unsigned char> vchPubKey = DummyPubKey(0x5a);
+    CScript scriptPubKey = GetScriptForDestination(CKeyID(Hash160(vchPubKey)));
+    CScript scriptSig = CScript() << DummySignature() << vchPubKey;
+    AcceptingSignatureChecker checker;
+    while (state.KeepRunning()) {
+        bool ret = VerifyScript(scriptSig, scriptPubKey, SCRIPT_VERIFY_P2SH, checker, NULL, parena);
+        assert(ret);
+    }
+}
+
+// 2-of-3 multisig, the most common P2SH script
+static void VerifyP2SHMultisig(benchmark::State& state, CScriptArena* parena)
+{
+    std::vector<CPubKey> vPubKeys;
+    for (unsigned char c = 1; c <= 3; c++) {
+        std::vector<unsigned char> vchPubKey = DummyPubKey(c);
+        vPubKeys.push_back(CPubKey(vchPubKey.begin(), vchPubKey.end()));
+    }
+    CScript redeemScript = GetScriptForMultisig(2, vPubKeys);
+    CScript scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+    CScript scriptSig = CScript() << OP_0 << DummySignature() << DummySignature()
+                                  << std::vector<unsigned char>(redeemScript.begin(), redeemScript.end());
+    AcceptingSignatureChecker checker;
+    while (state.KeepRunning()) {
+        bool ret = VerifyScript(scriptSig, scriptPubKey, SCRIPT_VERIFY_P2SH, checker, NULL, parena);
+        assert(ret);
+    }
+}
+
+// Fresh stacks for every script, as when no arena is passed
+static void VerifyScriptP2PKH(benchmark::State& state)
+{
+    VerifyP2PKH(state, NULL);
+}
+
+// Stacks reused across scripts, as by the script check threads
+static void VerifyScriptP2PKHArena(benchmark::State& state)
+{
+    CScriptArena arena;
+    VerifyP2PKH(state, &arena);
+}
+
+static void VerifyScriptP2SHMultisig(benchmark::State& state)
+{
+    VerifyP2SHMultisig(state, NULL);
+}
+
+static void VerifyScriptP2SHMultisigArena(benchmark::State& state)
+{
+    CScriptArena arena;
+    VerifyP2SHMultisig(state, &arena);
+}
+
+BENCHMARK(VerifyScriptP2PKH);
+BENCHMARK(VerifyScriptP2PKHArena);
+BENCHMARK(VerifyScriptP2SHMultisig);
+BENCHMARK(VerifyScriptP2SHMultisigArena);
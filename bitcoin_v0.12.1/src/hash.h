@@ -131,18 +131,25 @@ class CHashWriter // 
 {
 private:
     CHash256 ctx;
+    size_t nSize;
 
 public:
     int nType;
     int nVersion;
 
-    CHashWriter(int nTypeIn, int nVersionIn) : nType(nTypeIn), nVersion(nVersionIn) {}
+    CHashWriter(int nTypeIn, int nVersionIn) : nSize(0), nType(nTypeIn), nVersion(nVersionIn) {}
 
     CHashWriter& write(const char *pch, size_t size) {
         ctx.Write((const unsigned char*)pch, size);
+        nSize += size;
         return (*this);
     }
 
+    //! Number of bytes hashed so far
+    size_t size() const {
+        return nSize;
+    }
+
     // invalidates the object
     uint256 GetHash() {
         uint256 result;
@@ -158,6 +165,38 @@ public:
     }
 };
 
+/**
+ * A CHashWriter that also keeps the bytes written to it, so a single
+ * serialization pass gives the encoding, its size and its hash. Data that
+ * should only be hashed can go through the CHashWriter base.
+ */
+class CBufferedHashWriter : public CHashWriter
+{
+private:
+    std::vector<char> vch;
+
+public:
+    CBufferedHashWriter(int nTypeIn, int nVersionIn) : CHashWriter(nTypeIn, nVersionIn) {}
+
+    CBufferedHashWriter& write(const char *pch, size_t size) {
+        CHashWriter::write(pch, size);
+        vch.insert(vch.end(), pch, pch + size);
+        return (*this);
+    }
+
+    //! The bytes written through this class (not through the base)
+    const std::vector<char>& data() const {
+        return vch;
+    }
+
+    template<typename T>
+    CBufferedHashWriter& operator<<(const T& obj) {
+        // Serialize to this stream
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 /** Compute the 256-bit hash of an object's serialization. */
 template<typename T>
 uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL_VERSION)
@@ -596,6 +596,14 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
  * Replies must be sent in the main loop in the main http thread,
  * this cannot be done from worker threads.
  */ // ͵߳Ӧڷһ HTTP 󡣷 http ̵߳ѭзܴͣӹ߳з͡
+void HTTPRequest::WriteReplyPart(const std::string& strPart)
+{
+    assert(!replySent && req);
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    evbuffer_add(evb, strPart.data(), strPart.size());
+}
+
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
     assert(!replySent && req); // Ӧδ   http 
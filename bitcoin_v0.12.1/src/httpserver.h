@@ -103,6 +103,15 @@ public:
      */ // дӦͷעڵ WriteErrorReply  Reply ǰø
     void WriteHeader(const std::string& hdr, const std::string& value);
 
+    /**
+     * Append to the body of the HTTP reply without sending it yet, so large
+     * replies can be written piece by piece instead of as one string.
+     *
+     * @note call this before WriteReply, which sends what was appended
+     * followed by its own strReply.
+     */
+    void WriteReplyPart(const std::string& strPart);
+
     /**
      * Write HTTP reply.
      * nStatus is the HTTP status code to send.
@@ -68,6 +68,7 @@ using namespace std;
 CWallet* pwalletMain = NULL; // ָǮָ
 #endif
 bool fFeeEstimatesInitialized = false;
+static bool fDumpMempoolLater = false; // ڴؼɺ󣬹رʱת
 static const bool DEFAULT_PROXYRANDOMIZE = true;
 static const bool DEFAULT_REST_ENABLE = false;
 static const bool DEFAULT_DISABLE_SAFEMODE = false;
@@ -200,6 +201,9 @@ void Shutdown()
     StopTorControl(); // ر·
     UnregisterNodeSignals(GetNodeSignals()); // עעĽڵźź
 
+    if (fDumpMempoolLater && GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) // תڴص
+        DumpMempool();
+
     if (fFeeEstimatesInitialized) // ùѳʼ
     {
         boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME; // ·ƴӻȡùļ·
@@ -334,10 +338,14 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-maxorphantxperpeer=<n>", strprintf(_("Keep at most <n> unconnectable transactions from a single peer (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS_PER_PEER));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-txvalidationthreads=<n>", strprintf(_("Set the number of threads verifying relayed transactions (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        -GetNumCores(), MAX_TXVALIDATION_THREADS, DEFAULT_TXVALIDATION_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
@@ -366,6 +374,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
+    strUsage += HelpMessageOpt("-maxpeerblockrate=<n>", strprintf(_("Limit block and merkleblock traffic to each non-whitelisted peer to <n> kB/s, 0 = no limit (default: %u)"), DEFAULT_MAX_PEER_BLOCK_RATE));
+    strUsage += HelpMessageOpt("-maxpeertxrate=<n>", strprintf(_("Limit transaction traffic to each non-whitelisted peer to <n> kB/s, 0 = no limit (default: %u)"), DEFAULT_MAX_PEER_TX_RATE));
+    strUsage += HelpMessageOpt("-maxpeeraddrrate=<n>", strprintf(_("Limit address traffic to each non-whitelisted peer to <n> kB/s, 0 = no limit (default: %u)"), DEFAULT_MAX_PEER_ADDR_RATE));
+    strUsage += HelpMessageOpt("-maxrelaycachesize=<n>", strprintf(_("Keep relayed transactions that left the mempool in memory below <n> megabytes, so peers can still fetch them (default: %u)"), DEFAULT_MAX_RELAY_CACHE_SIZE));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
@@ -439,6 +451,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", DEFAULT_DISABLE_SAFEMODE));
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", DEFAULT_TESTSAFEMODE));
         strUsage += HelpMessageOpt("-dropmessagestest=<n>", "Randomly drop 1 of every <n> network messages");
+        strUsage += HelpMessageOpt("-feeestimatesrecord=<file>", "Append every transaction and block the fee estimator sees to <file>, for replaying with bench_bitcoin -replayfeeestimates");
         strUsage += HelpMessageOpt("-fuzzmessagestest=<n>", "Randomly fuzz 1 of every <n> network messages");
 #ifdef ENABLE_WALLET
         strUsage += HelpMessageOpt("-flushwallet", strprintf("Run a thread to flush wallet periodically (default: %u)", DEFAULT_FLUSHWALLET));
@@ -467,7 +480,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)");
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", DEFAULT_LIMITFREERELAY));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", DEFAULT_RELAYPRIORITY));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit sum of signature cache and script execution cache sizes to <n> MiB, split evenly between the two (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)"),
         CURRENCY_UNIT, FormatMoney(DEFAULT_MIN_RELAY_TX_FEE)));
@@ -654,6 +667,12 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles) // 
         LogPrintf("Stopping after block import\n");
         StartShutdown(); // رտͻ
     }
+
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) { // Ӵ¼ڴ
+        LoadMempool();
+        // Don't overwrite mempool.dat with what an interrupted load got through
+        fDumpMempoolLater = !fRequestShutdown;
+    }
 }
 
 /** Sanity checks
@@ -919,6 +938,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler) // [P]3.1
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS; // ߳Ϊ 16
 
+    // -txvalidationthreads=0 means autodetect; with nTxValidationThreads==0 the
+    // message handler thread verifies relayed transactions itself
+    nTxValidationThreads = GetArg("-txvalidationthreads", DEFAULT_TXVALIDATION_THREADS);
+    if (nTxValidationThreads <= 0)
+        nTxValidationThreads += GetNumCores();
+    if (nTxValidationThreads < 0)
+        nTxValidationThreads = 0;
+    else if (nTxValidationThreads > MAX_TXVALIDATION_THREADS)
+        nTxValidationThreads = MAX_TXVALIDATION_THREADS;
+
     fServer = GetBoolArg("-server", false); // 5.ѡ3.8.Ϊ true
 
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files // 6.޼ȡ̿ռ MiB ΪλԷͳļڻָ״̬ķ򲹶
@@ -1086,12 +1115,19 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler) // [P]3.1
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD); // ¼õļ
     std::ostringstream strErrors; // Ϣַ
 
+    InitSignatureCache(); //  -maxsigcachesize һԷǩͽűִл
+    InitScriptExecutionCache();
+
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads); // ¼ű֤߳ĬΪ CPU 
     if (nScriptCheckThreads) { // 7. N-1 ű֤߳
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck); // CCheckQueue е loop Ա
     }
 
+    LogPrintf("Using %u threads for relayed transaction verification\n", nTxValidationThreads);
+    for (int i = 0; i < nTxValidationThreads; i++)
+        threadGroup.create_thread(&ThreadTxValidation); // Ϣ֤߳м̵Ľ
+
     // Start the lightweight task scheduler thread // 8.߳
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler); // 8.1.Function/bind Ա serviceQueue  serviceLoop
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop)); // 8.2.߳ threadGroup һ߳
@@ -1259,6 +1295,20 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler) // [P]3.1
         CNode::SetMaxOutboundTarget(GetArg("-maxuploadtarget", DEFAULT_MAX_UPLOAD_TARGET)*1024*1024); // ĬΪ 0 ʾ
     }
 
+    // Per-peer send rates by traffic class // ÿԶ˰Ʒ
+    CNode::SetMaxSendRate(SEND_CLASS_BLOCK, std::max((int64_t)0, GetArg("-maxpeerblockrate", DEFAULT_MAX_PEER_BLOCK_RATE)) * 1000);
+    CNode::SetMaxSendRate(SEND_CLASS_TX, std::max((int64_t)0, GetArg("-maxpeertxrate", DEFAULT_MAX_PEER_TX_RATE)) * 1000);
+    CNode::SetMaxSendRate(SEND_CLASS_ADDR, std::max((int64_t)0, GetArg("-maxpeeraddrrate", DEFAULT_MAX_PEER_ADDR_RATE)) * 1000);
+
+    // Serve announced transactions that have since left the mempool from the relay cache // ͨ浫뿪ڴصĽм̻ṩ
+    relayCache.SetMaxUsage(std::max((int64_t)0, GetArg("-maxrelaycachesize", DEFAULT_MAX_RELAY_CACHE_SIZE)) * 1000000);
+    mempool.NotifyEntryRemoved.connect(boost::bind(&CRelayCache::Insert, &relayCache, _1));
+
+    // Keep the getblocktemplate template in step with the mempool // ʹ getblocktemplate ģڴرͬ
+    mempool.NotifyEntryAdded.connect(boost::bind(&BlockTemplateEngine::TransactionAdded, &blockTemplateEngine, _1));
+    mempool.NotifyEntryRemoved.connect(boost::bind(&BlockTemplateEngine::TransactionRemoved, &blockTemplateEngine, _1));
+    mempool.NotifyEntryPrioritised.connect(boost::bind(&BlockTemplateEngine::TransactionPrioritised, &blockTemplateEngine, _1));
+
     // ********************************************************* Step 7: load block chain // ݣĿ¼ .bitcoin/blocks/
 
     fReindex = GetBoolArg("-reindex", false); // ־ rev ļĬϹر
@@ -1429,6 +1479,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler) // [P]3.1
     if (!est_filein.IsNull()) // ļ
         mempool.ReadFeeEstimates(est_filein); // ڴضȡƷ
     fFeeEstimatesInitialized = true; // ùƳʼ״̬־Ϊ true
+    if (mapArgs.count("-feeestimatesrecord")) { // ¼룬߻ط
+        boost::filesystem::path record_path = GetArg("-feeestimatesrecord", "");
+        if (!record_path.is_complete())
+            record_path = GetDataDir() / record_path;
+        FILE* record_file = fopen(record_path.string().c_str(), "ab");
+        if (!record_file)
+            return InitError(strprintf("Cannot open fee estimates record file %s", record_path.string()));
+        mempool.SetFeeEstimatesRecordFile(record_file);
+        LogPrintf("Recording fee estimator input to %s\n", record_path.string());
+    }
 
     // ********************************************************* Step 8: load wallet // ǮܣǮ
 #ifdef ENABLE_WALLET // 1.ǮЧĺ
@@ -14,6 +14,8 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
 #include "hash.h"
 #include "init.h"
 #include "merkleblock.h"
@@ -63,6 +65,7 @@ int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange; // ı
 int nScriptCheckThreads = 0;
+int nTxValidationThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
@@ -86,9 +89,23 @@ CTxMemPool mempool(::minRelayTxFee); // 
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    int64_t nTimeExpire;
+    size_t nListPos; // position in vOrphanList
 };
-map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);;
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev GUARDED_BY(cs_main);;
+struct IteratorComparator
+{
+    template<typename I>
+    bool operator()(const I& a, const I& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+typedef map<uint256, COrphanTx>::iterator OrphanIt;
+typedef set<OrphanIt, IteratorComparator> OrphanItSet;
+map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main); // ¶ӳб
+map<COutPoint, OrphanItSet> mapOrphanTransactionsByPrev GUARDED_BY(cs_main); // ĳĹ¶
+map<NodeId, OrphanItSet> mapOrphanTransactionsByPeer GUARDED_BY(cs_main); // ÿԶ˷Ĺ¶
+vector<OrphanIt> vOrphanList GUARDED_BY(cs_main); // for O(1) random eviction // 
 void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 /**
@@ -543,6 +560,22 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     }
 }
 
+/** A relayed transaction waiting for a validation thread */
+struct QueuedTransaction
+{
+    CTransaction tx;
+    CNode* pfrom;
+    //! Keeps pfrom from being deleted before the transaction is processed
+    NodeSnapshot vNodesRef;
+
+    QueuedTransaction() : pfrom(NULL) {}
+};
+
+CWaitableCriticalSection csTxValidationQueue;
+CConditionVariable cvTxValidationQueue;
+std::deque<QueuedTransaction> queueTxValidation;
+std::map<NodeId, unsigned int> mapTxValidationQueuedPerPeer;
+
 } // anon namespace
 
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
@@ -576,6 +609,11 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals)
     nodeSignals.SendMessages.disconnect(&SendMessages);
     nodeSignals.InitializeNode.disconnect(&InitializeNode);
     nodeSignals.FinalizeNode.disconnect(&FinalizeNode);
+
+    // Transactions still waiting for a validation thread hold references to their nodes
+    boost::unique_lock<boost::mutex> lock(csTxValidationQueue);
+    queueTxValidation.clear();
+    mapTxValidationQueuedPerPeer.clear();
 }
 
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator)
@@ -601,7 +639,43 @@ CBlockTreeDB *pblocktree = NULL; // 
 // mapOrphanTransactions
 // // ¶ӳб
 
-bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+int static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    OrphanIt it = mapOrphanTransactions.find(hash);
+    if (it == mapOrphanTransactions.end())
+        return 0;
+    BOOST_FOREACH(const CTxIn& txin, it->second.tx.vin)
+    {
+        map<COutPoint, OrphanItSet>::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
+        if (itPrev == mapOrphanTransactionsByPrev.end())
+            continue;
+        itPrev->second.erase(it);
+        if (itPrev->second.empty())
+            mapOrphanTransactionsByPrev.erase(itPrev);
+    }
+
+    map<NodeId, OrphanItSet>::iterator itPeer = mapOrphanTransactionsByPeer.find(it->second.fromPeer);
+    if (itPeer != mapOrphanTransactionsByPeer.end()) {
+        itPeer->second.erase(it);
+        if (itPeer->second.empty())
+            mapOrphanTransactionsByPeer.erase(itPeer);
+    }
+
+    // Move the last entry of the list into the erased slot // бĩβĿλ
+    size_t nOldPos = it->second.nListPos;
+    assert(vOrphanList[nOldPos] == it);
+    if (nOldPos + 1 != vOrphanList.size()) {
+        OrphanIt itLast = vOrphanList.back();
+        vOrphanList[nOldPos] = itLast;
+        itLast->second.nListPos = nOldPos;
+    }
+    vOrphanList.pop_back();
+
+    mapOrphanTransactions.erase(it);
+    return 1;
+}
+
+bool AddOrphanTx(const CTransaction& tx, NodeId peer, unsigned int nMaxOrphansPerPeer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     uint256 hash = tx.GetHash();
     if (mapOrphanTransactions.count(hash))
@@ -614,68 +688,113 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(c
     // have been mined or received.
     // 10,000 orphans, each of which is at most 5,000 bytes big is
     // at most 500 megabytes of orphans:
-    unsigned int sz = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
+    unsigned int sz = tx.GetTotalSize();
     if (sz > 5000)
     {
         LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
         return false;
     }
 
-    mapOrphanTransactions[hash].tx = tx;
-    mapOrphanTransactions[hash].fromPeer = peer;
+    // A peer at its quota makes room among its own orphans, so flooding
+    // cannot push out the orphans other peers gave us.
+    if (nMaxOrphansPerPeer == 0)
+        return false;
+    map<NodeId, OrphanItSet>::iterator itPeer = mapOrphanTransactionsByPeer.find(peer);
+    if (itPeer != mapOrphanTransactionsByPeer.end() && itPeer->second.size() >= nMaxOrphansPerPeer) {
+        LogPrint("mempool", "orphan quota of peer=%d reached, removing one of its orphans\n", peer);
+        EraseOrphanTx((*itPeer->second.begin())->first);
+    }
+
+    OrphanIt it = mapOrphanTransactions.insert(make_pair(hash, COrphanTx())).first;
+    it->second.tx = tx;
+    it->second.fromPeer = peer;
+    it->second.nTimeExpire = GetTime() + ORPHAN_TX_EXPIRE_TIME;
+    it->second.nListPos = vOrphanList.size();
+    vOrphanList.push_back(it);
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
-        mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
+        mapOrphanTransactionsByPrev[txin.prevout].insert(it);
+    mapOrphanTransactionsByPeer[peer].insert(it);
 
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u outsz %u)\n", hash.ToString(),
              mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
     return true;
 }
 
-void static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+void EraseOrphansFor(NodeId peer)
 {
-    map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
-    if (it == mapOrphanTransactions.end())
+    map<NodeId, OrphanItSet>::iterator itPeer = mapOrphanTransactionsByPeer.find(peer);
+    if (itPeer == mapOrphanTransactionsByPeer.end())
         return;
-    BOOST_FOREACH(const CTxIn& txin, it->second.tx.vin)
-    {
-        map<uint256, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
-        if (itPrev == mapOrphanTransactionsByPrev.end())
-            continue;
-        itPrev->second.erase(hash);
-        if (itPrev->second.empty())
-            mapOrphanTransactionsByPrev.erase(itPrev);
-    }
-    mapOrphanTransactions.erase(it);
+    // EraseOrphanTx drops the peer's entry once its last orphan is gone
+    vector<uint256> vErase;
+    vErase.reserve(itPeer->second.size());
+    BOOST_FOREACH(const OrphanIt& it, itPeer->second)
+        vErase.push_back(it->first);
+    int nErased = 0;
+    BOOST_FOREACH(const uint256& hash, vErase)
+        nErased += EraseOrphanTx(hash);
+    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
 }
 
-void EraseOrphansFor(NodeId peer)
+// Drop orphans that were included in or conflict with a connected block
+void static EraseOrphansForBlock(const CBlock& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
-    int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
-    {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
-            ++nErased;
+    if (mapOrphanTransactions.empty())
+        return;
+
+    vector<uint256> vOrphanErase;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            map<COutPoint, OrphanItSet>::iterator itByPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
+            if (itByPrev == mapOrphanTransactionsByPrev.end())
+                continue;
+            BOOST_FOREACH(const OrphanIt& it, itByPrev->second)
+                vOrphanErase.push_back(it->first);
         }
     }
-    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
+
+    int nErased = 0;
+    BOOST_FOREACH(const uint256& hash, vOrphanErase)
+        nErased += EraseOrphanTx(hash);
+    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx included or conflicted by block\n", nErased);
 }
 
+void static ClearOrphans() EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    mapOrphanTransactions.clear();
+    mapOrphanTransactionsByPrev.clear();
+    mapOrphanTransactionsByPeer.clear();
+    vOrphanList.clear();
+}
 
 unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
+    static int64_t nNextSweep;
+    int64_t nNow = GetTime();
+    if (nNextSweep <= nNow) {
+        // Sweep out expired orphan pool entries: // ڵĹ¶
+        int nErased = 0;
+        int64_t nMinExpTime = nNow + ORPHAN_TX_EXPIRE_TIME - ORPHAN_TX_EXPIRE_INTERVAL;
+        OrphanIt iter = mapOrphanTransactions.begin();
+        while (iter != mapOrphanTransactions.end())
+        {
+            OrphanIt maybeErase = iter++; // increment to avoid iterator becoming invalid
+            if (maybeErase->second.nTimeExpire <= nNow) {
+                nErased += EraseOrphanTx(maybeErase->first);
+            } else {
+                nMinExpTime = std::min(maybeErase->second.nTimeExpire, nMinExpTime);
+            }
+        }
+        // Sweep again 5 minutes after the next entry that expires in order to batch the linear scan.
+        nNextSweep = nMinExpTime + ORPHAN_TX_EXPIRE_INTERVAL;
+        if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx due to expiration\n", nErased);
+    }
     unsigned int nEvicted = 0;
     while (mapOrphanTransactions.size() > nMaxOrphans)
     {
         // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
+        size_t randompos = GetRand(vOrphanList.size());
+        EraseOrphanTx(vOrphanList[randompos]->first);
         ++nEvicted;
     }
     return nEvicted;
@@ -942,7 +1061,7 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state)
     if (tx.vout.empty()) // Ϊ
         return state.DoS(10, false, REJECT_INVALID, "bad-txns-vout-empty");
     // Size limits
-    if (::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION) > MAX_BLOCK_SIZE) // Сڵ MAX_BLOCK_SIZE
+    if (tx.GetTotalSize() > MAX_BLOCK_SIZE) // Сڵ MAX_BLOCK_SIZE
         return state.DoS(100, false, REJECT_INVALID, "bad-txns-oversize");
 
     // Check for negative or overflow output values // Сڻֵ
@@ -1002,13 +1121,27 @@ std::string FormatStateMessage(const CValidationState &state)
         state.GetRejectCode());
 }
 
-bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                              bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee,
-                              std::vector<uint256>& vHashTxnToUncache)
+CMemPoolAdmission::CMemPoolAdmission(const CTransaction& txIn, bool fLimitFreeIn, int64_t nAcceptTimeIn,
+                                     bool fOverrideMempoolLimitIn, bool fRejectAbsurdFeeIn) :
+    tx(txIn), fLimitFree(fLimitFreeIn), nAcceptTime(nAcceptTimeIn),
+    fOverrideMempoolLimit(fOverrideMempoolLimitIn), fRejectAbsurdFee(fRejectAbsurdFeeIn), fMissingInputs(false),
+    view(&viewDummy), nModifiedFees(0), nConflictingFees(0), nConflictingSize(0),
+    nTransactionsUpdated(0), nBlockScriptFlags(SCRIPT_VERIFY_NONE), fScriptsChecked(false)
+{
+}
+
+static void UncacheCoins(const std::vector<uint256>& vHashTxnToUncache)
+{
+    BOOST_FOREACH(const uint256& hashTx, vHashTxnToUncache) // δĽ׹ϣб
+        pcoinsTip->Uncache(hashTx); // ӻƳý
+}
+
+static bool PreAcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, CMemPoolAdmission& admission)
 {
     AssertLockHeld(cs_main); // ֤
-    if (pfMissingInputs)
-        *pfMissingInputs = false;
+    const CTransaction& tx = admission.tx;
+    std::vector<uint256>& vHashTxnToUncache = admission.vHashTxnToUncache;
+    admission.fMissingInputs = false;
 
     if (!CheckTransaction(tx, state)) // 齻״̬
         return false;
@@ -1086,8 +1219,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
     }
 
     {
-        CCoinsView dummy; // ͼ
-        CCoinsViewCache view(&dummy); // ͼ
+        CCoinsViewCache& view = admission.view; // ѵıҵĸ֤űʱҪ
 
         CAmount nValueIn = 0;
         LockPoints lp;
@@ -1095,6 +1227,9 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         LOCK(pool.cs);
         CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
         view.SetBackend(viewMemPool);
+        admission.hashBestBlock = pcoinsTip->GetBestBlock();
+        admission.nBlockScriptFlags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus());
+        admission.nTransactionsUpdated = pool.GetTransactionsUpdated();
 
         // do we already have it?
         bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
@@ -1111,8 +1246,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
                 vHashTxnToUncache.push_back(txin.prevout.hash);
             if (!view.HaveCoins(txin.prevout.hash)) {
-                if (pfMissingInputs)
-                    *pfMissingInputs = true;
+                admission.fMissingInputs = true;
                 return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
         }
@@ -1127,7 +1261,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         nValueIn = view.GetValueIn(tx);
 
         // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool // ǻȫ룬лؼ٣ǲҪڴ
-        view.SetBackend(dummy);
+        view.SetBackend(admission.viewDummy);
 
         // Only accept BIP68 sequence locked transactions that can be mined in the next
         // block; we don't want our mempool filled up with transactions that can't
@@ -1166,7 +1300,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             }
         }
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOps, lp);
+        admission.pentry.reset(new CTxMemPoolEntry(tx, nFees, admission.nAcceptTime, dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOps, lp));
+        const CTxMemPoolEntry& entry = *admission.pentry;
         unsigned int nSize = entry.GetTxSize();
 
         // Check that the transaction doesn't have an excessive number of
@@ -1189,7 +1324,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         // Continuously rate-limit free (really, very-low-fee) transactions
         // This mitigates 'penny-flooding' -- sending thousands of free transactions just to
         // be annoying or make others' transactions take longer to confirm.
-        if (fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nSize))
+        if (admission.fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nSize))
         {
             static CCriticalSection csFreeLimiter;
             static double dFreeCount;
@@ -1209,13 +1344,13 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             dFreeCount += nSize;
         }
 
-        if (fRejectAbsurdFee && nFees > ::minRelayTxFee.GetFee(nSize) * 10000)
+        if (admission.fRejectAbsurdFee && nFees > ::minRelayTxFee.GetFee(nSize) * 10000)
             return state.Invalid(false,
                 REJECT_HIGHFEE, "absurdly-high-fee",
                 strprintf("%d > %d", nFees, ::minRelayTxFee.GetFee(nSize) * 10000));
 
         // Calculate in-mempool ancestors, up to a limit.
-        CTxMemPool::setEntries setAncestors;
+        CTxMemPool::setEntries& setAncestors = admission.setAncestors;
         size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
         size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
         size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
@@ -1243,21 +1378,23 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
 
         // Check if it's economically rational to mine this transaction rather
         // than the ones it replaces.
-        CAmount nConflictingFees = 0;
-        size_t nConflictingSize = 0;
+        admission.nModifiedFees = nModifiedFees;
+        CAmount& nConflictingFees = admission.nConflictingFees;
+        size_t& nConflictingSize = admission.nConflictingSize;
         uint64_t nConflictingCount = 0;
-        CTxMemPool::setEntries allConflicting;
+        CTxMemPool::vecEntries& allConflicting = admission.allConflicting;
 
         // If we don't hold the lock allConflicting might be incomplete; the
         // subsequent RemoveStaged() and addUnchecked() calls don't guarantee
-        // mempool consistency for us.
+        // mempool consistency for us, FinishAcceptToMemoryPool() checks that
+        // the mempool did not change in between.
         LOCK(pool.cs);
         if (setConflicts.size())
         {
             CFeeRate newFeeRate(nModifiedFees, nSize);
             set<uint256> setConflictsParents;
             const int maxDescendantsToVisit = 100;
-            CTxMemPool::setEntries setIterConflicting;
+            CTxMemPool::vecEntries vIterConflicting;
             BOOST_FOREACH(const uint256 &hashConflicting, setConflicts)
             {
                 CTxMemPool::txiter mi = pool.mapTx.find(hashConflicting);
@@ -1265,21 +1402,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
                     continue;
 
                 // Save these to avoid repeated lookups
-                setIterConflicting.insert(mi);
-
-                // If this entry is "dirty", then we don't have descendant
-                // state for this transaction, which means we probably have
-                // lots of in-mempool descendants.
-                // Don't allow replacements of dirty transactions, to ensure
-                // that we don't spend too much time walking descendants.
-                // This should be rare.
-                if (mi->IsDirty()) {
-                    return state.DoS(0,
-                            error("AcceptToMemoryPool: rejecting replacement %s; cannot replace tx %s with untracked descendants",
-                                hash.ToString(),
-                                mi->GetTx().GetHash().ToString()),
-                            REJECT_NONSTANDARD, "too many potential replacements");
-                }
+                vIterConflicting.push_back(mi);
 
                 // Don't allow the replacement to reduce the feerate of the
                 // mempool.
@@ -1321,9 +1444,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             if (nConflictingCount <= maxDescendantsToVisit) {
                 // If not too many to replace, then calculate the set of
                 // transactions that would have to be evicted
-                BOOST_FOREACH(CTxMemPool::txiter it, setIterConflicting) {
-                    pool.CalculateDescendants(it, allConflicting);
-                }
+                pool.StageWithDescendants(vIterConflicting, allConflicting);
                 BOOST_FOREACH(CTxMemPool::txiter it, allConflicting) {
                     nConflictingFees += it->GetModifiedFee();
                     nConflictingSize += it->GetTxSize();
@@ -1379,46 +1500,99 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             }
         }
 
-        // Check against previous transactions
-        // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true))
+        // Check the amounts and the maturity of spent coinbases, the
+        // scripts are left to CheckMemPoolAdmissionScripts().
+        PrecomputedTransactionData txdata;
+        if (!CheckInputs(tx, state, view, false, STANDARD_SCRIPT_VERIFY_FLAGS, true, false, txdata))
             return false;
+    }
 
-        // Check again against just the consensus-critical mandatory script
-        // verification flags, in case of bugs in the standard flags that cause
-        // transactions to pass as valid when they're actually invalid. For
-        // instance the STRICTENC flag was incorrectly allowing certain
-        // CHECKSIG NOT scripts to pass, even though they were invalid.
-        //
-        // There is a similar check in CreateNewBlock() to prevent creating
-        // invalid blocks, however allowing such transactions into the mempool
-        // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-        {
-            return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
-                __func__, hash.ToString(), FormatStateMessage(state));
-        }
+    return true;
+}
 
-        // Remove conflicting transactions from the mempool
-        BOOST_FOREACH(const CTxMemPool::txiter it, allConflicting)
-        {
-            LogPrint("mempool", "replacing tx %s with %s for %s BTC additional fees, %d delta bytes\n",
-                    it->GetTx().GetHash().ToString(),
-                    hash.ToString(),
-                    FormatMoney(nModifiedFees - nConflictingFees),
-                    (int)nSize - (int)nConflictingSize);
-        }
-        pool.RemoveStaged(allConflicting);
+bool PreAcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, CMemPoolAdmission& admission)
+{
+    if (!PreAcceptToMemoryPoolWorker(pool, state, admission)) {
+        UncacheCoins(admission.vHashTxnToUncache);
+        return false;
+    }
+    return true;
+}
 
-        // Store transaction in memory
-        pool.addUnchecked(hash, entry, setAncestors, !IsInitialBlockDownload());
+bool CheckMemPoolAdmissionScripts(CValidationState &state, CMemPoolAdmission& admission)
+{
+    const CTransaction& tx = admission.tx;
+    const uint256 hash = tx.GetHash();
+    const CCoinsViewCache& view = admission.view;
+    // Shared by the three passes below, so the signature hashing data is
+    // only computed once
+    PrecomputedTransactionData txdata;
+
+    // Check against previous transactions
+    // This is done last to help prevent CPU exhaustion denial-of-service attacks.
+    if (!CheckInputScripts(tx, state, view, STANDARD_SCRIPT_VERIFY_FLAGS, true, false, txdata))
+        return false;
 
-        // trim mempool and check if tx was trimmed
-        if (!fOverrideMempoolLimit) {
-            LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
-            if (!pool.exists(hash))
-                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
-        }
+    // Check again against just the consensus-critical mandatory script
+    // verification flags, in case of bugs in the standard flags that cause
+    // transactions to pass as valid when they're actually invalid. For
+    // instance the STRICTENC flag was incorrectly allowing certain
+    // CHECKSIG NOT scripts to pass, even though they were invalid.
+    //
+    // There is a similar check in CreateNewBlock() to prevent creating
+    // invalid blocks, however allowing such transactions into the mempool
+    // can be exploited as a DoS attack.
+    if (!CheckInputScripts(tx, state, view, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false, txdata))
+    {
+        return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
+            __func__, hash.ToString(), FormatStateMessage(state));
+    }
+
+    // Run the scripts once more under the flags the next block will most
+    // likely be connected with, this time remembering that they passed, so
+    // connecting that block can skip them. Every signature is a sigcache hit
+    // by now, so this costs little. If the flags turn out different, the
+    // block simply checks the scripts itself.
+    if (!CheckInputScripts(tx, state, view, admission.nBlockScriptFlags, true, true, txdata))
+    {
+        return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against block flags but not STANDARD flags %s, %s",
+            __func__, hash.ToString(), FormatStateMessage(state));
+    }
+
+    admission.fScriptsChecked = true;
+    return true;
+}
+
+// Adds a transaction that passed all checks to the mempool, with
+// pool.cs held since PreAcceptToMemoryPoolWorker() looked at it.
+static bool CommitToMemoryPool(CTxMemPool& pool, CValidationState &state, CMemPoolAdmission& admission)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(pool.cs);
+    const CTransaction& tx = admission.tx;
+    const uint256 hash = tx.GetHash();
+    const CTxMemPoolEntry& entry = *admission.pentry;
+    unsigned int nSize = entry.GetTxSize();
+
+    // Remove conflicting transactions from the mempool
+    BOOST_FOREACH(const CTxMemPool::txiter it, admission.allConflicting)
+    {
+        LogPrint("mempool", "replacing tx %s with %s for %s BTC additional fees, %d delta bytes\n",
+                it->GetTx().GetHash().ToString(),
+                hash.ToString(),
+                FormatMoney(admission.nModifiedFees - admission.nConflictingFees),
+                (int)nSize - (int)admission.nConflictingSize);
+    }
+    pool.RemoveStaged(admission.allConflicting, false);
+
+    // Store transaction in memory
+    pool.addUnchecked(hash, entry, admission.setAncestors, !IsInitialBlockDownload());
+
+    // trim mempool and check if tx was trimmed
+    if (!admission.fOverrideMempoolLimit) {
+        LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, NULL); // ͬ׵Ǯ
@@ -1426,18 +1600,58 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
     return true; // ɹ true
 }
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee)
+bool FinishAcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, CMemPoolAdmission& admission)
+{
+    AssertLockHeld(cs_main);
+    if (!admission.fScriptsChecked) {
+        UncacheCoins(admission.vHashTxnToUncache);
+        return false;
+    }
+
+    LOCK(pool.cs);
+    if (admission.hashBestBlock == pcoinsTip->GetBestBlock() && admission.nTransactionsUpdated == pool.GetTransactionsUpdated()) {
+        if (!CommitToMemoryPool(pool, state, admission)) {
+            UncacheCoins(admission.vHashTxnToUncache);
+            return false;
+        }
+        return true;
+    }
+
+    // The chain or the mempool changed while the scripts were verified, the
+    // inputs may be spent or the replacement rules may come out differently
+    // now. Redo the other checks; the scripts need not be verified again, the
+    // txids of the spent outputs commit to their scriptPubKeys. The free
+    // transaction rate limiter has already counted this one.
+    CMemPoolAdmission recheck(admission.tx, false, admission.nAcceptTime, admission.fOverrideMempoolLimit, admission.fRejectAbsurdFee);
+    bool fAccepted = PreAcceptToMemoryPoolWorker(pool, state, recheck) && CommitToMemoryPool(pool, state, recheck);
+    admission.fMissingInputs = recheck.fMissingInputs;
+    if (!fAccepted) {
+        UncacheCoins(admission.vHashTxnToUncache);
+        UncacheCoins(recheck.vHashTxnToUncache);
+    }
+    return fAccepted;
+}
+
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, bool fRejectAbsurdFee)
 {
-    std::vector<uint256> vHashTxToUncache; // δ潻׹ϣб
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, fRejectAbsurdFee, vHashTxToUncache); // յڴع
-    if (!res) { // ʧ
-        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache) // δĽ׹ϣб
-            pcoinsTip->Uncache(hashTx); // ӻƳý
+    CMemPoolAdmission admission(tx, fLimitFree, nAcceptTime, fOverrideMempoolLimit, fRejectAbsurdFee);
+    bool res = PreAcceptToMemoryPool(pool, state, admission);
+    if (res) {
+        CheckMemPoolAdmissionScripts(state, admission);
+        res = FinishAcceptToMemoryPool(pool, state, admission);
     }
+    if (pfMissingInputs)
+        *pfMissingInputs = admission.fMissingInputs;
     return res;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fOverrideMempoolLimit, fRejectAbsurdFee);
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1517,7 +1731,7 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
         return error("WriteBlockToDisk: OpenBlockFile failed");
 
     // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(block);
+    unsigned int nSize = block.GetTotalSize();
     fileout << FLATDATA(messageStart) << nSize;
 
     // Write block
@@ -1541,7 +1755,7 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 
     // Read block
     try {
-        filein >> block; // 
+        UnserializeBlockWithArena(filein, block); // 
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
@@ -1770,9 +1984,16 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
     UpdateCoins(tx, state, inputs, txundo, nHeight);
 }
 
+namespace {
+/** Interpreter stacks of each thread running script checks, reused from one check to the next */
+boost::thread_specific_ptr<CScriptArena> scriptArena;
+} // anon namespace
+
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig; // ȡָĽűǩ
-    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore), &error)) { // ֤ű
+    if (!scriptArena.get())
+        scriptArena.reset(new CScriptArena());
+    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore, txdata), &error, scriptArena.get())) { // ֤ű
         return false;
     }
     return true;
@@ -1831,16 +2052,108 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks)
+namespace {
+
+/**
+ * Transactions whose input scripts all passed under a set of script flags,
+ * so connecting a block made of transactions already seen in the mempool
+ * does not run their scripts again. Entries are
+ * SHA256(nonce || txid || flags). The txid commits to every output the
+ * inputs spend, and script validity depends on nothing else.
+ */
+CCriticalSection cs_scriptExecutionCache;
+CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
+uint256 scriptExecutionCacheNonce;
+
+uint256 ScriptExecutionCacheEntry(const CTransaction& tx, unsigned int flags)
+{
+    uint256 entry;
+    CSHA256().Write(scriptExecutionCacheNonce.begin(), 32).Write(tx.GetHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(entry.begin());
+    return entry;
+}
+
+} // anon namespace
+
+void InitScriptExecutionCache()
+{
+    // Gets the half of -maxsigcachesize the signature cache leaves
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20) / 2;
+    LOCK(cs_scriptExecutionCache);
+    GetRandBytes(scriptExecutionCacheNonce.begin(), 32);
+    size_t nElems = scriptExecutionCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for script execution cache, able to store %zu elements\n",
+              (nElems * sizeof(uint256)) >> 20, nMaxCacheSize >> 20, nElems);
+}
+
+bool CheckInputScripts(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
+{
+    // Skip everything if all the scripts already passed under these flags.
+    // An entry that is looked up without being stored again (a block being
+    // connected) will not be needed again and may be evicted.
+    uint256 hashCacheEntry = ScriptExecutionCacheEntry(tx, flags);
+    {
+        LOCK(cs_scriptExecutionCache);
+        if (scriptExecutionCache.contains(hashCacheEntry, !cacheFullScriptStore))
+            return true;
+    }
+
+    // Hash the parts of the transaction that all inputs sign alike only once
+    txdata.Init(tx);
+
+    if (pvChecks)
+        pvChecks->reserve(tx.vin.size());
+
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        const COutPoint &prevout = tx.vin[i].prevout;
+        const CCoins* coins = inputs.AccessCoins(prevout.hash);
+        assert(coins);
+
+        // Verify signature
+        CScriptCheck check(*coins, tx, i, flags, cacheSigStore, &txdata);
+        if (pvChecks) {
+            pvChecks->push_back(CScriptCheck());
+            check.swap(pvChecks->back());
+        } else if (!check()) {
+            if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
+                // Check whether the failure was caused by a
+                // non-mandatory script verification check, such as
+                // non-standard DER encodings or non-null dummy
+                // arguments; if so, don't trigger DoS protection to
+                // avoid splitting the network between upgraded and
+                // non-upgraded nodes.
+                CScriptCheck check2(*coins, tx, i,
+                        flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheSigStore, &txdata);
+                if (check2())
+                    return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
+            }
+            // Failures of other flags indicate a transaction that is
+            // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
+            // such nodes as they are not following the protocol. That
+            // said during an upgrade careful thought should be taken
+            // as to the correct behavior - we may want to continue
+            // peering with non-upgraded nodes even after a soft-fork
+            // super-majority vote has passed.
+            return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+        }
+    }
+
+    // Checks handed to pvChecks have not run yet, so only a result of our
+    // own can be remembered
+    if (cacheFullScriptStore && !pvChecks) {
+        LOCK(cs_scriptExecutionCache);
+        scriptExecutionCache.insert(hashCacheEntry);
+    }
+
+    return true;
+}
+
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
 {
     if (!tx.IsCoinBase())
     {
         if (!Consensus::CheckTxInputs(tx, state, inputs, GetSpendHeight(inputs)))
             return false;
 
-        if (pvChecks)
-            pvChecks->reserve(tx.vin.size());
-
         // The first loop above does all the inexpensive checks.
         // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
         // Helps prevent CPU exhaustion attacks.
@@ -1848,41 +2161,8 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // Skip ECDSA signature verification when connecting blocks
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
-        if (fScriptChecks) {
-            for (unsigned int i = 0; i < tx.vin.size(); i++) {
-                const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
-
-                // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
-                if (pvChecks) {
-                    pvChecks->push_back(CScriptCheck());
-                    check.swap(pvChecks->back());
-                } else if (!check()) {
-                    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
-                        // Check whether the failure was caused by a
-                        // non-mandatory script verification check, such as
-                        // non-standard DER encodings or non-null dummy
-                        // arguments; if so, don't trigger DoS protection to
-                        // avoid splitting the network between upgraded and
-                        // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
-                        if (check2())
-                            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
-                    }
-                    // Failures of other flags indicate a transaction that is
-                    // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
-                    // such nodes as they are not following the protocol. That
-                    // said during an upgrade careful thought should be taken
-                    // as to the correct behavior - we may want to continue
-                    // peering with non-upgraded nodes even after a soft-fork
-                    // super-majority vote has passed.
-                    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
-                }
-            }
-        }
+        if (fScriptChecks)
+            return CheckInputScripts(tx, state, inputs, flags, cacheSigStore, cacheFullScriptStore, txdata, pvChecks);
     }
 
     return true;
@@ -1897,8 +2177,16 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     if (fileout.IsNull())
         return error("%s: OpenUndoFile failed", __func__);
 
+    // Serialize once for the size, the data and the checksum. The undo
+    // encoding does not depend on the stream type, so the bytes hashed are
+    // the ones UndoReadFromDisk hashes.
+    CBufferedHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    static_cast<CHashWriter&>(hasher) << hashBlock;
+    hasher << blockundo;
+    const std::vector<char>& vchUndo = hasher.data();
+
     // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(blockundo);
+    unsigned int nSize = vchUndo.size();
     fileout << FLATDATA(messageStart) << nSize;
 
     // Write undo data
@@ -1906,12 +2194,10 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     if (fileOutPos < 0)
         return error("%s: ftell failed", __func__);
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    if (!vchUndo.empty())
+        fileout.write(&vchUndo[0], vchUndo.size());
 
-    // calculate & write checksum
-    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
-    hasher << hashBlock;
-    hasher << blockundo;
+    // write checksum
     fileout << hasher.GetHash();
 
     return true;
@@ -2204,6 +2490,33 @@ public:
 // Protected by cs_main
 static ThresholdConditionCache warningcache[VERSIONBITS_NUM_BITS];
 
+// BIP16 didn't become active until Apr 1 2012
+static const int64_t BIP16_SWITCH_TIME = 1333238400;
+
+unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consensus::Params& consensusparams)
+{
+    unsigned int flags = pindex->GetBlockTime() >= BIP16_SWITCH_TIME ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
+    // when 75% of the network has upgraded:
+    if (pindex->nVersion >= 3 && IsSuperMajority(3, pindex->pprev, consensusparams.nMajorityEnforceBlockUpgrade, consensusparams)) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
+    // blocks, when 75% of the network has upgraded:
+    if (pindex->nVersion >= 4 && IsSuperMajority(4, pindex->pprev, consensusparams.nMajorityEnforceBlockUpgrade, consensusparams)) {
+        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    }
+
+    // Start enforcing BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    if (VersionBitsState(pindex->pprev, consensusparams, Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
+        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    }
+
+    return flags;
+}
+
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
 static int64_t nTimeVerify = 0;
@@ -2282,36 +2595,25 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
-    // BIP16 didn't become active until Apr 1 2012
-    int64_t nBIP16SwitchTime = 1333238400;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
-
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
-
-    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
-    // when 75% of the network has upgraded:
-    if (block.nVersion >= 3 && IsSuperMajority(3, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
+    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= BIP16_SWITCH_TIME);
 
-    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
-    // blocks, when 75% of the network has upgraded:
-    if (block.nVersion >= 4 && IsSuperMajority(4, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-    }
+    unsigned int flags = GetBlockScriptFlags(pindex, chainparams.GetConsensus());
 
-    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    // Start enforcing BIP68 (sequence locks) along with BIP112 (CHECKSEQUENCEVERIFY)
     int nLockTimeFlags = 0;
-    if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
-        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    if (flags & SCRIPT_VERIFY_CHECKSEQUENCEVERIFY)
         nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
-    }
 
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
 
     CBlockUndo blockundo;
 
+    // Queued script checks point into txdata, so it must be declared before
+    // (and hence destroyed after) control, and never reallocate
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(block.vtx.size());
+
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     std::vector<int> prevheights;
@@ -2366,7 +2668,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, nScriptCheckThreads ? &vChecks : NULL))
+            txdata.push_back(PrecomputedTransactionData());
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, fCacheResults, txdata.back(), nScriptCheckThreads ? &vChecks : NULL))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
             control.Add(vChecks);
@@ -2379,7 +2682,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
 
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        pos.nTxOffset += tx.GetTotalSize();
     }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
@@ -2395,6 +2698,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         return state.DoS(100, false);
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime4 - nTime2), nInputs <= 1 ? 0 : 0.001 * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * 0.000001);
+    if (LogAcceptCategory("bench")) {
+        uint64_t nPubKeyHits, nPubKeyMisses;
+        GetParsedPubKeyCacheStats(nPubKeyHits, nPubKeyMisses);
+        LogPrint("bench", "    - Parsed pubkey cache: %u hits, %u misses\n", nPubKeyHits, nPubKeyMisses);
+    }
 
     if (fJustCheck)
         return true;
@@ -2716,6 +3024,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
+    EraseOrphansForBlock(*pblock); // ѱ֮ͻĹ¶
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
     // Tell wallet about transactions that went from mempool
@@ -2937,8 +3246,8 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
                 if (fCheckpointsEnabled) // 
                     nBlockEstimate = Checkpoints::GetTotalBlocksEstimate(chainparams.Checkpoints()); // ȡܹ
                 {
-                    LOCK(cs_vNodes); // ӵĽڵб
-                    BOOST_FOREACH(CNode* pnode, vNodes) { // ýڵб
+                    NodeSnapshot vNodesCopy = GetNodeSnapshot(); // ȡӵĽڵб
+                    BOOST_FOREACH(CNode* pnode, *vNodesCopy) { // ýڵб
                         if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate)) { // ߶ȴڵǰڵ
                             BOOST_REVERSE_FOREACH(const uint256& hash, vHashes) { // ϣб
                                 pnode->PushBlockHash(hash); // ͨϣб
@@ -3251,7 +3560,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     // because we receive the wrong transactions for it.
 
     // Size limits
-    if (block.vtx.empty() || block.vtx.size() > MAX_BLOCK_SIZE || ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION) > MAX_BLOCK_SIZE)
+    if (block.vtx.empty() || block.vtx.size() > MAX_BLOCK_SIZE || block.GetTotalSize() > MAX_BLOCK_SIZE)
         return state.DoS(100, error("CheckBlock(): size limits failed"),
                          REJECT_INVALID, "bad-blk-length");
 
@@ -3457,7 +3766,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
 
     // Write block to history file // дݵʷļ
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION); // ȡлС
+        unsigned int nBlockSize = block.GetTotalSize(); // ȡлС
         CDiskBlockPos blockPos;
         if (dbp != NULL)
             blockPos = *dbp;
@@ -3925,8 +4234,7 @@ void UnloadBlockIndex()
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
-    mapOrphanTransactions.clear();
-    mapOrphanTransactionsByPrev.clear();
+    ClearOrphans();
     nSyncStarted = 0;
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
@@ -3980,7 +4288,7 @@ bool InitBlockIndex(const CChainParams& chainparams)
         try {
             CBlock &block = const_cast<CBlock&>(chainparams.GenesisBlock()); // ȡ
             // Start new block file // ʼµļ
-            unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION); // ȡлС
+            unsigned int nBlockSize = block.GetTotalSize(); // ȡлС
             CDiskBlockPos blockPos;
             CValidationState state;
             if (!FindBlockPos(state, blockPos, nBlockSize+8, 0, block.GetBlockTime())) // ȡ״̬λ
@@ -4044,7 +4352,7 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 blkdat.SetLimit(nBlockPos + nSize); // 
                 blkdat.SetPos(nBlockPos); // λ
                 CBlock block; // յ
-                blkdat >> block; // 
+                UnserializeBlockWithArena(blkdat, block, nSize); // 
                 nRewind = blkdat.GetPos(); // ȡǰȡλ
 
                 // detect out of order blocks, and store them for later // 飬洢Ժʹ
@@ -4104,6 +4412,132 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     return nLoaded > 0; //  true
 }
 
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+// Parents have fewer in-mempool ancestors than their children, so they are
+// written, and accepted again on load, first.
+struct CompareTxIterForDump {
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+bool DumpMempool()
+{
+    int64_t nStart = GetTimeMicros();
+
+    std::vector<std::pair<CTransaction, int64_t> > vTxs; // ׼ڴصʱ
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        std::vector<CTxMemPool::txiter> vIters;
+        vIters.reserve(mempool.mapTx.size());
+        for (CTxMemPool::txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it)
+            vIters.push_back(it);
+        std::sort(vIters.begin(), vIters.end(), CompareTxIterForDump());
+        vTxs.reserve(vIters.size());
+        BOOST_FOREACH(CTxMemPool::txiter it, vIters)
+            vTxs.push_back(std::make_pair(it->GetTx(), it->GetTime()));
+    }
+
+    int64_t nCopied = GetTimeMicros();
+
+    try {
+        boost::filesystem::path pathNew = GetDataDir() / "mempool.dat.new";
+        FILE* filestr = fopen(pathNew.string().c_str(), "wb");
+        if (!filestr)
+            return false;
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t nVersion = MEMPOOL_DUMP_VERSION;
+        file << nVersion;
+        file << (uint64_t)vTxs.size();
+        for (size_t i = 0; i < vTxs.size(); i++) {
+            file << vTxs[i].first;
+            file << vTxs[i].second;
+        }
+        // Deltas set by prioritisetransaction, also for transactions not in the mempool
+        file << mapDeltas;
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(pathNew, GetDataDir() / "mempool.dat");
+        LogPrintf("Dumped mempool: %gs to copy, %gs to dump\n", (nCopied - nStart) * 0.000001, (GetTimeMicros() - nCopied) * 0.000001);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    return true;
+}
+
+bool LoadMempool()
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    // Read the whole file before taking any locks
+    std::vector<std::pair<CTransaction, int64_t> > vTxs;
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    try {
+        uint64_t nVersion;
+        file >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION) {
+            LogPrintf("Unknown mempool file version %d. Continuing anyway.\n", nVersion);
+            return false;
+        }
+        uint64_t nCount;
+        file >> nCount;
+        while (nCount--) {
+            vTxs.push_back(std::make_pair(CTransaction(), 0));
+            file >> vTxs.back().first;
+            file >> vTxs.back().second;
+        }
+        file >> mapDeltas;
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    file.fclose();
+
+    // Restore the deltas first, so transactions are accepted with them applied
+    for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+        mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+    int64_t nNow = GetTime();
+    int nAccepted = 0, nFailed = 0, nExpired = 0;
+    size_t i = 0;
+    while (i < vTxs.size()) {
+        // Let block processing and peers in between batches
+        LOCK(cs_main);
+        for (size_t nEnd = std::min(vTxs.size(), i + MEMPOOL_LOAD_BATCH_SIZE); i < nEnd; i++) {
+            const CTransaction& tx = vTxs[i].first;
+            int64_t nTime = vTxs[i].second;
+            if (nTime + nExpiryTimeout <= nNow) {
+                nExpired++;
+                continue;
+            }
+            CValidationState state;
+            if (AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime))
+                nAccepted++;
+            else
+                nFailed++;
+        }
+        if (ShutdownRequested())
+            return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired\n", nAccepted, nFailed, nExpired);
+    return true;
+}
+
 void static CheckBlockIndex(const Consensus::Params& consensusParams)
 {
     if (!fCheckBlockIndex) {
@@ -4490,17 +4924,10 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
             }
             else if (inv.IsKnownType()) // ÿĿΪ֪
             {
-                // Send stream from relay memory // мڴз
+                // Send stream from the mempool, or from relay memory for // ڴط뿪ڴص
+                // transactions that have left it since we announced them // ͨ潻м̻淢
                 bool pushed = false; // ͱ־ʼΪ false
-                {
-                    LOCK(cs_mapRelay); // мӳб
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv); // мӳбвҸÿĿ
-                    if (mi != mapRelay.end()) { // ҵ
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second); // ͶӦݵԶ
-                        pushed = true; // ͱ־ true
-                    }
-                }
-                if (!pushed && inv.type == MSG_TX) { // δҵÿ  ĿΪϢ
+                if (inv.type == MSG_TX) { // ĿΪϢ
                     CTransaction tx; // һ׶
                     if (mempool.lookup(inv.hash, tx)) { // ڴ֮вҲȡý
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION); // 
@@ -4508,6 +4935,12 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         ss << tx; // ѽ׵
                         pfrom->PushMessage(NetMsgType::TX, ss); // Ѹý׵͸Զ
                         pushed = true; // ͱ־Ϊ true
+                    } else {
+                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                        if (relayCache.Lookup(inv.hash, ss)) { // м̻в
+                            pfrom->PushMessage(NetMsgType::TX, ss);
+                            pushed = true;
+                        }
                     }
                 }
                 if (!pushed) { // ͱ־Ϊ false
@@ -4537,6 +4970,211 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     }
 }
 
+// Handles the outcome of admitting a transaction relayed by pfrom: relays
+// it and the orphans it resolves, or keeps it as an orphan, or answers with a
+// reject message and punishes the peer.
+void static TransactionProcessed(CNode* pfrom, const CTransaction& tx, bool fAccepted, bool fMissingInputs, CValidationState& state)
+{
+    AssertLockHeld(cs_main);
+    deque<COutPoint> vWorkQueue; // ĿɻڲǵĹ¶
+    set<uint256> setEraseQueue;
+    CInv inv(MSG_TX, tx.GetHash());
+
+    if (fAccepted)
+    {
+        mempool.check(pcoinsTip);
+        RelayTransaction(tx);
+        for (unsigned int i = 0; i < tx.vout.size(); i++)
+            vWorkQueue.push_back(COutPoint(inv.hash, i));
+
+        LogPrint("mempool", "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
+            pfrom->id,
+            tx.GetHash().ToString(),
+            mempool.size(), mempool.DynamicMemoryUsage() / 1000);
+
+        // Recursively process any orphan transactions that depended on this one
+        set<NodeId> setMisbehaving;
+        while (!vWorkQueue.empty())
+        {
+            map<COutPoint, OrphanItSet>::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
+            vWorkQueue.pop_front();
+            if (itByPrev == mapOrphanTransactionsByPrev.end())
+                continue;
+            for (OrphanItSet::iterator mi = itByPrev->second.begin();
+                 mi != itByPrev->second.end();
+                 ++mi)
+            {
+                const CTransaction& orphanTx = (*mi)->second.tx;
+                const uint256& orphanHash = orphanTx.GetHash();
+                NodeId fromPeer = (*mi)->second.fromPeer;
+                bool fMissingInputs2 = false;
+                // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+                // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                // anyone relaying LegitTxX banned)
+                CValidationState stateDummy;
+
+
+                if (setMisbehaving.count(fromPeer))
+                    continue;
+                // An orphan spending several of the new outputs is only resolved once
+                if (setEraseQueue.count(orphanHash))
+                    continue;
+                if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
+                {
+                    LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+                    RelayTransaction(orphanTx);
+                    for (unsigned int i = 0; i < orphanTx.vout.size(); i++)
+                        vWorkQueue.push_back(COutPoint(orphanHash, i));
+                    setEraseQueue.insert(orphanHash);
+                }
+                else if (!fMissingInputs2)
+                {
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0)
+                    {
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos);
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+                    }
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee/priority
+                    LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+                    setEraseQueue.insert(orphanHash);
+                    assert(recentRejects);
+                    recentRejects->insert(orphanHash);
+                }
+                mempool.check(pcoinsTip);
+            }
+        }
+
+        BOOST_FOREACH(const uint256& hash, setEraseQueue)
+            EraseOrphanTx(hash);
+    }
+    else if (fMissingInputs)
+    {
+        unsigned int nMaxOrphanTxPerPeer = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantxperpeer", DEFAULT_MAX_ORPHAN_TRANSACTIONS_PER_PEER));
+        AddOrphanTx(tx, pfrom->GetId(), nMaxOrphanTxPerPeer);
+
+        // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+        unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+        unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+        if (nEvicted > 0)
+            LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+    } else {
+        assert(recentRejects);
+        recentRejects->insert(tx.GetHash());
+
+        if (pfrom->fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
+            // Always relay transactions received from whitelisted peers, even
+            // if they were already in the mempool or rejected from it due
+            // to policy, allowing the node to function as a gateway for
+            // nodes hidden behind it.
+            //
+            // Never relay transactions that we would assign a non-zero DoS
+            // score for, as we expect peers to do the same with us in that
+            // case.
+            int nDoS = 0;
+            if (!state.IsInvalid(nDoS) || nDoS == 0) {
+                LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
+                if (!mempool.exists(tx.GetHash()))
+                    relayCache.Insert(tx); // δڴأм̻ṩý
+                RelayTransaction(tx);
+            } else {
+                LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->id, FormatStateMessage(state));
+            }
+        }
+    }
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+    {
+        LogPrint("mempoolrej", "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
+            pfrom->id,
+            FormatStateMessage(state));
+        if (state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
+            pfrom->PushMessage(NetMsgType::REJECT, string(NetMsgType::TX), (unsigned char)state.GetRejectCode(),
+                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    }
+    FlushStateToDisk(state, FLUSH_STATE_PERIODIC);
+}
+
+// Admits a transaction relayed by pfrom to the mempool. cs_main is released
+// while the scripts are verified, so this can run on several threads at once.
+void static ProcessTransaction(CNode* pfrom, const CTransaction& tx)
+{
+    CInv inv(MSG_TX, tx.GetHash());
+    CValidationState state;
+    CMemPoolAdmission admission(tx, true, GetTime());
+    {
+        LOCK(cs_main);
+        pfrom->setAskFor.erase(inv.hash);
+        mapAlreadyAskedFor.erase(inv);
+
+        if (AlreadyHave(inv) || !PreAcceptToMemoryPool(mempool, state, admission)) {
+            TransactionProcessed(pfrom, tx, false, admission.fMissingInputs, state);
+            return;
+        }
+    }
+
+    CheckMemPoolAdmissionScripts(state, admission); // ֤ű
+
+    LOCK(cs_main);
+    bool fAccepted = FinishAcceptToMemoryPool(mempool, state, admission);
+    TransactionProcessed(pfrom, tx, fAccepted, admission.fMissingInputs, state);
+}
+
+
+// Hands a transaction over to the validation threads. Returns false if
+// there are none or they are behind, the caller then processes the
+// transaction itself, which stops it from reading more from its peers.
+bool static QueueTransaction(CNode* pfrom, const CTransaction& tx)
+{
+    if (nTxValidationThreads == 0)
+        return false;
+
+    QueuedTransaction queued;
+    queued.vNodesRef = GetNodeSnapshot();
+    if (std::find(queued.vNodesRef->begin(), queued.vNodesRef->end(), pfrom) == queued.vNodesRef->end())
+        return false; // ڵѶϿ
+    queued.pfrom = pfrom;
+    queued.tx = tx;
+
+    {
+        boost::unique_lock<boost::mutex> lock(csTxValidationQueue);
+        if (queueTxValidation.size() >= MAX_TXVALIDATION_QUEUE)
+            return false;
+        // Keep one flooding peer from taking every slot
+        unsigned int& nQueued = mapTxValidationQueuedPerPeer[pfrom->GetId()];
+        if (nQueued >= MAX_TXVALIDATION_QUEUE_PER_PEER)
+            return false;
+        nQueued++;
+        queueTxValidation.push_back(queued);
+    }
+    cvTxValidationQueue.notify_one();
+    return true;
+}
+
+void ThreadTxValidation()
+{
+    RenameThread("bitcoin-txval");
+    while (true) {
+        QueuedTransaction queued;
+        {
+            boost::unique_lock<boost::mutex> lock(csTxValidationQueue);
+            while (queueTxValidation.empty())
+                cvTxValidationQueue.wait(lock); // жϵ
+            queued = queueTxValidation.front();
+            queueTxValidation.pop_front();
+            std::map<NodeId, unsigned int>::iterator it = mapTxValidationQueuedPerPeer.find(queued.pfrom->GetId());
+            if (it != mapTxValidationQueuedPerPeer.end() && --it->second == 0)
+                mapTxValidationQueuedPerPeer.erase(it);
+        }
+        ProcessTransaction(queued.pfrom, queued.tx);
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived) // Σڵ㣬ݣʱ
 {
     const CChainParams& chainparams = Params(); // ȡ
@@ -4745,7 +5383,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             {
                 // Relay to a limited number of other nodes
                 {
-                    LOCK(cs_vNodes);
+                    NodeSnapshot vNodesCopy = GetNodeSnapshot();
                     // Use deterministic randomness to send to the same nodes for 24 hours
                     // at a time so the addrKnowns of the chosen nodes prevent repeats
                     static uint256 hashSalt;
@@ -4755,7 +5393,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     uint256 hashRand = ArithToUint256(UintToArith256(hashSalt) ^ (hashAddr<<32) ^ ((GetTime()+hashAddr)/(24*60*60)));
                     hashRand = Hash(BEGIN(hashRand), END(hashRand));
                     multimap<uint256, CNode*> mapMix;
-                    BOOST_FOREACH(CNode* pnode, vNodes)
+                    BOOST_FOREACH(CNode* pnode, *vNodesCopy)
                     {
                         if (pnode->nVersion < CADDR_TIME_VERSION)
                             continue;
@@ -4987,131 +5625,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
         CTransaction tx;
         vRecv >> tx;
 
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        LOCK(cs_main);
-
-        bool fMissingInputs = false;
-        CValidationState state;
-
-        pfrom->setAskFor.erase(inv.hash);
-        mapAlreadyAskedFor.erase(inv);
-
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs))
-        {
-            mempool.check(pcoinsTip);
-            RelayTransaction(tx);
-            vWorkQueue.push_back(inv.hash);
-
-            LogPrint("mempool", "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
-                pfrom->id,
-                tx.GetHash().ToString(),
-                mempool.size(), mempool.DynamicMemoryUsage() / 1000);
-
-            // Recursively process any orphan transactions that depended on this one
-            set<NodeId> setMisbehaving;
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
-            {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
-                    {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
-                        vWorkQueue.push_back(orphanHash);
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        assert(recentRejects);
-                        recentRejects->insert(orphanHash);
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
-        }
-        else if (fMissingInputs)
-        {
-            AddOrphanTx(tx, pfrom->GetId());
-
-            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-            if (nEvicted > 0)
-                LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
-        } else {
-            assert(recentRejects);
-            recentRejects->insert(tx.GetHash());
-
-            if (pfrom->fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
-                // Always relay transactions received from whitelisted peers, even
-                // if they were already in the mempool or rejected from it due
-                // to policy, allowing the node to function as a gateway for
-                // nodes hidden behind it.
-                //
-                // Never relay transactions that we would assign a non-zero DoS
-                // score for, as we expect peers to do the same with us in that
-                // case.
-                int nDoS = 0;
-                if (!state.IsInvalid(nDoS) || nDoS == 0) {
-                    LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
-                    RelayTransaction(tx);
-                } else {
-                    LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->id, FormatStateMessage(state));
-                }
-            }
-        }
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS))
-        {
-            LogPrint("mempoolrej", "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
-                pfrom->id,
-                FormatStateMessage(state));
-            if (state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
-                pfrom->PushMessage(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
-                                   state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0)
-                Misbehaving(pfrom->GetId(), nDoS);
-        }
-        FlushStateToDisk(state, FLUSH_STATE_PERIODIC);
+        if (!QueueTransaction(pfrom, tx))
+            ProcessTransaction(pfrom, tx);
     }
 
 
@@ -5219,7 +5740,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         CBlock block;
-        vRecv >> block;
+        UnserializeBlockWithArena(vRecv, block, vRecv.size());
 
         CInv inv(MSG_BLOCK, block.GetHash());
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
@@ -5385,8 +5906,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 // Relay
                 pfrom->setKnown.insert(alertHash);
                 {
-                    LOCK(cs_vNodes);
-                    BOOST_FOREACH(CNode* pnode, vNodes)
+                    NodeSnapshot vNodesCopy = GetNodeSnapshot();
+                    BOOST_FOREACH(CNode* pnode, *vNodesCopy)
                         alert.RelayTo(pnode); // Ϣÿ֮Ľڵ
                 }
             }
@@ -5832,52 +6353,71 @@ bool SendMessages(CNode* pto) // 
         // Message: inventory // Ϣ棨ף
         //
         vector<CInv> vInv; // б
-        vector<CInv> vInvWait; // ȴб
         {
-            bool fSendTrickle = pto->fWhitelisted; // ȡýڵı־Ϊͱ־
-            if (pto->nNextInvSend < nNow) { // һ淢ʱСڵǰʱ
-                fSendTrickle = true; // ͱ־Ϊ true
-                pto->nNextInvSend = PoissonNextSend(nNow, AVG_INVENTORY_BROADCAST_INTERVAL);
-            }
             LOCK(pto->cs_inventory); // 
-            vInv.reserve(std::min<size_t>(1000, pto->vInventoryToSend.size())); // Ԥ 1000 ĿĿռ
-            vInvWait.reserve(pto->vInventoryToSend.size()); // ȴбԤٺʹͿбһĿռ
+            vInv.reserve(std::max<size_t>(pto->vInventoryToSend.size(), INVENTORY_BROADCAST_MAX)); // Ԥٿռ
+
+            // Blocks are never trickled // Ӳ
             BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend) // Ϳб
             {
-                if (inv.type == MSG_TX && pto->filterInventoryKnown.contains(inv.hash)) // ĿΪ  ֪Ŀкд˽
-                    continue; // 
+                vInv.push_back(inv); // б
+                if (vInv.size() == MAX_INV_SZ) { // бﵽ
+                    pto->PushMessage(NetMsgType::INV, vInv); // ͸ÿб
+                    pto->nInvMsgSent++;
+                    vInv.clear(); // б
+                }
+            }
+            pto->vInventoryToSend.clear(); // մͿб
 
-                // trickle out tx inv to protect privacy // Ŀ˽
-                if (inv.type == MSG_TX && !fSendTrickle) // Ϊ  ͱ־Ϊ false
-                {
-                    // 1/4 of tx invs blast to all immediately // 1/4 Ľ̶нڵкը
-                    static uint256 hashSalt;
-                    if (hashSalt.IsNull())
-                        hashSalt = GetRandHash(); // ȡһϣΪֵ
-                    uint256 hashRand = ArithToUint256(UintToArith256(inv.hash) ^ UintToArith256(hashSalt)); // Ŀϣ  ֵϣ
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand)); // ϲ hash256
-                    bool fTrickleWait = ((UintToArith256(hashRand) & 3) != 0); // ȴ־
+            // Transactions go out in batches on a Poisson timer, to protect // װɼʱԱ˽
+            // privacy and to amortise the cost of announcing them
+            bool fSendTrickle = pto->fWhitelisted; // ȡýڵı־Ϊͱ־
+            if (pto->nNextInvSend < nNow) { // һ淢ʱСڵǰʱ
+                fSendTrickle = true; // ͱ־Ϊ true
+                // Use half the delay for outbound peers, as there is less privacy concern for them. // ڵ˽Ǹ٣ӳټ
+                pto->nNextInvSend = PoissonNextSend(nNow, AVG_INVENTORY_BROADCAST_INTERVAL >> !pto->fInbound);
+            }
+            if (fSendTrickle && !pto->setInventoryTxToSend.empty()) {
+                // Drop what the peer already knows about, then sort the rest by // ȥԶ֪Ľףٰ
+                // feerate with in-mempool parents ahead of their children // Ҹӽ֮ǰ
+                vector<uint256> vInvTx;
+                vInvTx.reserve(pto->setInventoryTxToSend.size());
+                BOOST_FOREACH(const uint256& hash, pto->setInventoryTxToSend) {
+                    if (!pto->filterInventoryKnown.contains(hash))
+                        vInvTx.push_back(hash);
+                }
+                pto->setInventoryTxToSend.clear();
+                vector<uint256> vNotInMempool;
+                mempool.SortForAnnouncement(vInvTx, vNotInMempool);
+                // Whatever left the mempool is still announced if the relay cache can serve it // 뿪ڴصĽм̻ṩȻͨ
+                BOOST_FOREACH(const uint256& hash, vNotInMempool) {
+                    if (relayCache.Exists(hash))
+                        vInvTx.push_back(hash);
+                }
 
-                    if (fTrickleWait) // 
-                    {
-                        vInvWait.push_back(inv); // ȴĿб
+                unsigned int nRelayedTransactions = 0;
+                BOOST_FOREACH(const uint256& hash, vInvTx) {
+                    if (nRelayedTransactions >= INVENTORY_BROADCAST_MAX) {
+                        // Keep the rest for the next trickle // ´
+                        pto->setInventoryTxToSend.insert(hash);
                         continue;
                     }
+                    nRelayedTransactions++;
+                    pto->filterInventoryKnown.insert(hash); // ѸĿϣ֪ĿĹ
+                    vInv.push_back(CInv(MSG_TX, hash)); // б
+                    if (vInv.size() == MAX_INV_SZ) {
+                        pto->PushMessage(NetMsgType::INV, vInv);
+                        pto->nInvMsgSent++;
+                        vInv.clear();
+                    }
                 }
-
-                pto->filterInventoryKnown.insert(inv.hash); // ѸĿϣ֪ĿĹ
-
-                vInv.push_back(inv); // б
-                if (vInv.size() >= 1000) // бԪص 1000 
-                {
-                    pto->PushMessage(NetMsgType::INV, vInv); // ͸ÿб
-                    vInv.clear(); // б
-                }
+                pto->nInvTxSent += nRelayedTransactions;
+            }
+            if (!vInv.empty()) { // бǿ
+                pto->PushMessage(NetMsgType::INV, vInv); // ٴηͿб
+                pto->nInvMsgSent++;
             }
-            pto->vInventoryToSend = vInvWait; // ѿȴбеĿ·͵Ŀб
         }
-        if (!vInv.empty()) // бǿ
-            pto->PushMessage(NetMsgType::INV, vInv); // ٴηͿб
 
         // Detect whether we're stalling // Ƿֹͣǰ
         nNow = GetTimeMicros(); // ȡǰʱ䣬΢
@@ -5975,7 +6515,6 @@ public:
         mapBlockIndex.clear(); // ӳб
 
         // orphan transactions // ¶
-        mapOrphanTransactions.clear(); // չ¶ӳб
-        mapOrphanTransactionsByPrev.clear();
+        ClearOrphans(); // չ¶ӳб
     }
 } instance_of_cmaincleanup; // ȫ
@@ -16,6 +16,7 @@
 #include "net.h"
 #include "script/script_error.h"
 #include "sync.h"
+#include "txmempool.h"
 #include "versionbits.h"
 
 #include <algorithm>
@@ -27,6 +28,8 @@
 #include <utility>
 #include <vector>
 
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/unordered_map.hpp>
 
 class CBlockIndex;
@@ -41,6 +44,7 @@ class CValidationState;
 
 struct CNodeStateStats;
 struct LockPoints;
+struct PrecomputedTransactionData;
 
 /** Default for accepting alerts from the P2P network. */
 static const bool DEFAULT_ALERTS = false;
@@ -52,6 +56,12 @@ static const bool DEFAULT_WHITELISTFORCERELAY = true;
 static const unsigned int DEFAULT_MIN_RELAY_TX_FEE = 1000; // ĬСм̽׷ѣĬ 1000 satoshi
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxorphantxperpeer, maximum number of orphan transactions kept for a single peer */
+static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS_PER_PEER = 25;
+/** Expiration time for orphan transactions in seconds */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
+/** Minimum time between orphan transactions expire time checks in seconds */
+static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** Default for -limitancestorcount, max number of in-mempool ancestors */
 static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
 /** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
@@ -62,6 +72,10 @@ static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Number of transactions from mempool.dat accepted per cs_main lock */
+static const unsigned int MEMPOOL_LOAD_BATCH_SIZE = 100;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -73,6 +87,14 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of transaction validation threads allowed */
+static const int MAX_TXVALIDATION_THREADS = 16;
+/** -txvalidationthreads default (number of threads admitting relayed transactions, 0 = auto) */
+static const int DEFAULT_TXVALIDATION_THREADS = 0;
+/** Maximum number of relayed transactions waiting for a validation thread */
+static const unsigned int MAX_TXVALIDATION_QUEUE = 1000;
+/** Maximum number of those relayed by any one peer */
+static const unsigned int MAX_TXVALIDATION_QUEUE_PER_PEER = 100;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16; // κʱӵԶ
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -96,8 +118,11 @@ static const unsigned int AVG_LOCAL_ADDRESS_BROADCAST_INTERVAL = 24 * 24 * 60; /
 /** Average delay between peer address broadcasts in seconds. */
 static const unsigned int AVG_ADDRESS_BROADCAST_INTERVAL = 30;
 /** Average delay between trickled inventory broadcasts in seconds.
- *  Blocks, whitelisted receivers, and a random 25% of transactions bypass this. */ // ΪλĿ㲥ƽӳ١飬Ľߣһ 25% Ľƹһ㡣
+ *  Blocks and whitelisted receivers bypass this, outbound peers get half this delay. */ // ΪλĿ㲥ƽӳ١ͼĽƹһ㣬ڵӳټ롣
 static const unsigned int AVG_INVENTORY_BROADCAST_INTERVAL = 5; // 5s
+/** Maximum number of transactions announced to a peer per trickle.
+ *  Limits the impact of low-fee transaction floods; the rest waits for the next one. */ // ÿһڵͨ
+static const unsigned int INVENTORY_BROADCAST_MAX = 7 * AVG_INVENTORY_BROADCAST_INTERVAL;
 /** Block download timeout base, expressed in millionths of the block interval (i.e. 10 min) */ // سʱİ֮һʾ 10 ӣ
 static const int64_t BLOCK_DOWNLOAD_TIMEOUT_BASE = 1000000;
 /** Additional block download timeout per parallel downloading peer (i.e. 5 min) */ // ÿͬĶسʱ 5 ӣ
@@ -138,6 +163,7 @@ extern CConditionVariable cvBlockChange; // 
 extern bool fImporting;
 extern bool fReindex; // ־ĬϹر
 extern int nScriptCheckThreads;
+extern int nTxValidationThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
@@ -206,6 +232,10 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */ // ⲿļ
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/** Dump the mempool to mempool.dat */ // תڴص mempool.dat
+bool DumpMempool();
+/** Load the mempool from mempool.dat, accepting transactions in batches */ //  mempool.dat ڴ
+bool LoadMempool();
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex(const CChainParams& chainparams); // ʼһµݿ+ݵ
 /** Load the block tree and coins database from disk */
@@ -222,6 +252,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck(); // һű̵߳ʵ
+/** Run an instance of the relayed transaction validation thread */
+void ThreadTxValidation();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -277,6 +309,67 @@ void PruneAndFlush(); // 
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit=false, bool fRejectAbsurdFee=false);
 
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit=false, bool fRejectAbsurdFee=false);
+
+/**
+ * A transaction on its way into the memory pool. Admission can be split in
+ * three steps so that script verification, by far the most expensive part,
+ * runs without cs_main held:
+ *  - PreAcceptToMemoryPool does every check that needs the chain or the
+ *    mempool, and copies the coins the transaction spends into view;
+ *  - CheckMemPoolAdmissionScripts verifies the scripts against that copy;
+ *  - FinishAcceptToMemoryPool adds the transaction to the mempool.
+ * AcceptToMemoryPool runs the three steps in a row.
+ */
+struct CMemPoolAdmission : boost::noncopyable
+{
+    const CTransaction& tx;
+    const bool fLimitFree;
+    const int64_t nAcceptTime;
+    const bool fOverrideMempoolLimit;
+    const bool fRejectAbsurdFee;
+    //! Set when the transaction was rejected because its inputs are unknown
+    bool fMissingInputs;
+
+    //! Filled in by PreAcceptToMemoryPool
+    CCoinsView viewDummy;
+    CCoinsViewCache view;
+    boost::scoped_ptr<CTxMemPoolEntry> pentry;
+    CTxMemPool::setEntries setAncestors;
+    CTxMemPool::vecEntries allConflicting;
+    CAmount nModifiedFees;
+    CAmount nConflictingFees;
+    size_t nConflictingSize;
+    std::vector<uint256> vHashTxnToUncache;
+    //! Chain tip and mempool state the checks were done against
+    uint256 hashBestBlock;
+    unsigned int nTransactionsUpdated;
+    //! Script flags of the tip, which the next block most likely shares
+    unsigned int nBlockScriptFlags;
+
+    //! Set by CheckMemPoolAdmissionScripts
+    bool fScriptsChecked;
+
+    CMemPoolAdmission(const CTransaction& txIn, bool fLimitFreeIn, int64_t nAcceptTimeIn,
+                      bool fOverrideMempoolLimitIn = false, bool fRejectAbsurdFeeIn = false);
+};
+
+/** Check a transaction for admission to the mempool, except for its scripts. Requires cs_main. */
+bool PreAcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, CMemPoolAdmission& admission);
+
+/** Verify the scripts of a transaction checked by PreAcceptToMemoryPool. Needs no locks. */
+bool CheckMemPoolAdmissionScripts(CValidationState &state, CMemPoolAdmission& admission);
+
+/**
+ * Add a transaction whose scripts passed CheckMemPoolAdmissionScripts to the
+ * mempool, redoing the checks of PreAcceptToMemoryPool first if the chain or
+ * the mempool changed in between. Returns false without doing anything else
+ * if the scripts did not pass. Requires cs_main.
+ */
+bool FinishAcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, CMemPoolAdmission& admission);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -336,10 +429,32 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * instead of being performed inline, and refer to txdata, which must outlive them.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                 unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks = NULL);
+                 unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata,
+                 std::vector<CScriptCheck> *pvChecks = NULL);
+
+/**
+ * Verify the scripts of all inputs of this transaction, the expensive part of
+ * CheckInputs. Only reads the coins in view, so it does not need cs_main when
+ * view is not backed by pcoinsTip.
+ *
+ * Returns at once if the scripts already passed under flags. cacheSigStore
+ * keeps the verified signatures in the signature cache, cacheFullScriptStore
+ * remembers that all scripts of tx passed (only done when pvChecks is NULL).
+ * txdata is filled in on first use and can be passed again for the same tx to
+ * skip recomputing its signature hashing data.
+ */
+bool CheckInputScripts(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view,
+                       unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore,
+                       PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = NULL);
+
+/** Size the script execution cache used by CheckInputScripts. Called once at startup. */
+void InitScriptExecutionCache();
+
+/** Script verification flags a block at pindex is connected with */
+unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consensus::Params& consensusparams);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, int nHeight);
@@ -399,12 +514,13 @@ private:
     unsigned int nFlags;
     bool cacheStore;
     ScriptError error; // űͶ
+    const PrecomputedTransactionData *txdata; // ׵ǩϣԤ
 
 public:
-    CScriptCheck(): ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
+    CScriptCheck(): ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(NULL) {}
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, const PrecomputedTransactionData* txdataIn = NULL) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()(); // صĺ
 
@@ -415,6 +531,7 @@ public:
         std::swap(nFlags, check.nFlags);
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
+        std::swap(txdata, check.txdata);
     }
 
     ScriptError GetScriptError() const { return error; }
@@ -45,16 +45,20 @@ using namespace std;
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
-class ScoreCompare
+BlockTemplateEngine blockTemplateEngine; // getblocktemplate ʹõģ
+
+static void GetBlockSizeLimits(unsigned int& nBlockMaxSize, unsigned int& nBlockMinSize)
 {
-public:
-    ScoreCompare() {}
+    // Largest block you're willing to create:
+    nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE); // ϣСĬ 750,000 1M
+    // Limit to between 1K and MAX_BLOCK_SIZE-1K for sanity:
+    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize)); // ȡС
 
-    bool operator()(const CTxMemPool::txiter a, const CTxMemPool::txiter b)
-    {
-        return CompareTxMemPoolEntryByScore()(*b,*a); // Convert to less than
-    }
-};
+    // Minimum block size you want to create; block will be filled with free transactions
+    // until there are no more or the block reaches this size:
+    nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE); // ĬССƣĬΪ 0
+    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+}
 
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
@@ -71,44 +75,381 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
     return nNewTime - nOldTime; // ¾ʱ
 }
 
-CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+BlockAssembler::BlockAssembler(const CChainParams& _chainparams)
+    : chainparams(_chainparams)
 {
+    GetBlockSizeLimits(nBlockMaxSize, nBlockMinSize);
+}
+
+void BlockAssembler::resetBlock()
+{
+    inBlock.clear();
+
+    // Reserve space for coinbase tx
+    nBlockSize = 1000;
+    nBlockSigOps = 100;
+
+    // These counters do not include coinbase tx
+    nBlockTx = 0;
+    nFees = 0;
+
+    lastFewTxs = 0;
+    blockFinished = false;
+}
+
+CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
+{
+    resetBlock();
+
     // Create new block
-    auto_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate()); // һµģ壨Ѻͽǩ
+    pblocktemplate.reset(new CBlockTemplate()); // һµģ壨Ѻͽǩ
     if(!pblocktemplate.get())
         return NULL;
-    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
-
-    // Create coinbase tx
-    CMutableTransaction txNew; // ҽ׶
-    txNew.vin.resize(1);
-    txNew.vin[0].prevout.SetNull(); // Ϊ
-    txNew.vout.resize(1);
-    txNew.vout[0].scriptPubKey = scriptPubKeyIn; // Կű
+    pblock = &pblocktemplate->block; // pointer for convenience
 
     // Add dummy coinbase tx as first transaction
     pblock->vtx.push_back(CTransaction()); // ӼٵĴҽΪһʽ׵б
     pblocktemplate->vTxFees.push_back(-1); // updated at end // ޽
     pblocktemplate->vTxSigOps.push_back(-1); // updated at end // ޽ǩ
 
-    // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE); // ϣСĬ 750,000 1M
-    // Limit to between 1K and MAX_BLOCK_SIZE-1K for sanity:
-    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize)); // ȡС
+    LOCK2(cs_main, mempool.cs);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    nHeight = pindexPrev->nHeight + 1;
+
+    pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus()); // 汾
+    // -regtest only: allow overriding block.nVersion with
+    // -blockversion=N to test forking scenarios
+    if (chainparams.MineBlocksOnDemand())
+        pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+
+    pblock->nTime = GetAdjustedTime();
+    const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
+
+    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                       ? nMedianTimePast
+                       : pblock->GetBlockTime();
+
+    addPriorityTxs(); // Ȱȼĸȼ
+    addPackageTxs(); // ٰȵķѡװ
+
+    nLastBlockTx = nBlockTx; // ڽ
+    nLastBlockSize = nBlockSize; // С
+    LogPrintf("CreateNewBlock(): total size %u txs: %u fees: %ld sigops %d\n", nBlockSize, nBlockTx, nFees, nBlockSigOps);
+
+    // Create coinbase transaction. // ҽ
+    CMutableTransaction coinbaseTx;
+    coinbaseTx.vin.resize(1);
+    coinbaseTx.vin[0].prevout.SetNull(); // Ϊ
+    coinbaseTx.vout.resize(1);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn; // Կű
+    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus()); // 㴴ҽֵ齱ͨǰ߶Ⱥ͹ʶ
+    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0; // ýǩűĸ߶ȣOP_0 ʾһֽڿմջ
+    pblock->vtx[0] = coinbaseTx; // 봴ҽ
+    pblocktemplate->vTxFees[0] = -nFees; // 㽻ѣΪ 0
+
+    // Fill in header
+    pblock->hashPrevBlock  = pindexPrev->GetBlockHash(); // ȡϣ
+    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+    pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus()); // ȡѶȶӦֵ
+    pblock->nNonce         = 0; //  0 0 ʼҿ
+    pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]); // ȡҽǩ
+
+    CValidationState state;
+    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) { // ֤ǷЧ
+        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+    }
+
+    return pblocktemplate.release(); // ͷŲģָ
+}
+
+bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
+{
+    BOOST_FOREACH(const CTxMemPoolEntry* parent, mempool.GetMemPoolParents(iter))
+    {
+        if (!inBlock.count(mempool.GetIter(parent))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
+{
+    for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
+        // Only test txs not already in the block
+        if (inBlock.count(*iit)) {
+            testSet.erase(iit++);
+        }
+        else {
+            iit++;
+        }
+    }
+}
+
+bool BlockAssembler::TestPackage(uint64_t packageSize, unsigned int packageSigOps)
+{
+    if (nBlockSize + packageSize >= nBlockMaxSize)
+        return false;
+    if (nBlockSigOps + packageSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+    return true;
+}
+
+// Block size and sigops have already been tested.  Check that all transactions
+// are final.
+bool BlockAssembler::TestPackageFinality(const CTxMemPool::setEntries& package)
+{
+    BOOST_FOREACH (const CTxMemPool::txiter it, package) {
+        if (!IsFinalTx(it->GetTx(), nHeight, nLockTimeCutoff))
+            return false;
+    }
+    return true;
+}
+
+bool BlockAssembler::TestForBlock(CTxMemPool::txiter iter)
+{
+    if (nBlockSize + iter->GetTxSize() >= nBlockMaxSize) {
+        // If the block is so close to full that no more txs will fit
+        // or if we've tried more than 50 times to fill remaining space
+        // then flag that the block is finished
+        if (nBlockSize >  nBlockMaxSize - 100 || lastFewTxs > 50) {
+             blockFinished = true;
+             return false;
+        }
+        // Once we're within 1000 bytes of a full block, only look at 50 more txs
+        // to try to fill the remaining space.
+        if (nBlockSize > nBlockMaxSize - 1000) {
+            lastFewTxs++;
+        }
+        return false;
+    }
+
+    if (nBlockSigOps + iter->GetSigOpCount() >= MAX_BLOCK_SIGOPS) {
+        // If the block has room for no more sig ops then
+        // flag that the block is finished
+        if (nBlockSigOps > MAX_BLOCK_SIGOPS - 2) {
+            blockFinished = true;
+            return false;
+        }
+        // Otherwise attempt to find another tx with fewer sigops
+        // to put in the block.
+        return false;
+    }
+
+    // Must check that lock times are still valid
+    // This can be removed once MTP is always enforced
+    // as long as reorgs keep the mempool consistent.
+    if (!IsFinalTx(iter->GetTx(), nHeight, nLockTimeCutoff))
+        return false;
+
+    return true;
+}
+
+void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
+{
+    pblock->vtx.push_back(iter->GetTx());
+    pblocktemplate->vTxFees.push_back(iter->GetFee());
+    pblocktemplate->vTxSigOps.push_back(iter->GetSigOpCount());
+    nBlockSize += iter->GetTxSize();
+    ++nBlockTx; // ڽ 1
+    nBlockSigOps += iter->GetSigOpCount();
+    nFees += iter->GetFee(); // ۼӽ׷
+    inBlock.insert(iter);
+
+    bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY); // ӡȼ־ĬϹر
+    if (fPrintPriority) {
+        double dPriority = iter->GetPriority(nHeight);
+        CAmount dummy;
+        mempool.ApplyDeltas(iter->GetTx().GetHash(), dPriority, dummy);
+        LogPrintf("priority %.1f fee %s txid %s\n",
+                  dPriority,
+                  CFeeRate(iter->GetModifiedFee(), iter->GetTxSize()).ToString(),
+                  iter->GetTx().GetHash().ToString());
+    }
+}
+
+void BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
+        indexed_modified_transaction_set &mapModifiedTx)
+{
+    BOOST_FOREACH(const CTxMemPool::txiter it, alreadyAdded) {
+        CTxMemPool::vecEntries descendants;
+        mempool.CalculateDescendants(it, descendants);
+        // Insert all descendants (not yet in block) into the modified set
+        BOOST_FOREACH(CTxMemPool::txiter desc, descendants) {
+            if (alreadyAdded.count(desc))
+                continue;
+            modtxiter mit = mapModifiedTx.find(desc);
+            if (mit == mapModifiedTx.end()) {
+                CTxMemPoolModifiedEntry modEntry(desc);
+                modEntry.nSizeWithAncestors -= it->GetTxSize();
+                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
+                modEntry.nSigOpCountWithAncestors -= it->GetSigOpCount();
+                mapModifiedTx.insert(modEntry);
+            } else {
+                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+            }
+        }
+    }
+}
+
+// Skip entries in mapTx that are already in a block or are present
+// in mapModifiedTx (which implies that the mapTx ancestor state is
+// stale due to ancestor inclusion in the block)
+// Also skip transactions that we've already failed to add. This can happen if
+// we consider a transaction in mapModifiedTx and it fails: we can then
+// potentially consider it again while walking mapTx.  It's currently
+// guaranteed to fail again, but as a belt-and-suspenders check we put it in
+// failedTx and avoid re-evaluation, since the re-evaluation would be using
+// cached size/sigops/fee values that are not actually correct.
+bool BlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx)
+{
+    assert (it != mempool.mapTx.end());
+    if (mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it))
+        return true;
+    return false;
+}
+
+void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, std::vector<CTxMemPool::txiter>& sortedEntries)
+{
+    // Sort package by ancestor count
+    // If a transaction A depends on transaction B, then A's ancestor count
+    // must be greater than B's.  So this is sufficient to validly order the
+    // transactions for block inclusion.
+    sortedEntries.clear();
+    sortedEntries.insert(sortedEntries.begin(), package.begin(), package.end());
+    std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+}
+
+// This transaction selection algorithm orders the mempool based
+// on feerate of a transaction including all unconfirmed ancestors.
+// Since we don't remove transactions from the mempool as we select them
+// for block inclusion, we need an alternate method of updating the feerate
+// of a transaction with its not-yet-selected ancestors as we go.
+// This is accomplished by walking the in-mempool descendants of selected
+// transactions and storing a temporary modified state in mapModifiedTxs.
+// Each time through the loop, we compare the best transaction in
+// mapModifiedTxs with the next transaction in the mempool to decide what
+// transaction package to work on next.
+void BlockAssembler::addPackageTxs()
+{
+    // mapModifiedTx will store sorted packages after they are modified
+    // because some of their txs are already in the block
+    indexed_modified_transaction_set mapModifiedTx;
+    // Keep track of entries that failed inclusion, to avoid duplicate work
+    CTxMemPool::setEntries failedTx;
+
+    // Start by adding all descendants of previously added txs to mapModifiedTx
+    // and modifying them for their already included ancestors
+    UpdatePackagesForAdded(inBlock, mapModifiedTx);
+
+    CTxMemPool::indexed_transaction_set::nth_index<4>::type::iterator mi = mempool.mapTx.get<4>().begin();
+    CTxMemPool::txiter iter;
+    while (mi != mempool.mapTx.get<4>().end() || !mapModifiedTx.empty())
+    {
+        // First try to find a new transaction in mapTx to evaluate.
+        if (mi != mempool.mapTx.get<4>().end() &&
+                SkipMapTxEntry(mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
+            ++mi;
+            continue;
+        }
+
+        // Now that mi is not stale, determine which transaction to evaluate:
+        // the next entry from mapTx, or the best from mapModifiedTx?
+        bool fUsingModified = false;
+
+        modtxscoreiter modit = mapModifiedTx.get<1>().begin();
+        if (mi == mempool.mapTx.get<4>().end()) {
+            // We're out of entries in mapTx; use the entry from mapModifiedTx
+            iter = modit->iter;
+            fUsingModified = true;
+        } else {
+            // Try to compare the mapTx entry to the mapModifiedTx entry
+            iter = mempool.mapTx.project<0>(mi);
+            if (modit != mapModifiedTx.get<1>().end() &&
+                    CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                // The best entry in mapModifiedTx has higher score
+                // than the one from mapTx.
+                // Switch which transaction (package) to consider
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                // Either no entry in mapModifiedTx, or it's worse than mapTx.
+                // Increment mi for the next loop iteration.
+                ++mi;
+            }
+        }
+
+        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
+        // contain anything that is inBlock.
+        assert(!inBlock.count(iter));
+
+        uint64_t packageSize = iter->GetSizeWithAncestors();
+        CAmount packageFees = iter->GetModFeesWithAncestors();
+        unsigned int packageSigOps = iter->GetSigOpCountWithAncestors();
+        if (fUsingModified) {
+            packageSize = modit->nSizeWithAncestors;
+            packageFees = modit->nModFeesWithAncestors;
+            packageSigOps = modit->nSigOpCountWithAncestors;
+        }
+
+        if (packageFees < ::minRelayTxFee.GetFee(packageSize) && nBlockSize >= nBlockMinSize) {
+            // Everything else we might consider has a lower fee rate
+            return;
+        }
+
+        if (!TestPackage(packageSize, packageSigOps)) {
+            if (fUsingModified) {
+                // Since we always look at the best entry in mapModifiedTx,
+                // we must erase failed entries so that we can consider the
+                // next best entry on the next loop iteration
+                mapModifiedTx.get<1>().erase(modit);
+                failedTx.insert(iter);
+            }
+            continue;
+        }
+
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+        onlyUnconfirmed(ancestors);
+        ancestors.insert(iter);
 
+        // Test if all tx's are Final
+        if (!TestPackageFinality(ancestors)) {
+            if (fUsingModified) {
+                mapModifiedTx.get<1>().erase(modit);
+                failedTx.insert(iter);
+            }
+            continue;
+        }
+
+        // Package can be added. Sort the entries in a valid order.
+        vector<CTxMemPool::txiter> sortedEntries;
+        SortForBlock(ancestors, sortedEntries);
+
+        for (size_t i=0; i<sortedEntries.size(); ++i) {
+            AddToBlock(sortedEntries[i]);
+            // Erase from the modified set, if present
+            mapModifiedTx.erase(sortedEntries[i]);
+        }
+
+        // Update transactions that depend on each of these
+        UpdatePackagesForAdded(ancestors, mapModifiedTx);
+    }
+}
+
+void BlockAssembler::addPriorityTxs()
+{
     // How much of the block should be dedicated to high-priority transactions,
     // included regardless of the fees they pay
     unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE); // ĬȼСĬΪ 0
     nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize); // ڰȼĽ
 
-    // Minimum block size you want to create; block will be filled with free transactions
-    // until there are no more or the block reaches this size:
-    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE); // ĬССƣĬΪ 0
-    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
-
-    // Collect memory pool transactions into the block
-    CTxMemPool::setEntries inBlock;
-    CTxMemPool::setEntries waitSet;
+    if (nBlockPrioritySize == 0) {
+        return;
+    }
 
     // This vector will be sorted into a priority queue:
     vector<TxCoinAgePriority> vecPriority;
@@ -117,185 +458,284 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
     typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
     double actualPriority = -1;
 
-    std::priority_queue<CTxMemPool::txiter, std::vector<CTxMemPool::txiter>, ScoreCompare> clearedTxs;
-    bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY); // ӡȼ־ĬϹر
-    uint64_t nBlockSize = 1000; // С
-    uint64_t nBlockTx = 0; // ڽ
-    unsigned int nBlockSigOps = 100;
-    int lastFewTxs = 0;
-    CAmount nFees = 0;
-
+    vecPriority.reserve(mempool.mapTx.size());
+    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
+         mi != mempool.mapTx.end(); ++mi)
     {
-        LOCK2(cs_main, mempool.cs);
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        const int nHeight = pindexPrev->nHeight + 1;
-        pblock->nTime = GetAdjustedTime();
-        const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
-
-        pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus()); // 汾
-        // -regtest only: allow overriding block.nVersion with
-        // -blockversion=N to test forking scenarios
-        if (chainparams.MineBlocksOnDemand())
-            pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
-
-        int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                                ? nMedianTimePast
-                                : pblock->GetBlockTime();
-
-        bool fPriorityBlock = nBlockPrioritySize > 0;
-        if (fPriorityBlock) {
-            vecPriority.reserve(mempool.mapTx.size());
-            for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-                 mi != mempool.mapTx.end(); ++mi)
-            {
-                double dPriority = mi->GetPriority(nHeight);
-                CAmount dummy;
-                mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
-                vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
-            }
-            std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+        double dPriority = mi->GetPriority(nHeight);
+        CAmount dummy;
+        mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+        vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+    }
+    std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+
+    CTxMemPool::txiter iter;
+    while (!vecPriority.empty() && !blockFinished) { // add a tx from priority queue to fill the blockprioritysize
+        iter = vecPriority.front().second;
+        actualPriority = vecPriority.front().first;
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+        vecPriority.pop_back();
+
+        // If tx already in block, skip
+        if (inBlock.count(iter)) {
+            assert(false); // shouldn't happen for priority txs
+            continue;
         }
 
-        CTxMemPool::indexed_transaction_set::nth_index<3>::type::iterator mi = mempool.mapTx.get<3>().begin();
-        CTxMemPool::txiter iter;
-
-        while (mi != mempool.mapTx.get<3>().end() || !clearedTxs.empty())
-        {
-            bool priorityTx = false;
-            if (fPriorityBlock && !vecPriority.empty()) { // add a tx from priority queue to fill the blockprioritysize
-                priorityTx = true;
-                iter = vecPriority.front().second;
-                actualPriority = vecPriority.front().first;
-                std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-                vecPriority.pop_back();
-            }
-            else if (clearedTxs.empty()) { // add tx with next highest score
-                iter = mempool.mapTx.project<0>(mi);
-                mi++;
-            }
-            else {  // try to add a previously postponed child tx
-                iter = clearedTxs.top();
-                clearedTxs.pop();
-            }
+        // If tx is dependent on other mempool txs which haven't yet been included
+        // then put it in the waitSet
+        if (isStillDependent(iter)) {
+            waitPriMap.insert(std::make_pair(iter, actualPriority));
+            continue;
+        }
 
-            if (inBlock.count(iter))
-                continue; // could have been added to the priorityBlock
+        // If this tx fits in the block add it, otherwise keep looping
+        if (TestForBlock(iter)) {
+            AddToBlock(iter);
 
-            const CTransaction& tx = iter->GetTx();
+            // If now that this txs is added we've surpassed our desired priority size
+            // or have dropped below the AllowFreeThreshold, then we're done adding priority txs
+            if (nBlockSize >= nBlockPrioritySize || !AllowFree(actualPriority)) {
+                break;
+            }
 
-            bool fOrphan = false;
-            BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
+            // This tx was successfully added, so
+            // add transactions that depend on this one to the priority queue to try again
+            BOOST_FOREACH(const CTxMemPoolEntry* childEntry, mempool.GetMemPoolChildren(iter))
             {
-                if (!inBlock.count(parent)) {
-                    fOrphan = true;
-                    break;
+                CTxMemPool::txiter child = mempool.GetIter(childEntry);
+                waitPriIter wpiter = waitPriMap.find(child);
+                if (wpiter != waitPriMap.end()) {
+                    vecPriority.push_back(TxCoinAgePriority(wpiter->second,child));
+                    std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                    waitPriMap.erase(wpiter);
                 }
             }
-            if (fOrphan) {
-                if (priorityTx)
-                    waitPriMap.insert(std::make_pair(iter,actualPriority));
-                else
-                    waitSet.insert(iter);
-                continue;
-            }
+        }
+    }
+}
 
-            unsigned int nTxSize = iter->GetTxSize();
-            if (fPriorityBlock &&
-                (nBlockSize + nTxSize >= nBlockPrioritySize || !AllowFree(actualPriority))) {
-                fPriorityBlock = false;
-                waitPriMap.clear();
-            }
-            if (!priorityTx &&
-                (iter->GetModifiedFee() < ::minRelayTxFee.GetFee(nTxSize) && nBlockSize >= nBlockMinSize)) {
-                break;
-            }
-            if (nBlockSize + nTxSize >= nBlockMaxSize) {
-                if (nBlockSize >  nBlockMaxSize - 100 || lastFewTxs > 50) {
-                    break;
-                }
-                // Once we're within 1000 bytes of a full block, only look at 50 more txs
-                // to try to fill the remaining space.
-                if (nBlockSize > nBlockMaxSize - 1000) {
-                    lastFewTxs++;
-                }
-                continue;
-            }
+CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+{
+    return BlockAssembler(chainparams).CreateNewBlock(scriptPubKeyIn);
+}
 
-            if (!IsFinalTx(tx, nHeight, nLockTimeCutoff))
-                continue;
+BlockTemplateEngine::BlockTemplateEngine()
+    : fRebuild(false), pindexPrev(NULL), nBlockSize(0), nBlockSigOps(0), nFees(0),
+      nBlockMaxSize(0), nBlockMinSize(0), nHeight(0), nLockTimeCutoff(0),
+      fStale(false), nLastRebuild(0), nRebuilds(0), nUpdates(0)
+{
+}
 
-            unsigned int nTxSigOps = iter->GetSigOpCount();
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS) {
-                if (nBlockSigOps > MAX_BLOCK_SIGOPS - 2) {
-                    break;
-                }
-                continue;
-            }
+void BlockTemplateEngine::TransactionAdded(const CTransaction& tx)
+{
+    LOCK(cs);
+    if (vAdded.size() + setRemoved.size() >= MAX_BLOCK_TEMPLATE_PENDING) {
+        // Nobody asked for a template in a long time; rebuild instead
+        fRebuild = true;
+        vAdded.clear();
+        setRemoved.clear();
+    }
+    if (!fRebuild)
+        vAdded.push_back(tx.GetHash());
+}
 
-            CAmount nTxFees = iter->GetFee();
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx; // ڽ 1
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees; // ۼӽ׷
-
-            if (fPrintPriority) // ӡȼ
-            {
-                double dPriority = iter->GetPriority(nHeight);
-                CAmount dummy;
-                mempool.ApplyDeltas(tx.GetHash(), dPriority, dummy);
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                          dPriority , CFeeRate(iter->GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
-            }
+void BlockTemplateEngine::TransactionRemoved(const CTransaction& tx)
+{
+    LOCK(cs);
+    if (vAdded.size() + setRemoved.size() >= MAX_BLOCK_TEMPLATE_PENDING) {
+        fRebuild = true;
+        vAdded.clear();
+        setRemoved.clear();
+    }
+    if (!fRebuild)
+        setRemoved.insert(tx.GetHash());
+}
 
-            inBlock.insert(iter);
+void BlockTemplateEngine::TransactionPrioritised(const uint256& hash)
+{
+    // A fee delta reorders the whole package selection, and may raise
+    // transactions we passed over above ones already in the template
+    LOCK(cs);
+    fRebuild = true;
+    vAdded.clear();
+    setRemoved.clear();
+}
 
-            // Add transactions that depend on this one to the priority queue
-            BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter))
-            {
-                if (fPriorityBlock) {
-                    waitPriIter wpiter = waitPriMap.find(child);
-                    if (wpiter != waitPriMap.end()) {
-                        vecPriority.push_back(TxCoinAgePriority(wpiter->second,child));
-                        std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-                        waitPriMap.erase(wpiter);
-                    }
-                }
-                else {
-                    if (waitSet.count(child)) {
-                        clearedTxs.push(child);
-                        waitSet.erase(child);
-                    }
-                }
-            }
-        }
-        nLastBlockTx = nBlockTx; // ڽ
-        nLastBlockSize = nBlockSize; // С
-        LogPrintf("CreateNewBlock(): total size %u txs: %u fees: %ld sigops %d\n", nBlockSize, nBlockTx, nFees, nBlockSigOps);
-
-        // Compute final coinbase transaction. // 㴴ҽ
-        txNew.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus()); // 㴴ҽֵ齱ͨǰ߶Ⱥ͹ʶ
-        txNew.vin[0].scriptSig = CScript() << nHeight << OP_0; // ýǩűĸ߶ȣOP_0 ʾһֽڿմջ
-        pblock->vtx[0] = txNew; // 봴ҽ
-        pblocktemplate->vTxFees[0] = -nFees; // 㽻ѣΪ 0
-
-        // Fill in header
-        pblock->hashPrevBlock  = pindexPrev->GetBlockHash(); // ȡϣ
-        UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev); 
-        pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus()); // ȡѶȶӦֵ
-        pblock->nNonce         = 0; //  0 0 ʼҿ
-        pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]); // ȡҽǩ
+CBlockTemplate* BlockTemplateEngine::GetBlockTemplate(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+{
+    LOCK2(cs_main, mempool.cs);
+    std::vector<uint256> vAddedNow;
+    std::set<uint256> setRemovedNow;
+    bool fRebuildNow;
+    {
+        LOCK(cs);
+        vAddedNow.swap(vAdded);
+        setRemovedNow.swap(setRemoved);
+        fRebuildNow = fRebuild;
+        fRebuild = false;
+    }
 
+    if (!pblocktemplate.get() || pindexPrev != chainActive.Tip() || fRebuildNow ||
+        (fStale && GetTime() - nLastRebuild >= BLOCK_TEMPLATE_REBUILD_INTERVAL)) {
+        // A new tip frees the space of all transactions it confirmed, which
+        // only a full pass over the mempool can fill again.
+        Rebuild(chainparams);
+    } else if (!vAddedNow.empty() || !setRemovedNow.empty()) {
+        Update(chainparams, vAddedNow, setRemovedNow);
+        // Check the result as CreateNewBlock does, and fall back to a full
+        // pass if the incremental changes left an invalid block
         CValidationState state;
-        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) { // ֤ǷЧ
-            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+        if (!TestBlockValidity(state, chainparams, pblocktemplate->block, chainActive.Tip(), false, false)) {
+            LogPrintf("%s: updated template failed TestBlockValidity, rebuilding: %s\n", __func__, FormatStateMessage(state));
+            Rebuild(chainparams);
         }
     }
 
-    return pblocktemplate.release(); // ͷŲģָ
+    std::auto_ptr<CBlockTemplate> pcopy(new CBlockTemplate(*pblocktemplate));
+    CMutableTransaction coinbaseTx(pcopy->block.vtx[0]);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    pcopy->block.vtx[0] = coinbaseTx;
+    return pcopy.release();
+}
+
+void BlockTemplateEngine::Rebuild(const CChainParams& chainparams)
+{
+    pblocktemplate.reset();
+    pindexPrev = NULL;
+    setInTemplate.clear();
+
+    // Throws if the assembled block is invalid, leaving no template
+    pblocktemplate.reset(BlockAssembler(chainparams).CreateNewBlock(CScript()));
+
+    const CBlock& block = pblocktemplate->block;
+    pindexPrev = chainActive.Tip();
+    nHeight = pindexPrev->nHeight + 1;
+    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                       ? pindexPrev->GetMedianTimePast()
+                       : block.GetBlockTime();
+    GetBlockSizeLimits(nBlockMaxSize, nBlockMinSize);
+
+    // Same accounting as BlockAssembler, which reserves room for the coinbase
+    nBlockSize = 1000;
+    nBlockSigOps = 100;
+    nFees = 0;
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        setInTemplate.insert(block.vtx[i].GetHash());
+        nBlockSize += block.vtx[i].GetTotalSize();
+        nBlockSigOps += pblocktemplate->vTxSigOps[i];
+        nFees += pblocktemplate->vTxFees[i];
+    }
+
+    fStale = false;
+    nLastRebuild = GetTime();
+    nRebuilds++;
+}
+
+void BlockTemplateEngine::Update(const CChainParams& chainparams, const std::vector<uint256>& vAddedNow, const std::set<uint256>& setRemovedNow)
+{
+    if (!setRemovedNow.empty())
+        RemoveTransactions(setRemovedNow);
+
+    // Consider the new transactions best package first, as the assembler would
+    std::vector<CTxMemPool::txiter> vIters;
+    vIters.reserve(vAddedNow.size());
+    BOOST_FOREACH(const uint256& hash, vAddedNow) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it != mempool.mapTx.end() && !setInTemplate.count(hash))
+            vIters.push_back(it);
+    }
+    std::sort(vIters.begin(), vIters.end(), CompareTxIterByAncestorFee());
+    BOOST_FOREACH(CTxMemPool::txiter it, vIters) {
+        if (!setInTemplate.count(it->GetTx().GetHash()))
+            AppendPackage(it);
+    }
+
+    UpdateCoinbase(chainparams);
+    nLastBlockTx = pblocktemplate->block.vtx.size() - 1;
+    nLastBlockSize = nBlockSize;
+    nUpdates++;
+}
+
+void BlockTemplateEngine::RemoveTransactions(const std::set<uint256>& setRemovedNow)
+{
+    CBlock& block = pblocktemplate->block;
+    size_t nKeep = 1;
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        const uint256 hash = block.vtx[i].GetHash();
+        if (setRemovedNow.count(hash)) {
+            // Removals other than for a block take all descendants along, so
+            // the remaining transactions are still in a valid order.
+            nBlockSize -= block.vtx[i].GetTotalSize();
+            nBlockSigOps -= pblocktemplate->vTxSigOps[i];
+            nFees -= pblocktemplate->vTxFees[i];
+            setInTemplate.erase(hash);
+            fStale = true; // the freed space may fit transactions we passed over
+            continue;
+        }
+        if (nKeep != i) {
+            block.vtx[nKeep] = block.vtx[i];
+            pblocktemplate->vTxFees[nKeep] = pblocktemplate->vTxFees[i];
+            pblocktemplate->vTxSigOps[nKeep] = pblocktemplate->vTxSigOps[i];
+        }
+        nKeep++;
+    }
+    block.vtx.resize(nKeep);
+    pblocktemplate->vTxFees.resize(nKeep);
+    pblocktemplate->vTxSigOps.resize(nKeep);
+}
+
+bool BlockTemplateEngine::AppendPackage(CTxMemPool::txiter iter)
+{
+    CTxMemPool::setEntries ancestors;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+    ancestors.insert(iter);
+
+    std::vector<CTxMemPool::txiter> sortedEntries;
+    uint64_t nPackageSize = 0;
+    CAmount nPackageFees = 0;
+    unsigned int nPackageSigOps = 0;
+    BOOST_FOREACH(CTxMemPool::txiter it, ancestors) {
+        if (setInTemplate.count(it->GetTx().GetHash()))
+            continue;
+        if (!IsFinalTx(it->GetTx(), nHeight, nLockTimeCutoff))
+            return false;
+        nPackageSize += it->GetTxSize();
+        nPackageFees += it->GetModifiedFee();
+        nPackageSigOps += it->GetSigOpCount();
+        sortedEntries.push_back(it);
+    }
+
+    // The assembler stops at packages below the relay fee as well
+    if (nPackageFees < ::minRelayTxFee.GetFee(nPackageSize) && nBlockSize >= nBlockMinSize)
+        return false;
+    if (nBlockSize + nPackageSize >= nBlockMaxSize || nBlockSigOps + nPackageSigOps >= MAX_BLOCK_SIGOPS) {
+        // It may be worth more than what is in the template already
+        fStale = true;
+        return false;
+    }
+
+    std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+    BOOST_FOREACH(CTxMemPool::txiter it, sortedEntries) {
+        pblocktemplate->block.vtx.push_back(it->GetTx());
+        pblocktemplate->vTxFees.push_back(it->GetFee());
+        pblocktemplate->vTxSigOps.push_back(it->GetSigOpCount());
+        setInTemplate.insert(it->GetTx().GetHash());
+        nBlockSize += it->GetTxSize();
+        nBlockSigOps += it->GetSigOpCount();
+        nFees += it->GetFee();
+    }
+    return true;
+}
+
+void BlockTemplateEngine::UpdateCoinbase(const CChainParams& chainparams)
+{
+    CMutableTransaction coinbaseTx(pblocktemplate->block.vtx[0]);
+    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+    pblocktemplate->block.vtx[0] = coinbaseTx;
+    pblocktemplate->vTxFees[0] = -nFees;
 }
 
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
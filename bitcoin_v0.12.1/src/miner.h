@@ -7,8 +7,12 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "txmempool.h"
 
 #include <stdint.h>
+#include <memory>
+#include "boost/multi_index_container.hpp"
+#include "boost/multi_index/ordered_index.hpp"
 
 /** Search the genesis block */
 void getGenesisBlock(CBlock *pblock);
@@ -24,6 +28,10 @@ static const bool DEFAULT_GENERATE = false; // 
 static const int DEFAULT_GENERATE_THREADS = 1; // ڿ߳ĬΪ 1
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Minimum seconds between full rebuilds of an incrementally maintained block template */
+static const int64_t BLOCK_TEMPLATE_REBUILD_INTERVAL = 5;
+/** Pending mempool changes kept for the block template before it is rebuilt instead */
+static const size_t MAX_BLOCK_TEMPLATE_PENDING = 100000;
 
 struct CBlockTemplate // ģ
 {
@@ -32,6 +40,244 @@ struct CBlockTemplate // 
     std::vector<int64_t> vTxSigOps; // ǩ
 };
 
+// Container for tracking updates to ancestor feerate as we include (parent)
+// transactions in a block
+struct CTxMemPoolModifiedEntry {
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
+    {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+        nSigOpCountWithAncestors = entry->GetSigOpCountWithAncestors();
+    }
+
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    unsigned int nSigOpCountWithAncestors;
+};
+
+/** Comparator for CTxMemPool::txiter objects.
+ *  It simply compares the internal memory address of the CTxMemPoolEntry object
+ *  pointed to. This means it has no meaning, and is only useful for using them
+ *  as key in other indexes.
+ */
+struct CompareCTxMemPoolIter {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator() (const CTxMemPoolModifiedEntry &entry) const
+    {
+        return entry.iter;
+    }
+};
+
+// This matches the calculation in CompareTxMemPoolEntryByAncestorFee,
+// except operating on CTxMemPoolModifiedEntry.
+struct CompareModifiedEntry {
+    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2) {
+            return a.iter->GetTx().GetHash() < b.iter->GetTx().GetHash();
+        }
+        return f1 > f2;
+    }
+};
+
+// A comparator that sorts transactions based on number of ancestors.
+// This is sufficient to sort an ancestor package in an order that is valid
+// to appear in a block.
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+// Sorts mempool iterators by ancestor feerate, highest first.
+struct CompareTxIterByAncestorFee {
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
+    {
+        return CompareTxMemPoolEntryByAncestorFee()(*a, *b);
+    }
+};
+
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        // keyed by the mempool entry
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CompareCTxMemPoolIter
+        >,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry
+        >
+    >
+> indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::nth_index<1>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion
+{
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator() (CTxMemPoolModifiedEntry &e)
+    {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+        e.nSigOpCountWithAncestors -= iter->GetSigOpCount();
+    }
+
+    CTxMemPool::txiter iter;
+};
+
+/** Generate a new block, without valid proof-of-work */
+class BlockAssembler // װ
+{
+private:
+    // The constructed block template
+    std::auto_ptr<CBlockTemplate> pblocktemplate;
+    // A convenience pointer that always refers to the CBlock in pblocktemplate
+    CBlock* pblock;
+
+    // Configuration parameters for the block size
+    unsigned int nBlockMaxSize, nBlockMinSize;
+
+    // Information on the current status of the block
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    unsigned int nBlockSigOps;
+    CAmount nFees;
+    CTxMemPool::setEntries inBlock;
+
+    // Chain context for the block
+    int nHeight;
+    int64_t nLockTimeCutoff;
+    const CChainParams& chainparams;
+
+    // Variables used for addPriorityTxs
+    int lastFewTxs;
+    bool blockFinished;
+
+public:
+    BlockAssembler(const CChainParams& chainparams);
+    /** Construct a new block template with coinbase to scriptPubKeyIn */
+    CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
+
+private:
+    // utility functions
+    /** Clear the block's state and prepare for assembling a new block */
+    void resetBlock();
+    /** Add a tx to the block */
+    void AddToBlock(CTxMemPool::txiter iter);
+
+    // Methods for how to add transactions to a block.
+    /** Add transactions based on tx "priority" */
+    void addPriorityTxs();
+    /** Add transactions based on feerate including unconfirmed ancestors */
+    void addPackageTxs();
+
+    // helper functions for addPriorityTxs
+    /** Test if tx will still "fit" in the block */
+    bool TestForBlock(CTxMemPool::txiter iter);
+    /** Test if tx still has unconfirmed parents not yet in block */
+    bool isStillDependent(CTxMemPool::txiter iter);
+
+    // helper functions for addPackageTxs()
+    /** Remove confirmed (inBlock) entries from given set */
+    void onlyUnconfirmed(CTxMemPool::setEntries& testSet);
+    /** Test if a new package would "fit" in the block */
+    bool TestPackage(uint64_t packageSize, unsigned int packageSigOps);
+    /** Test if a set of transactions are all final */
+    bool TestPackageFinality(const CTxMemPool::setEntries& package);
+    /** Return true if given transaction from mapTx has already been evaluated,
+      * or if the transaction's cached data in mapTx is incorrect. */
+    bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx);
+    /** Sort the package in an order that is valid to appear in a block */
+    void SortForBlock(const CTxMemPool::setEntries& package, std::vector<CTxMemPool::txiter>& sortedEntries);
+    /** Add descendants of given transactions to mapModifiedTx with ancestor
+      * state updated assuming given transactions are inBlock. */
+    void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
+};
+
+/** Keeps a block template on top of the current tip in step with the mempool.
+ *
+ *  Transactions entering the mempool are appended to the template together
+ *  with their missing ancestors when the package fits, and transactions
+ *  leaving it are dropped from the template. The template is only assembled
+ *  from scratch (with BlockAssembler) when the tip changes, or when a package
+ *  did not fit or space was freed and BLOCK_TEMPLATE_REBUILD_INTERVAL has
+ *  passed since the last rebuild.
+ *
+ *  TransactionAdded and TransactionRemoved are connected to the mempool's
+ *  notification signals; the queued changes are applied on the next
+ *  GetBlockTemplate call.
+ */
+class BlockTemplateEngine // άģ
+{
+private:
+    // Mempool changes not yet applied to the template
+    CCriticalSection cs;
+    std::vector<uint256> vAdded;
+    std::set<uint256> setRemoved;
+    bool fRebuild;
+
+    // The template and its bookkeeping, protected by cs_main and mempool.cs
+    std::auto_ptr<CBlockTemplate> pblocktemplate;
+    const CBlockIndex* pindexPrev;
+    std::set<uint256> setInTemplate;
+    uint64_t nBlockSize;
+    unsigned int nBlockSigOps;
+    CAmount nFees;
+    unsigned int nBlockMaxSize, nBlockMinSize;
+    int nHeight;
+    int64_t nLockTimeCutoff;
+    bool fStale;
+    int64_t nLastRebuild;
+
+    uint64_t nRebuilds;
+    uint64_t nUpdates;
+
+    /** Assemble the template from scratch on top of the current tip */
+    void Rebuild(const CChainParams& chainparams);
+    /** Apply queued mempool changes to the template */
+    void Update(const CChainParams& chainparams, const std::vector<uint256>& vAddedNow, const std::set<uint256>& setRemovedNow);
+    /** Drop the given transactions from the template */
+    void RemoveTransactions(const std::set<uint256>& setRemovedNow);
+    /** Append a mempool transaction and its ancestors not yet in the template */
+    bool AppendPackage(CTxMemPool::txiter iter);
+    /** Set the coinbase value and fee for the current contents */
+    void UpdateCoinbase(const CChainParams& chainparams);
+
+public:
+    BlockTemplateEngine();
+
+    /** Return a copy of the up to date template with coinbase to scriptPubKeyIn */
+    CBlockTemplate* GetBlockTemplate(const CChainParams& chainparams, const CScript& scriptPubKeyIn);
+
+    void TransactionAdded(const CTransaction& tx);
+    void TransactionRemoved(const CTransaction& tx);
+    void TransactionPrioritised(const uint256& hash);
+
+    uint64_t GetRebuildCount() const { return nRebuilds; }
+    uint64_t GetUpdateCount() const { return nUpdates; }
+};
+
+extern BlockTemplateEngine blockTemplateEngine;
+
 /** Run the miner threads */ // п߳
 void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainparams); // ɱ̻߳򴴽µĿ߳
 /** Generate a new block, without valid proof-of-work */
@@ -15,6 +15,7 @@
 #include "consensus/consensus.h"
 #include "crypto/common.h"
 #include "hash.h"
+#include "memusage.h"
 #include "primitives/transaction.h"
 #include "scheduler.h"
 #include "ui_interface.h"
@@ -89,9 +90,8 @@ std::string strSubVersion;
 
 vector<CNode*> vNodes; // ɹӵĽڵб
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay; // мӳб
-deque<pair<int64_t, CInv> > vRelayExpiration; // м̵ڶ <ʱ䣬ϢĿм̣>
-CCriticalSection cs_mapRelay; // мӳб
+static NodeSnapshot pvNodesSnapshot(new std::vector<CNode*>()); // ڵбֻ
+CRelayCache relayCache; // 뿪ڴصм̽׻
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
 
 static deque<string> vOneShots; // ַ˫˶
@@ -343,6 +343,34 @@ uint64_t CNode::nMaxOutboundTotalBytesSentInCycle = 0;
 uint64_t CNode::nMaxOutboundTimeframe = 60*60*24; //1 day
 uint64_t CNode::nMaxOutboundCycleStartTime = 0;
 
+uint64_t CNode::nMaxSendRate[SEND_CLASS_MAX] = {};
+
+// Runs in whichever thread drops the last reference to a snapshot, often a
+// reader holding cs_main, so it must not take cs_vNodes. A node removed from
+// vNodes never enters a later snapshot, so once its count reaches zero it
+// stays there.
+static void ReleaseNodeSnapshot(const std::vector<CNode*>* pvNodes)
+{
+    BOOST_FOREACH(CNode* pnode, *pvNodes)
+        pnode->nSnapshotRefCount.fetch_sub(1, boost::memory_order_release);
+    delete pvNodes;
+}
+
+void PublishNodeSnapshot()
+{
+    AssertLockHeld(cs_vNodes);
+    std::vector<CNode*>* pvNodes = new std::vector<CNode*>(vNodes);
+    BOOST_FOREACH(CNode* pnode, *pvNodes)
+        pnode->nSnapshotRefCount.fetch_add(1, boost::memory_order_relaxed);
+    NodeSnapshot pvNodesNew(pvNodes, ReleaseNodeSnapshot);
+    boost::atomic_store(&pvNodesSnapshot, pvNodesNew);
+}
+
+NodeSnapshot GetNodeSnapshot()
+{
+    return boost::atomic_load(&pvNodesSnapshot);
+}
+
 CNode* FindNode(const CNetAddr& ip)
 {
     LOCK(cs_vNodes);
@@ -420,6 +448,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
         {
             LOCK(cs_vNodes);
             vNodes.push_back(pnode); // ɹӵĽڵб
+            PublishNodeSnapshot();
         }
 
         pnode->nTimeConnected = GetTime(); // ¼ӵʱ
@@ -650,6 +679,24 @@ void CNode::copyStats(CNodeStats &stats)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    {
+        LOCK(cs_inventory);
+        stats.nInvTxQueued = setInventoryTxToSend.size();
+        X(nInvTxSent);
+        X(nInvMsgSent);
+    }
+
+    {
+        LOCK(cs_vSend);
+        stats.nSendQueued = nSendSize;
+        int64_t nThrottled = nThrottledTime;
+        if (nThrottledSince != 0)
+            nThrottled += GetTimeMicros() - nThrottledSince;
+        stats.dThrottledTime = ((double)nThrottled) / 1e6;
+        for (int i = 0; i < SEND_CLASS_MAX; i++)
+            stats.mapSendBytesPerClass[i] = nSendBytesPerClass[i];
+    }
 }
 #undef X
 
@@ -747,13 +794,69 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
 
 
+SendClass GetSendClass(const std::string& strCommand)
+{
+    if (strCommand == NetMsgType::BLOCK || strCommand == NetMsgType::MERKLEBLOCK)
+        return SEND_CLASS_BLOCK;
+    if (strCommand == NetMsgType::TX)
+        return SEND_CLASS_TX;
+    if (strCommand == NetMsgType::ADDR)
+        return SEND_CLASS_ADDR;
+    if (strCommand == NetMsgType::INV || strCommand == NetMsgType::NOTFOUND)
+        return SEND_CLASS_INV;
+    return SEND_CLASS_CONTROL;
+}
+
+const char* GetSendClassName(SendClass sendClass)
+{
+    switch (sendClass) {
+    case SEND_CLASS_CONTROL: return "control";
+    case SEND_CLASS_BLOCK: return "block";
+    case SEND_CLASS_TX: return "tx";
+    case SEND_CLASS_ADDR: return "addr";
+    case SEND_CLASS_INV: return "inv";
+    default: return "unknown";
+    }
+}
+
+// requires LOCK(cs_vSend)
+bool CNode::ReleaseSendData(int64_t nNowMicros)
+{
+    if (!vSendControl.empty()) { // Ϣ
+        vSendMsg.push_back(CSerializeData());
+        vSendMsg.back().swap(vSendControl.front());
+        vSendControl.pop_front();
+        nSendBytesPerClass[SEND_CLASS_CONTROL] += vSendMsg.back().size();
+        return true;
+    }
+    if (vSendData.empty())
+        return false;
+
+    SendClass sendClass = vSendData.front().first;
+    if (!fWhitelisted && !sendBucket[sendClass].CanSend(nNowMicros)) { // Ʋ㣬ݻ
+        if (nThrottledSince == 0)
+            nThrottledSince = nNowMicros;
+        return false;
+    }
+    if (nThrottledSince != 0) {
+        nThrottledTime += nNowMicros - nThrottledSince;
+        nThrottledSince = 0;
+    }
+    vSendMsg.push_back(CSerializeData());
+    vSendMsg.back().swap(vSendData.front().second);
+    vSendData.pop_front();
+    sendBucket[sendClass].Consume(vSendMsg.back().size());
+    nSendBytesPerClass[sendClass] += vSendMsg.back().size();
+    return true;
+}
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode) // ͨ׽ַϢ
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    int64_t nNow = GetTimeMicros();
 
-    while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
+    while (!pnode->vSendMsg.empty() || pnode->ReleaseSendData(nNow)) { // ȼͰȡϢ
+        const CSerializeData &data = pnode->vSendMsg.front();
         assert(data.size() > pnode->nSendOffset);
         int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT); // Ϥ send 
         if (nBytes > 0) {
@@ -764,7 +867,7 @@ void SocketSendData(CNode *pnode) // ͨ
             if (pnode->nSendOffset == data.size()) { // ƫڷһϢĴС
                 pnode->nSendOffset = 0; // ƫ 0
                 pnode->nSendSize -= data.size(); // 㷢ϢʣҪ͵ݴС
-                it++;
+                pnode->vSendMsg.pop_front();
             } else { // δϢֹͣ͸
                 // could not send full message; stop sending more
                 break;
@@ -784,11 +887,11 @@ void SocketSendData(CNode *pnode) // ͨ
         }
     }
 
-    if (it == pnode->vSendMsg.end()) { // ֤ͳɹǷȫ
+    if (pnode->vSendMsg.empty()) { // ֤ͳɹǷȫ
         assert(pnode->nSendOffset == 0);
-        assert(pnode->nSendSize == 0);
+        if (pnode->vSendControl.empty() && pnode->vSendData.empty())
+            assert(pnode->nSendSize == 0);
     }
-    pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it); // շϢ
 }
 
 static list<CNode*> vNodesDisconnected;
@@ -1017,6 +1120,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode); // ӽڵб
+        PublishNodeSnapshot();
     }
 }
 
@@ -1032,6 +1136,7 @@ void ThreadSocketHandler()
             LOCK(cs_vNodes);
             // Disconnect unused nodes
             vector<CNode*> vNodesCopy = vNodes;
+            bool fRemoved = false;
             BOOST_FOREACH(CNode* pnode, vNodesCopy)
             {
                 if (pnode->fDisconnect ||
@@ -1050,16 +1155,22 @@ void ThreadSocketHandler()
                     if (pnode->fNetworkNode || pnode->fInbound)
                         pnode->Release(); // LRUCache ü 1
                     vNodesDisconnected.push_back(pnode); // Ͽӽڵб
+                    fRemoved = true;
                 }
             }
+            if (fRemoved)
+                PublishNodeSnapshot(); // ѶϿڵ¿
         }
         {
             // Delete disconnected nodes
             list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
             BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy) // Ͽӽڵб
             {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) // ǰڵüСڵ 0
+                // wait until threads are done using it, including readers of older snapshots
+                // Pairs with the release in ReleaseNodeSnapshot, so the last
+                // reader is done with the node before it is deleted
+                bool fUnused = pnode->GetRefCount() <= 0 && pnode->nSnapshotRefCount.load(boost::memory_order_acquire) == 0;
+                if (fUnused) // ǰڵüСڵ 0 Ҳκο
                 {
                     bool fDelete = false;
                     {
@@ -1110,9 +1221,9 @@ void ThreadSocketHandler()
             have_fds = true;
         }
 
+        NodeSnapshot vNodesCopy = GetNodeSnapshot(); // ȡڵбգ cs_vNodes
         {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
+            BOOST_FOREACH(CNode* pnode, *vNodesCopy)
             {
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
@@ -1184,14 +1295,7 @@ void ThreadSocketHandler()
         //
         // Service each socket // 4.ÿ׽֣աͺδ飩
         //
-        vector<CNode*> vNodesCopy;
-        {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes; // һ
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->AddRef(); // ͬʱӶӦü
-        }
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        BOOST_FOREACH(CNode* pnode, *vNodesCopy)
         {
             boost::this_thread::interruption_point();
 
@@ -1250,6 +1354,13 @@ void ThreadSocketHandler()
                 if (lockSend)
                     SocketSendData(pnode); // ͨ׽ַ
             }
+            else
+            {
+                // Data held back by a token bucket is not select()ed for; retry it every loop
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (lockSend && pnode->IsSendThrottled())
+                    SocketSendData(pnode); // Ͱָ
+            }
 
             //
             // Inactivity checking // 4.3.飨ʱûݽͶϿ
@@ -1279,11 +1390,6 @@ void ThreadSocketHandler()
                 }
             }
         }
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodesCopy) // ͷӽڵбĿ
-                pnode->Release();
-        }
     }
 }
 
@@ -1716,18 +1822,11 @@ void ThreadMessageHandler() // 
     SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
     while (true) // ѭղϢȻϢ
     {
-        vector<CNode*> vNodesCopy; // ѽӵĽڵб
-        {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes; // ѽӵĽڵб
-            BOOST_FOREACH(CNode* pnode, vNodesCopy) { // ø
-                pnode->AddRef(); // ʹÿڵü 1
-            }
-        }
+        NodeSnapshot vNodesCopy = GetNodeSnapshot(); // ѽӵĽڵб
 
         bool fSleep = true; // Ƿ˯Ĭ˯
 
-        BOOST_FOREACH(CNode* pnode, vNodesCopy) // ڵб
+        BOOST_FOREACH(CNode* pnode, *vNodesCopy) // ڵб
         {
             if (pnode->fDisconnect) // ״̬
                 continue;
@@ -1759,12 +1858,7 @@ void ThreadMessageHandler() // 
             }
             boost::this_thread::interruption_point(); // ٴϵ
         }
-
-        {
-            LOCK(cs_vNodes); // ڵб
-            BOOST_FOREACH(CNode* pnode, vNodesCopy) // ڵб
-                pnode->Release(); // ü 1
-        }
+        vNodesCopy.reset(); // ͷſգ˯ڼƳѶϿڵɾ
 
         if (fSleep) // ǰ˯״̬δݣ
             messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100)); // ˯ 100ms
@@ -2023,7 +2117,13 @@ public:
                     LogPrintf("CloseSocket(hListenSocket) failed with error %s\n", NetworkErrorString(WSAGetLastError()));
 
         // clean up some globals (to help leak detection)
-        BOOST_FOREACH(CNode *pnode, vNodes)
+        std::vector<CNode*> vNodesCopy;
+        {
+            LOCK(cs_vNodes);
+            vNodesCopy.swap(vNodes);
+            PublishNodeSnapshot(); // drop the snapshot's references before deleting the nodes
+        }
+        BOOST_FOREACH(CNode *pnode, vNodesCopy)
             delete pnode;
         BOOST_FOREACH(CNode *pnode, vNodesDisconnected)
             delete pnode;
@@ -2049,32 +2149,116 @@ instance_of_cnetcleanup;
 
 
 
-void RelayTransaction(const CTransaction& tx)
+CRelayCache::CRelayCache(size_t nMaxUsageIn) : nMaxUsage(nMaxUsageIn), nUsage(0)
 {
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss.reserve(10000); // Ԥ 10000 ֽ
-    ss << tx; // 뽻
-    RelayTransaction(tx, ss); // ʼм
+    CRelayCacheHasher hasher;
+    hasher.salt = GetRandHash();
+    mapRelay = relaymap(0, hasher);
 }
 
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
+size_t CRelayCache::EntryUsage(const CDataStream& ss) const
 {
-    CInv inv(MSG_TX, tx.GetHash()); // ݽ׹ϣ inv 
-    {
-        LOCK(cs_mapRelay); // мӳб
-        // Expire old relay messages // ʹɵмݹ
-        while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime())
-        { // м̵ڶзǿ  м̹ڶжͷԪعʱСڵǰʱ䣨ʾѹڣ
-            mapRelay.erase(vRelayExpiration.front().second); // мӳбвм̹ڶеĶͷ
-            vRelayExpiration.pop_front(); // м̹ڶг
-        }
+    // Map node, the bucket slot holding the hash, and the serialized bytes
+    return memusage::MallocUsage(sizeof(relaymap::value_type) + 2 * sizeof(void*)) + sizeof(uint256) + memusage::MallocUsage(ss.size());
+}
 
-        // Save original serialized message so newer versions are preserved // ԭʼлϢԱ㱣°汾
-        mapRelay.insert(std::make_pair(inv, ss)); // Ѹýײмӳб
-        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv)); //  15min Ĺʱ䣬ڶ
+void CRelayCache::EvictOldest()
+{
+    while (!vBuckets.empty() && vBuckets.front().vHashes.empty())
+        vBuckets.pop_front();
+    if (vBuckets.empty())
+        return;
+    CRelayBucket& bucket = vBuckets.front();
+    relaymap::iterator it = mapRelay.find(bucket.vHashes.front());
+    if (it != mapRelay.end()) {
+        nUsage -= EntryUsage(it->second);
+        mapRelay.erase(it);
     }
-    LOCK(cs_vNodes); // ѽӵĽڵб
-    BOOST_FOREACH(CNode* pnode, vNodes) // ǰѽӵĽڵб
+    bucket.vHashes.pop_front();
+    if (bucket.vHashes.empty())
+        vBuckets.pop_front();
+}
+
+void CRelayCache::SetMaxUsage(size_t nMaxUsageIn)
+{
+    LOCK(cs);
+    nMaxUsage = nMaxUsageIn;
+    while (TotalUsage() > nMaxUsage && !mapRelay.empty())
+        EvictOldest();
+}
+
+void CRelayCache::Insert(const CTransaction& tx)
+{
+    const uint256& hash = tx.GetHash();
+    int64_t nNow = GetTime();
+    LOCK(cs);
+    if (nMaxUsage == 0 || mapRelay.count(hash))
+        return;
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(tx.GetTotalSize()); // ʵʴС٣ٶռڴ
+    ss << tx;
+
+    if (vBuckets.empty() || vBuckets.back().nTimeStart + BUCKET_INTERVAL <= nNow)
+        vBuckets.push_back(CRelayBucket(nNow)); // µʱͰ
+    vBuckets.back().vHashes.push_back(hash);
+    nUsage += EntryUsage(ss);
+    mapRelay.insert(std::make_pair(hash, ss));
+
+    // Bounded by memory, not by age: drop the oldest entries until we fit
+    while (TotalUsage() > nMaxUsage && !mapRelay.empty())
+        EvictOldest();
+}
+
+bool CRelayCache::Lookup(const uint256& hash, CDataStream& ssRet) const
+{
+    LOCK(cs);
+    relaymap::const_iterator it = mapRelay.find(hash);
+    if (it == mapRelay.end())
+        return false;
+    ssRet = it->second;
+    return true;
+}
+
+bool CRelayCache::Exists(const uint256& hash) const
+{
+    LOCK(cs);
+    return mapRelay.count(hash) != 0;
+}
+
+void CRelayCache::Clear()
+{
+    LOCK(cs);
+    mapRelay.clear();
+    vBuckets.clear();
+    nUsage = 0;
+}
+
+size_t CRelayCache::size() const
+{
+    LOCK(cs);
+    return mapRelay.size();
+}
+
+size_t CRelayCache::TotalUsage() const
+{
+    return nUsage + memusage::MallocUsage(sizeof(void*) * mapRelay.bucket_count());
+}
+
+size_t CRelayCache::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return TotalUsage();
+}
+
+void RelayTransaction(const CTransaction& tx)
+{
+    // Peers fetch the transaction from the mempool, or from relayCache once
+    // it has left it; callers relaying something that was never accepted
+    // must put it into relayCache themselves.
+    CInv inv(MSG_TX, tx.GetHash()); // ݽ׹ϣ inv 
+    NodeSnapshot vNodesCopy = GetNodeSnapshot(); // ȡѽӵĽڵб
+    BOOST_FOREACH(CNode* pnode, *vNodesCopy) // ǰѽӵĽڵб
     {
         if(!pnode->fRelayTxes) // м̽״̬Ϊ false
             continue; // ýڵ
@@ -2147,6 +2331,18 @@ uint64_t CNode::GetMaxOutboundTimeLeftInCycle()
     return (cycleEndTime < now) ? 0 : cycleEndTime - GetTime();
 }
 
+void CNode::SetMaxSendRate(SendClass sendClass, uint64_t nBytesPerSecond)
+{
+    assert(sendClass >= 0 && sendClass < SEND_CLASS_MAX);
+    nMaxSendRate[sendClass] = nBytesPerSecond;
+}
+
+uint64_t CNode::GetMaxSendRate(SendClass sendClass)
+{
+    assert(sendClass >= 0 && sendClass < SEND_CLASS_MAX);
+    return nMaxSendRate[sendClass];
+}
+
 void CNode::SetMaxOutboundTimeframe(uint64_t timeframe)
 {
     LOCK(cs_totalBytesSent);
@@ -2365,8 +2561,17 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fSuccessfullyConnected = false;
     fDisconnect = false;
     nRefCount = 0;
+    nSnapshotRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    nSendClass = SEND_CLASS_CONTROL;
+    nThrottledSince = 0;
+    nThrottledTime = 0;
+    int64_t nNow = GetTimeMicros();
+    for (int i = 0; i < SEND_CLASS_MAX; i++) {
+        sendBucket[i].SetRate(nMaxSendRate[i], nNow);
+        nSendBytesPerClass[i] = 0;
+    }
     hashContinue = uint256();
     nStartingHeight = -1;
     filterInventoryKnown.reset();
@@ -2374,6 +2579,8 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nNextLocalAddrSend = 0;
     nNextAddrSend = 0;
     nNextInvSend = 0;
+    nInvTxSent = 0;
+    nInvMsgSent = 0;
     fRelayTxes = false;
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
@@ -2448,6 +2655,7 @@ void CNode::BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSen
     ENTER_CRITICAL_SECTION(cs_vSend);
     assert(ssSend.size() == 0); // Ϊ
     ssSend << CMessageHeader(Params().MessageStart(), pszCommand, 0); // ʼϢͷ
+    nSendClass = GetSendClass(pszCommand);
     LogPrint("net", "sending: %s ", SanitizeString(pszCommand));
 }
 
@@ -2492,13 +2700,20 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it); // Ϣ뷢Ϣ vSendMsg Ϣ
-    nSendSize += (*it).size();
+    CSerializeData* pdata;
+    if (nSendClass == SEND_CLASS_CONTROL) { // Ϣȶ
+        vSendControl.push_back(CSerializeData());
+        pdata = &vSendControl.back();
+    } else { // ϢŶ
+        vSendData.push_back(std::make_pair(nSendClass, CSerializeData()));
+        pdata = &vSendData.back().second;
+    }
+    ssSend.GetAndClear(*pdata); // ϢͶвϢ
+    nSendSize += pdata->size();
 
-    // If write queue empty, attempt "optimistic write" // дΪգԡֹд롱
-    if (it == vSendMsg.begin()) // պָǷϢеĶͷ
-        SocketSendData(this); // Ϣ vSendMsg 
+    // If nothing is being written, attempt "optimistic write" // ǰûдϢԡֹд롱
+    if (vSendMsg.empty())
+        SocketSendData(this); // ʹͶе
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
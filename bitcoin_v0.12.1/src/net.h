@@ -23,13 +23,17 @@
 #include <arpa/inet.h>
 #endif
 
+#include <boost/atomic.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
+#include <boost/unordered_map.hpp>
 
 class CAddrMan;
 class CScheduler;
 class CNode;
+class CTransaction;
 
 namespace boost {
     class thread_group;
@@ -69,6 +73,12 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** Default for -maxrelaycachesize, maximum megabytes of relayed transactions kept after they leave the mempool */
+static const unsigned int DEFAULT_MAX_RELAY_CACHE_SIZE = 5;
+/** Defaults for -maxpeerblockrate, -maxpeertxrate and -maxpeeraddrrate, in kilobytes per second per peer. 0 = Unlimited */
+static const unsigned int DEFAULT_MAX_PEER_BLOCK_RATE = 0;
+static const unsigned int DEFAULT_MAX_PEER_TX_RATE = 0;
+static const unsigned int DEFAULT_MAX_PEER_ADDR_RATE = 0;
 
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h") //  rpcnet:setban İϢ"24h"
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
@@ -91,6 +101,131 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler); // 
 bool StopNode(); // ֹͣ߳
 void SocketSendData(CNode *pnode); // ͨ׽ַ
 
+/** Traffic classes used for per-peer send accounting and throttling */
+enum SendClass
+{
+    SEND_CLASS_CONTROL, // handshake, ping, headers, getdata, ...: never throttled, sent ahead of queued data
+    SEND_CLASS_BLOCK,   // block, merkleblock
+    SEND_CLASS_TX,      // tx
+    SEND_CLASS_ADDR,    // addr
+    SEND_CLASS_INV,     // inv, notfound: not metered, but kept in order with the data around them
+
+    SEND_CLASS_MAX
+};
+
+SendClass GetSendClass(const std::string& strCommand); // ȡϢӦ
+const char* GetSendClassName(SendClass sendClass);
+
+/**
+ * Token bucket refilling at nRate bytes per second and holding at most one
+ * second worth of tokens. A message may start as long as the bucket is not in
+ * debt; its full size is charged when it starts, so messages are never split
+ * and an oversized one simply delays the next. A rate of 0 means unlimited.
+ */
+class CTokenBucket
+{
+private:
+    uint64_t nRate; // bytes per second
+    int64_t nTokens; // in millionths of a byte, may go negative
+    int64_t nLastRefill; // time of the last refill in microseconds
+
+    void Refill(int64_t nNowMicros)
+    {
+        int64_t nElapsed = nNowMicros - nLastRefill;
+        nLastRefill = nNowMicros;
+        if (nElapsed <= 0)
+            return;
+        int64_t nBurst = nRate * 1000000;
+        // Never credit more time than it takes to fill up, so the product cannot overflow
+        nElapsed = std::min(nElapsed, (nBurst - nTokens) / (int64_t)nRate + 1);
+        nTokens = std::min(nBurst, nTokens + nElapsed * (int64_t)nRate);
+    }
+
+public:
+    CTokenBucket() : nRate(0), nTokens(0), nLastRefill(0) {}
+
+    //! Set the rate in bytes per second and start with a full bucket
+    void SetRate(uint64_t nRateIn, int64_t nNowMicros)
+    {
+        nRate = nRateIn;
+        nTokens = nRate * 1000000;
+        nLastRefill = nNowMicros;
+    }
+
+    bool IsLimited() const { return nRate != 0; }
+
+    bool CanSend(int64_t nNowMicros)
+    {
+        if (nRate == 0)
+            return true;
+        Refill(nNowMicros);
+        return nTokens >= 0;
+    }
+
+    void Consume(uint64_t nBytes)
+    {
+        if (nRate != 0)
+            nTokens -= (int64_t)nBytes * 1000000;
+    }
+};
+
+/**
+ * Serialized copies of relayed transactions that are no longer in the mempool
+ * (mined, replaced, expired, evicted, or force-relayed without ever being
+ * accepted), so that peers which saw our inv can still fetch them. Anything
+ * still in the mempool is served from there and is not duplicated here.
+ *
+ * Entries are grouped into buckets by insertion time. The cache is bounded by
+ * memory rather than by age: once the budget is exceeded, the oldest entries
+ * of the oldest bucket are dropped first, and emptied buckets are released.
+ */
+class CRelayCache
+{
+private:
+    /** Width of a time bucket in seconds */
+    static const int64_t BUCKET_INTERVAL = 60;
+
+    struct CRelayCacheHasher
+    {
+        uint256 salt;
+        size_t operator()(const uint256& hash) const { return hash.GetHash(salt); }
+    };
+
+    struct CRelayBucket
+    {
+        int64_t nTimeStart;
+        std::deque<uint256> vHashes;
+
+        CRelayBucket(int64_t nTimeStartIn) : nTimeStart(nTimeStartIn) {}
+    };
+
+    typedef boost::unordered_map<uint256, CDataStream, CRelayCacheHasher> relaymap;
+
+    mutable CCriticalSection cs;
+    relaymap mapRelay;
+    std::deque<CRelayBucket> vBuckets;
+    size_t nMaxUsage;
+    size_t nUsage;
+
+    size_t EntryUsage(const CDataStream& ss) const;
+    size_t TotalUsage() const;
+    void EvictOldest();
+
+public:
+    CRelayCache(size_t nMaxUsageIn = DEFAULT_MAX_RELAY_CACHE_SIZE * 1000000);
+
+    void SetMaxUsage(size_t nMaxUsageIn);
+    /** Keep a serialized copy of tx; no-op if it is already cached. */
+    void Insert(const CTransaction& tx);
+    /** Copy the cached serialization of hash into ssRet. */
+    bool Lookup(const uint256& hash, CDataStream& ssRet) const;
+    bool Exists(const uint256& hash) const;
+    void Clear();
+
+    size_t size() const;
+    size_t DynamicMemoryUsage() const;
+};
+
 typedef int NodeId;
 
 struct CombinerAll
@@ -161,9 +296,18 @@ extern int nMaxConnections; // ͬʱ
 
 extern std::vector<CNode*> vNodes; // ѽӵĽڵб
 extern CCriticalSection cs_vNodes; // ڵб
-extern std::map<CInv, CDataStream> mapRelay; // мӳб
-extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration; // м̹ڶ
-extern CCriticalSection cs_mapRelay; // мӳб
+
+/**
+ * Read-only copy of vNodes, republished whenever a connection is added or
+ * removed. Readers take one with GetNodeSnapshot() and may use every node in
+ * it for as long as they hold it: a disconnected node is only deleted once no
+ * snapshot containing it is alive anymore. Neither taking nor dropping a
+ * snapshot locks cs_vNodes, so readers never wait for connection changes.
+ */
+typedef boost::shared_ptr<const std::vector<CNode*> > NodeSnapshot;
+NodeSnapshot GetNodeSnapshot(); // ȡڵб
+void PublishNodeSnapshot(); // requires cs_vNodes; call after every change to vNodes
+extern CRelayCache relayCache; // 뿪ڴصм̽׻
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
 
 extern std::vector<std::string> vAddedNodes; // ӵĽڵб
@@ -205,6 +349,12 @@ public:
     double dPingWait;
     double dPingMin;
     std::string addrLocal;
+    uint64_t nInvTxQueued;
+    uint64_t nInvTxSent;
+    uint64_t nInvMsgSent;
+    uint64_t nSendQueued;
+    double dThrottledTime;
+    uint64_t mapSendBytesPerClass[SEND_CLASS_MAX];
 };
 
 
@@ -318,10 +468,19 @@ public:
     uint64_t nServices;
     SOCKET hSocket; // ׽
     CDataStream ssSend; // 
-    size_t nSendSize; // total size of all vSendMsg entries
+    size_t nSendSize; // total size of all queued messages (vSendMsg, vSendControl and vSendData)
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSerializeData> vSendMsg; // messages being written to the socket
+    // Messages not yet handed to the socket. Control messages go ahead of data; // δ׽ֵϢϢݣ
+    // data keeps its order and is released subject to the per-class buckets. // ݱ˳ܸͰ
+    std::deque<CSerializeData> vSendControl;
+    std::deque<std::pair<SendClass, CSerializeData> > vSendData;
+    SendClass nSendClass; // class of the message between BeginMessage and EndMessage
+    CTokenBucket sendBucket[SEND_CLASS_MAX];
+    uint64_t nSendBytesPerClass[SEND_CLASS_MAX];
+    int64_t nThrottledSince; // time in microseconds data became blocked on a bucket, 0 if not blocked
+    int64_t nThrottledTime; // total microseconds spent throttled
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData; // ջȡ inv 
@@ -359,6 +518,7 @@ public:
     CCriticalSection cs_filter;
     CBloomFilter* pfilter;
     int nRefCount; // ڵü
+    boost::atomic<int> nSnapshotRefCount; // number of live vNodes snapshots containing this node
     NodeId id; // ӽڵ
 protected:
 
@@ -390,8 +550,15 @@ public:
 
     // inventory based relay // м̵Ŀ
     CRollingBloomFilter filterInventoryKnown; // ³ķ
-    std::vector<CInv> vInventoryToSend; // Ϳб
+    // Set of transaction ids we still have to announce. They are sorted by // ͨĽ׼ϣǰڴ
+    // the mempool before relay, so the order is not important. // ʲ˳޹ؽҪ
+    std::set<uint256> setInventoryTxToSend;
+    // Non-transaction inventory (blocks) we still have to announce.
+    std::vector<CInv> vInventoryToSend; // ͵ķǽ׿б
     CCriticalSection cs_inventory;
+    // Announcement counters, reported by getpeerinfo. Protected by cs_inventory.
+    uint64_t nInvTxSent; // ͨĽ
+    uint64_t nInvMsgSent; // ѷ͵ inv Ϣ
     std::set<uint256> setAskFor; // б
     std::multimap<int64_t, CInv> mapAskFor; // ӳб <ʱ䣬Ŀ>
     int64_t nNextInvSend;
@@ -427,6 +594,9 @@ private:
     static uint64_t nMaxOutboundLimit;
     static uint64_t nMaxOutboundTimeframe;
 
+    // per-peer send rate for each traffic class, in bytes per second
+    static uint64_t nMaxSendRate[SEND_CLASS_MAX];
+
     CNode(const CNode&);
     void operator=(const CNode&);
 
@@ -507,9 +677,12 @@ public:
     {
         {
             LOCK(cs_inventory); // 
-            if (inv.type == MSG_TX && filterInventoryKnown.contains(inv.hash)) // Ϊ  ³ķ˸ý inv Ĺϣ
-                return; // ɶҲֱӷ
-            vInventoryToSend.push_back(inv); // 뷢Ϳб
+            // Transactions are checked against filterInventoryKnown once per // ÿʱ֪
+            // trickle in SendMessages rather than once per push here. // ÿͶ
+            if (inv.type == MSG_TX)
+                setInventoryTxToSend.insert(inv.hash); // ͨ潻׼ϣԶȥأ
+            else
+                vInventoryToSend.push_back(inv); // 뷢Ϳб
         }
     }
 
@@ -530,6 +703,14 @@ public:
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void EndMessage() UNLOCK_FUNCTION(cs_vSend);
 
+    // Move the next queued message into vSendMsg, if its class bucket allows. Requires cs_vSend.
+    bool ReleaseSendData(int64_t nNowMicros); // ͷһϢ
+    // True if data is waiting only on a token bucket. Requires cs_vSend.
+    bool IsSendThrottled() const
+    {
+        return vSendMsg.empty() && vSendControl.empty() && !vSendData.empty();
+    }
+
     void PushVersion(); // Ͱ汾
 
 
@@ -744,6 +925,10 @@ public:
     static void SetMaxOutboundTimeframe(uint64_t timeframe);
     static uint64_t GetMaxOutboundTimeframe();
 
+    //!set the per-peer send rate of a traffic class in bytes per second, 0 = unlimited (applies to new connections)
+    static void SetMaxSendRate(SendClass sendClass, uint64_t nBytesPerSecond);
+    static uint64_t GetMaxSendRate(SendClass sendClass);
+
     //!check if the outbound target is reached
     // if param historicalBlockServingLimit is set true, the function will
     // response true if the limit for serving historical blocks has been reached
@@ -761,8 +946,7 @@ public:
 
 
 class CTransaction;
-void RelayTransaction(const CTransaction& tx); // תغ
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss); // м̽
+void RelayTransaction(const CTransaction& tx); // м̽
 
 /** Access to the (IP) address database (peers.dat) */
 class CAddrDB // IP ַݿ⣨ڱ peers.dat м¼ IP
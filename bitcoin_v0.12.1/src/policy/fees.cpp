@@ -7,47 +7,76 @@
 #include "policy/policy.h"
 
 #include "amount.h"
+#include "clientversion.h"
 #include "primitives/transaction.h"
+#include "random.h"
 #include "streams.h"
 #include "txmempool.h"
 #include "util.h"
 
-void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
+#include <algorithm>
+
+// Record types in files written by CBlockPolicyEstimator::SetRecordFile
+static const unsigned char RECORD_TX = 't';
+static const unsigned char RECORD_REMOVE = 'r';
+static const unsigned char RECORD_BLOCK = 'b';
+
+std::string StringForFeeEstimateHorizon(FeeEstimateHorizon horizon)
+{
+    switch (horizon) {
+    case SHORT_HALFLIFE: return "short";
+    case MED_HALFLIFE: return "medium";
+    case LONG_HALFLIFE: return "long";
+    }
+    return "";
+}
+
+FeeEstimatorTx::FeeEstimatorTx(const CTxMemPoolEntry& entry, unsigned int nPriorityHeight)
+    : hash(entry.GetTx().GetHash()), nHeight(entry.GetHeight()), nFee(entry.GetFee()),
+      nTxSize(entry.GetTxSize()), dPriority(entry.GetPriority(nPriorityHeight)),
+      fClearAtEntry(entry.WasClearAtEntry())
+{
+}
+
+void TxConfirmStats::Initialize(const std::vector<double>& defaultBuckets,
                                 unsigned int maxConfirms, double _decay, std::string _dataTypeString)
 {
     decay = _decay;
     dataTypeString = _dataTypeString;
-    for (unsigned int i = 0; i < defaultBuckets.size(); i++) {
-        buckets.push_back(defaultBuckets[i]);
-        bucketMap[defaultBuckets[i]] = i;
-    }
-    confAvg.resize(maxConfirms);
-    curBlockConf.resize(maxConfirms);
-    unconfTxs.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        confAvg[i].resize(buckets.size());
-        curBlockConf[i].resize(buckets.size());
-        unconfTxs[i].resize(buckets.size());
-    }
+    buckets = defaultBuckets;
+    confAvg.assign(maxConfirms, std::vector<double>(buckets.size()));
+    curBlockConf.assign(maxConfirms, std::vector<int>(buckets.size()));
+    unconfTxs.assign(maxConfirms, std::vector<int>(buckets.size()));
+
+    oldUnconfTxs.assign(buckets.size(), 0);
+    curBlockTxCt.assign(buckets.size(), 0);
+    txCtAvg.assign(buckets.size(), 0);
+    curBlockVal.assign(buckets.size(), 0);
+    avg.assign(buckets.size(), 0);
+    fUnconfSumsValid = false;
+}
 
-    oldUnconfTxs.resize(buckets.size());
-    curBlockTxCt.resize(buckets.size());
-    txCtAvg.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
-    avg.resize(buckets.size());
+unsigned int TxConfirmStats::FindBucket(double val) const
+{
+    // The first bucket whose upper bound is at least val. The last bound is
+    // infinite, so everything fits somewhere.
+    unsigned int bucketindex = std::lower_bound(buckets.begin(), buckets.end(), val) - buckets.begin();
+    return std::min(bucketindex, (unsigned int)buckets.size() - 1);
 }
 
 // Zero out the data for the current block
 void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
 {
+    std::vector<int>& unconfBlock = unconfTxs[nBlockHeight % unconfTxs.size()];
     for (unsigned int j = 0; j < buckets.size(); j++) {
-        oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
-        unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
-        for (unsigned int i = 0; i < curBlockConf.size(); i++)
-            curBlockConf[i][j] = 0;
+        oldUnconfTxs[j] += unconfBlock[j];
+        unconfBlock[j] = 0;
         curBlockTxCt[j] = 0;
         curBlockVal[j] = 0;
     }
+    for (unsigned int i = 0; i < curBlockConf.size(); i++)
+        std::fill(curBlockConf[i].begin(), curBlockConf[i].end(), 0);
+    fUnconfSumsValid = false;
 }
 
 
@@ -56,10 +85,9 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     // blocksToConfirm is 1-based
     if (blocksToConfirm < 1)
         return;
-    unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    for (size_t i = blocksToConfirm; i <= curBlockConf.size(); i++) {
-        curBlockConf[i - 1][bucketindex]++;
-    }
+    unsigned int bucketindex = FindBucket(val);
+    if ((unsigned int)blocksToConfirm <= curBlockConf.size())
+        curBlockConf[blocksToConfirm - 1][bucketindex]++;
     curBlockTxCt[bucketindex]++;
     curBlockVal[bucketindex] += val;
 }
@@ -67,13 +95,38 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
 void TxConfirmStats::UpdateMovingAverages()
 {
     for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
+        // A tx confirmed in exactly Y blocks was confirmed within Y or more
+        int nConfirmed = 0;
+        for (unsigned int i = 0; i < confAvg.size(); i++) {
+            nConfirmed += curBlockConf[i][j];
+            confAvg[i][j] = confAvg[i][j] * decay + nConfirmed;
+        }
         avg[j] = avg[j] * decay + curBlockVal[j];
         txCtAvg[j] = txCtAvg[j] * decay + curBlockTxCt[j];
     }
 }
 
+void TxConfirmStats::UpdateUnconfSums(unsigned int nBlockHeight)
+{
+    if (fUnconfSumsValid && nUnconfSumsHeight == nBlockHeight)
+        return;
+    unsigned int bins = unconfTxs.size();
+    unconfSums.resize(bins);
+    for (unsigned int i = 0; i < bins; i++)
+        unconfSums[i].resize(buckets.size());
+    for (unsigned int j = 0; j < buckets.size(); j++) {
+        // Txs unconfirmed for confTarget blocks or more, going from the oldest
+        int nSum = oldUnconfTxs[j];
+        unconfSums[bins - 1][j] = nSum;
+        for (unsigned int confct = bins - 1; confct >= 1; confct--) {
+            nSum += unconfTxs[(nBlockHeight - confct) % bins][j];
+            unconfSums[confct - 1][j] = nSum;
+        }
+    }
+    nUnconfSumsHeight = nBlockHeight;
+    fUnconfSumsValid = true;
+}
+
 // returns -1 on error conditions
 double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
                                          double successBreakPoint, bool requireGreater,
@@ -104,16 +157,15 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int bestFarBucket = startbucket;
 
     bool foundAnswer = false;
-    unsigned int bins = unconfTxs.size();
+    UpdateUnconfSums(nBlockHeight);
+    const std::vector<int>& unconfSince = unconfSums[confTarget - 1];
 
     // Start counting from highest(default) or lowest fee/pri transactions
     for (int bucket = startbucket; bucket >= 0 && bucket <= maxbucketindex; bucket += step) {
         curFarBucket = bucket;
         nConf += confAvg[confTarget - 1][bucket];
         totalNum += txCtAvg[bucket];
-        for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
-            extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
-        extraNum += oldUnconfTxs[bucket];
+        extraNum += unconfSince[bucket];
         // If we have enough transaction data points in this range of buckets,
         // we can test for success
         // (Only count the confirmed data points, so that each confirmation count
@@ -221,7 +273,6 @@ void TxConfirmStats::Read(CAutoFile& filein)
     avg = fileAvg;
     confAvg = fileConfAvg;
     txCtAvg = fileTxCtAvg;
-    bucketMap.clear();
 
     // Resize the current block variables which aren't stored in the data file
     // to match the number of confirms and buckets
@@ -237,9 +288,7 @@ void TxConfirmStats::Read(CAutoFile& filein)
         unconfTxs[i].resize(buckets.size());
     }
     oldUnconfTxs.resize(buckets.size());
-
-    for (unsigned int i = 0; i < buckets.size(); i++)
-        bucketMap[buckets[i]] = i;
+    fUnconfSumsValid = false;
 
     LogPrint("estimatefee", "Reading estimates: %u %s buckets counting confirms up to %u blocks\n",
              numBuckets, dataTypeString, maxConfirms);
@@ -247,9 +296,10 @@ void TxConfirmStats::Read(CAutoFile& filein)
 
 unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
 {
-    unsigned int bucketindex = bucketMap.lower_bound(val)->second;
+    unsigned int bucketindex = FindBucket(val);
     unsigned int blockIndex = nBlockHeight % unconfTxs.size();
     unconfTxs[blockIndex][bucketindex]++;
+    fUnconfSumsValid = false;
     LogPrint("estimatefee", "adding to %s", dataTypeString);
     return bucketindex;
 }
@@ -265,6 +315,7 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
         return;  //This can't happen because we call this with our best seen height, no entries can have higher
     }
 
+    fUnconfSumsValid = false;
     if (blocksAgo >= (int)unconfTxs.size()) {
         if (oldUnconfTxs[bucketindex] > 0)
             oldUnconfTxs[bucketindex]--;
@@ -284,7 +335,14 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
 
 void CBlockPolicyEstimator::removeTx(uint256 hash)
 {
-    std::map<uint256, TxStatsInfo>::iterator pos = mapMemPoolTxs.find(hash);
+    if (pfileRecord) {
+        try {
+            *pfileRecord << RECORD_REMOVE << hash;
+        } catch (const std::exception& e) {
+            StopRecording(e);
+        }
+    }
+    boost::unordered_map<uint256, TxStatsInfo, TxidHasher>::iterator pos = mapMemPoolTxs.find(hash);
     if (pos == mapMemPoolTxs.end()) {
         LogPrint("estimatefee", "Blockpolicy error mempool tx %s not found for removeTx\n",
                  hash.ToString().c_str());
@@ -296,11 +354,17 @@ void CBlockPolicyEstimator::removeTx(uint256 hash)
 
     if (stats != NULL)
         stats->removeTx(entryHeight, nBestSeenHeight, bucketIndex);
-    mapMemPoolTxs.erase(hash);
+    if (stats == &feeStats) {
+        shortStats.removeTx(entryHeight, nBestSeenHeight, bucketIndex);
+        longStats.removeTx(entryHeight, nBestSeenHeight, bucketIndex);
+    }
+    mapMemPoolTxs.erase(pos);
 }
 
+CBlockPolicyEstimator::TxidHasher::TxidHasher() : salt(GetRandHash()) {}
+
 CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
-    : nBestSeenHeight(0)
+    : nBestSeenHeight(0), pfileRecord(NULL)
 {
     minTrackedFee = _minRelayFee < CFeeRate(MIN_FEERATE) ? CFeeRate(MIN_FEERATE) : _minRelayFee;
     std::vector<double> vfeelist;
@@ -309,6 +373,8 @@ CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
     }
     vfeelist.push_back(INF_FEERATE);
     feeStats.Initialize(vfeelist, MAX_BLOCK_CONFIRMS, DEFAULT_DECAY, "FeeRate");
+    shortStats.Initialize(vfeelist, SHORT_BLOCK_CONFIRMS, SHORT_DECAY, "FeeRate");
+    longStats.Initialize(vfeelist, LONG_BLOCK_CONFIRMS, LONG_DECAY, "FeeRate");
 
     minTrackedPriority = AllowFreeThreshold() < MIN_PRIORITY ? MIN_PRIORITY : AllowFreeThreshold();
     std::vector<double> vprilist;
@@ -324,6 +390,50 @@ CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
     priLikely = INF_PRIORITY;
 }
 
+CBlockPolicyEstimator::~CBlockPolicyEstimator()
+{
+    delete pfileRecord;
+}
+
+void CBlockPolicyEstimator::SetRecordFile(FILE* pfile)
+{
+    delete pfileRecord;
+    pfileRecord = pfile ? new CAutoFile(pfile, SER_DISK, CLIENT_VERSION) : NULL;
+}
+
+void CBlockPolicyEstimator::StopRecording(const std::exception& e)
+{
+    LogPrintf("CBlockPolicyEstimator: stopped recording after a write error: %s\n", e.what());
+    SetRecordFile(NULL);
+}
+
+TxConfirmStats& CBlockPolicyEstimator::GetFeeStats(FeeEstimateHorizon horizon)
+{
+    switch (horizon) {
+    case SHORT_HALFLIFE: return shortStats;
+    case LONG_HALFLIFE: return longStats;
+    default: return feeStats;
+    }
+}
+
+unsigned int CBlockPolicyEstimator::HighestTargetTracked(FeeEstimateHorizon horizon) const
+{
+    switch (horizon) {
+    case SHORT_HALFLIFE: return shortStats.GetMaxConfirms();
+    case LONG_HALFLIFE: return longStats.GetMaxConfirms();
+    default: return feeStats.GetMaxConfirms();
+    }
+}
+
+double CBlockPolicyEstimator::HorizonDecay(FeeEstimateHorizon horizon) const
+{
+    switch (horizon) {
+    case SHORT_HALFLIFE: return shortStats.GetDecay();
+    case LONG_HALFLIFE: return longStats.GetDecay();
+    default: return feeStats.GetDecay();
+    }
+}
+
 bool CBlockPolicyEstimator::isFeeDataPoint(const CFeeRate &fee, double pri)
 {
     if ((pri < minTrackedPriority && fee >= minTrackedFee) ||
@@ -344,8 +454,20 @@ bool CBlockPolicyEstimator::isPriDataPoint(const CFeeRate &fee, double pri)
 
 void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, bool fCurrentEstimate)
 {
-    unsigned int txHeight = entry.GetHeight();
-    uint256 hash = entry.GetTx().GetHash();
+    processTransaction(FeeEstimatorTx(entry, entry.GetHeight()), fCurrentEstimate);
+}
+
+void CBlockPolicyEstimator::processTransaction(const FeeEstimatorTx& tx, bool fCurrentEstimate)
+{
+    if (pfileRecord) {
+        try {
+            *pfileRecord << RECORD_TX << tx << fCurrentEstimate;
+        } catch (const std::exception& e) {
+            StopRecording(e);
+        }
+    }
+    unsigned int txHeight = tx.nHeight;
+    const uint256& hash = tx.hash;
     if (mapMemPoolTxs[hash].stats != NULL) {
         LogPrint("estimatefee", "Blockpolicy error mempool tx %s already being tracked\n",
                  hash.ToString().c_str());
@@ -363,7 +485,7 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
     if (!fCurrentEstimate)
         return;
 
-    if (!entry.WasClearAtEntry()) {
+    if (!tx.fClearAtEntry) {
         // This transaction depends on other transactions in the mempool to
         // be included in a block before it will be able to be included, so
         // we shouldn't include it in our calculations
@@ -371,24 +493,27 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
     }
 
     // Fees are stored and reported as BTC-per-kb:
-    CFeeRate feeRate(entry.GetFee(), entry.GetTxSize());
+    CFeeRate feeRate(tx.nFee, tx.nTxSize);
 
     // Want the priority of the tx at confirmation. However we don't know
     // what that will be and its too hard to continue updating it
     // so use starting priority as a proxy
-    double curPri = entry.GetPriority(txHeight);
-    mapMemPoolTxs[hash].blockHeight = txHeight;
+    double curPri = tx.dPriority;
+    TxStatsInfo& info = mapMemPoolTxs[hash];
+    info.blockHeight = txHeight;
 
     LogPrint("estimatefee", "Blockpolicy mempool tx %s ", hash.ToString().substr(0,10));
     // Record this as a priority estimate
-    if (entry.GetFee() == 0 || isPriDataPoint(feeRate, curPri)) {
-        mapMemPoolTxs[hash].stats = &priStats;
-        mapMemPoolTxs[hash].bucketIndex =  priStats.NewTx(txHeight, curPri);
+    if (tx.nFee == 0 || isPriDataPoint(feeRate, curPri)) {
+        info.stats = &priStats;
+        info.bucketIndex =  priStats.NewTx(txHeight, curPri);
     }
-    // Record this as a fee estimate
+    // Record this as a fee estimate, in every horizon
     else if (isFeeDataPoint(feeRate, curPri)) {
-        mapMemPoolTxs[hash].stats = &feeStats;
-        mapMemPoolTxs[hash].bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
+        info.stats = &feeStats;
+        info.bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
+        shortStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
+        longStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
     }
     else {
         LogPrint("estimatefee", "not adding");
@@ -396,9 +521,9 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
     LogPrint("estimatefee", "\n");
 }
 
-void CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry& entry)
+void CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const FeeEstimatorTx& tx)
 {
-    if (!entry.WasClearAtEntry()) {
+    if (!tx.fClearAtEntry) {
         // This transaction depended on other transactions in the mempool to
         // be included in a block before it was able to be included, so
         // we shouldn't include it in our calculations
@@ -408,7 +533,7 @@ void CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxM
     // How many blocks did it take for miners to include this transaction?
     // blocksToConfirm is 1-based, so a transaction included in the earliest
     // possible block has confirmation count of 1
-    int blocksToConfirm = nBlockHeight - entry.GetHeight();
+    int blocksToConfirm = nBlockHeight - tx.nHeight;
     if (blocksToConfirm <= 0) {
         // This can't happen because we don't process transactions from a block with a height
         // lower than our greatest seen height
@@ -417,25 +542,46 @@ void CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxM
     }
 
     // Fees are stored and reported as BTC-per-kb:
-    CFeeRate feeRate(entry.GetFee(), entry.GetTxSize());
+    CFeeRate feeRate(tx.nFee, tx.nTxSize);
 
     // Want the priority of the tx at confirmation.  The priority when it
     // entered the mempool could easily be very small and change quickly
-    double curPri = entry.GetPriority(nBlockHeight);
+    double curPri = tx.dPriority;
 
     // Record this as a priority estimate
-    if (entry.GetFee() == 0 || isPriDataPoint(feeRate, curPri)) {
+    if (tx.nFee == 0 || isPriDataPoint(feeRate, curPri)) {
         priStats.Record(blocksToConfirm, curPri);
     }
     // Record this as a fee estimate
     else if (isFeeDataPoint(feeRate, curPri)) {
         feeStats.Record(blocksToConfirm, (double)feeRate.GetFeePerK());
+        shortStats.Record(blocksToConfirm, (double)feeRate.GetFeePerK());
+        longStats.Record(blocksToConfirm, (double)feeRate.GetFeePerK());
     }
 }
 
 void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
-                                         std::vector<CTxMemPoolEntry>& entries, bool fCurrentEstimate)
+                                         const std::vector<const CTxMemPoolEntry*>& entries, bool fCurrentEstimate)
+{
+    // Confirmed txs are judged by their priority at the block's height
+    std::vector<FeeEstimatorTx> vConfirmed;
+    vConfirmed.reserve(entries.size());
+    for (unsigned int i = 0; i < entries.size(); i++)
+        vConfirmed.push_back(FeeEstimatorTx(*entries[i], nBlockHeight));
+    processBlock(nBlockHeight, vConfirmed, fCurrentEstimate);
+}
+
+void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
+                                         const std::vector<FeeEstimatorTx>& vConfirmed, bool fCurrentEstimate)
 {
+    if (pfileRecord) {
+        try {
+            *pfileRecord << RECORD_BLOCK << nBlockHeight << fCurrentEstimate << vConfirmed;
+            fflush(pfileRecord->Get());
+        } catch (const std::exception& e) {
+            StopRecording(e);
+        }
+    }
     if (nBlockHeight <= nBestSeenHeight) {
         // Ignore side chains and re-orgs; assuming they are random
         // they don't affect the estimate.
@@ -477,18 +623,22 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
 
     // Clear the current block states
     feeStats.ClearCurrent(nBlockHeight);
+    shortStats.ClearCurrent(nBlockHeight);
+    longStats.ClearCurrent(nBlockHeight);
     priStats.ClearCurrent(nBlockHeight);
 
     // Repopulate the current block states
-    for (unsigned int i = 0; i < entries.size(); i++)
-        processBlockTx(nBlockHeight, entries[i]);
+    for (unsigned int i = 0; i < vConfirmed.size(); i++)
+        processBlockTx(nBlockHeight, vConfirmed[i]);
 
     // Update all exponential averages with the current block states
     feeStats.UpdateMovingAverages();
+    shortStats.UpdateMovingAverages();
+    longStats.UpdateMovingAverages();
     priStats.UpdateMovingAverages();
 
     LogPrint("estimatefee", "Blockpolicy after updating estimates for %u confirmed entries, new mempool map size %u\n",
-             entries.size(), mapMemPoolTxs.size());
+             vConfirmed.size(), mapMemPoolTxs.size());
 }
 
 CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
@@ -505,6 +655,23 @@ CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
     return CFeeRate(median);
 }
 
+CFeeRate CBlockPolicyEstimator::estimateRawFee(int confTarget, double successThreshold, FeeEstimateHorizon horizon)
+{
+    TxConfirmStats& stats = GetFeeStats(horizon);
+    // Return failure if trying to analyze a target we're not tracking
+    if (confTarget <= 0 || (unsigned int)confTarget > stats.GetMaxConfirms())
+        return CFeeRate(0);
+    if (successThreshold <= 0 || successThreshold > 1)
+        return CFeeRate(0);
+
+    double median = stats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, successThreshold, true, nBestSeenHeight);
+
+    if (median < 0)
+        return CFeeRate(0);
+
+    return CFeeRate(median);
+}
+
 CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool)
 {
     if (answerFoundAtTarget)
@@ -570,6 +737,8 @@ void CBlockPolicyEstimator::Write(CAutoFile& fileout)
     fileout << nBestSeenHeight;
     feeStats.Write(fileout);
     priStats.Write(fileout);
+    shortStats.Write(fileout);
+    longStats.Write(fileout);
 }
 
 void CBlockPolicyEstimator::Read(CAutoFile& filein)
@@ -579,4 +748,53 @@ void CBlockPolicyEstimator::Read(CAutoFile& filein)
     feeStats.Read(filein);
     priStats.Read(filein);
     nBestSeenHeight = nFileBestSeenHeight;
+    try {
+        shortStats.Read(filein);
+        longStats.Read(filein);
+    } catch (const std::ios_base::failure&) {
+        // Files written before there were short and long horizons end here
+    }
+    // Every fee horizon has to use the same buckets, so a tx is in the same
+    // bucket in all of them. Start over on any that don't match.
+    if (shortStats.GetBuckets() != feeStats.GetBuckets() || shortStats.GetMaxConfirms() != SHORT_BLOCK_CONFIRMS)
+        shortStats.Initialize(feeStats.GetBuckets(), SHORT_BLOCK_CONFIRMS, SHORT_DECAY, "FeeRate");
+    if (longStats.GetBuckets() != feeStats.GetBuckets() || longStats.GetMaxConfirms() != LONG_BLOCK_CONFIRMS)
+        longStats.Initialize(feeStats.GetBuckets(), LONG_BLOCK_CONFIRMS, LONG_DECAY, "FeeRate");
+}
+
+unsigned int ReplayFeeEstimatorRecord(CAutoFile& filein, CBlockPolicyEstimator& estimator,
+                                      const boost::function<void(unsigned int)>& blockProcessed)
+{
+    unsigned int nBlocks = 0;
+    while (true) {
+        unsigned char type;
+        try {
+            filein >> type;
+        } catch (const std::ios_base::failure&) {
+            if (feof(filein.Get()))
+                break;
+            throw;
+        }
+        if (type == RECORD_TX) {
+            FeeEstimatorTx tx;
+            bool fCurrentEstimate;
+            filein >> tx >> fCurrentEstimate;
+            estimator.processTransaction(tx, fCurrentEstimate);
+        } else if (type == RECORD_REMOVE) {
+            uint256 hash;
+            filein >> hash;
+            estimator.removeTx(hash);
+        } else if (type == RECORD_BLOCK) {
+            unsigned int nBlockHeight;
+            bool fCurrentEstimate;
+            std::vector<FeeEstimatorTx> vConfirmed;
+            filein >> nBlockHeight >> fCurrentEstimate >> vConfirmed;
+            estimator.processBlock(nBlockHeight, vConfirmed, fCurrentEstimate);
+            blockProcessed(nBlockHeight);
+            nBlocks++;
+        } else {
+            throw std::runtime_error("Corrupt fee estimator record. Unknown record type");
+        }
+    }
+    return nBlocks;
 }
@@ -6,12 +6,17 @@
 #define BITCOIN_POLICYESTIMATOR_H
 
 #include "amount.h"
+#include "serialize.h"
 #include "uint256.h"
 
-#include <map>
+#include <stdexcept>
+#include <stdio.h>
 #include <string>
 #include <vector>
 
+#include <boost/function.hpp>
+#include <boost/unordered_map.hpp>
+
 class CAutoFile;
 class CFeeRate;
 class CTxMemPoolEntry;
@@ -65,8 +70,22 @@ class CTxMemPool;
  * the number of transactions we've seen in that fee bucket when calculating
  * an estimate for any number of confirmations below the number of blocks
  * they've been outstanding.
+ *
+ * Fee estimates are kept over three horizons, with the same buckets but
+ * different decays and confirmation ranges: a short one that follows changes
+ * in the fee market within hours, the medium one every estimate used before,
+ * and a long one with targets up to a day that remembers about a week.
  */
 
+/** Time horizons fee estimates are tracked over */
+enum FeeEstimateHorizon {
+    SHORT_HALFLIFE = 0,
+    MED_HALFLIFE = 1,
+    LONG_HALFLIFE = 2
+};
+
+std::string StringForFeeEstimateHorizon(FeeEstimateHorizon horizon);
+
 /**
  * We will instantiate two instances of this class, one to track transactions
  * that were included in a block due to fee, and one for tx's included due to
@@ -81,7 +100,6 @@ class TxConfirmStats
 private:
     //Define the buckets we will group transactions into (both fee buckets and priority buckets)
     std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive)
-    std::map<double, unsigned int> bucketMap; // Map of bucket upper-bound to index into all vectors by bucket
 
     // For each bucket X:
     // Count the total # of txs in each bucket
@@ -93,7 +111,8 @@ private:
     // Count the total # of txs confirmed within Y blocks in each bucket
     // Track the historical moving average of theses totals over blocks
     std::vector<std::vector<double> > confAvg; // confAvg[Y][X]
-    // and calcuate the totals for the current block to update the moving averages
+    // and count the txs confirmed in exactly Y blocks in the current block, which
+    // UpdateMovingAverages turns into the "within Y" totals once per block
     std::vector<std::vector<int> > curBlockConf; // curBlockConf[Y][X]
 
     // Sum the total priority/fee of all tx's in each bucket
@@ -115,7 +134,23 @@ private:
     // transactions still unconfirmed after MAX_CONFIRMS for each bucket
     std::vector<int> oldUnconfTxs;
 
+    // For each bucket X, the number of mempool transactions that have been
+    // unconfirmed for Y blocks or more, as of nUnconfSumsHeight. Rebuilt from
+    // unconfTxs when an estimate needs it after the mempool changed, so all
+    // the estimates made in between share one pass over unconfTxs.
+    std::vector<std::vector<int> > unconfSums; // unconfSums[Y][X]
+    unsigned int nUnconfSumsHeight;
+    bool fUnconfSumsValid;
+
+    /** Returns the bucket index for val */
+    unsigned int FindBucket(double val) const;
+
+    /** Rebuild unconfSums for nBlockHeight if it is out of date */
+    void UpdateUnconfSums(unsigned int nBlockHeight);
+
 public:
+    TxConfirmStats() : decay(0), nUnconfSumsHeight(0), fUnconfSumsValid(false) {}
+
     /**
      * Initialize the data structures.  This is called by BlockPolicyEstimator's
      * constructor with default values.
@@ -124,7 +159,7 @@ public:
      * @param decay how much to decay the historical moving average per block
      * @param dataTypeString for logging purposes
      */
-    void Initialize(std::vector<double>& defaultBuckets, unsigned int maxConfirms, double decay, std::string dataTypeString);
+    void Initialize(const std::vector<double>& defaultBuckets, unsigned int maxConfirms, double decay, std::string dataTypeString);
 
     /** Clear the state of the curBlock variables to start counting for the new block */
     void ClearCurrent(unsigned int nBlockHeight);
@@ -163,7 +198,13 @@ public:
                              double minSuccess, bool requireGreater, unsigned int nBlockHeight);
 
     /** Return the max number of confirms we're tracking */
-    unsigned int GetMaxConfirms() { return confAvg.size(); }
+    unsigned int GetMaxConfirms() const { return confAvg.size(); }
+
+    /** Return the decay of the moving averages */
+    double GetDecay() const { return decay; }
+
+    /** Return the bucket boundaries */
+    const std::vector<double>& GetBuckets() const { return buckets; }
 
     /** Write state of estimation data to a file*/
     void Write(CAutoFile& fileout);
@@ -183,6 +224,18 @@ static const unsigned int MAX_BLOCK_CONFIRMS = 25;
 /** Decay of .998 is a half-life of 346 blocks or about 2.4 days */
 static const double DEFAULT_DECAY = .998;
 
+/** The short horizon tracks confirm delays up to 12 blocks */
+static const unsigned int SHORT_BLOCK_CONFIRMS = 12;
+
+/** Decay of .962 is a half-life of 18 blocks or about 3 hours */
+static const double SHORT_DECAY = .962;
+
+/** The long horizon tracks confirm delays up to 144 blocks, about a day */
+static const unsigned int LONG_BLOCK_CONFIRMS = 144;
+
+/** Decay of .99931 is a half-life of 1004 blocks or about 1 week */
+static const double LONG_DECAY = .99931;
+
 /** Require greater than 95% of X fee transactions to be confirmed within Y blocks for X to be big enough */
 static const double MIN_SUCCESS_PCT = .95;
 static const double UNLIKELY_PCT = .5;
@@ -210,6 +263,33 @@ static const double FEE_SPACING = 1.1;
 /** Spacing of Priority buckets */
 static const double PRI_SPACING = 2;
 
+/** What the estimator uses of a mempool entry. Data is fed to the estimator
+ *  in this form, so what it saw can be recorded and replayed offline. */
+struct FeeEstimatorTx
+{
+    uint256 hash;
+    unsigned int nHeight; //! Chain height when the tx entered the mempool
+    CAmount nFee;
+    unsigned int nTxSize;
+    double dPriority; //! Priority at entry, or at confirmation for a confirmed tx
+    bool fClearAtEntry; //! No inputs from other mempool txs at entry
+
+    FeeEstimatorTx() : nHeight(0), nFee(0), nTxSize(0), dPriority(0), fClearAtEntry(false) {}
+    FeeEstimatorTx(const CTxMemPoolEntry& entry, unsigned int nPriorityHeight);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hash);
+        READWRITE(nHeight);
+        READWRITE(nFee);
+        READWRITE(nTxSize);
+        READWRITE(dPriority);
+        READWRITE(fClearAtEntry);
+    }
+};
+
 /**
  *  We want to be able to estimate fees or priorities that are needed on tx's to be included in
  * a certain number of blocks.  Every time a block is added to the best chain, this class records
@@ -221,19 +301,28 @@ public:
     /** Create new BlockPolicyEstimator and initialize stats tracking classes with default values */
     CBlockPolicyEstimator(const CFeeRate& minRelayFee);
 
+    ~CBlockPolicyEstimator();
+
     /** Process all the transactions that have been included in a block */
     void processBlock(unsigned int nBlockHeight,
-                      std::vector<CTxMemPoolEntry>& entries, bool fCurrentEstimate);
+                      const std::vector<const CTxMemPoolEntry*>& entries, bool fCurrentEstimate);
+    void processBlock(unsigned int nBlockHeight,
+                      const std::vector<FeeEstimatorTx>& vConfirmed, bool fCurrentEstimate);
 
     /** Process a transaction confirmed in a block*/
-    void processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry& entry);
+    void processBlockTx(unsigned int nBlockHeight, const FeeEstimatorTx& tx);
 
     /** Process a transaction accepted to the mempool*/
     void processTransaction(const CTxMemPoolEntry& entry, bool fCurrentEstimate);
+    void processTransaction(const FeeEstimatorTx& tx, bool fCurrentEstimate);
 
     /** Remove a transaction from the mempool tracking stats*/
     void removeTx(uint256 hash);
 
+    /** Append everything the estimator is fed from now on to pfile, which
+     *  the estimator takes ownership of. NULL stops recording. */
+    void SetRecordFile(FILE* pfile);
+
     /** Is this transaction likely included in a block because of its fee?*/
     bool isFeeDataPoint(const CFeeRate &fee, double pri);
 
@@ -243,6 +332,16 @@ public:
     /** Return a fee estimate */ // һ׷Ԥֵ
     CFeeRate estimateFee(int confTarget);
 
+    /** Return a fee estimate over the given horizon with the given success
+     *  threshold, or 0 if there is not enough data */
+    CFeeRate estimateRawFee(int confTarget, double successThreshold, FeeEstimateHorizon horizon);
+
+    /** Return the highest target the horizon can estimate for */
+    unsigned int HighestTargetTracked(FeeEstimateHorizon horizon) const;
+
+    /** Return the per block decay of the data the horizon estimates from */
+    double HorizonDecay(FeeEstimateHorizon horizon) const;
+
     /** Estimate fee rate needed to get be included in a block within
      *  confTarget blocks. If no answer can be given at confTarget, return an
      *  estimate at the lowest target where one can be given.
@@ -276,14 +375,41 @@ private:
         TxStatsInfo() : stats(NULL), blockHeight(0), bucketIndex(0) {}
     };
 
+    struct TxidHasher
+    {
+        uint256 salt;
+        TxidHasher();
+        size_t operator()(const uint256& hash) const { return hash.GetHash(salt); }
+    };
+
     // map of txids to information about that transaction
-    std::map<uint256, TxStatsInfo> mapMemPoolTxs;
+    boost::unordered_map<uint256, TxStatsInfo, TxidHasher> mapMemPoolTxs;
 
-    /** Classes to track historical data on transaction confirmations */
+    /** Classes to track historical data on transaction confirmations.
+     *  feeStats is the medium fee horizon. A tx tracked in feeStats is
+     *  tracked in the short and long ones too, in the same bucket. */
     TxConfirmStats feeStats, priStats;
+    TxConfirmStats shortStats, longStats;
+
+    /** Where what the estimator is fed gets recorded, if anywhere */
+    CAutoFile* pfileRecord;
+
+    TxConfirmStats& GetFeeStats(FeeEstimateHorizon horizon);
+
+    /** Drop the record file after it failed */
+    void StopRecording(const std::exception& e);
 
     /** Breakpoints to help determine whether a transaction was confirmed by priority or Fee */
     CFeeRate feeLikely, feeUnlikely;
     double priLikely, priUnlikely;
 };
+
+/**
+ * Feed a file recorded by CBlockPolicyEstimator::SetRecordFile to estimator,
+ * as if it was running on the node that recorded it. blockProcessed is
+ * called with the height of each block after the estimator processed it.
+ * Returns the number of blocks replayed, or throws on a corrupt file.
+ */
+unsigned int ReplayFeeEstimatorRecord(CAutoFile& filein, CBlockPolicyEstimator& estimator,
+                                      const boost::function<void(unsigned int)>& blockProcessed);
 #endif /*BITCOIN_POLICYESTIMATOR_H */
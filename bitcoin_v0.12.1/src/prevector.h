@@ -25,6 +25,11 @@
  *
  *  The data type T must be movable by memmove/realloc(). Once we switch to C++,
  *  move constructors can be used instead.
+ *
+ *  An indirect buffer can also be external (see assign_external): then the top
+ *  bit of capacity is set, and the buffer is never reallocated or freed here.
+ *  Anything that needs to change the capacity first moves the elements to a
+ *  buffer of its own.
  */
 template<unsigned int N, typename T, typename Size = uint32_t, typename Diff = int32_t>
 class prevector {
@@ -154,18 +159,29 @@ private:
     const T* indirect_ptr(difference_type pos) const { return reinterpret_cast<const T*>(_union.indirect) + pos; }
     bool is_direct() const { return _size <= N; }
 
+    //! Flag in _union.capacity marking an indirect buffer this prevector does not own
+    static const Size EXTERNAL_FLAG = ((Size)1) << (sizeof(Size) * 8 - 1);
+    bool is_external() const { return !is_direct() && (_union.capacity & EXTERNAL_FLAG); }
+
     void change_capacity(size_type new_capacity) {
         if (new_capacity <= N) {
             if (!is_direct()) {
                 T* indirect = indirect_ptr(0);
+                bool fOwned = !is_external();
                 T* src = indirect;
                 T* dst = direct_ptr(0);
                 memcpy(dst, src, size() * sizeof(T));
-                free(indirect);
+                if (fOwned)
+                    free(indirect);
                 _size -= N + 1;
             }
         } else {
-            if (!is_direct()) {
+            if (is_external()) {
+                char* new_indirect = static_cast<char*>(malloc(((size_t)sizeof(T)) * new_capacity));
+                memcpy(new_indirect, _union.indirect, size() * sizeof(T));
+                _union.indirect = new_indirect;
+                _union.capacity = new_capacity;
+            } else if (!is_direct()) {
                 _union.indirect = static_cast<char*>(realloc(_union.indirect, ((size_t)sizeof(T)) * new_capacity));
                 _union.capacity = new_capacity;
             } else {
@@ -281,7 +297,7 @@ public:
         if (is_direct()) {
             return N;
         } else {
-            return _union.capacity;
+            return _union.capacity & ~EXTERNAL_FLAG;
         }
     }
 
@@ -321,6 +337,32 @@ public:
         resize(0);
     }
 
+    /**
+     * Replace the contents with n default constructed elements stored in the
+     * caller's buffer, which must hold n elements, and must outlive this
+     * prevector or any use of its elements. Anything that grows or shrinks
+     * the capacity later copies them out first. Copies of this prevector get
+     * buffers of their own.
+     */
+    void assign_external(char* storage, size_type n) {
+        if (n <= N) {
+            clear();
+            resize(n);
+            return;
+        }
+        clear();
+        if (!is_direct() && !is_external()) {
+            free(_union.indirect);
+        }
+        _union.indirect = storage;
+        _union.capacity = n | EXTERNAL_FLAG;
+        _size = N + 1;
+        while (size() < n) {
+            _size++;
+            new(static_cast<void*>(item_ptr(size() - 1))) T();
+        }
+    }
+
     iterator insert(iterator pos, const T& value) {
         size_type p = pos - begin();
         size_type new_size = size() + 1;
@@ -423,7 +465,7 @@ public:
 
     ~prevector() {
         clear();
-        if (!is_direct()) {
+        if (!is_direct() && !is_external()) {
             free(_union.indirect);
             _union.indirect = NULL;
         }
@@ -474,7 +516,7 @@ public:
     }
 
     size_t allocated_memory() const {
-        if (is_direct()) {
+        if (is_direct() || is_external()) {
             return 0;
         } else {
             return ((size_t)(sizeof(T))) * _union.capacity;
@@ -15,6 +15,14 @@ uint256 CBlockHeader::GetHash() const
     return SerializeHash(*this);
 }
 
+unsigned int CBlock::GetTotalSize() const
+{
+    unsigned int nSize = ::GetSerializeSize(*(const CBlockHeader*)this, SER_NETWORK, PROTOCOL_VERSION) + GetSizeOfCompactSize(vtx.size());
+    for (unsigned int i = 0; i < vtx.size(); i++)
+        nSize += vtx[i].GetTotalSize();
+    return nSize;
+}
+
 std::string CBlock::ToString() const
 {
     std::stringstream s;
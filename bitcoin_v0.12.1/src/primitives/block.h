@@ -10,6 +10,10 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <boost/shared_ptr.hpp>
+
+class CBlockArena;
+
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
  * requirements.  When they solve the proof-of-work, they broadcast the block
@@ -73,6 +77,11 @@ public:
 class CBlock : public CBlockHeader
 {
 public:
+    // memory only: storage for the scripts in vtx, when read with
+    // UnserializeBlockWithArena (streams.h).
+    // Declared before vtx so it is destroyed after it.
+    boost::shared_ptr<CBlockArena> arena;
+
     // network and disk
     std::vector<CTransaction> vtx; // 岿֣бһʴҽף
 
@@ -102,9 +111,13 @@ public:
     {
         CBlockHeader::SetNull();
         vtx.clear();
+        arena.reset();
         fChecked = false;
     }
 
+    //! Serialized size, summed from the sizes the transactions cache
+    unsigned int GetTotalSize() const;
+
     CBlockHeader GetBlockHeader() const
     {
         CBlockHeader block;
@@ -203,6 +203,7 @@ class CTransaction // 
 private:
     /** Memory only. */
     const uint256 hash; // ׹ϣ
+    const unsigned int nTotalSize;
     void UpdateHash() const;
 
 public:
@@ -254,6 +255,15 @@ public:
         return hash;
     }
 
+    /**
+     * Serialized size, the same as ::GetSerializeSize(tx, ...) for any type and
+     * version (none of them change how a transaction is encoded). Counted
+     * while hashing, so it costs no extra serialization.
+     */
+    unsigned int GetTotalSize() const {
+        return nTotalSize;
+    }
+
     // Return sum of txouts.
     CAmount GetValueOut() const; // ؽܺ
     // GetValueIn() is a method on CCoinsViewCache, because
@@ -7,6 +7,8 @@
 #include <secp256k1.h>
 #include <secp256k1_recovery.h>
 
+#include <boost/static_assert.hpp>
+
 namespace
 {
 /* Global secp256k1_context object used for verification. */
@@ -164,14 +166,9 @@ static int ecdsa_signature_parse_der_lax(const secp256k1_context* ctx, secp256k1
     return 1;
 }
 
-bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
-    if (!IsValid())
-        return false;
-    secp256k1_pubkey pubkey;
+/** Verify a lax DER signature against an already parsed public key. */
+static bool VerifyParsed(const secp256k1_pubkey* pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig) {
     secp256k1_ecdsa_signature sig;
-    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &(*this)[0], size())) {
-        return false;
-    }
     if (vchSig.size() == 0) {
         return false;
     }
@@ -181,7 +178,29 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
     /* libsecp256k1's ECDSA verification requires lower-S signatures, which have
      * not historically been enforced in Bitcoin, so normalize them first. */
     secp256k1_ecdsa_signature_normalize(secp256k1_context_verify, &sig, &sig);
-    return secp256k1_ecdsa_verify(secp256k1_context_verify, &sig, hash.begin(), &pubkey);
+    return secp256k1_ecdsa_verify(secp256k1_context_verify, &sig, hash.begin(), pubkey);
+}
+
+bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
+    if (!IsValid())
+        return false;
+    secp256k1_pubkey pubkey;
+    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &(*this)[0], size())) {
+        return false;
+    }
+    return VerifyParsed(&pubkey, hash, vchSig);
+}
+
+bool CParsedPubKey::Set(const CPubKey& pubkey) {
+    BOOST_STATIC_ASSERT(sizeof(secp256k1_pubkey) == sizeof(vch));
+    fValid = pubkey.IsValid() && secp256k1_ec_pubkey_parse(secp256k1_context_verify, (secp256k1_pubkey*)vch, &pubkey[0], pubkey.size());
+    return fValid;
+}
+
+bool CParsedPubKey::Verify(const uint256& hash, const std::vector<unsigned char>& vchSig) const {
+    if (!fValid)
+        return false;
+    return VerifyParsed((const secp256k1_pubkey*)vch, hash, vchSig);
 }
 
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
@@ -192,6 +192,33 @@ public:
     bool Derive(CPubKey& pubkeyChild, ChainCode &ccChild, unsigned int nChild, const ChainCode& cc) const;
 };
 
+/**
+ * A public key already parsed (and for compressed keys, decompressed) into the
+ * form libsecp256k1 verifies against. Parsing costs a field square root, so a
+ * key that signs many inputs only needs to be parsed once.
+ */
+class CParsedPubKey
+{
+private:
+    //! Opaque secp256k1_pubkey
+    unsigned char vch[64];
+    bool fValid;
+
+public:
+    CParsedPubKey() : fValid(false) {}
+
+    //! Parse pubkey. Returns false, leaving this invalid, if it is not a valid point.
+    bool Set(const CPubKey& pubkey);
+
+    bool IsValid() const
+    {
+        return fValid;
+    }
+
+    //! Same as CPubKey::Verify on the key this was set from.
+    bool Verify(const uint256& hash, const std::vector<unsigned char>& vchSig) const;
+};
+
 struct CExtPubKey {
     unsigned char nDepth;
     unsigned char vchFingerprint[4];
@@ -17,7 +17,9 @@
 #include "version.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 #include <boost/dynamic_bitset.hpp>
+#include <boost/function.hpp>
 
 #include <univalue.h>
 
@@ -61,7 +63,7 @@ struct CCoin {
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
 extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 extern UniValue mempoolInfoToJSON();
-extern UniValue mempoolToJSON(bool fVerbose = false);
+extern void mempoolToJSONStream(const boost::function<void(const std::string&)>& write);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
@@ -332,11 +334,11 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
 
     switch (rf) {
     case RF_JSON: {
-        UniValue mempoolObject = mempoolToJSON(true);
-
-        string strJSON = mempoolObject.write() + "\n";
+        // Written to the reply as it is built, a page of entries at a time,
+        // instead of building the whole mempool as one UniValue first
         req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        mempoolToJSONStream(boost::bind(&HTTPRequest::WriteReplyPart, req, _1));
+        req->WriteReply(HTTP_OK);
         return true;
     }
     default: {
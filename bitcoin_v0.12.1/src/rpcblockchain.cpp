@@ -20,6 +20,9 @@
 #include "utilstrencodings.h"
 
 #include <stdint.h>
+#include <limits>
+
+#include <boost/function.hpp>
 
 #include <univalue.h>
 
@@ -178,46 +181,141 @@ UniValue getdifficulty(const UniValue& params, bool fHelp)
     return GetDifficulty(); // ػȡѶֵ
 }
 
-UniValue mempoolToJSON(bool fVerbose = false)
+/** Fields of a mempool entry reported by the verbose mempool dumps. They are
+ *  copied out under mempool.cs a page at a time, so formatting a full mempool
+ *  does not hold the lock. */
+struct MempoolEntryInfo
 {
-    if (fVerbose)
-    { // ϸϢ
-        LOCK(mempool.cs);
-        UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
-        { // ȡ׳еĽĿ
-            const uint256& hash = e.GetTx().GetHash();
-            UniValue info(UniValue::VOBJ);
-            info.push_back(Pair("size", (int)e.GetTxSize())); // ״С
-            info.push_back(Pair("fee", ValueFromAmount(e.GetFee()))); // ׷
-            info.push_back(Pair("modifiedfee", ValueFromAmount(e.GetModifiedFee()))); // ޸ĵĽ׷
-            info.push_back(Pair("time", e.GetTime())); // ǰʱ
-            info.push_back(Pair("height", (int)e.GetHeight())); // ǰ߶
-            info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight()))); // ʼȼͨ߶ȣ
-            info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height()))); // ǰȼ
-            info.push_back(Pair("descendantcount", e.GetCountWithDescendants())); // 
-            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants())); // С
-            info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants())); // 
-            const CTransaction& tx = e.GetTx();
-            set<string> setDepends; // 
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                if (mempool.exists(txin.prevout.hash)) // ѯϣڴǷ
-                    setDepends.insert(txin.prevout.hash.ToString()); // 
-            }
-
-            UniValue depends(UniValue::VARR);
-            BOOST_FOREACH(const string& dep, setDepends) // Ŀ
-            {
-                depends.push_back(dep);
-            }
-
-            info.push_back(Pair("depends", depends)); // 뽻
-            o.push_back(Pair(hash.ToString(), info)); //   Ϣ 
-        }
-        return o;
+    uint256 hash;
+    int64_t nTime;
+    unsigned int nTxSize;
+    unsigned int nHeight;
+    CAmount nFee;
+    CAmount nModifiedFee;
+    double dStartingPriority;
+    double dCurrentPriority;
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+    std::vector<uint256> vDepends;
+};
+
+// Number of entries copied per mempool.cs lock by the verbose mempool dumps
+static const size_t MEMPOOL_DUMP_PAGE = 1000;
+
+typedef CTxMemPool::indexed_transaction_set::nth_index<2>::type mempool_by_time;
+
+/** A position in the time index, which orders entries by (entry time, txid) */
+typedef std::pair<int64_t, uint256> MempoolPosition;
+
+/** Compares mempool entries with a position, to seek in the time index */
+struct CompareEntryPosition
+{
+    bool operator()(const CTxMemPoolEntry& e, const MempoolPosition& pos) const
+    {
+        return e.GetTime() < pos.first || (e.GetTime() == pos.first && e.GetTx().GetHash() < pos.second);
+    }
+    bool operator()(const MempoolPosition& pos, const CTxMemPoolEntry& e) const
+    {
+        return pos.first < e.GetTime() || (pos.first == e.GetTime() && pos.second < e.GetTx().GetHash());
+    }
+};
+
+static void CopyMempoolEntry(const CTxMemPoolEntry& e, int nChainHeight, MempoolEntryInfo& info)
+{
+    AssertLockHeld(mempool.cs);
+    const CTransaction& tx = e.GetTx();
+    info.hash = tx.GetHash();
+    info.nTime = e.GetTime();
+    info.nTxSize = e.GetTxSize();
+    info.nHeight = e.GetHeight();
+    info.nFee = e.GetFee();
+    info.nModifiedFee = e.GetModifiedFee();
+    info.dStartingPriority = e.GetPriority(e.GetHeight());
+    info.dCurrentPriority = e.GetPriority(nChainHeight);
+    info.nCountWithDescendants = e.GetCountWithDescendants();
+    info.nSizeWithDescendants = e.GetSizeWithDescendants();
+    info.nModFeesWithDescendants = e.GetModFeesWithDescendants();
+    info.vDepends.clear();
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        if (mempool.exists(txin.prevout.hash)) // ѯϣڴǷ
+            info.vDepends.push_back(txin.prevout.hash);
+    }
+}
+
+static UniValue MempoolEntryToJSON(const MempoolEntryInfo& e)
+{
+    UniValue info(UniValue::VOBJ);
+    info.push_back(Pair("size", (int)e.nTxSize)); // ״С
+    info.push_back(Pair("fee", ValueFromAmount(e.nFee))); // ׷
+    info.push_back(Pair("modifiedfee", ValueFromAmount(e.nModifiedFee))); // ޸ĵĽ׷
+    info.push_back(Pair("time", e.nTime)); // ǰʱ
+    info.push_back(Pair("height", (int)e.nHeight)); // ǰ߶
+    info.push_back(Pair("startingpriority", e.dStartingPriority)); // ʼȼͨ߶ȣ
+    info.push_back(Pair("currentpriority", e.dCurrentPriority)); // ǰȼ
+    info.push_back(Pair("descendantcount", e.nCountWithDescendants)); // 
+    info.push_back(Pair("descendantsize", e.nSizeWithDescendants)); // С
+    info.push_back(Pair("descendantfees", e.nModFeesWithDescendants)); // 
+    set<string> setDepends; // 
+    BOOST_FOREACH(const uint256& hash, e.vDepends)
+        setDepends.insert(hash.ToString());
+
+    UniValue depends(UniValue::VARR);
+    BOOST_FOREACH(const string& dep, setDepends) // Ŀ
+    {
+        depends.push_back(dep);
+    }
+
+    info.push_back(Pair("depends", depends)); // 뽻
+    return info;
+}
+
+static int GetChainHeight()
+{
+    LOCK(cs_main);
+    return chainActive.Height();
+}
+
+// Copies up to nCount entries following pos in the time index, or from the
+// start of it if pos is NULL, to vInfo. Returns whether more entries follow,
+// and sets posLast to the last entry copied.
+static bool CopyMempoolPage(bool fVerbose, const MempoolPosition* pos, size_t nCount, int nChainHeight,
+                            std::vector<MempoolEntryInfo>& vInfo, MempoolPosition& posLast)
+{
+    LOCK(mempool.cs);
+    const mempool_by_time& byTime = mempool.mapTx.get<2>();
+    mempool_by_time::const_iterator it = pos ? byTime.upper_bound(*pos, CompareEntryPosition()) : byTime.begin();
+    vInfo.reserve(vInfo.size() + std::min(nCount, mempool.mapTx.size()));
+    for (size_t i = 0; it != byTime.end() && i < nCount; ++it, i++) {
+        vInfo.push_back(MempoolEntryInfo());
+        if (fVerbose)
+            CopyMempoolEntry(*it, nChainHeight, vInfo.back());
+        else
+            vInfo.back().hash = it->GetTx().GetHash();
+        posLast = MempoolPosition(it->GetTime(), it->GetTx().GetHash());
     }
-    else
+    return it != byTime.end();
+}
+
+static UniValue MempoolEntriesToJSON(bool fVerbose, const std::vector<MempoolEntryInfo>& vInfo)
+{
+    if (!fVerbose) {
+        UniValue a(UniValue::VARR);
+        BOOST_FOREACH(const MempoolEntryInfo& info, vInfo)
+            a.push_back(info.hash.ToString());
+        return a;
+    }
+
+    UniValue o(UniValue::VOBJ);
+    BOOST_FOREACH(const MempoolEntryInfo& info, vInfo)
+        o.push_back(Pair(info.hash.ToString(), MempoolEntryToJSON(info))); //   Ϣ 
+    return o;
+}
+
+UniValue mempoolToJSON(bool fVerbose = false)
+{
+    if (!fVerbose)
     { // ϣ
         vector<uint256> vtxid;
         mempool.queryHashes(vtxid); // 佻׳еĽ׹ϣ vtxid
@@ -228,16 +326,91 @@ UniValue mempoolToJSON(bool fVerbose = false)
 
         return a;
     }
+
+    // Entries are copied out under mempool.cs and formatted without it
+    std::vector<MempoolEntryInfo> vInfo;
+    MempoolPosition posLast;
+    CopyMempoolPage(true, NULL, std::numeric_limits<size_t>::max(), GetChainHeight(), vInfo, posLast);
+    return MempoolEntriesToJSON(true, vInfo);
+}
+
+/** Formats a position in the time index as a getrawmempool cursor */
+static std::string MempoolCursorToString(const MempoolPosition& pos)
+{
+    return strprintf("%d:%s", pos.first, pos.second.GetHex());
+}
+
+/** Parses a getrawmempool cursor, returning false if it is malformed */
+static bool MempoolCursorFromString(const std::string& str, MempoolPosition& pos)
+{
+    size_t nColon = str.find(':');
+    if (nColon == std::string::npos)
+        return false;
+    std::string strHash = str.substr(nColon + 1);
+    if (!ParseInt64(str.substr(0, nColon), &pos.first) || strHash.size() != 64 || !IsHex(strHash))
+        return false;
+    pos.second = uint256S(strHash);
+    return true;
+}
+
+static UniValue mempoolPageToJSON(bool fVerbose, const MempoolPosition* pos, size_t nCount)
+{
+    // A cursor rather than an offset marks where the page ends, so that
+    // transactions leaving the pool between two calls do not shift the
+    // later pages.
+    std::vector<MempoolEntryInfo> vInfo;
+    MempoolPosition posLast;
+    if (pos)
+        posLast = *pos;
+    bool fMore = CopyMempoolPage(fVerbose, pos, nCount, GetChainHeight(), vInfo, posLast);
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("transactions", MempoolEntriesToJSON(fVerbose, vInfo)));
+    if (fMore)
+        result.push_back(Pair("next", MempoolCursorToString(posLast)));
+    return result;
+}
+
+void mempoolToJSONStream(const boost::function<void(const std::string&)>& write)
+{
+    // Same object as mempoolToJSON(true), written out a page at a time. The
+    // position between pages is the (entry time, txid) of the last entry
+    // written, so transactions that stay in the pool are written exactly
+    // once even if others come and go.
+    const int nChainHeight = GetChainHeight();
+    MempoolPosition posLast;
+    std::vector<MempoolEntryInfo> vInfo;
+    bool fFirst = true;
+    bool fMore = true;
+    write("{");
+    while (fMore) {
+        vInfo.clear();
+        fMore = CopyMempoolPage(true, fFirst ? NULL : &posLast, MEMPOOL_DUMP_PAGE, nChainHeight, vInfo, posLast);
+
+        std::string strPage;
+        BOOST_FOREACH(const MempoolEntryInfo& info, vInfo) {
+            if (!fFirst)
+                strPage += ",";
+            fFirst = false;
+            strPage += "\"" + info.hash.ToString() + "\":" + MempoolEntryToJSON(info).write();
+        }
+        if (vInfo.empty())
+            break;
+        write(strPage);
+    }
+    write("}\n");
 }
 
 UniValue getrawmempool(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() > 1) // Ϊ 1 
+    if (fHelp || params.size() > 3) // Ϊ 3 
         throw runtime_error( // 
-            "getrawmempool ( verbose )\n"
+            "getrawmempool ( verbose \"cursor\" count )\n"
             "\nReturns all transaction ids in memory pool as a json array of string transaction ids.\n"
             "\nArguments:\n"
             "1. verbose           (boolean, optional, default=false) true for a json object, false for array of transaction ids\n"
+            "2. \"cursor\"          (string, optional) return the transactions after this \"next\" value of an earlier call, in order of entry time; \"\" starts from the first\n"
+            "3. count             (numeric, optional) return at most this many transactions\n"
             "\nResult: (for verbose = false):\n"
             "[                     (json array of string)\n"
             "  \"transactionid\"     (string) The transaction id\n"
@@ -261,18 +434,39 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             "       ... ]\n"
             "  }, ...\n"
             "}\n"
+            "\nResult: (if cursor or count is given):\n"
+            "{\n"
+            "  \"transactions\" : ...,   (json array or object) the page of transactions, as above\n"
+            "  \"next\" : \"cursor\"       (string) cursor for the next page, present only if more transactions follow\n"
+            "}\n"
+            "Transactions entering the pool after a page was returned are included in later pages only if\n"
+            "their entry time is after the cursor.\n"
             "\nExamples\n"
             + HelpExampleCli("getrawmempool", "true")
+            + HelpExampleCli("getrawmempool", "true \"\" 1000")
             + HelpExampleRpc("getrawmempool", "true")
         );
 
-    LOCK(cs_main); // 
-
     bool fVerbose = false; // ϸ־ĬΪ false
     if (params.size() > 0)
         fVerbose = params[0].get_bool(); // ȡϸ
 
-    return mempoolToJSON(fVerbose); // ڴؽ״Ϊ JSON ʽ
+    if (params.size() < 2)
+        return mempoolToJSON(fVerbose); // ڴؽ״Ϊ JSON ʽ
+
+    MempoolPosition pos;
+    const std::string strCursor = params[1].get_str();
+    if (!strCursor.empty() && !MempoolCursorFromString(strCursor, pos))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    size_t nCount = std::numeric_limits<size_t>::max();
+    if (params.size() > 2) {
+        int64_t n = params[2].get_int64();
+        if (n < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+        nCount = n;
+    }
+
+    return mempoolPageToJSON(fVerbose, strCursor.empty() ? NULL : &pos, nCount);
 }
 
 UniValue getblockhash(const UniValue& params, bool fHelp)
@@ -811,6 +1005,17 @@ UniValue mempoolInfoToJSON()
     ret.push_back(Pair("maxmempool", (int64_t) maxmempool)); // ڴصĴС
     ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK()))); // ڴС
 
+    UniValue histogram(UniValue::VARR); // ʷͰĽͳ
+    BOOST_FOREACH(const CFeeRateBucket& bucket, mempool.GetFeeRateHistogram()) {
+        UniValue b(UniValue::VOBJ);
+        b.push_back(Pair("feerate", ValueFromAmount(bucket.feeRateFrom.GetFeePerK())));
+        b.push_back(Pair("count", bucket.nCount));
+        b.push_back(Pair("bytes", bucket.nSize));
+        b.push_back(Pair("fees", ValueFromAmount(bucket.nFees)));
+        histogram.push_back(b);
+    }
+    ret.push_back(Pair("feehistogram", histogram));
+
     return ret;
 }
 
@@ -826,7 +1031,15 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "  \"bytes\": xxxxx,              (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx,              (numeric) Total memory usage for the mempool\n"
             "  \"maxmempool\": xxxxx,         (numeric) Maximum memory usage for the mempool\n"
-            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee for tx to be accepted\n"
+            "  \"mempoolminfee\": xxxxx,      (numeric) Minimum fee for tx to be accepted\n"
+            "  \"feehistogram\": [            (array) Transactions grouped by modified feerate, lowest first\n"
+            "    {\n"
+            "      \"feerate\": x.xxxx,        (numeric) Lowest feerate of the bucket in " + CURRENCY_UNIT + "/kB\n"
+            "      \"count\": xxxxx,           (numeric) Number of transactions in the bucket\n"
+            "      \"bytes\": xxxxx,           (numeric) Sum of their sizes\n"
+            "      \"fees\": x.xxxx            (numeric) Sum of their modified fees in " + CURRENCY_UNIT + "\n"
+            "    }, ...\n"
+            "  ]\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -503,14 +503,14 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         CBlockIndex* pindexPrevNew = chainActive.Tip(); // ȡ
         nStart = GetTime();
 
-        // Create new block
+        // Get the template, updated with the mempool changes since the last call
         if(pblocktemplate) // ģѴ
         {
             delete pblocktemplate; // ɾ
             pblocktemplate = NULL; // ÿ
         }
         CScript scriptDummy = CScript() << OP_TRUE; // ű
-        pblocktemplate = CreateNewBlock(Params(), scriptDummy); // һ¿
+        pblocktemplate = blockTemplateEngine.GetBlockTemplate(Params(), scriptDummy); // ȡµģ
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
@@ -763,6 +763,61 @@ UniValue estimatesmartfee(const UniValue& params, bool fHelp)
     return result; // ؽ
 }
 
+UniValue estimaterawfee(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "estimaterawfee nblocks ( threshold )\n"
+            "\nWARNING: This interface is unstable and may disappear or change!\n"
+            "\nEstimates the approximate fee per kilobyte needed for a transaction to begin\n"
+            "confirmation within nblocks blocks, separately for each horizon the estimator tracks.\n"
+            "\nArguments:\n"
+            "1. nblocks     (numeric) confirmation target in blocks\n"
+            "2. threshold   (numeric, optional, default=0.95) fraction of transactions in a feerate\n"
+            "               bucket that must have confirmed within nblocks for the bucket to pass,\n"
+            "               greater than 0 and at most 1\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"short\" : {          (json object) estimate for the short horizon\n"
+            "    \"feerate\" : x.x,   (numeric) estimate fee-per-kilobyte (in BTC), -1 if there is not enough data\n"
+            "    \"decay\" : x.x,     (numeric) exponential decay per block of the historical data\n"
+            "    \"maxtarget\" : n    (numeric) highest nblocks this horizon can answer for\n"
+            "  },\n"
+            "  \"medium\" : { ... }, (json object) same for the medium horizon, used by estimatefee\n"
+            "  \"long\" : { ... }    (json object) same for the long horizon\n"
+            "}\n"
+            "\nHorizons that do not track nblocks are omitted.\n"
+            "\nExample:\n"
+            + HelpExampleCli("estimaterawfee", "6 0.9")
+            );
+
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VNUM)(UniValue::VNUM), true);
+
+    int nBlocks = params[0].get_int();
+    if (nBlocks < 1)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid nblocks");
+    double dThreshold = 0.95;
+    if (params.size() > 1)
+        dThreshold = params[1].get_real();
+    if (dThreshold <= 0 || dThreshold > 1)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid threshold");
+
+    UniValue result(UniValue::VOBJ);
+    const FeeEstimateHorizon horizons[] = {SHORT_HALFLIFE, MED_HALFLIFE, LONG_HALFLIFE};
+    BOOST_FOREACH(FeeEstimateHorizon horizon, horizons) { // βѯʱ
+        unsigned int nMaxTarget = mempool.HighestTargetTracked(horizon);
+        if ((unsigned int)nBlocks > nMaxTarget)
+            continue;
+        CFeeRate feeRate = mempool.estimateRawFee(nBlocks, dThreshold, horizon);
+        UniValue horizonResult(UniValue::VOBJ);
+        horizonResult.push_back(Pair("feerate", feeRate == CFeeRate(0) ? -1.0 : ValueFromAmount(feeRate.GetFeePerK())));
+        horizonResult.push_back(Pair("decay", mempool.GetFeeEstimateDecay(horizon)));
+        horizonResult.push_back(Pair("maxtarget", (int)nMaxTarget));
+        result.push_back(Pair(StringForFeeEstimateHorizon(horizon), horizonResult));
+    }
+    return result;
+}
+
 UniValue estimatesmartpriority(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1) // Ϊ 1 
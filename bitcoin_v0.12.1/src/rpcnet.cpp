@@ -36,9 +36,7 @@ UniValue getconnectioncount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getconnectioncount", "")
         );
 
-    LOCK2(cs_main, cs_vNodes);
-
-    return (int)vNodes.size(); // ѽӵĽڵбĴС
+    return (int)GetNodeSnapshot()->size(); // ѽӵĽڵбĴС
 }
 
 UniValue ping(const UniValue& params, bool fHelp)
@@ -55,9 +53,9 @@ UniValue ping(const UniValue& params, bool fHelp)
         );
 
     // Request that each node send a ping during next message processing pass
-    LOCK2(cs_main, cs_vNodes); // һϢÿڵ㷢һ ping
+    NodeSnapshot vNodesCopy = GetNodeSnapshot(); // һϢÿڵ㷢һ ping
 
-    BOOST_FOREACH(CNode* pNode, vNodes) { // ѽӵÿڵ
+    BOOST_FOREACH(CNode* pNode, *vNodesCopy) { // ѽӵÿڵ
         pNode->fPingQueued = true; //  ping б־Ϊ true
     }
 
@@ -68,9 +66,9 @@ static void CopyNodeStats(std::vector<CNodeStats>& vstats)
 {
     vstats.clear(); // 
 
-    LOCK(cs_vNodes); // 
-    vstats.reserve(vNodes.size()); // 뿪ٿռ䣬ֹԶ
-    BOOST_FOREACH(CNode* pnode, vNodes) { // ԽӵĽڵб
+    NodeSnapshot vNodesCopy = GetNodeSnapshot(); // ȡڵбգ߳
+    vstats.reserve(vNodesCopy->size()); // 뿪ٿռ䣬ֹԶ
+    BOOST_FOREACH(CNode* pnode, *vNodesCopy) { // ԽӵĽڵб
         CNodeStats stats;
         pnode->copyStats(stats); // ȡڵ״̬ stats
         vstats.push_back(stats); // ״̬б
@@ -110,7 +108,20 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
+            "    \"invtxqueued\": n,          (numeric) Transactions waiting for the next announcement to this peer\n"
+            "    \"invtxsent\": n,            (numeric) Transactions announced to this peer\n"
+            "    \"invmsgsent\": n,           (numeric) Inv messages sent to this peer\n"
+            "    \"sendqueue\": n,            (numeric) Bytes queued for sending to this peer\n"
+            "    \"throttledtime\": n,        (numeric) Seconds spent with data held back by the per-peer rate limits\n"
+            "    \"bytessent_per_class\": {   (json object) Bytes handed to the socket, by traffic class\n"
+            "       \"control\": n,           (numeric) Handshake, ping, headers and request messages (never throttled)\n"
+            "       \"block\": n,             (numeric) Block and merkleblock messages (-maxpeerblockrate)\n"
+            "       \"tx\": n,                (numeric) Transaction messages (-maxpeertxrate)\n"
+            "       \"addr\": n,              (numeric) Address messages (-maxpeeraddrrate)\n"
+            "       \"inv\": n                (numeric) Inv and notfound messages\n"
+            "    }\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -164,6 +175,15 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             obj.push_back(Pair("inflight", heights));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
+        obj.push_back(Pair("invtxqueued", stats.nInvTxQueued)); // ͨĽ
+        obj.push_back(Pair("invtxsent", stats.nInvTxSent));
+        obj.push_back(Pair("invmsgsent", stats.nInvMsgSent));
+        obj.push_back(Pair("sendqueue", stats.nSendQueued)); // ͵ֽ
+        obj.push_back(Pair("throttledtime", stats.dThrottledTime)); // ٵʱ
+        UniValue sendPerClass(UniValue::VOBJ);
+        for (int i = 0; i < SEND_CLASS_MAX; i++)
+            sendPerClass.push_back(Pair(GetSendClassName((SendClass)i), stats.mapSendBytesPerClass[i]));
+        obj.push_back(Pair("bytessent_per_class", sendPerClass));
 
         ret.push_back(obj);
     }
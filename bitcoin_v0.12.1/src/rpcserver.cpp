@@ -323,6 +323,7 @@ static const CRPCCommand vRPCCommands[] =
     { "util",               "estimatesmartpriority",  &estimatesmartpriority,  true  },
 
     /* Not shown in help */
+    { "hidden",             "estimaterawfee",         &estimaterawfee,         true  },
     { "hidden",             "invalidateblock",        &invalidateblock,        true  },
     { "hidden",             "reconsiderblock",        &reconsiderblock,        true  },
     { "hidden",             "setmocktime",            &setmocktime,            true  },
@@ -195,6 +195,7 @@ extern UniValue estimatefee(const UniValue& params, bool fHelp); // Ԥ
 extern UniValue estimatepriority(const UniValue& params, bool fHelp); // Ԥȼ
 extern UniValue estimatesmartfee(const UniValue& params, bool fHelp); // ܹƽ׷
 extern UniValue estimatesmartpriority(const UniValue& params, bool fHelp); // ܹƽȼ
+extern UniValue estimaterawfee(const UniValue& params, bool fHelp); // ʱȹƽ׷
 
 extern UniValue getnewaddress(const UniValue& params, bool fHelp); // ȡµַ
 extern UniValue getaccountaddress(const UniValue& params, bool fHelp); // ȡ˻տַ
@@ -13,6 +13,8 @@
 #include "script/script.h"
 #include "uint256.h"
 
+#include <algorithm>
+
 using namespace std;
 
 typedef vector<unsigned char> valtype; // ޷ַ
@@ -54,9 +56,9 @@ bool CastToBool(const valtype& vch)
  * Script is a stack machine (like Forth) that evaluates a predicate
  * returning a bool indicating valid or not.  There are no loops.
  */
-#define stacktop(i)  (stack.at(stack.size()+(i)))
-#define altstacktop(i)  (altstack.at(altstack.size()+(i)))
-static inline void popstack(vector<valtype>& stack)
+#define stacktop(i)  (stack.top(i))
+#define altstacktop(i)  (altstack.top(i))
+static inline void popstack(CScriptStack& stack)
 {
     if (stack.empty()) // ջж
         throw runtime_error("popstack(): stack empty");
@@ -229,7 +231,16 @@ bool static CheckMinimalPush(const valtype& data, opcodetype opcode) {
     return true; // ֱӷ true
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+bool EvalScript(vector<vector<unsigned char> >& vstack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+{
+    CScriptStack stack;
+    stack.swap(vstack);
+    bool ret = EvalScript(stack, script, flags, checker, serror);
+    stack.swap(vstack);
+    return ret;
+}
+
+bool EvalScript(CScriptStack& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror, CScriptStack* paltstack)
 {
     static const CScriptNum bnZero(0);
     static const CScriptNum bnOne(1);
@@ -245,7 +256,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
     opcodetype opcode; // 
     valtype vchPushValue; // push ֵ
     vector<bool> vfExec; // ִб־
-    vector<valtype> altstack;
+    CScriptStack altstackLocal;
+    CScriptStack& altstack = paltstack ? *paltstack : altstackLocal;
+    altstack.clear();
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR); // δ֪ű
     if (script.size() > 10000) // űС 10,000 ֽ
         return set_error(serror, SCRIPT_ERR_SCRIPT_SIZE);
@@ -318,7 +331,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                 {
                     // ( -- value)
                     CScriptNum bn((int)opcode - (int)(OP_1 - 1)); // һűֶ
-                    stack.push_back(bn.getvch()); // лջ
+                    bn.getvch(stack.push_back_reuse()); // лջ
                     // The result of these opcodes should always be the minimal way to push the data
                     // they push, so no need for a CheckMinimalPush here.
                 } // ЩĽӦʼݵСʽﲻҪ CheckMinimalPush
@@ -481,7 +494,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                 {
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    altstack.push_back(stacktop(-1));
+                    altstack.push_back_reuse().swap(stacktop(-1));
                     popstack(stack);
                 }
                 break;
@@ -490,7 +503,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                 {
                     if (altstack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_ALTSTACK_OPERATION);
-                    stack.push_back(altstacktop(-1));
+                    stack.push_back_reuse().swap(altstacktop(-1));
                     popstack(altstack);
                 }
                 break;
@@ -510,10 +523,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 -- x1 x2 x1 x2)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-2);
-                    valtype vch2 = stacktop(-1);
-                    stack.push_back(vch1);
-                    stack.push_back(vch2);
+                    stack.push_back(stacktop(-2));
+                    stack.push_back(stacktop(-2));
                 }
                 break;
 
@@ -522,12 +533,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 x3 -- x1 x2 x3 x1 x2 x3)
                     if (stack.size() < 3)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-3);
-                    valtype vch2 = stacktop(-2);
-                    valtype vch3 = stacktop(-1);
-                    stack.push_back(vch1);
-                    stack.push_back(vch2);
-                    stack.push_back(vch3);
+                    stack.push_back(stacktop(-3));
+                    stack.push_back(stacktop(-3));
+                    stack.push_back(stacktop(-3));
                 }
                 break;
 
@@ -536,10 +544,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 x3 x4 -- x1 x2 x3 x4 x1 x2)
                     if (stack.size() < 4)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-4);
-                    valtype vch2 = stacktop(-3);
-                    stack.push_back(vch1);
-                    stack.push_back(vch2);
+                    stack.push_back(stacktop(-4));
+                    stack.push_back(stacktop(-4));
                 }
                 break;
 
@@ -548,11 +554,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 x3 x4 x5 x6 -- x3 x4 x5 x6 x1 x2)
                     if (stack.size() < 6)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch1 = stacktop(-6);
-                    valtype vch2 = stacktop(-5);
-                    stack.erase(stack.end()-6, stack.end()-4);
-                    stack.push_back(vch1);
-                    stack.push_back(vch2);
+                    std::rotate(stack.end()-6, stack.end()-4, stack.end());
                 }
                 break;
 
@@ -571,9 +573,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x - 0 | x x)
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-1);
-                    if (CastToBool(vch))
-                        stack.push_back(vch);
+                    if (CastToBool(stacktop(-1)))
+                        stack.push_back(stacktop(-1));
                 }
                 break;
 
@@ -581,7 +582,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                 {
                     // -- stacksize
                     CScriptNum bn(stack.size());
-                    stack.push_back(bn.getvch());
+                    bn.getvch(stack.push_back_reuse());
                 }
                 break;
 
@@ -599,8 +600,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x -- x x)
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-1);
-                    stack.push_back(vch);
+                    stack.push_back(stacktop(-1));
                 }
                 break;
 
@@ -609,7 +609,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 -- x2)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    stack.erase(stack.end() - 2);
+                    std::rotate(stack.end()-2, stack.end()-1, stack.end());
+                    popstack(stack);
                 }
                 break;
 
@@ -618,8 +619,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 -- x1 x2 x1)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-2);
-                    stack.push_back(vch);
+                    stack.push_back(stacktop(-2));
                 }
                 break;
 
@@ -634,10 +634,10 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     popstack(stack);
                     if (n < 0 || n >= (int)stack.size())
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-n-1);
                     if (opcode == OP_ROLL)
-                        stack.erase(stack.end()-n-1);
-                    stack.push_back(vch);
+                        std::rotate(stack.end()-n-1, stack.end()-n, stack.end());
+                    else
+                        stack.push_back(stacktop(-n-1));
                 }
                 break;
 
@@ -667,8 +667,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     // (x1 x2 -- x2 x1 x2)
                     if (stack.size() < 2)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
-                    valtype vch = stacktop(-1);
-                    stack.insert(stack.end()-2, vch);
+                    stack.push_back(stacktop(-1));
+                    std::rotate(stack.end()-3, stack.end()-1, stack.end());
                 }
                 break;
 
@@ -679,7 +679,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     CScriptNum bn(stacktop(-1).size());
-                    stack.push_back(bn.getvch());
+                    bn.getvch(stack.push_back_reuse());
                 }
                 break;
 
@@ -741,7 +741,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     default:            assert(!"invalid opcode"); break;
                     }
                     popstack(stack);
-                    stack.push_back(bn.getvch());
+                    bn.getvch(stack.push_back_reuse());
                 }
                 break;
 
@@ -790,7 +790,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     }
                     popstack(stack);
                     popstack(stack);
-                    stack.push_back(bn.getvch());
+                    bn.getvch(stack.push_back_reuse());
 
                     if (opcode == OP_NUMEQUALVERIFY)
                     {
@@ -832,19 +832,20 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                     if (stack.size() < 1)
                         return set_error(serror, SCRIPT_ERR_INVALID_STACK_OPERATION);
                     valtype& vch = stacktop(-1);
-                    valtype vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
+                    unsigned char vchHash[32];
+                    size_t nHashSize = (opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32;
                     if (opcode == OP_RIPEMD160)
-                        CRIPEMD160().Write(begin_ptr(vch), vch.size()).Finalize(begin_ptr(vchHash));
+                        CRIPEMD160().Write(begin_ptr(vch), vch.size()).Finalize(vchHash);
                     else if (opcode == OP_SHA1)
-                        CSHA1().Write(begin_ptr(vch), vch.size()).Finalize(begin_ptr(vchHash));
+                        CSHA1().Write(begin_ptr(vch), vch.size()).Finalize(vchHash);
                     else if (opcode == OP_SHA256)
-                        CSHA256().Write(begin_ptr(vch), vch.size()).Finalize(begin_ptr(vchHash));
+                        CSHA256().Write(begin_ptr(vch), vch.size()).Finalize(vchHash);
                     else if (opcode == OP_HASH160)
-                        CHash160().Write(begin_ptr(vch), vch.size()).Finalize(begin_ptr(vchHash));
+                        CHash160().Write(begin_ptr(vch), vch.size()).Finalize(vchHash);
                     else if (opcode == OP_HASH256)
-                        CHash256().Write(begin_ptr(vch), vch.size()).Finalize(begin_ptr(vchHash));
-                    popstack(stack);
-                    stack.push_back(vchHash);
+                        CHash256().Write(begin_ptr(vch), vch.size()).Finalize(vchHash);
+                    // The hash replaces its input in place
+                    vch.assign(vchHash, vchHash + nHashSize);
                 }
                 break;                                   
 
@@ -1104,9 +1105,83 @@ public:
     }
 };
 
+/** Stream that appends everything written to it to a byte vector */
+class CVectorWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+
+public:
+    int nType;
+    int nVersion;
+
+    CVectorWriter(std::vector<unsigned char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    CVectorWriter& write(const char *pch, size_t size) {
+        vch.insert(vch.end(), (const unsigned char*)pch, (const unsigned char*)pch + size);
+        return (*this);
+    }
+
+    template<typename T>
+    CVectorWriter& operator<<(const T& obj) {
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+/** Stream that feeds everything written to it into a single SHA256 state */
+class CSHA256Writer
+{
+private:
+    CSHA256& ctx;
+
+public:
+    int nType;
+    int nVersion;
+
+    CSHA256Writer(CSHA256& ctxIn, int nTypeIn, int nVersionIn) : ctx(ctxIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    CSHA256Writer& write(const char *pch, size_t size) {
+        ctx.Write((const unsigned char*)pch, size);
+        return (*this);
+    }
+
+    template<typename T>
+    CSHA256Writer& operator<<(const T& obj) {
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+//! Size of a serialized input with a blanked scriptSig: prevout, empty script, nSequence
+static const size_t BLANK_INPUT_SIZE = 32 + 4 + 1 + 4;
+
 } // anon namespace
 
-uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+void PrecomputedTransactionData::Init(const CTransaction& txTo)
+{
+    if (fReady)
+        return;
+    // An input index past the end blanks every input's scriptSig
+    CTransactionSignatureSerializer txTmp(txTo, CScript(), txTo.vin.size(), SIGHASH_ALL);
+    vchBlank.clear();
+    CVectorWriter ss(vchBlank, SER_GETHASH, 0);
+    ss << txTmp;
+
+    nInputsBegin = sizeof(txTo.nVersion) + GetSizeOfCompactSize(txTo.vin.size());
+    assert(vchBlank.size() >= nInputsBegin + txTo.vin.size() * BLANK_INPUT_SIZE);
+    vPrefix.clear();
+    vPrefix.reserve(txTo.vin.size());
+    CSHA256 sha;
+    sha.Write(&vchBlank[0], nInputsBegin);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++) {
+        vPrefix.push_back(sha);
+        sha.Write(&vchBlank[nInputsBegin + i * BLANK_INPUT_SIZE], BLANK_INPUT_SIZE);
+    }
+    fReady = true;
+}
+
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const PrecomputedTransactionData* cache)
 {
     static const uint256 one(uint256S("0000000000000000000000000000000000000000000000000000000000000001"));
     if (nIn >= txTo.vin.size()) {
@@ -1125,6 +1200,23 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
+    if (cache && cache->fReady && !(nHashType & SIGHASH_ANYONECANPAY) &&
+        (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
+        assert(cache->vPrefix.size() == txTo.vin.size());
+        // Resume from the state after everything before input nIn, hash the
+        // input being signed, then the blanked rest of the transaction
+        CSHA256 sha(cache->vPrefix[nIn]);
+        CSHA256Writer ss(sha, SER_GETHASH, 0);
+        txTmp.SerializeInput(ss, nIn, SER_GETHASH, 0);
+        size_t nRest = cache->nInputsBegin + (nIn + 1) * BLANK_INPUT_SIZE;
+        sha.Write(&cache->vchBlank[nRest], cache->vchBlank.size() - nRest);
+        ss << nHashType;
+        uint256 hash;
+        sha.Finalize(hash.begin());
+        CSHA256().Write(hash.begin(), CSHA256::OUTPUT_SIZE).Finalize(hash.begin());
+        return hash;
+    }
+
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
@@ -1149,7 +1241,7 @@ bool TransactionSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn
     int nHashType = vchSig.back();
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType);
+    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, txdata);
 
     if (!VerifySignature(vchSig, pubkey, sighash))
         return false;
@@ -1239,7 +1331,173 @@ bool TransactionSignatureChecker::CheckSequence(const CScriptNum& nSequence) con
     return true;
 }
 
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror)
+namespace {
+
+//! Most pushes a scriptSig of a recognized template has: dummy, 16 signatures, redeemScript
+static const unsigned int MAX_TEMPLATE_PUSHES = 18;
+
+/**
+ * Evaluate script, which must consist of data pushes only, onto stack.
+ * Returns false without setting an error if it does not, or if the
+ * interpreter would have failed on it.
+ */
+bool EvalPushes(const CScript& script, unsigned int flags, CScriptStack& stack)
+{
+    stack.clear();
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    while (pc < script.end()) {
+        if (stack.size() == MAX_TEMPLATE_PUSHES)
+            return false;
+        valtype& vch = stack.push_back_reuse();
+        if (!script.GetOp(pc, opcode, vch) || opcode > OP_PUSHDATA4 || vch.size() > MAX_SCRIPT_ELEMENT_SIZE)
+            return false;
+        if ((flags & SCRIPT_VERIFY_MINIMALDATA) && !CheckMinimalPush(vch, opcode))
+            return false;
+    }
+    return true;
+}
+
+bool IsPayToPubKeyHash(const CScript& script)
+{
+    return script.size() == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 &&
+           script[2] == 20 && script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG;
+}
+
+/**
+ * Match OP_m <pubkey>... OP_n OP_CHECKMULTISIG with m and n up to 16 and
+ * every key a direct push of 33 or 65 bytes, leaving the keys in vPubKeys.
+ */
+bool MatchMultisig(const CScript& script, int& nRequired, CScriptStack& vPubKeys)
+{
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    if (!script.GetOp(pc, opcode) || opcode < OP_1 || opcode > OP_16)
+        return false;
+    nRequired = CScript::DecodeOP_N(opcode);
+    vPubKeys.clear();
+    while (true) {
+        if (!script.GetOp(pc, opcode, vPubKeys.push_back_reuse()))
+            return false;
+        if (opcode >= OP_1 && opcode <= OP_16)
+            break;
+        if (opcode != vPubKeys.back().size() || (opcode != 33 && opcode != 65))
+            return false;
+    }
+    vPubKeys.pop_back();
+    if (CScript::DecodeOP_N(opcode) != (int)vPubKeys.size() || nRequired > (int)vPubKeys.size())
+        return false;
+    return script.GetOp(pc, opcode) && opcode == OP_CHECKMULTISIG && pc == script.end();
+}
+
+} // anon namespace
+
+bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, bool& fResult, ScriptError* serror, CScriptArena* parena)
+{
+    CScriptArena arenaLocal;
+    CScriptArena& arena = parena ? *parena : arenaLocal;
+    CScriptStack& stack = arena.stack;
+    if (!EvalPushes(scriptSig, flags, stack))
+        return false;
+
+    if (IsPayToPubKeyHash(scriptPubKey)) {
+        // <sig> <pubkey> | OP_DUP OP_HASH160 <hash> OP_EQUALVERIFY OP_CHECKSIG
+        if (stack.size() != 2)
+            return false;
+        const valtype& vchSig = stack.top(-2);
+        const valtype& vchPubKey = stack.top(-1);
+        unsigned char hash[CHash160::OUTPUT_SIZE];
+        CHash160().Write(begin_ptr(vchPubKey), vchPubKey.size()).Finalize(hash);
+        if (memcmp(hash, &scriptPubKey[3], sizeof(hash)) != 0) {
+            fResult = set_error(serror, SCRIPT_ERR_EQUALVERIFY);
+            return true;
+        }
+        // A push of a signature this long cannot occur in the 25 byte script
+        CScript scriptCode(scriptPubKey);
+        if (vchSig.size() < scriptCode.size())
+            scriptCode.FindAndDelete(CScript(vchSig));
+        if (!CheckSignatureEncoding(vchSig, flags, serror) || !CheckPubKeyEncoding(vchPubKey, flags, serror)) {
+            fResult = false;
+            return true;
+        }
+        if (checker.CheckSig(vchSig, vchPubKey, scriptCode))
+            fResult = set_success(serror);
+        else
+            fResult = set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+        return true;
+    }
+
+    // m-of-n multisig, bare or wrapped in P2SH:
+    // OP_0 <sig>... | OP_m <pubkey>... OP_n OP_CHECKMULTISIG
+    // OP_0 <sig>... <redeemScript> | OP_HASH160 <hash> OP_EQUAL
+    const CScript* pscriptMultisig = &scriptPubKey;
+    CScript redeemScript;
+    if (scriptPubKey.IsPayToScriptHash()) {
+        if (!(flags & SCRIPT_VERIFY_P2SH) || stack.empty())
+            return false;
+        const valtype& vchRedeem = stack.back();
+        unsigned char hash[CHash160::OUTPUT_SIZE];
+        CHash160().Write(begin_ptr(vchRedeem), vchRedeem.size()).Finalize(hash);
+        if (memcmp(hash, &scriptPubKey[2], sizeof(hash)) != 0) {
+            fResult = set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+            return true;
+        }
+        redeemScript = CScript(vchRedeem.begin(), vchRedeem.end());
+        stack.pop_back();
+        pscriptMultisig = &redeemScript;
+    }
+    CScriptStack& vPubKeys = arena.stackCopy;
+    int nRequired;
+    if (!MatchMultisig(*pscriptMultisig, nRequired, vPubKeys))
+        return false;
+    if (stack.size() != (size_t)nRequired + 1)
+        return false;
+    if ((flags & SCRIPT_VERIFY_NULLDUMMY) && !stack.begin()->empty())
+        return false;
+
+    // From here on exactly as OP_CHECKMULTISIG: signatures and keys are
+    // tried from the last one backwards
+    CScript scriptCode(*pscriptMultisig);
+    for (int k = 0; k < nRequired; k++)
+        scriptCode.FindAndDelete(CScript(stack.top(-1 - k)));
+
+    int nSigsCount = nRequired;
+    int nKeysCount = vPubKeys.size();
+    int isig = -1;
+    int ikey = -1;
+    bool fSuccess = true;
+    while (fSuccess && nSigsCount > 0) {
+        const valtype& vchSig = stack.top(isig);
+        const valtype& vchPubKey = vPubKeys.top(ikey);
+        if (!CheckSignatureEncoding(vchSig, flags, serror) || !CheckPubKeyEncoding(vchPubKey, flags, serror)) {
+            fResult = false;
+            return true;
+        }
+        if (checker.CheckSig(vchSig, vchPubKey, scriptCode)) {
+            isig--;
+            nSigsCount--;
+        }
+        ikey--;
+        nKeysCount--;
+        if (nSigsCount > nKeysCount)
+            fSuccess = false;
+    }
+    if (fSuccess)
+        fResult = set_success(serror);
+    else
+        fResult = set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+    return true;
+}
+
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror, CScriptArena* parena)
+{
+    bool fResult;
+    if (VerifyStandardScript(scriptSig, scriptPubKey, flags, checker, fResult, serror, parena))
+        return fResult;
+    return VerifyScriptInterpreted(scriptSig, scriptPubKey, flags, checker, serror, parena);
+}
+
+bool VerifyScriptInterpreted(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* serror, CScriptArena* parena)
 {
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR); // δ֪ʹ
 
@@ -1247,13 +1505,17 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigne
         return set_error(serror, SCRIPT_ERR_SIG_PUSHONLY); // ôϢ
     }
 
-    vector<vector<unsigned char> > stack, stackCopy; // ջջ
-    if (!EvalScript(stack, scriptSig, flags, checker, serror)) // űͨűǩ
+    CScriptArena arenaLocal;
+    CScriptArena& arena = parena ? *parena : arenaLocal;
+    CScriptStack& stack = arena.stack; // ջ
+    CScriptStack& stackCopy = arena.stackCopy; // ջ
+    stack.clear();
+    if (!EvalScript(stack, scriptSig, flags, checker, serror, &arena.altstack)) // űͨűǩ
         // serror is set // 
         return false;
     if (flags & SCRIPT_VERIFY_P2SH) // Ϊ SCRIPT_VERIFY_P2SH
         stackCopy = stack; // ջ
-    if (!EvalScript(stack, scriptPubKey, flags, checker, serror)) // ٴűͨűԿ
+    if (!EvalScript(stack, scriptPubKey, flags, checker, serror, &arena.altstack)) // ٴűͨűԿ
         // serror is set // 
         return false;
     if (stack.empty()) // ջΪ
@@ -1269,7 +1531,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigne
             return set_error(serror, SCRIPT_ERR_SIG_PUSHONLY);
 
         // Restore stack. // 洢ջ
-        swap(stack, stackCopy);
+        stack.swap(stackCopy);
 
         // stack cannot be empty here, because if it was the // ջﲻΪգΪ
         // P2SH  HASH <> EQUAL  scriptPubKey would be evaluated with // P2SH  HASH <> EQUAL űԿ
@@ -1280,7 +1542,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigne
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end()); // Կű
         popstack(stack); // ջ
 
-        if (!EvalScript(stack, pubKey2, flags, checker, serror)) // ʹµĹԿűű
+        if (!EvalScript(stack, pubKey2, flags, checker, serror, &arena.altstack)) // ʹµĹԿűű
             // serror is set
             return false;
         if (stack.empty()) // ջΪ
@@ -7,8 +7,10 @@
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
 #include "script_error.h"
+#include "crypto/sha256.h"
 #include "primitives/transaction.h"
 
+#include <stdexcept>
 #include <vector>
 #include <stdint.h>
 #include <string>
@@ -90,7 +92,32 @@ enum // 
 
 bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned int flags, ScriptError* serror);
 
-uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+/**
+ * Signature hashing data of one transaction that is the same for all of its
+ * inputs, computed once and shared by the checks of every input.
+ *
+ * For SIGHASH_ALL, the message signed by input n is the transaction with every
+ * scriptSig blanked except input n's, which is replaced by the scriptCode.
+ * vchBlank holds the serialization with all scriptSigs blanked, and
+ * vPrefix[n] the SHA256 state after absorbing everything in it up to input n,
+ * so that only input n and what follows it has to be hashed per input instead
+ * of reserializing and rehashing the whole transaction.
+ */
+struct PrecomputedTransactionData
+{
+    bool fReady;
+    //! Offset of the first input in vchBlank
+    size_t nInputsBegin;
+    std::vector<unsigned char> vchBlank;
+    std::vector<CSHA256> vPrefix;
+
+    PrecomputedTransactionData() : fReady(false), nInputsBegin(0) {}
+    explicit PrecomputedTransactionData(const CTransaction& txTo) : fReady(false), nInputsBegin(0) { Init(txTo); }
+
+    void Init(const CTransaction& txTo);
+};
+
+uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const PrecomputedTransactionData* cache = NULL);
 
 class BaseSignatureChecker
 {
@@ -118,12 +145,13 @@ class TransactionSignatureChecker : public BaseSignatureChecker
 private:
     const CTransaction* txTo;
     unsigned int nIn;
+    const PrecomputedTransactionData* txdata;
 
 protected:
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 
 public:
-    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn) : txTo(txToIn), nIn(nInIn) {}
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const PrecomputedTransactionData* txdataIn = NULL) : txTo(txToIn), nIn(nInIn), txdata(txdataIn) {}
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const;
     bool CheckLockTime(const CScriptNum& nLockTime) const;
     bool CheckSequence(const CScriptNum& nSequence) const;
@@ -138,7 +166,128 @@ public:
     MutableTransactionSignatureChecker(const CMutableTransaction* txToIn, unsigned int nInIn) : TransactionSignatureChecker(&txTo, nInIn), txTo(*txToIn) {}
 };
 
+/**
+ * Stack of the script interpreter.
+ *
+ * Popped elements are not freed but kept past the top of the stack, and later
+ * pushes overwrite them in place. A stack that is reused from one script to
+ * the next therefore stops allocating once it has held elements as large and
+ * as many as the scripts it runs.
+ */
+class CScriptStack
+{
+public:
+    typedef std::vector<unsigned char> value_type;
+    typedef std::vector<value_type>::iterator iterator;
+    typedef std::vector<value_type>::const_iterator const_iterator;
+
+private:
+    //! Elements [0, nSize) are on the stack, the rest are spare buffers
+    std::vector<value_type> vElems;
+    size_t nSize;
+
+public:
+    CScriptStack() : nSize(0) {}
+
+    CScriptStack(const CScriptStack& other) : nSize(0) { *this = other; }
+
+    CScriptStack& operator=(const CScriptStack& other)
+    {
+        if (this != &other) {
+            clear();
+            for (const_iterator it = other.begin(); it != other.end(); ++it)
+                push_back(*it);
+        }
+        return *this;
+    }
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator begin() { return vElems.begin(); }
+    iterator end() { return vElems.begin() + nSize; }
+    const_iterator begin() const { return vElems.begin(); }
+    const_iterator end() const { return vElems.begin() + nSize; }
+
+    /** Element i from the top, i.e. top(-1) is the topmost one */
+    value_type& top(int i)
+    {
+        if (i >= 0 || (size_t)-i > nSize)
+            throw std::out_of_range("CScriptStack::top(): out of range");
+        return vElems[nSize + i];
+    }
+
+    value_type& back() { return top(-1); }
+    const value_type& back() const { return vElems.at(nSize - 1); }
+
+    /** Push an element with stale contents, for the caller to overwrite */
+    value_type& push_back_reuse()
+    {
+        if (nSize == vElems.size())
+            vElems.push_back(value_type());
+        return vElems[nSize++];
+    }
+
+    /** Push a copy of vch, which may be an element of this stack */
+    void push_back(const value_type& vch)
+    {
+        if (nSize < vElems.size())
+            vElems[nSize].assign(vch.begin(), vch.end());
+        else
+            vElems.push_back(vch);
+        nSize++;
+    }
+
+    void pop_back()
+    {
+        if (nSize == 0)
+            throw std::out_of_range("CScriptStack::pop_back(): empty stack");
+        nSize--;
+    }
+
+    void clear() { nSize = 0; }
+
+    /** Exchange the elements on the stack with the ones in v */
+    void swap(std::vector<value_type>& v)
+    {
+        vElems.resize(nSize);
+        vElems.swap(v);
+        nSize = vElems.size();
+    }
+
+    void swap(CScriptStack& other)
+    {
+        vElems.swap(other.vElems);
+        std::swap(nSize, other.nSize);
+    }
+};
+
+/**
+ * Stacks VerifyScript evaluates in. A caller that verifies many scripts, such
+ * as a script check thread, can keep one around so the stack elements of one
+ * script are reused by the next.
+ */
+struct CScriptArena
+{
+    CScriptStack stack;
+    CScriptStack stackCopy;
+    CScriptStack altstack;
+};
+
 bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL); // ű
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL); // ֤ű
+bool EvalScript(CScriptStack& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL, CScriptStack* paltstack = NULL);
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL, CScriptArena* parena = NULL); // ֤ű
+
+/**
+ * Verify a spend of a P2PKH output, or of a bare or P2SH m-of-n multisig one,
+ * without going through the interpreter. Returns false if the scripts do not
+ * have one of those shapes (or would make the interpreter fail before checking
+ * a signature), in which case nothing was checked. Otherwise returns true and
+ * sets fResult and error exactly as running the scripts would.
+ */
+bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, bool& fResult, ScriptError* error = NULL, CScriptArena* parena = NULL);
+
+/** VerifyScript without the fast paths of VerifyStandardScript */
+bool VerifyScriptInterpreted(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL, CScriptArena* parena = NULL);
 
 #endif // BITCOIN_SCRIPT_INTERPRETER_H
@@ -313,12 +313,25 @@ public:
         return serialize(m_value); // лֵ
     }
 
+    /** Serialize into vch, reusing its buffer */
+    void getvch(std::vector<unsigned char>& vch) const
+    {
+        serialize(m_value, vch);
+    }
+
     static std::vector<unsigned char> serialize(const int64_t& value)
     {
+        std::vector<unsigned char> result; // 
+        serialize(value, result);
+        return result; // лĽ
+    }
+
+    static void serialize(const int64_t& value, std::vector<unsigned char>& result)
+    {
+        result.clear();
         if(value == 0) // ֵΪ 0
-            return std::vector<unsigned char>(); // ֱӷʱб
+            return;
 
-        std::vector<unsigned char> result; // 
         const bool neg = value < 0; // 
         uint64_t absvalue = neg ? -value : value; // ֵ
 
@@ -342,8 +355,6 @@ public:
             result.push_back(neg ? 0x80 : 0); // Ϊ 0x80 0
         else if (neg) // Ϊ
             result.back() |= 0x80; //  8 λ׷ 0x80
-
-        return result; // лĽ
     }
 
 private:
@@ -5,44 +5,36 @@
 
 #include "sigcache.h"
 
-#include "memusage.h"
+#include "cuckoocache.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
-#include <boost/unordered_set.hpp>
+#include <boost/thread/tss.hpp>
 
 namespace {
 
-/**
- * We're hashing a nonce into the entries themselves, so we don't need extra
- * blinding in the set hash computation.
- */
-class CSignatureCacheHasher
-{
-public:
-    size_t operator()(const uint256& key) const {
-        return key.GetCheapHash();
-    }
-};
-
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
  * again when accepted into the block chain)
+ *
+ * Lookups take cs_sigcache shared, so the script check threads never block
+ * each other, and marking an entry for eviction is a lock-free atomic bit
+ * flip. Only inserts, which happen on mempool acceptance, take it exclusively.
  */
 class CSignatureCache
 {
 private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
-    typedef boost::unordered_set<uint256, CSignatureCacheHasher> map_type;
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
     map_type setValid;
     boost::shared_mutex cs_sigcache;
 
-
 public:
     CSignatureCache()
     {
@@ -56,54 +48,111 @@ public:
     }
 
     bool
-    Get(const uint256& entry)
+    Get(const uint256& entry, const bool erase)
     {
         boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.count(entry);
+        return setValid.contains(entry, erase);
     }
 
-    void Erase(const uint256& entry)
+    void Set(const uint256& entry)
     {
         boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.erase(entry);
+        setValid.insert(entry);
     }
 
-    void Set(const uint256& entry)
+    uint32_t setup_bytes(size_t n)
     {
-        size_t nMaxCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-        if (nMaxCacheSize <= 0) return;
-
         boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
-        {
-            map_type::size_type s = GetRand(setValid.bucket_count());
-            map_type::local_iterator it = setValid.begin(s);
-            if (it != setValid.end(s)) {
-                setValid.erase(*it);
-            }
-        }
+        return setValid.setup_bytes(n);
+    }
+};
 
-        setValid.insert(entry);
+// Not a local static in VerifySignature, so InitSignatureCache can size it and
+// every signature check does not pay for the static's thread-safe guard
+static CSignatureCache signatureCache;
+
+/**
+ * Recently parsed public keys, one cache per script check thread so lookups
+ * need no locking. Keys that sign many inputs (such as a busy exchange
+ * address, or every input of a consolidation) are only decompressed once.
+ *
+ * Direct mapped on the first bytes of the key's x coordinate: a colliding key
+ * just replaces the slot, and entries are compared in full, so chosen keys
+ * can cost extra parsing but never a wrong result.
+ */
+class CParsedPubKeyCache
+{
+private:
+    static const size_t SLOTS = 1024;
+
+    struct Entry {
+        CPubKey pubkey;
+        CParsedPubKey parsed;
+    };
+    std::vector<Entry> vEntries;
+
+public:
+    CParsedPubKeyCache() : vEntries(SLOTS) {}
+
+    //! Return the parsed form of pubkey, or NULL if it is not a valid point
+    const CParsedPubKey* Get(const CPubKey& pubkey, bool& fHit)
+    {
+        uint32_t n = 0;
+        if (pubkey.size() >= 5)
+            memcpy(&n, pubkey.begin() + 1, 4);
+        Entry& entry = vEntries[n % SLOTS];
+        fHit = entry.parsed.IsValid() && entry.pubkey == pubkey;
+        if (!fHit) {
+            if (!entry.parsed.Set(pubkey))
+                return NULL;
+            entry.pubkey = pubkey;
+        }
+        return &entry.parsed;
     }
 };
 
+boost::thread_specific_ptr<CParsedPubKeyCache> parsedPubKeyCache;
+boost::atomic<uint64_t> nParsedPubKeyHits(0);
+boost::atomic<uint64_t> nParsedPubKeyMisses(0);
 }
 
-bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+void GetParsedPubKeyCacheStats(uint64_t& nHits, uint64_t& nMisses)
 {
-    static CSignatureCache signatureCache;
+    nHits = nParsedPubKeyHits.load(boost::memory_order_relaxed);
+    nMisses = nParsedPubKeyMisses.load(boost::memory_order_relaxed);
+}
 
+// To be called once in AppInit2/TestingSetup to initialize the signatureCache
+void InitSignatureCache()
+{
+    // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
+    // setup_bytes creates the minimum possible cache (2 elements). The other
+    // half of -maxsigcachesize goes to the script execution cache.
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20) / 2;
+    size_t nElems = signatureCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for signature cache, able to store %zu elements\n",
+              (nElems * sizeof(uint256)) >> 20, nMaxCacheSize >> 20, nElems);
+}
+
+bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(entry)) {
-        if (!store) {
-            signatureCache.Erase(entry);
-        }
+    // An entry checked again while connecting a block is unlikely to be
+    // needed after that, so it is allowed to be evicted
+    if (signatureCache.Get(entry, !store))
         return true;
-    }
 
-    if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
+    CParsedPubKeyCache* pcache = parsedPubKeyCache.get();
+    if (!pcache) {
+        pcache = new CParsedPubKeyCache();
+        parsedPubKeyCache.reset(pcache);
+    }
+    bool fHit;
+    const CParsedPubKey* pparsed = pcache->Get(pubkey, fHit);
+    (fHit ? nParsedPubKeyHits : nParsedPubKeyMisses).fetch_add(1, boost::memory_order_relaxed);
+    if (!pparsed || !pparsed->Verify(sighash, vchSig))
         return false;
 
     if (store) {
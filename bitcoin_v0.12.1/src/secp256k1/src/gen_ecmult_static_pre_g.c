@@ -0,0 +1,86 @@
+/**********************************************************************
+ * Copyright (c) 2013, 2014, 2015 Thomas Daede, Cory Fields           *
+ * Distributed under the MIT software license, see the accompanying   *
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.*
+ **********************************************************************/
+
+#define USE_BASIC_CONFIG 1
+
+#include "basic-config.h"
+#include "include/secp256k1.h"
+#include "field_impl.h"
+#include "scalar_impl.h"
+#include "group_impl.h"
+#include "ecmult_impl.h"
+
+static void default_error_callback_fn(const char* str, void* data) {
+    (void)data;
+    fprintf(stderr, "[libsecp256k1] internal consistency check failed: %s\n", str);
+    abort();
+}
+
+static const secp256k1_callback default_error_callback = {
+    default_error_callback_fn,
+    NULL
+};
+
+static void print_table(FILE *fp, const char *name, const secp256k1_gej *gj) {
+    secp256k1_ge_storage* table;
+    int j;
+
+    table = (secp256k1_ge_storage*)checked_malloc(&default_error_callback, sizeof(table[0]) * ECMULT_TABLE_SIZE(WINDOW_G));
+    secp256k1_ecmult_odd_multiples_table_storage_var(ECMULT_TABLE_SIZE(WINDOW_G), table, gj, &default_error_callback);
+
+    fprintf(fp, "static const secp256k1_ge_storage %s[ECMULT_TABLE_SIZE(%d)] = {\n", name, WINDOW_G);
+    for (j = 0; j != ECMULT_TABLE_SIZE(WINDOW_G); j++) {
+        fprintf(fp,"    SC(%uu, %uu, %uu, %uu, %uu, %uu, %uu, %uu, %uu, %uu, %uu, %uu, %uu, %uu, %uu, %uu)", SECP256K1_GE_STORAGE_CONST_GET(table[j]));
+        if (j != ECMULT_TABLE_SIZE(WINDOW_G) - 1) {
+            fprintf(fp,",\n");
+        } else {
+            fprintf(fp,"\n");
+        }
+    }
+    fprintf(fp,"};\n");
+    free(table);
+}
+
+int main(int argc, char **argv) {
+    secp256k1_gej gj;
+    secp256k1_gej g_128j;
+    int i;
+    FILE* fp;
+
+    (void)argc;
+    (void)argv;
+
+    fp = fopen("src/ecmult_static_pre_g.h","w");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not open src/ecmult_static_pre_g.h for writing!\n");
+        return -1;
+    }
+
+    fprintf(fp, "#ifndef _SECP256K1_ECMULT_STATIC_PRE_G_\n");
+    fprintf(fp, "#define _SECP256K1_ECMULT_STATIC_PRE_G_\n");
+    fprintf(fp, "#include \"group.h\"\n");
+    fprintf(fp, "#define ECMULT_STATIC_PRE_G_WINDOW %d\n", WINDOW_G);
+    fprintf(fp, "#define SC SECP256K1_GE_STORAGE_CONST\n");
+
+    /* odd multiples of the generator */
+    secp256k1_gej_set_ge(&gj, &secp256k1_ge_const_g);
+    print_table(fp, "secp256k1_ecmult_static_pre_g", &gj);
+
+    /* odd multiples of 2^128*generator, only used with the endomorphism */
+    g_128j = gj;
+    for (i = 0; i < 128; i++) {
+        secp256k1_gej_double_var(&g_128j, &g_128j, NULL);
+    }
+    fprintf(fp, "#ifdef USE_ENDOMORPHISM\n");
+    print_table(fp, "secp256k1_ecmult_static_pre_g_128", &g_128j);
+    fprintf(fp, "#endif\n");
+
+    fprintf(fp, "#undef SC\n");
+    fprintf(fp, "#endif\n");
+    fclose(fp);
+
+    return 0;
+}
@@ -491,6 +491,12 @@ template<typename C> unsigned int GetSerializeSize(const std::basic_string<C>& s
 template<typename Stream, typename C> void Serialize(Stream& os, const std::basic_string<C>& str, int, int=0);
 template<typename Stream, typename C> void Unserialize(Stream& is, std::basic_string<C>& str, int, int=0);
 
+/**
+ * Storage that outlives the stream for nSize bytes of deserialized data, or NULL
+ * to allocate as usual. Only streams that read into an arena provide any.
+ */
+template<typename Stream> inline char* SerArenaAllocate(Stream& s, size_t nSize) { return NULL; }
+
 /**
  * prevector
  * prevectors of unsigned char are a special case and are intended to be serialized as a single opaque blob.
@@ -654,6 +660,14 @@ void Unserialize_impl(Stream& is, prevector<N, T>& v, int nType, int nVersion, c
     // Limit size per read so bogus size value won't cause out of memory
     v.clear();
     unsigned int nSize = ReadCompactSize(is);
+    if (nSize > N) {
+        char* storage = SerArenaAllocate(is, nSize * sizeof(T));
+        if (storage) {
+            v.assign_external(storage, nSize);
+            is.read((char*)&v[0], nSize * sizeof(T));
+            return;
+        }
+    }
     unsigned int i = 0;
     while (i < nSize)
     {
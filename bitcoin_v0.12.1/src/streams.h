@@ -14,6 +14,7 @@
 #include <ios>
 #include <limits>
 #include <map>
+#include <new>
 #include <set>
 #include <stdint.h>
 #include <stdio.h>
@@ -497,6 +498,9 @@ public:
         fclose();
     }
 
+    int GetType()                { return nType; }
+    int GetVersion()             { return nVersion; }
+
     void fclose()
     {
         if (src) {
@@ -592,4 +596,117 @@ public:
     }
 };
 
+/**
+ * Bump allocator for the deserialized contents of one block. Nothing is freed
+ * until the whole arena is, so the scripts of all of a block's transactions
+ * can share a few large allocations instead of taking one each.
+ */
+class CBlockArena
+{
+private:
+    // Disallow copies
+    CBlockArena(const CBlockArena&);
+    CBlockArena& operator=(const CBlockArena&);
+
+    std::vector<char*> vChunks;
+    char* pNext;
+    size_t nLeft;
+    size_t nNextChunk;
+    size_t nAllocated;
+
+public:
+    //! Larger requests are not served, so a bogus length read from the stream
+    //! cannot make the arena grab much memory before the read fails.
+    static const size_t MAX_ALLOCATION = 1 << 16;
+    static const size_t MIN_CHUNK = 1 << 16;
+    static const size_t MAX_CHUNK = 1 << 20;
+
+    //! nSizeHint: the serialized size of what will be read, if known
+    explicit CBlockArena(size_t nSizeHint = 0) : pNext(NULL), nLeft(0), nAllocated(0)
+    {
+        nNextChunk = std::max(nSizeHint, (size_t)MIN_CHUNK);
+    }
+
+    ~CBlockArena()
+    {
+        for (size_t i = 0; i < vChunks.size(); i++)
+            free(vChunks[i]);
+    }
+
+    //! Returns NULL if nSize is over MAX_ALLOCATION
+    char* Allocate(size_t nSize)
+    {
+        if (nSize > MAX_ALLOCATION)
+            return NULL;
+        if (nSize > nLeft) {
+            char* chunk = static_cast<char*>(malloc(nNextChunk));
+            if (!chunk)
+                throw std::bad_alloc();
+            vChunks.push_back(chunk);
+            pNext = chunk;
+            nLeft = nNextChunk;
+            nAllocated += nNextChunk;
+            nNextChunk = std::min(2 * nNextChunk, std::max(nNextChunk, (size_t)MAX_CHUNK));
+        }
+        char* ret = pNext;
+        pNext += nSize;
+        nLeft -= nSize;
+        return ret;
+    }
+
+    //! Bytes held in chunks
+    size_t DynamicMemoryUsage() const { return nAllocated; }
+    size_t NumChunks() const { return vChunks.size(); }
+};
+
+/**
+ * Reads through to another stream, placing the storage of deserialized
+ * scripts in a CBlockArena. Everything read must not outlive the arena;
+ * copies of it are independent of the arena as usual.
+ */
+template<typename Stream>
+class CArenaReader
+{
+private:
+    Stream& stream;
+    CBlockArena& arena;
+    const int nType;
+    const int nVersion;
+
+public:
+    CArenaReader(Stream& streamIn, CBlockArena& arenaIn) :
+        stream(streamIn), arena(arenaIn), nType(streamIn.GetType()), nVersion(streamIn.GetVersion()) {}
+
+    int GetType() const          { return nType; }
+    int GetVersion() const       { return nVersion; }
+    CBlockArena& GetArena()      { return arena; }
+
+    void read(char* pch, size_t nSize)
+    {
+        stream.read(pch, nSize);
+    }
+
+    template<typename T>
+    CArenaReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+template<typename Stream> inline char* SerArenaAllocate(CArenaReader<Stream>& s, size_t nSize) { return s.GetArena().Allocate(nSize); }
+
+/**
+ * Deserialize a CBlock from s with the storage of its scripts in a new arena
+ * owned by the block. nSizeHint is the block's serialized size, if known.
+ */
+template<typename Stream, typename Block>
+void UnserializeBlockWithArena(Stream& s, Block& block, size_t nSizeHint = 0)
+{
+    block.SetNull();
+    block.arena.reset(new CBlockArena(nSizeHint));
+    CArenaReader<Stream> reader(s, *block.arena);
+    reader >> block;
+}
+
 #endif // BITCOIN_STREAMS_H
@@ -23,15 +23,29 @@
 #include <boost/test/unit_test.hpp>
 
 // Tests this internal-to-main.cpp method:
-extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
+extern bool AddOrphanTx(const CTransaction& tx, NodeId peer, unsigned int nMaxOrphansPerPeer);
 extern void EraseOrphansFor(NodeId peer);
 extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    int64_t nTimeExpire;
+    size_t nListPos;
 };
+struct IteratorComparator
+{
+    template<typename I>
+    bool operator()(const I& a, const I& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+typedef std::map<uint256, COrphanTx>::iterator OrphanIt;
+typedef std::set<OrphanIt, IteratorComparator> OrphanItSet;
 extern std::map<uint256, COrphanTx> mapOrphanTransactions; // ¶ӳб
-extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev; // ǰһʽ׵Ĺ¶ӳб
+extern std::map<COutPoint, OrphanItSet> mapOrphanTransactionsByPrev; // ĳĹ¶
+extern std::map<NodeId, OrphanItSet> mapOrphanTransactionsByPeer;
+extern std::vector<OrphanIt> vOrphanList;
 
 CService ip(uint32_t i)
 {
@@ -133,7 +147,7 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
 
-        AddOrphanTx(tx, i);
+        AddOrphanTx(tx, i, DEFAULT_MAX_ORPHAN_TRANSACTIONS_PER_PEER);
     }
 
     // ... and 50 that depend on other orphans:
@@ -150,7 +164,7 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
         SignSignature(keystore, txPrev, tx, 0);
 
-        AddOrphanTx(tx, i);
+        AddOrphanTx(tx, i, DEFAULT_MAX_ORPHAN_TRANSACTIONS_PER_PEER);
     }
 
     // This really-big orphan should be ignored:
@@ -174,7 +188,7 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         for (unsigned int j = 1; j < tx.vin.size(); j++)
             tx.vin[j].scriptSig = tx.vin[0].scriptSig;
 
-        BOOST_CHECK(!AddOrphanTx(tx, i));
+        BOOST_CHECK(!AddOrphanTx(tx, i, DEFAULT_MAX_ORPHAN_TRANSACTIONS_PER_PEER));
     }
 
     // Test EraseOrphansFor:
@@ -193,6 +207,63 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     LimitOrphanTxSize(0);
     BOOST_CHECK(mapOrphanTransactions.empty());
     BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPeer.empty());
+    BOOST_CHECK(vOrphanList.empty());
+}
+
+static CTransaction OrphanSpending(const uint256& hashPrev, uint32_t n)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(hashPrev, n);
+    tx.vin[0].scriptSig << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1*CENT;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(DoS_orphanQuotaAndExpiry)
+{
+    uint256 hashParent = GetRandHash();
+
+    // Orphans are indexed by the outpoint they spend
+    CTransaction tx0 = OrphanSpending(hashParent, 0);
+    CTransaction tx1 = OrphanSpending(hashParent, 1);
+    BOOST_CHECK(AddOrphanTx(tx0, 0, 2));
+    BOOST_CHECK(AddOrphanTx(tx1, 1, 2));
+    BOOST_CHECK(!AddOrphanTx(tx1, 1, 2));
+    BOOST_CHECK_EQUAL(mapOrphanTransactionsByPrev.size(), 2U);
+    BOOST_CHECK_EQUAL(mapOrphanTransactionsByPrev[COutPoint(hashParent, 1)].size(), 1U);
+    BOOST_CHECK((*mapOrphanTransactionsByPrev[COutPoint(hashParent, 1)].begin())->first == tx1.GetHash());
+    BOOST_CHECK(!mapOrphanTransactionsByPrev.count(COutPoint(hashParent, 2)));
+
+    // A peer at its quota replaces its own orphans instead of growing the pool
+    for (int i = 0; i < 10; i++)
+        BOOST_CHECK(AddOrphanTx(OrphanSpending(GetRandHash(), 0), 0, 2));
+    BOOST_CHECK_EQUAL(mapOrphanTransactionsByPeer[0].size(), 2U);
+    BOOST_CHECK_EQUAL(mapOrphanTransactionsByPeer[1].size(), 1U);
+    BOOST_CHECK(mapOrphanTransactions.count(tx1.GetHash()));
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 3U);
+    BOOST_CHECK_EQUAL(vOrphanList.size(), 3U);
+    BOOST_CHECK(!AddOrphanTx(OrphanSpending(GetRandHash(), 0), 2, 0));
+
+    // Orphans expire after ORPHAN_TX_EXPIRE_TIME
+    int64_t nStartTime = GetTime();
+    SetMockTime(nStartTime + ORPHAN_TX_EXPIRE_TIME + ORPHAN_TX_EXPIRE_INTERVAL);
+    CTransaction tx2 = OrphanSpending(hashParent, 2);
+    BOOST_CHECK(AddOrphanTx(tx2, 2, 2));
+    LimitOrphanTxSize(100);
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 1U);
+    BOOST_CHECK(mapOrphanTransactions.count(tx2.GetHash()));
+    BOOST_CHECK_EQUAL(mapOrphanTransactionsByPrev.size(), 1U);
+    BOOST_CHECK_EQUAL(vOrphanList.size(), 1U);
+
+    EraseOrphansFor(2);
+    BOOST_CHECK(mapOrphanTransactions.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPeer.empty());
+    SetMockTime(0);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
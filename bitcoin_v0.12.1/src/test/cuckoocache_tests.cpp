@@ -0,0 +1,236 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "uint256.h"
+
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+/** Test Suite for CuckooCache
+ *
+ *  1) All tests should have a deterministic result (using insecure rand
+ *  with deterministic seeds)
+ *  2) Results should be treated as a regression test, i.e., did the behavior
+ *  change significantly from what was expected. This can be OK, depending on
+ *  the nature of the change, but requires updating the tests to reflect the new
+ *  expected behavior. For example improving the hit rate may cause some tests
+ *  using BOOST_CHECK_CLOSE to fail.
+ */
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+typedef CuckooCache::cache<uint256, SignatureCacheHasher> sigcache_type;
+
+static uint256 InsecureRandHash()
+{
+    uint256 hash;
+    for (int i = 0; i < 8; i++) {
+        uint32_t n = insecure_rand();
+        memcpy(hash.begin() + 4 * i, &n, 4);
+    }
+    return hash;
+}
+
+static std::vector<uint256> InsecureRandHashes(size_t n)
+{
+    std::vector<uint256> hashes;
+    hashes.reserve(n);
+    for (size_t i = 0; i < n; i++)
+        hashes.push_back(InsecureRandHash());
+    return hashes;
+}
+
+static size_t CountContained(const sigcache_type& set, const std::vector<uint256>& hashes, size_t nBegin, size_t nEnd)
+{
+    size_t count = 0;
+    for (size_t i = nBegin; i < nEnd; i++)
+        count += set.contains(hashes[i], false);
+    return count;
+}
+
+/* Test that no values not inserted into the cache are read out of it.
+ *
+ * There are no repeats in the first 200000 insecure_rand calls
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_nothing_not_inserted)
+{
+    seed_insecure_rand(true);
+    sigcache_type cc;
+    cc.setup_bytes(1 << 20);
+    for (int x = 0; x < 100000; ++x)
+        cc.insert(InsecureRandHash());
+    for (int x = 0; x < 100000; ++x)
+        BOOST_CHECK(!cc.contains(InsecureRandHash(), false));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_setup_bytes)
+{
+    // The table holds exactly as many elements as fit in the given memory
+    sigcache_type cc;
+    BOOST_CHECK_EQUAL(cc.setup_bytes(4 << 20), (uint32_t)((4 << 20) / sizeof(uint256)));
+    sigcache_type cc_tiny;
+    BOOST_CHECK_EQUAL(cc_tiny.setup_bytes(0), 2U);
+}
+
+/** Fills a cache with load times its capacity of random elements and returns
+ * the fraction of them still present afterwards, normalized by the fraction
+ * that could possibly fit (1 / load when load exceeds the capacity).
+ */
+static double NormalizedHitRate(size_t megabytes, double load)
+{
+    seed_insecure_rand(true);
+    sigcache_type set;
+    uint32_t n_insert = (uint32_t)(load * set.setup_bytes(megabytes << 20));
+    std::vector<uint256> hashes = InsecureRandHashes(n_insert);
+    for (uint32_t i = 0; i < n_insert; ++i)
+        set.insert(hashes[i]);
+    double hit_rate = (double)CountContained(set, hashes, 0, n_insert) / (double)n_insert;
+    return hit_rate * std::max(1.0, load);
+}
+
+/** Check the hit rate on loads ranging from 10% to 160% of capacity.
+ *
+ * At low loads everything fits. At loads above 100% the cache is expected to
+ * hold on to nearly all of what fits, even though it never reallocates.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate_ok)
+{
+    const double HitRateThresh = 0.98;
+    const size_t megabytes = 4;
+    for (double load = 0.1; load < 2; load *= 2)
+        BOOST_CHECK(NormalizedHitRate(megabytes, load) > HitRateThresh);
+}
+
+/** Fill the cache to 90%, erase half of what went in, then insert another
+ * 90% worth: the new elements should take the place of the erased ones
+ * rather than of the ones that were kept.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_erase_ok)
+{
+    seed_insecure_rand(true);
+    sigcache_type set;
+    uint32_t n_insert = (uint32_t)(0.9 * set.setup_bytes(4 << 20));
+    std::vector<uint256> hashes = InsecureRandHashes(2 * n_insert);
+
+    for (uint32_t i = 0; i < n_insert; ++i)
+        set.insert(hashes[i]);
+    // Erase the first half
+    for (uint32_t i = 0; i < n_insert / 2; ++i)
+        BOOST_CHECK(set.contains(hashes[i], true));
+    // Erased elements stay readable until their slot is needed
+    BOOST_CHECK_EQUAL(CountContained(set, hashes, 0, n_insert / 2), n_insert / 2);
+
+    for (uint32_t i = n_insert; i < 2 * n_insert; ++i)
+        set.insert(hashes[i]);
+
+    double hit_rate_erased = (double)CountContained(set, hashes, 0, n_insert / 2) / (n_insert / 2.0);
+    double hit_rate_stale = (double)CountContained(set, hashes, n_insert / 2, n_insert) / (n_insert / 2.0);
+    double hit_rate_fresh = (double)CountContained(set, hashes, n_insert, 2 * n_insert) / n_insert;
+
+    // Check that our hit_rate_fresh is perfect
+    BOOST_CHECK_EQUAL(hit_rate_fresh, 1.0);
+    // Check that we have a more than 2x better hit rate on stale elements than
+    // erased elements.
+    BOOST_CHECK(hit_rate_stale > 2 * hit_rate_erased);
+}
+
+static void EraseRange(const sigcache_type* set, boost::shared_mutex* mtx, const std::vector<uint256>* hashes,
+                       size_t nBegin, size_t nEnd)
+{
+    boost::shared_lock<boost::shared_mutex> l(*mtx);
+    for (size_t i = nBegin; i < nEnd; ++i)
+        set->contains((*hashes)[i], true);
+}
+
+/** Same as cuckoocache_erase_ok, but with the erases spread over several
+ * threads holding a shared lock, as the script check threads do.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_erase_parallel_ok)
+{
+    seed_insecure_rand(true);
+    sigcache_type set;
+    uint32_t n_insert = (uint32_t)(0.9 * set.setup_bytes(4 << 20));
+    std::vector<uint256> hashes = InsecureRandHashes(2 * n_insert);
+    boost::shared_mutex mtx;
+
+    {
+        // Grab lock to make sure we release inserts
+        boost::unique_lock<boost::shared_mutex> l(mtx);
+        for (uint32_t i = 0; i < n_insert; ++i)
+            set.insert(hashes[i]);
+    }
+
+    // Spin up 3 threads to run contains with erase.
+    boost::thread_group threads;
+    size_t nPerThread = (n_insert / 2) / 3;
+    for (size_t x = 0; x < 3; ++x)
+        threads.create_thread(boost::bind(EraseRange, &set, &mtx, &hashes, x * nPerThread, (x + 1) * nPerThread));
+    threads.join_all();
+    size_t nErased = 3 * nPerThread;
+
+    {
+        boost::unique_lock<boost::shared_mutex> l(mtx);
+        for (uint32_t i = n_insert; i < 2 * n_insert; ++i)
+            set.insert(hashes[i]);
+    }
+
+    boost::shared_lock<boost::shared_mutex> l(mtx);
+    double hit_rate_erased = (double)CountContained(set, hashes, 0, nErased) / nErased;
+    double hit_rate_stale = (double)CountContained(set, hashes, nErased, n_insert) / (n_insert - nErased);
+    double hit_rate_fresh = (double)CountContained(set, hashes, n_insert, 2 * n_insert) / n_insert;
+
+    BOOST_CHECK_EQUAL(hit_rate_fresh, 1.0);
+    BOOST_CHECK(hit_rate_stale > 2 * hit_rate_erased);
+}
+
+/** Simulate the cache across many blocks: every block inserts a batch of new
+ * elements (mempool acceptance) and reads and erases most of an older batch
+ * (block connection). Elements inserted within the last few blocks must all
+ * still be there, even though the cache has been overwritten many times.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_generations)
+{
+    // Fraction of the cache one block inserts
+    const double BLOCK_FRACTION = 1.0 / 16;
+    // Fraction of a block's inserts that a later block erases
+    const double ERASE_FRACTION = 0.75;
+    // How many blocks an insert waits before being erased
+    const size_t BLOCK_DELAY = 4;
+    // How many blocks' worth of recent inserts are checked
+    const size_t RECENT_BLOCKS = 4;
+    const size_t TOTAL_BLOCKS = 200;
+
+    seed_insecure_rand(true);
+    sigcache_type set;
+    size_t nPerBlock = (size_t)(BLOCK_FRACTION * set.setup_bytes(1 << 20));
+    std::vector<std::vector<uint256> > blocks;
+    size_t nOutOfSightMisses = 0;
+    for (size_t b = 0; b < TOTAL_BLOCKS; b++) {
+        blocks.push_back(InsecureRandHashes(nPerBlock));
+        for (size_t i = 0; i < nPerBlock; i++)
+            set.insert(blocks.back()[i]);
+        if (blocks.size() > BLOCK_DELAY) {
+            const std::vector<uint256>& old = blocks[blocks.size() - 1 - BLOCK_DELAY];
+            for (size_t i = 0; i < (size_t)(ERASE_FRACTION * nPerBlock); i++)
+                nOutOfSightMisses += !set.contains(old[i], true);
+        }
+        if (blocks.size() > RECENT_BLOCKS) {
+            size_t nMissing = 0;
+            for (size_t r = blocks.size() - RECENT_BLOCKS; r < blocks.size(); r++)
+                nMissing += nPerBlock - CountContained(set, blocks[r], 0, nPerBlock);
+            BOOST_CHECK_EQUAL(nMissing, 0U);
+        }
+    }
+    // Elements read back BLOCK_DELAY blocks after insertion were all found
+    BOOST_CHECK_EQUAL(nOutOfSightMisses, 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
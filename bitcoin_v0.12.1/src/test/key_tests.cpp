@@ -5,7 +5,9 @@
 #include "key.h"
 
 #include "base58.h"
+#include "primitives/transaction.h"
 #include "script/script.h"
+#include "script/sigcache.h"
 #include "uint256.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -188,4 +190,55 @@ BOOST_AUTO_TEST_CASE(key_test1)
     BOOST_CHECK(detsigc == ParseHex("2052d8a32079c11e79db95af63bb9600c5b04f21a9ca33dc129c2bfa8ac9dc1cd561d8ae5e0f6c1a16bde3719c64c2fd70e404b6428ab9a69566962e8771b5944d"));
 }
 
+BOOST_AUTO_TEST_CASE(parsed_pubkey)
+{
+    CBitcoinSecret bsecret1, bsecret1C, bsecret2C;
+    BOOST_CHECK(bsecret1.SetString(strSecret1));
+    BOOST_CHECK(bsecret1C.SetString(strSecret1C));
+    BOOST_CHECK(bsecret2C.SetString(strSecret2C));
+    CKey key1 = bsecret1.GetKey();
+    CKey key1C = bsecret1C.GetKey();
+    CPubKey pubkey1 = key1.GetPubKey();
+    CPubKey pubkey1C = key1C.GetPubKey();
+    CPubKey pubkey2C = bsecret2C.GetKey().GetPubKey();
+
+    string strMsg = "Very parsed message";
+    uint256 hashMsg = Hash(strMsg.begin(), strMsg.end());
+    vector<unsigned char> sign1, sign1C;
+    BOOST_CHECK(key1.Sign(hashMsg, sign1));
+    BOOST_CHECK(key1C.Sign(hashMsg, sign1C));
+
+    // A parsed key verifies exactly what the serialized one does
+    CParsedPubKey parsed1, parsed1C;
+    BOOST_CHECK(parsed1.Set(pubkey1));
+    BOOST_CHECK(parsed1C.Set(pubkey1C));
+    BOOST_CHECK(parsed1.Verify(hashMsg, sign1));
+    BOOST_CHECK(parsed1C.Verify(hashMsg, sign1C));
+    BOOST_CHECK(parsed1C.Verify(hashMsg, sign1));
+    BOOST_CHECK(!parsed1.Verify(hashMsg, vector<unsigned char>()));
+    BOOST_CHECK(!parsed1.Verify(Hash(strMsg.begin(), strMsg.end() - 1), sign1));
+
+    // Invalid points do not parse
+    CParsedPubKey parsedBad;
+    std::vector<unsigned char> vchBad(pubkey1C.begin(), pubkey1C.end());
+    vchBad[0] = 0x05;
+    BOOST_CHECK(!parsedBad.Set(CPubKey(vchBad)));
+    BOOST_CHECK(!parsedBad.IsValid());
+    BOOST_CHECK(!parsedBad.Verify(hashMsg, sign1C));
+
+    // Signature checks outside the signature cache parse a key once per thread
+    CTransaction tx;
+    CachingTransactionSignatureChecker checker(&tx, 0, false);
+    uint64_t nHitsBefore, nMissesBefore, nHits, nMisses;
+    GetParsedPubKeyCacheStats(nHitsBefore, nMissesBefore);
+    BOOST_CHECK(checker.VerifySignature(sign1C, pubkey1C, hashMsg));
+    BOOST_CHECK(checker.VerifySignature(sign1C, pubkey1C, hashMsg));
+    BOOST_CHECK(!checker.VerifySignature(sign1C, pubkey2C, hashMsg));
+    BOOST_CHECK(checker.VerifySignature(sign1C, pubkey1C, hashMsg));
+    BOOST_CHECK(!checker.VerifySignature(sign1C, CPubKey(vchBad), hashMsg));
+    GetParsedPubKeyCacheStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nHits - nHitsBefore, 2U);
+    BOOST_CHECK_EQUAL(nMisses - nMissesBefore, 3U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,88 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "consensus/validation.h"
+#include "key.h"
+#include "main.h"
+#include "random.h"
+#include "script/standard.h"
+#include "txmempool.h"
+#include "utiltime.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(mempool_persist_tests, TestChain100Setup)
+
+// Spends the first output of txPrev, which pays to key, back to key
+static CTransaction CreateSpend(const CTransaction& txPrev, const CKey& key, CAmount nFee)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = txPrev.vout[0].nValue - nFee;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(mempool_dump_load)
+{
+    CTransaction txParent = CreateSpend(coinbaseTxns[0], coinbaseKey, 10000);
+    CTransaction txChild = CreateSpend(txParent, coinbaseKey, 10000);
+    int64_t nTimeParent = GetTime() - 200;
+    int64_t nTimeChild = GetTime() - 100;
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPoolWithTime(mempool, state, txParent, false, NULL, nTimeParent));
+        BOOST_CHECK(AcceptToMemoryPoolWithTime(mempool, state, txChild, false, NULL, nTimeChild));
+    }
+    uint256 hashOther = GetRandHash();
+    mempool.PrioritiseTransaction(txChild.GetHash(), txChild.GetHash().ToString(), 0, 5000);
+    mempool.PrioritiseTransaction(hashOther, hashOther.ToString(), 1.0, 3000);
+
+    // Transactions come back with their entry times, deltas come back for
+    // transactions in and out of the mempool
+    BOOST_CHECK(DumpMempool());
+    mempool.clear();
+    mempool.ClearPrioritisation(txChild.GetHash());
+    mempool.ClearPrioritisation(hashOther);
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 2U);
+    {
+        LOCK(mempool.cs);
+        CTxMemPool::txiter it = mempool.mapTx.find(txParent.GetHash());
+        BOOST_CHECK(it != mempool.mapTx.end() && it->GetTime() == nTimeParent);
+        it = mempool.mapTx.find(txChild.GetHash());
+        BOOST_CHECK(it != mempool.mapTx.end() && it->GetTime() == nTimeChild);
+        BOOST_CHECK_EQUAL(it->GetModifiedFee(), 15000);
+    }
+    double dPriorityDelta = 0;
+    CAmount nFeeDelta = 0;
+    mempool.ApplyDeltas(hashOther, dPriorityDelta, nFeeDelta);
+    BOOST_CHECK_EQUAL(dPriorityDelta, 1.0);
+    BOOST_CHECK_EQUAL(nFeeDelta, 3000);
+
+    // Expired transactions are not loaded
+    BOOST_CHECK(DumpMempool());
+    mempool.clear();
+    SetMockTime(GetTime() + DEFAULT_MEMPOOL_EXPIRY * 60 * 60);
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+    SetMockTime(0);
+
+    mempool.ClearPrioritisation(txChild.GetHash());
+    mempool.ClearPrioritisation(hashOther);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
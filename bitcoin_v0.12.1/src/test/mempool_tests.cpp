@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "random.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -317,6 +318,295 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     CheckSort<3>(pool, sortedOrder);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    entry.hadNoDependencies = true;
+
+    /* 3rd highest fee */
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(10000LL).Priority(10.0).FromTx(tx1));
+
+    /* highest fee */
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 2 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(20000LL).Priority(9.0).FromTx(tx2));
+    uint64_t tx2Size = ::GetSerializeSize(tx2, SER_NETWORK, PROTOCOL_VERSION);
+
+    /* lowest fee */
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(0LL).Priority(100.0).FromTx(tx3));
+
+    /* 2nd highest fee */
+    CMutableTransaction tx4 = CMutableTransaction();
+    tx4.vout.resize(1);
+    tx4.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx4.vout[0].nValue = 6 * COIN;
+    pool.addUnchecked(tx4.GetHash(), entry.Fee(15000LL).Priority(1.0).FromTx(tx4));
+
+    /* equal fee rate to tx1, but newer */
+    CMutableTransaction tx5 = CMutableTransaction();
+    tx5.vout.resize(1);
+    tx5.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx5.vout[0].nValue = 11 * COIN;
+    pool.addUnchecked(tx5.GetHash(), entry.Fee(10000LL).FromTx(tx5));
+    BOOST_CHECK_EQUAL(pool.size(), 5);
+
+    std::vector<std::string> sortedOrder;
+    sortedOrder.resize(5);
+    sortedOrder[0] = tx2.GetHash().ToString(); // 20000
+    sortedOrder[1] = tx4.GetHash().ToString(); // 15000
+    // tx1 and tx5 are both 10000
+    // Ties are broken by hash, not timestamp, so determine which
+    // hash comes first.
+    if (tx1.GetHash() < tx5.GetHash()) {
+        sortedOrder[2] = tx1.GetHash().ToString();
+        sortedOrder[3] = tx5.GetHash().ToString();
+    } else {
+        sortedOrder[2] = tx5.GetHash().ToString();
+        sortedOrder[3] = tx1.GetHash().ToString();
+    }
+    sortedOrder[4] = tx3.GetHash().ToString(); // 0
+
+    CheckSort<4>(pool, sortedOrder);
+
+    /* low fee parent with high fee child */
+    /* tx6 (0) -> tx7 (high) */
+    CMutableTransaction tx6 = CMutableTransaction();
+    tx6.vout.resize(1);
+    tx6.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx6.vout[0].nValue = 20 * COIN;
+    uint64_t tx6Size = ::GetSerializeSize(tx6, SER_NETWORK, PROTOCOL_VERSION);
+
+    pool.addUnchecked(tx6.GetHash(), entry.Fee(0LL).FromTx(tx6));
+    BOOST_CHECK_EQUAL(pool.size(), 6);
+    // Ties are broken by hash
+    if (tx3.GetHash() < tx6.GetHash())
+        sortedOrder.push_back(tx6.GetHash().ToString());
+    else
+        sortedOrder.insert(sortedOrder.end()-1,tx6.GetHash().ToString());
+
+    CheckSort<4>(pool, sortedOrder);
+
+    CMutableTransaction tx7 = CMutableTransaction();
+    tx7.vin.resize(1);
+    tx7.vin[0].prevout = COutPoint(tx6.GetHash(), 0);
+    tx7.vin[0].scriptSig = CScript() << OP_11;
+    tx7.vout.resize(1);
+    tx7.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx7.vout[0].nValue = 10 * COIN;
+    uint64_t tx7Size = ::GetSerializeSize(tx7, SER_NETWORK, PROTOCOL_VERSION);
+
+    /* set the fee to just below tx2's feerate when including ancestor */
+    CAmount fee = (20000/tx2Size)*(tx7Size + tx6Size) - 1;
+
+    pool.addUnchecked(tx7.GetHash(), entry.Fee(fee).FromTx(tx7));
+    BOOST_CHECK_EQUAL(pool.size(), 7);
+    sortedOrder.insert(sortedOrder.begin()+1, tx7.GetHash().ToString());
+    CheckSort<4>(pool, sortedOrder);
+
+    CTxMemPool::txiter it7 = pool.mapTx.find(tx7.GetHash());
+    BOOST_CHECK_EQUAL(it7->GetCountWithAncestors(), 2U);
+    BOOST_CHECK_EQUAL(it7->GetSizeWithAncestors(), tx6Size + tx7Size);
+    BOOST_CHECK_EQUAL(it7->GetModFeesWithAncestors(), fee);
+
+    /* prioritising the parent raises the child's package feerate */
+    pool.PrioritiseTransaction(tx6.GetHash(), tx6.GetHash().ToString(), 0.0, 1000);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(tx7.GetHash())->GetModFeesWithAncestors(), fee + 1000);
+    pool.PrioritiseTransaction(tx6.GetHash(), tx6.GetHash().ToString(), 0.0, -1000);
+    CheckSort<4>(pool, sortedOrder);
+
+    /* after tx6 is mined, tx7 should move up in the sort */
+    std::vector<CTransaction> vtx;
+    vtx.push_back(tx6);
+    std::list<CTransaction> dummy;
+    pool.removeForBlock(vtx, 1, dummy, false);
+
+    it7 = pool.mapTx.find(tx7.GetHash());
+    BOOST_CHECK_EQUAL(it7->GetCountWithAncestors(), 1U);
+    BOOST_CHECK_EQUAL(it7->GetSizeWithAncestors(), tx7Size);
+
+    sortedOrder.erase(sortedOrder.begin()+1);
+    // Ties are broken by hash
+    if (tx3.GetHash() < tx6.GetHash())
+        sortedOrder.pop_back();
+    else
+        sortedOrder.erase(sortedOrder.end()-2);
+    sortedOrder.insert(sortedOrder.begin(), tx7.GetHash().ToString());
+    CheckSort<4>(pool, sortedOrder);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAncestorWalkTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string errString;
+
+    // A diamond: txB and txC both spend txA, txD spends txB and txC
+    CMutableTransaction txA;
+    txA.vout.resize(2);
+    txA.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txA.vout[0].nValue = 10 * COIN;
+    txA.vout[1] = txA.vout[0];
+    pool.addUnchecked(txA.GetHash(), entry.Fee(10000LL).FromTx(txA));
+
+    CMutableTransaction txB;
+    txB.vin.resize(1);
+    txB.vin[0].prevout = COutPoint(txA.GetHash(), 0);
+    txB.vout.resize(1);
+    txB.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txB.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txB.GetHash(), entry.Fee(10000LL).FromTx(txB));
+
+    CMutableTransaction txC = txB;
+    txC.vin[0].prevout = COutPoint(txA.GetHash(), 1);
+    pool.addUnchecked(txC.GetHash(), entry.Fee(10000LL).FromTx(txC));
+
+    CMutableTransaction txD;
+    txD.vin.resize(2);
+    txD.vin[0].prevout = COutPoint(txB.GetHash(), 0);
+    txD.vin[1].prevout = COutPoint(txC.GetHash(), 0);
+    txD.vout.resize(1);
+    txD.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txD.vout[0].nValue = 20 * COIN;
+    pool.addUnchecked(txD.GetHash(), entry.Fee(10000LL).FromTx(txD));
+
+    // txA is only counted once, whichever way it is reached
+    CTxMemPool::txiter itA = pool.mapTx.find(txA.GetHash());
+    CTxMemPool::txiter itD = pool.mapTx.find(txD.GetHash());
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(itA).size(), 2U);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolParents(itD).size(), 2U);
+    BOOST_CHECK(pool.GetIter(pool.GetMemPoolChildren(itA)[0]) != itD);
+    BOOST_CHECK_EQUAL(itD->GetCountWithAncestors(), 4U);
+    BOOST_CHECK_EQUAL(itD->GetModFeesWithAncestors(), 40000);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txA.GetHash())->GetCountWithDescendants(), 4U);
+    CTxMemPool::setEntries setAncestors;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*itD, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, errString, false));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 3U);
+    setAncestors.clear();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*itD, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, errString, true));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 3U);
+
+    // Limits for a child of txD
+    CMutableTransaction txE;
+    txE.vin.resize(1);
+    txE.vin[0].prevout = COutPoint(txD.GetHash(), 0);
+    txE.vout.resize(1);
+    txE.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txE.vout[0].nValue = 20 * COIN;
+    CTxMemPoolEntry entryE = entry.Fee(10000LL).FromTx(txE);
+    setAncestors.clear();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entryE, setAncestors, 5, nNoLimit, 5, nNoLimit, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 4U);
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entryE, setAncestors, 4, nNoLimit, nNoLimit, nNoLimit, errString));
+    BOOST_CHECK(errString.find("too many unconfirmed ancestors") == 0);
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entryE, setAncestors, nNoLimit, nNoLimit, 4, nNoLimit, errString));
+    BOOST_CHECK(errString.find("too many descendants") == 0);
+
+    // A fee delta on txA reaches txD once
+    pool.PrioritiseTransaction(txA.GetHash(), txA.GetHash().ToString(), 0, 1000);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txD.GetHash())->GetModFeesWithAncestors(), 41000);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txA.GetHash())->GetModFeesWithDescendants(), 41000);
+
+    // txD is staged once from both of its parents, and not at all when
+    // staged already
+    CTxMemPool::vecEntries vRoots;
+    vRoots.push_back(pool.mapTx.find(txB.GetHash()));
+    vRoots.push_back(pool.mapTx.find(txC.GetHash()));
+    CTxMemPool::vecEntries vStage;
+    pool.StageWithDescendants(vRoots, vStage);
+    BOOST_CHECK_EQUAL(vStage.size(), 3U);
+    BOOST_CHECK(vStage[2] == itD);
+    vStage.assign(1, itD);
+    pool.StageWithDescendants(vRoots, vStage);
+    BOOST_CHECK_EQUAL(vStage.size(), 3U);
+
+    // Removing txB takes txD along
+    std::list<CTransaction> removed;
+    pool.remove(txB, removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2U);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txA.GetHash())->GetCountWithDescendants(), 2U);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txA.GetHash())->GetModFeesWithDescendants(), 21000);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txC.GetHash())->GetCountWithAncestors(), 2U);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(itA).size(), 1U);
+    BOOST_CHECK(pool.GetIter(pool.GetMemPoolChildren(itA)[0])->GetTx().GetHash() == txC.GetHash());
+
+    // All link memory is accounted for
+    pool.remove(txA, removed, true);
+    pool.ClearPrioritisation(txA.GetHash());
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), CTxMemPool(CFeeRate(0)).DynamicMemoryUsage());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAnnouncementOrderTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    /* low fee parent */
+    CMutableTransaction txParent = CMutableTransaction();
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent, &pool));
+
+    /* high fee child of txParent */
+    CMutableTransaction txChild = CMutableTransaction();
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 9 * COIN;
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(50000LL).FromTx(txChild, &pool));
+
+    /* unrelated, in between */
+    CMutableTransaction txOther = CMutableTransaction();
+    txOther.vout.resize(1);
+    txOther.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txOther.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(txOther.GetHash(), entry.Fee(10000LL).FromTx(txOther, &pool));
+
+    uint256 hashMissing = GetRandHash();
+    std::vector<uint256> vHashes;
+    vHashes.push_back(txOther.GetHash());
+    vHashes.push_back(hashMissing);
+    vHashes.push_back(txChild.GetHash());
+    vHashes.push_back(txParent.GetHash());
+
+    // The child has the best score, so it goes first, preceded by its parent
+    std::vector<uint256> vMissing;
+    pool.SortForAnnouncement(vHashes, vMissing);
+    BOOST_CHECK_EQUAL(vHashes.size(), 3);
+    BOOST_CHECK(vHashes[0] == txParent.GetHash());
+    BOOST_CHECK(vHashes[1] == txChild.GetHash());
+    BOOST_CHECK(vHashes[2] == txOther.GetHash());
+    BOOST_CHECK_EQUAL(vMissing.size(), 1);
+    BOOST_CHECK(vMissing[0] == hashMissing);
+
+    // Without the parent queued, plain score order applies
+    vHashes.clear();
+    vMissing.clear();
+    vHashes.push_back(txOther.GetHash());
+    vHashes.push_back(txChild.GetHash());
+    pool.SortForAnnouncement(vHashes, vMissing);
+    BOOST_CHECK_EQUAL(vHashes.size(), 2);
+    BOOST_CHECK(vHashes[0] == txChild.GetHash());
+    BOOST_CHECK(vHashes[1] == txOther.GetHash());
+    BOOST_CHECK(vMissing.empty());
+}
 
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
@@ -447,11 +737,12 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     std::list<CTransaction> conflicts;
     SetMockTime(42);
     SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
-    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), maxFeeRateRemoved.GetFeePerK() + 1000);
+    // Limits well above the pool size keep the histogram floor out of these
+    BOOST_CHECK_EQUAL(pool.GetMinFee(pool.DynamicMemoryUsage() * 5 / 4).GetFeePerK(), maxFeeRateRemoved.GetFeePerK() + 1000);
     // ... we should keep the same min fee until we get a block
     pool.removeForBlock(vtx, 1, conflicts);
     SetMockTime(42 + 2*CTxMemPool::ROLLING_FEE_HALFLIFE);
-    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), (maxFeeRateRemoved.GetFeePerK() + 1000)/2);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(pool.DynamicMemoryUsage() * 5 / 4).GetFeePerK(), (maxFeeRateRemoved.GetFeePerK() + 1000)/2);
     // ... then feerate should drop 1/2 each halflife
 
     SetMockTime(42 + 2*CTxMemPool::ROLLING_FEE_HALFLIFE + CTxMemPool::ROLLING_FEE_HALFLIFE/2);
@@ -463,14 +754,174 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     // ... with a 1/4 halflife when mempool is < 1/4 its target size
 
     SetMockTime(42 + 7*CTxMemPool::ROLLING_FEE_HALFLIFE + CTxMemPool::ROLLING_FEE_HALFLIFE/2 + CTxMemPool::ROLLING_FEE_HALFLIFE/4);
-    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 1000);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(pool.DynamicMemoryUsage() * 5 / 4).GetFeePerK(), 1000);
     // ... but feerate should never drop below 1000
 
     SetMockTime(42 + 8*CTxMemPool::ROLLING_FEE_HALFLIFE + CTxMemPool::ROLLING_FEE_HALFLIFE/2 + CTxMemPool::ROLLING_FEE_HALFLIFE/4);
-    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(pool.DynamicMemoryUsage() * 5 / 4).GetFeePerK(), 0);
     // ... unless it has gone all the way to 0 (after getting past 1000/2)
 
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolBatchTrimTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    TestMemPoolEntryHelper entry;
+
+    // 50 unrelated transactions and 25 parent/child pairs with a high fee
+    // child, in random fee order
+    std::vector<CMutableTransaction> vtx;
+    for (int i = 0; i < 100; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << i;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = 10 * COIN;
+        if (i % 4 == 3)
+            tx.vin[0].prevout = COutPoint(vtx.back().GetHash(), 0);
+        vtx.push_back(tx);
+        CAmount nFee = (i % 4 == 3) ? 50000 : 1000 + insecure_rand() % 20000;
+        pool.addUnchecked(tx.GetHash(), entry.Fee(nFee).FromTx(tx, &pool));
+    }
+
+    // Taking out packages one at a time and in a batch gives the same result
+    CTxMemPool poolOneByOne(CFeeRate(1000));
+    BOOST_FOREACH(CMutableTransaction& tx, vtx) {
+        CTxMemPool::txiter it = pool.mapTx.find(tx.GetHash());
+        poolOneByOne.addUnchecked(tx.GetHash(), entry.Fee(it->GetFee()).FromTx(tx, &poolOneByOne));
+    }
+    size_t nLimit = pool.DynamicMemoryUsage() * 2 / 3;
+    pool.TrimToSize(nLimit);
+    while (poolOneByOne.DynamicMemoryUsage() > nLimit) {
+        // remove the single lowest scoring package, as TrimToSize used to
+        CTxMemPool::vecEntries stage(1, poolOneByOne.mapTx.project<0>(poolOneByOne.mapTx.get<1>().begin()));
+        poolOneByOne.CalculateDescendants(stage[0], stage);
+        poolOneByOne.RemoveStaged(stage, false);
+    }
+    BOOST_CHECK(pool.DynamicMemoryUsage() <= nLimit);
+    BOOST_CHECK(pool.size() < vtx.size());
+    BOOST_CHECK_EQUAL(pool.size(), poolOneByOne.size());
+    BOOST_FOREACH(CMutableTransaction& tx, vtx)
+        BOOST_CHECK_EQUAL(pool.exists(tx.GetHash()), poolOneByOne.exists(tx.GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolBlockRemovalTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    TestMemPoolEntryHelper entry;
+
+    // A chain A <- B <- C with A and B confirmed, a transaction D with a
+    // child F that conflict with the confirmed E, and an unrelated G
+    std::vector<CMutableTransaction> vtx(7);
+    for (int i = 0; i < 7; i++) {
+        vtx[i].vin.resize(1);
+        vtx[i].vin[0].prevout = COutPoint(uint256(), i);
+        vtx[i].vin[0].scriptSig = CScript() << i;
+        vtx[i].vout.resize(1);
+        vtx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        vtx[i].vout[0].nValue = 10 * COIN;
+    }
+    CMutableTransaction &txA = vtx[0], &txB = vtx[1], &txC = vtx[2], &txD = vtx[3];
+    CMutableTransaction &txE = vtx[4], &txF = vtx[5], &txG = vtx[6];
+    txB.vin[0].prevout = COutPoint(txA.GetHash(), 0);
+    txC.vin[0].prevout = COutPoint(txB.GetHash(), 0);
+    txD.vin[0].prevout = COutPoint(uint256S("ee"), 0);
+    txE.vin[0].prevout = txD.vin[0].prevout;
+    txF.vin[0].prevout = COutPoint(txD.GetHash(), 0);
+    BOOST_FOREACH(CMutableTransaction& tx, vtx) {
+        if (tx.GetHash() != txE.GetHash())
+            pool.addUnchecked(tx.GetHash(), entry.Fee(1000).FromTx(tx, &pool));
+    }
+    pool.PrioritiseTransaction(txD.GetHash(), txD.GetHash().ToString(), 0, 5000);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txC.GetHash())->GetCountWithAncestors(), 3U);
+
+    std::vector<CTransaction> block;
+    block.push_back(txA);
+    block.push_back(txB);
+    block.push_back(txE);
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(block, 1, conflicts);
+
+    BOOST_CHECK_EQUAL(pool.size(), 2U);
+    BOOST_CHECK(pool.exists(txC.GetHash()));
+    BOOST_CHECK(pool.exists(txG.GetHash()));
+    BOOST_CHECK_EQUAL(conflicts.size(), 2U);
+    BOOST_FOREACH(const CTransaction& tx, conflicts)
+        BOOST_CHECK(tx.GetHash() == txD.GetHash() || tx.GetHash() == txF.GetHash());
+
+    // The child left behind no longer counts its confirmed ancestors
+    CTxMemPool::txiter it = pool.mapTx.find(txC.GetHash());
+    BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), 1U);
+    BOOST_CHECK_EQUAL(it->GetSizeWithAncestors(), it->GetTxSize());
+    BOOST_CHECK_EQUAL(it->GetModFeesWithAncestors(), 1000);
+    BOOST_CHECK(it->GetMemPoolParents().empty());
+
+    // and the conflict's prioritisation is gone
+    double dPriorityDelta = 0;
+    CAmount nFeeDelta = 0;
+    pool.ApplyDeltas(txD.GetHash(), dPriorityDelta, nFeeDelta);
+    BOOST_CHECK_EQUAL(nFeeDelta, 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolFeeHistogramTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    TestMemPoolEntryHelper entry;
+
+    std::vector<CMutableTransaction> vtx(3);
+    for (int i = 0; i < 3; i++) {
+        vtx[i].vin.resize(1);
+        vtx[i].vin[0].scriptSig = CScript() << i;
+        vtx[i].vout.resize(1);
+        vtx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        vtx[i].vout[0].nValue = 10 * COIN;
+    }
+    CAmount nSize = ::GetSerializeSize(CTransaction(vtx[0]), SER_NETWORK, PROTOCOL_VERSION);
+
+    // Free, exactly 1000 satoshis per kB, and more than the last bucket bound
+    pool.addUnchecked(vtx[0].GetHash(), entry.Fee(0).FromTx(vtx[0]));
+    pool.addUnchecked(vtx[1].GetHash(), entry.Fee(nSize).FromTx(vtx[1]));
+    pool.addUnchecked(vtx[2].GetHash(), entry.Fee(COIN).FromTx(vtx[2]));
+
+    std::vector<CFeeRateBucket> vBuckets = pool.GetFeeRateHistogram();
+    BOOST_CHECK_EQUAL(vBuckets.size(), CTxMemPool::FEE_HISTOGRAM_BUCKETS);
+    BOOST_CHECK_EQUAL(vBuckets[0].feeRateFrom.GetFeePerK(), 0);
+    BOOST_CHECK_EQUAL(vBuckets[1].feeRateFrom.GetFeePerK(), 1000);
+    BOOST_CHECK_EQUAL(vBuckets[2].feeRateFrom.GetFeePerK(), 1250);
+    BOOST_CHECK_EQUAL(vBuckets[0].nCount, 1U);
+    BOOST_CHECK_EQUAL(vBuckets[0].nFees, 0);
+    BOOST_CHECK_EQUAL(vBuckets[1].nCount, 1U);
+    BOOST_CHECK_EQUAL(vBuckets[1].nSize, (uint64_t)nSize);
+    BOOST_CHECK_EQUAL(vBuckets[1].nFees, nSize);
+    BOOST_CHECK_EQUAL(vBuckets.back().nCount, 1U);
+    BOOST_CHECK_EQUAL(vBuckets.back().nFees, COIN);
+
+    // Prioritisation moves a transaction up
+    pool.PrioritiseTransaction(vtx[1].GetHash(), vtx[1].GetHash().ToString(), 0, nSize / 2);
+    vBuckets = pool.GetFeeRateHistogram();
+    BOOST_CHECK_EQUAL(vBuckets[1].nCount, 0U);
+    BOOST_CHECK_EQUAL(vBuckets[2].nCount, 1U);
+    BOOST_CHECK_EQUAL(vBuckets[2].nFees, nSize + nSize / 2);
+
+    // Near the size limit the min fee is the upper bound of the lowest
+    // buckets that hold the excess
+    BOOST_CHECK_EQUAL(pool.GetMinFee(pool.DynamicMemoryUsage() * 2).GetFeePerK(), 0);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(pool.DynamicMemoryUsage() * 20 / 19).GetFeePerK(), vBuckets[1].feeRateFrom.GetFeePerK());
+    BOOST_CHECK_EQUAL(pool.GetMinFee(pool.DynamicMemoryUsage() / 2).GetFeePerK(), vBuckets[3].feeRateFrom.GetFeePerK());
+    BOOST_CHECK(pool.GetMinFee(1) > vBuckets.back().feeRateFrom);
+
+    std::list<CTransaction> removed;
+    pool.remove(vtx[2], removed, true);
+    vBuckets = pool.GetFeeRateHistogram();
+    BOOST_CHECK_EQUAL(vBuckets.back().nCount, 0U);
+    BOOST_CHECK_EQUAL(vBuckets.back().nSize, 0U);
+
+    pool.clear();
+    vBuckets = pool.GetFeeRateHistogram();
+    BOOST_FOREACH(const CFeeRateBucket& bucket, vBuckets)
+        BOOST_CHECK_EQUAL(bucket.nCount, 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -18,6 +18,7 @@
 
 #include "test/test_bitcoin.h"
 
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(miner_tests, TestingSetup)
@@ -71,6 +72,223 @@ bool TestSequenceLocks(const CTransaction &tx, int flags)
     return CheckSequenceLocks(tx, flags);
 }
 
+// Test suite for ancestor feerate transaction selection.
+// Implemented as an additional function, rather than a separate test case,
+// to allow reusing the blockchain created in CreateNewBlock_validity.
+// Note that this test assumes blockprioritysize is 0.
+void TestPackageSelection(const CChainParams& chainparams, CScript scriptPubKey, std::vector<CTransaction *>& txFirst)
+{
+    // Test the ancestor feerate transaction selection.
+    TestMemPoolEntryHelper entry;
+
+    // Test that a medium fee transaction will be selected after a higher fee
+    // rate package with a low fee rate parent.
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 5000000000LL - 1000;
+    // This tx has a low fee: 1000 satoshis
+    uint256 hashParentTx = tx.GetHash(); // save this txid for later use
+    mempool.addUnchecked(hashParentTx, entry.Fee(1000).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+
+    // This tx has a medium fee: 10000 satoshis
+    tx.vin[0].prevout.hash = txFirst[1]->GetHash();
+    tx.vout[0].nValue = 5000000000LL - 10000;
+    uint256 hashMediumFeeTx = tx.GetHash();
+    mempool.addUnchecked(hashMediumFeeTx, entry.Fee(10000).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+
+    // This tx has a high fee, but depends on the first transaction
+    tx.vin[0].prevout.hash = hashParentTx;
+    tx.vout[0].nValue = 5000000000LL - 1000 - 50000; // 50k satoshi fee
+    uint256 hashHighFeeTx = tx.GetHash();
+    mempool.addUnchecked(hashHighFeeTx, entry.Fee(50000).Time(GetTime()).SpendsCoinbase(false).FromTx(tx));
+
+    CBlockTemplate *pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == hashParentTx);
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == hashHighFeeTx);
+    BOOST_CHECK(pblocktemplate->block.vtx[3].GetHash() == hashMediumFeeTx);
+    delete pblocktemplate;
+
+    // Test that a package below the min relay fee doesn't get included
+    tx.vin[0].prevout.hash = hashHighFeeTx;
+    tx.vout[0].nValue = 5000000000LL - 1000 - 50000; // 0 fee
+    uint256 hashFreeTx = tx.GetHash();
+    mempool.addUnchecked(hashFreeTx, entry.Fee(0).FromTx(tx));
+    size_t freeTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+
+    // Calculate a fee on child transaction that will put the package just
+    // below the min relay fee (assuming 1 child tx of the same size).
+    CAmount feeToUse = minRelayTxFee.GetFee(2*freeTxSize) - 1;
+
+    tx.vin[0].prevout.hash = hashFreeTx;
+    tx.vout[0].nValue = 5000000000LL - 1000 - 50000 - feeToUse;
+    uint256 hashLowFeeTx = tx.GetHash();
+    mempool.addUnchecked(hashLowFeeTx, entry.Fee(feeToUse).FromTx(tx));
+    pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    // Verify that the free tx and the low fee tx didn't get selected
+    for (size_t i=0; i<pblocktemplate->block.vtx.size(); ++i) {
+        BOOST_CHECK(pblocktemplate->block.vtx[i].GetHash() != hashFreeTx);
+        BOOST_CHECK(pblocktemplate->block.vtx[i].GetHash() != hashLowFeeTx);
+    }
+    delete pblocktemplate;
+
+    // Test that packages above the min relay fee do get included, even if one
+    // of the transactions is below the min relay fee
+    // Remove the low fee transaction and replace with a higher fee transaction
+    std::list<CTransaction> dummy;
+    mempool.remove(tx, dummy, true);
+    tx.vout[0].nValue -= 2; // Now we should be just over the min relay fee
+    hashLowFeeTx = tx.GetHash();
+    mempool.addUnchecked(hashLowFeeTx, entry.Fee(feeToUse+2).FromTx(tx));
+    pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(pblocktemplate->block.vtx[4].GetHash() == hashFreeTx);
+    BOOST_CHECK(pblocktemplate->block.vtx[5].GetHash() == hashLowFeeTx);
+    delete pblocktemplate;
+
+    // Test that transaction selection properly updates ancestor fee
+    // calculations as ancestor transactions get included in a block.
+    // Add a 0-fee transaction that has 2 outputs.
+    tx.vin[0].prevout.hash = txFirst[2]->GetHash();
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 5000000000LL - 100000000;
+    tx.vout[1].nValue = 100000000; // 1BTC output
+    uint256 hashFreeTx2 = tx.GetHash();
+    mempool.addUnchecked(hashFreeTx2, entry.Fee(0).SpendsCoinbase(true).FromTx(tx));
+
+    // This tx can't be mined by itself
+    tx.vin[0].prevout.hash = hashFreeTx2;
+    tx.vout.resize(1);
+    feeToUse = minRelayTxFee.GetFee(freeTxSize);
+    tx.vout[0].nValue = 5000000000LL - 100000000 - feeToUse;
+    uint256 hashLowFeeTx2 = tx.GetHash();
+    mempool.addUnchecked(hashLowFeeTx2, entry.Fee(feeToUse).SpendsCoinbase(false).FromTx(tx));
+    pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+
+    // Verify that this tx isn't selected.
+    for (size_t i=0; i<pblocktemplate->block.vtx.size(); ++i) {
+        BOOST_CHECK(pblocktemplate->block.vtx[i].GetHash() != hashFreeTx2);
+        BOOST_CHECK(pblocktemplate->block.vtx[i].GetHash() != hashLowFeeTx2);
+    }
+    delete pblocktemplate;
+
+    // This tx will be mineable, and should cause hashLowFeeTx2 to be selected
+    // as well.
+    tx.vin[0].prevout.n = 1;
+    tx.vout[0].nValue = 100000000 - 10000; // 10k satoshi fee
+    mempool.addUnchecked(tx.GetHash(), entry.Fee(10000).FromTx(tx));
+    pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK(pblocktemplate->block.vtx[8].GetHash() == hashLowFeeTx2);
+    delete pblocktemplate;
+}
+
+void TestTemplateEngine(const CChainParams& chainparams, CScript scriptPubKey, std::vector<CTransaction *>& txFirst)
+{
+    // Test that the template engine follows the mempool without rebuilding.
+    TestMemPoolEntryHelper entry;
+    BlockTemplateEngine engine;
+    boost::signals2::scoped_connection connAdded(mempool.NotifyEntryAdded.connect(boost::bind(&BlockTemplateEngine::TransactionAdded, &engine, _1)));
+    boost::signals2::scoped_connection connRemoved(mempool.NotifyEntryRemoved.connect(boost::bind(&BlockTemplateEngine::TransactionRemoved, &engine, _1)));
+    boost::signals2::scoped_connection connPrioritised(mempool.NotifyEntryPrioritised.connect(boost::bind(&BlockTemplateEngine::TransactionPrioritised, &engine, _1)));
+    CAmount nSubsidy = GetBlockSubsidy(chainActive.Height() + 1, chainparams.GetConsensus());
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 5000000000LL - 10000;
+    CTransaction txParent(tx);
+    mempool.addUnchecked(txParent.GetHash(), entry.Fee(10000).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+
+    CBlockTemplate *pblocktemplate = engine.GetBlockTemplate(chainparams, scriptPubKey);
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 1U);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+    BOOST_CHECK(pblocktemplate->block.vtx[0].vout[0].scriptPubKey == scriptPubKey);
+    delete pblocktemplate;
+
+    // A child and an unrelated higher fee transaction are appended in place
+    tx.vin[0].prevout.hash = txParent.GetHash();
+    tx.vout[0].nValue = 5000000000LL - 10000 - 20000;
+    CTransaction txChild(tx);
+    mempool.addUnchecked(txChild.GetHash(), entry.Fee(20000).Time(GetTime()).SpendsCoinbase(false).FromTx(tx));
+    tx.vin[0].prevout.hash = txFirst[1]->GetHash();
+    tx.vout[0].nValue = 5000000000LL - 30000;
+    CTransaction txOther(tx);
+    mempool.addUnchecked(txOther.GetHash(), entry.Fee(30000).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+
+    pblocktemplate = engine.GetBlockTemplate(chainparams, scriptPubKey);
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 1U);
+    BOOST_CHECK_EQUAL(engine.GetUpdateCount(), 1U);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4U);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == txParent.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == txOther.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[3].GetHash() == txChild.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0].vout[0].nValue, nSubsidy + 60000);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -60000);
+    CValidationState state;
+    BOOST_CHECK(TestBlockValidity(state, chainparams, pblocktemplate->block, chainActive.Tip(), false, false));
+    delete pblocktemplate;
+
+    // Removing the parent takes the child out of the template as well
+    std::list<CTransaction> removed;
+    mempool.remove(txParent, removed, true);
+    pblocktemplate = engine.GetBlockTemplate(chainparams, scriptPubKey);
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 1U);
+    BOOST_CHECK_EQUAL(engine.GetUpdateCount(), 2U);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == txOther.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0].vout[0].nValue, nSubsidy + 30000);
+    delete pblocktemplate;
+
+    // The freed space gets a full pass once the rebuild interval has passed
+    pblocktemplate = engine.GetBlockTemplate(chainparams, scriptPubKey);
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 1U);
+    delete pblocktemplate;
+    SetMockTime(GetTime() + BLOCK_TEMPLATE_REBUILD_INTERVAL);
+    pblocktemplate = engine.GetBlockTemplate(chainparams, scriptPubKey);
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 2U);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+    delete pblocktemplate;
+    SetMockTime(0);
+
+    // A transaction without fee is left out until a fee delta raises it
+    tx.vin[0].prevout.hash = txFirst[2]->GetHash();
+    tx.vout[0].nValue = 5000000000LL;
+    CTransaction txFree(tx);
+    mempool.addUnchecked(txFree.GetHash(), entry.Fee(0).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+    pblocktemplate = engine.GetBlockTemplate(chainparams, scriptPubKey);
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 2U);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+    delete pblocktemplate;
+    mempool.PrioritiseTransaction(txFree.GetHash(), txFree.GetHash().ToString(), 0, 100000);
+    pblocktemplate = engine.GetBlockTemplate(chainparams, scriptPubKey);
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 3U);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == txFree.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0].vout[0].nValue, nSubsidy + 30000);
+    delete pblocktemplate;
+    mempool.ClearPrioritisation(txFree.GetHash());
+
+    // An update that leaves an invalid block is not handed out: the engine
+    // falls back to the assembler, which refuses to build one either
+    tx.vin[0].prevout.hash = txFree.GetHash();
+    tx.vin[0].prevout.n = 1;
+    tx.vout[0].nValue = 10000;
+    CTransaction txInvalid(tx);
+    mempool.addUnchecked(txInvalid.GetHash(), entry.Fee(40000).Time(GetTime()).SpendsCoinbase(false).FromTx(tx));
+    BOOST_CHECK_THROW(engine.GetBlockTemplate(chainparams, scriptPubKey), std::runtime_error);
+    BOOST_CHECK_EQUAL(engine.GetUpdateCount(), 4U);
+    mempool.remove(txInvalid, removed, false);
+    pblocktemplate = engine.GetBlockTemplate(chainparams, scriptPubKey);
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 4U);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+    delete pblocktemplate;
+}
+
 // NOTE: These tests rely on CreateNewBlock doing its own self-validation!
 BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 {
@@ -124,6 +342,12 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     BOOST_CHECK(pblocktemplate = CreateNewBlock(chainparams, scriptPubKey));
     delete pblocktemplate;
 
+    TestPackageSelection(chainparams, scriptPubKey, txFirst);
+    mempool.clear();
+
+    TestTemplateEngine(chainparams, scriptPubKey, txFirst);
+    mempool.clear();
+
     // block sigops > limit: 1000 CHECKMULTISIG + 1
     tx.vin.resize(1);
     // NOTE: OP_NOP is used to force 20 SigOps for the CHECKMULTISIG
@@ -0,0 +1,187 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "net.h"
+#include "protocol.h"
+#include "utiltime.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(net_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(send_class)
+{
+    BOOST_CHECK_EQUAL(GetSendClass(NetMsgType::BLOCK), SEND_CLASS_BLOCK);
+    BOOST_CHECK_EQUAL(GetSendClass(NetMsgType::MERKLEBLOCK), SEND_CLASS_BLOCK);
+    BOOST_CHECK_EQUAL(GetSendClass(NetMsgType::TX), SEND_CLASS_TX);
+    BOOST_CHECK_EQUAL(GetSendClass(NetMsgType::ADDR), SEND_CLASS_ADDR);
+    BOOST_CHECK_EQUAL(GetSendClass(NetMsgType::INV), SEND_CLASS_INV);
+    BOOST_CHECK_EQUAL(GetSendClass(NetMsgType::NOTFOUND), SEND_CLASS_INV);
+    BOOST_CHECK_EQUAL(GetSendClass(NetMsgType::PING), SEND_CLASS_CONTROL);
+    BOOST_CHECK_EQUAL(GetSendClass(NetMsgType::HEADERS), SEND_CLASS_CONTROL);
+    BOOST_CHECK_EQUAL(GetSendClass(NetMsgType::GETDATA), SEND_CLASS_CONTROL);
+    BOOST_CHECK_EQUAL(GetSendClass("unknown"), SEND_CLASS_CONTROL);
+}
+
+BOOST_AUTO_TEST_CASE(token_bucket)
+{
+    CTokenBucket unlimited;
+    BOOST_CHECK(!unlimited.IsLimited());
+    unlimited.Consume(1000000000);
+    BOOST_CHECK(unlimited.CanSend(0));
+
+    // 1000 bytes/s, starts with a full second worth of tokens
+    int64_t nNow = 1000000000;
+    CTokenBucket bucket;
+    bucket.SetRate(1000, nNow);
+    BOOST_CHECK(bucket.IsLimited());
+    BOOST_CHECK(bucket.CanSend(nNow));
+    bucket.Consume(600);
+    BOOST_CHECK(bucket.CanSend(nNow));
+    // A message larger than the remaining tokens still goes out whole, leaving the bucket in debt
+    bucket.Consume(1400);
+    BOOST_CHECK(!bucket.CanSend(nNow));
+    BOOST_CHECK(!bucket.CanSend(nNow + 999999));
+    BOOST_CHECK(bucket.CanSend(nNow + 1000000));
+
+    // Idle time never accumulates more than one second of burst
+    nNow += 3600 * 1000000LL;
+    BOOST_CHECK(bucket.CanSend(nNow));
+    bucket.Consume(2000);
+    BOOST_CHECK(!bucket.CanSend(nNow));
+    BOOST_CHECK(!bucket.CanSend(nNow + 999999));
+    BOOST_CHECK(bucket.CanSend(nNow + 1000000));
+
+    // Refilling in many small steps does not lose fractional tokens
+    bucket.SetRate(3, nNow);
+    bucket.Consume(6);
+    for (int i = 1; i < 1000; i++)
+        BOOST_CHECK(!bucket.CanSend(nNow + i * 1000));
+    BOOST_CHECK(bucket.CanSend(nNow + 1000000));
+}
+
+BOOST_AUTO_TEST_CASE(send_queue_priority)
+{
+    uint64_t nOldRate = CNode::GetMaxSendRate(SEND_CLASS_TX);
+    CNode::SetMaxSendRate(SEND_CLASS_TX, 1000);
+    CAddress addr(CService("127.0.0.1", Params().GetDefaultPort()));
+    CNode node(INVALID_SOCKET, addr, "", true);
+    CNode::SetMaxSendRate(SEND_CLASS_TX, nOldRate);
+
+    // Nothing can be written to the socket, so everything stays queued
+    std::vector<unsigned char> vTx(1500, 0);
+    node.PushMessage(NetMsgType::TX, vTx);
+    node.PushMessage(NetMsgType::TX, vTx);
+    node.PushMessage(NetMsgType::PING, (uint64_t)1);
+
+    int64_t nNow = GetTimeMicros();
+    LOCK(node.cs_vSend);
+    BOOST_CHECK_EQUAL(node.vSendMsg.size(), 1U);
+    BOOST_CHECK_EQUAL(node.vSendData.size(), 1U);
+    BOOST_CHECK_EQUAL(node.vSendControl.size(), 1U);
+    BOOST_CHECK_EQUAL(node.nSendBytesPerClass[SEND_CLASS_TX], node.vSendMsg.front().size());
+
+    // The ping overtakes the queued transaction
+    node.vSendMsg.clear();
+    BOOST_CHECK(node.ReleaseSendData(nNow));
+    BOOST_CHECK_EQUAL(node.vSendControl.size(), 0U);
+    BOOST_CHECK_EQUAL(node.nSendBytesPerClass[SEND_CLASS_CONTROL], node.vSendMsg.front().size());
+
+    // The first transaction used up the tx bucket
+    node.vSendMsg.clear();
+    BOOST_CHECK(node.IsSendThrottled());
+    BOOST_CHECK(!node.ReleaseSendData(nNow));
+    BOOST_CHECK(node.nThrottledSince != 0);
+    BOOST_CHECK(node.ReleaseSendData(nNow + 2000000));
+    BOOST_CHECK_EQUAL(node.vSendData.size(), 0U);
+    BOOST_CHECK(node.nThrottledSince == 0);
+    BOOST_CHECK(node.nThrottledTime > 0);
+
+    // Whitelisted peers are never throttled
+    node.vSendMsg.clear();
+    node.fWhitelisted = true;
+    node.vSendData.push_back(std::make_pair(SEND_CLASS_TX, CSerializeData(10)));
+    BOOST_CHECK(node.ReleaseSendData(nNow + 2000000));
+    node.vSendMsg.clear();
+    node.nSendSize = 0;
+}
+
+// Holds cs_vNodes until told the snapshot was released, or for 5 seconds
+struct SnapshotLockHolder
+{
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fLocked;
+    bool fReleased;
+    bool fReleasedWhileLocked;
+
+    SnapshotLockHolder() : fLocked(false), fReleased(false), fReleasedWhileLocked(false) {}
+
+    void Run()
+    {
+        LOCK(cs_vNodes);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fLocked = true;
+        cond.notify_all();
+        boost::system_time timeout = boost::get_system_time() + boost::posix_time::seconds(5);
+        while (!fReleased && cond.timed_wait(lock, timeout)) {}
+        fReleasedWhileLocked = fReleased;
+    }
+
+    void WaitLocked()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fLocked)
+            cond.wait(lock);
+    }
+
+    void SetReleased()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fReleased = true;
+        cond.notify_all();
+    }
+};
+
+BOOST_AUTO_TEST_CASE(node_snapshot)
+{
+    CAddress addr(CService("127.0.0.1", Params().GetDefaultPort()));
+    CNode node(INVALID_SOCKET, addr, "", true);
+
+    {
+        LOCK(cs_vNodes);
+        vNodes.push_back(&node);
+        PublishNodeSnapshot();
+    }
+    NodeSnapshot vNodesOld = GetNodeSnapshot();
+    BOOST_CHECK_EQUAL(vNodesOld->size(), 1U);
+    BOOST_CHECK_EQUAL((*vNodesOld)[0], &node);
+
+    // Removing the node publishes a new snapshot, the old one keeps it referenced
+    {
+        LOCK(cs_vNodes);
+        vNodes.clear();
+        PublishNodeSnapshot();
+        BOOST_CHECK_EQUAL(node.nSnapshotRefCount.load(), 1);
+    }
+    BOOST_CHECK(GetNodeSnapshot()->empty());
+    BOOST_CHECK_EQUAL(vNodesOld->size(), 1U);
+
+    // Dropping the last reference does not wait for cs_vNodes, which another
+    // thread holds until the release is done or it gives up
+    SnapshotLockHolder holder;
+    boost::thread thread(boost::bind(&SnapshotLockHolder::Run, &holder));
+    holder.WaitLocked();
+    vNodesOld.reset();
+    holder.SetReleased();
+    thread.join();
+    BOOST_CHECK(holder.fReleasedWhileLocked);
+    BOOST_CHECK_EQUAL(node.nSnapshotRefCount.load(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
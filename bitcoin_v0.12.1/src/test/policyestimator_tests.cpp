@@ -2,15 +2,25 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
+#include "hash.h"
 #include "policy/fees.h"
+#include "random.h"
+#include "rpcprotocol.h"
+#include "rpcserver.h"
+#include "streams.h"
 #include "txmempool.h"
 #include "uint256.h"
 #include "util.h"
 
 #include "test/test_bitcoin.h"
 
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
 
+#include <univalue.h>
+
 BOOST_FIXTURE_TEST_SUITE(policyestimator_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
@@ -207,4 +217,108 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     }
 }
 
+static void RecordBlockHeight(std::vector<unsigned int>& vHeights, unsigned int nHeight)
+{
+    vHeights.push_back(nHeight);
+}
+
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimatorReplay)
+{
+    CFeeRate minRelayFee(1000);
+    CBlockPolicyEstimator recorded(minRelayFee);
+    boost::filesystem::path pathRecord = GetTempPath() / strprintf("fee_estimates_record_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+    FILE* file = fopen(pathRecord.string().c_str(), "wb");
+    BOOST_REQUIRE(file != NULL);
+    recorded.SetRecordFile(file);
+
+    // 20 fee paying txs a block: the higher the fee, the sooner it confirms
+    seed_insecure_rand(true);
+    std::vector<FeeEstimatorTx> vWaiting;
+    uint32_t nTx = 0;
+    for (unsigned int nHeight = 1; nHeight <= 300; nHeight++) {
+        for (int i = 0; i < 20; i++, nTx++) {
+            FeeEstimatorTx tx;
+            tx.hash = Hash(BEGIN(nTx), END(nTx));
+            tx.nHeight = nHeight - 1;
+            tx.nTxSize = 250;
+            tx.nFee = 1000 * (1 + i / 2);
+            tx.fClearAtEntry = true;
+            recorded.processTransaction(tx, true);
+            vWaiting.push_back(tx);
+        }
+        std::vector<FeeEstimatorTx> vConfirmed;
+        for (size_t i = 0; i < vWaiting.size(); ) {
+            if (insecure_rand() % 10 < (uint32_t)vWaiting[i].nFee / 1000) {
+                // Leaves the mempool first, as in CTxMemPool::removeForBlock
+                recorded.removeTx(vWaiting[i].hash);
+                vConfirmed.push_back(vWaiting[i]);
+                vWaiting[i] = vWaiting.back();
+                vWaiting.pop_back();
+            } else {
+                i++;
+            }
+        }
+        // A few are evicted instead
+        if (nHeight % 7 == 0 && !vWaiting.empty()) {
+            recorded.removeTx(vWaiting.back().hash);
+            vWaiting.pop_back();
+        }
+        recorded.processBlock(nHeight, vConfirmed, true);
+    }
+    recorded.SetRecordFile(NULL);
+
+    CBlockPolicyEstimator replayed(minRelayFee);
+    std::vector<unsigned int> vHeights;
+    CAutoFile filein(fopen(pathRecord.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!filein.IsNull());
+    BOOST_CHECK_EQUAL(ReplayFeeEstimatorRecord(filein, replayed, boost::bind(RecordBlockHeight, boost::ref(vHeights), _1)), 300U);
+    filein.fclose();
+    boost::filesystem::remove(pathRecord);
+    BOOST_CHECK_EQUAL(vHeights.size(), 300U);
+    BOOST_CHECK_EQUAL(vHeights.back(), 300U);
+
+    // The replayed estimator ends up in exactly the same state
+    const FeeEstimateHorizon horizons[] = {SHORT_HALFLIFE, MED_HALFLIFE, LONG_HALFLIFE};
+    BOOST_FOREACH(FeeEstimateHorizon horizon, horizons) {
+        BOOST_CHECK_EQUAL(recorded.HighestTargetTracked(horizon), replayed.HighestTargetTracked(horizon));
+        for (unsigned int i = 1; i <= recorded.HighestTargetTracked(horizon); i++)
+            BOOST_CHECK(recorded.estimateRawFee(i, 0.95, horizon) == replayed.estimateRawFee(i, 0.95, horizon));
+    }
+    for (int i = 1; i < 25; i++)
+        BOOST_CHECK(recorded.estimateFee(i) == replayed.estimateFee(i));
+
+    // Every horizon has seen enough to answer, and the medium one is what estimateFee uses
+    BOOST_CHECK_EQUAL(recorded.HighestTargetTracked(SHORT_HALFLIFE), SHORT_BLOCK_CONFIRMS);
+    BOOST_CHECK_EQUAL(recorded.HighestTargetTracked(LONG_HALFLIFE), LONG_BLOCK_CONFIRMS);
+    BOOST_CHECK(recorded.estimateRawFee(2, 0.95, MED_HALFLIFE) == recorded.estimateFee(2));
+    BOOST_CHECK(recorded.estimateRawFee(2, 0.95, SHORT_HALFLIFE) > CFeeRate(0));
+    BOOST_CHECK(recorded.estimateRawFee(2, 0.95, LONG_HALFLIFE) > CFeeRate(0));
+    BOOST_CHECK(recorded.estimateRawFee(1, 0.95, SHORT_HALFLIFE) >= recorded.estimateRawFee(6, 0.95, SHORT_HALFLIFE));
+    BOOST_CHECK(recorded.estimateRawFee(SHORT_BLOCK_CONFIRMS + 1, 0.95, SHORT_HALFLIFE) == CFeeRate(0));
+}
+
+// Returns the RPC error code of estimaterawfee 2 dThreshold, or 0 if it succeeds
+static int EstimateRawFeeError(double dThreshold)
+{
+    UniValue params(UniValue::VARR);
+    params.push_back(2);
+    params.push_back(dThreshold);
+    try {
+        estimaterawfee(params, false);
+    } catch (const UniValue& objError) {
+        return find_value(objError, "code").get_int();
+    }
+    return 0;
+}
+
+BOOST_AUTO_TEST_CASE(EstimateRawFeeThreshold)
+{
+    // The estimator has no answer for thresholds outside (0, 1], so the RPC refuses them
+    BOOST_CHECK_EQUAL(EstimateRawFeeError(0), RPC_INVALID_PARAMETER);
+    BOOST_CHECK_EQUAL(EstimateRawFeeError(-0.5), RPC_INVALID_PARAMETER);
+    BOOST_CHECK_EQUAL(EstimateRawFeeError(1.5), RPC_INVALID_PARAMETER);
+    BOOST_CHECK_EQUAL(EstimateRawFeeError(0.5), 0);
+    BOOST_CHECK_EQUAL(EstimateRawFeeError(1), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
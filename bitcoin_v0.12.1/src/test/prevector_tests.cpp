@@ -23,6 +23,9 @@ class prevector_tester {
     typedef prevector<N, T> pretype;
     pretype pre_vector;
 
+    // Buffer lent to pre_vector by assign_external
+    T external[32];
+
     typedef typename pretype::size_type Size;
 
     void test() {
@@ -149,6 +152,12 @@ public:
         pre_vector.shrink_to_fit();
         test();
     }
+
+    void assign_external(Size n) {
+        real_vector.assign(n, T());
+        pre_vector.assign_external(reinterpret_cast<char*>(external), n);
+        test();
+    }
 };
 
 BOOST_AUTO_TEST_CASE(PrevectorTestInt)
@@ -210,6 +219,9 @@ BOOST_AUTO_TEST_CASE(PrevectorTestInt)
             if (((r >> 21) & 512) == 12) {
                 test.assign(insecure_rand() % 32, insecure_rand());
             }
+            if ((r >> 12) % 64 == 13) {
+                test.assign_external(insecure_rand() % 32);
+            }
         }
     }
 }
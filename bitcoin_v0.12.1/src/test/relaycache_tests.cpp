@@ -0,0 +1,111 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "net.h"
+#include "primitives/transaction.h"
+#include "txmempool.h"
+#include "utiltime.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(relaycache_tests, BasicTestingSetup)
+
+static CMutableTransaction MakeTx(int n)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(uint256(), n);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = n;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(relaycache_lookup)
+{
+    CRelayCache cache;
+    CTransaction tx(MakeTx(1));
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(!cache.Lookup(tx.GetHash(), ss));
+
+    cache.Insert(tx);
+    cache.Insert(tx);
+    BOOST_CHECK_EQUAL(cache.size(), 1);
+    BOOST_CHECK(cache.Lookup(tx.GetHash(), ss));
+
+    CTransaction txRead;
+    ss >> txRead;
+    BOOST_CHECK(txRead == tx);
+
+    cache.Clear();
+    BOOST_CHECK(!cache.Exists(tx.GetHash()));
+    BOOST_CHECK_EQUAL(cache.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(relaycache_byte_limit)
+{
+    CRelayCache cache(0);
+    CTransaction tx0(MakeTx(0));
+    cache.Insert(tx0);
+    BOOST_CHECK_EQUAL(cache.size(), 0);
+
+    // Fill the cache over several time buckets, then shrink it: the oldest
+    // entries must go first, regardless of how old they are.
+    SetMockTime(1000000);
+    cache.SetMaxUsage(1000000);
+    std::vector<CTransaction> vtx;
+    for (int i = 0; i < 20; i++) {
+        vtx.push_back(CTransaction(MakeTx(i)));
+        cache.Insert(vtx.back());
+        SetMockTime(GetTime() + 30);
+    }
+    BOOST_CHECK_EQUAL(cache.size(), 20);
+
+    size_t nUsage = cache.DynamicMemoryUsage();
+    cache.SetMaxUsage(nUsage / 2);
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= nUsage / 2);
+    BOOST_CHECK(cache.size() < 20);
+    BOOST_CHECK(cache.size() > 0);
+    BOOST_CHECK(!cache.Exists(vtx.front().GetHash()));
+    BOOST_CHECK(cache.Exists(vtx.back().GetHash()));
+    for (size_t i = 1; i < vtx.size(); i++) {
+        // Nothing newer than an evicted entry may have been evicted before it
+        if (cache.Exists(vtx[i - 1].GetHash()))
+            BOOST_CHECK(cache.Exists(vtx[i].GetHash()));
+    }
+
+    // Inserting more keeps the cache within its budget
+    for (int i = 20; i < 40; i++)
+        cache.Insert(CTransaction(MakeTx(i)));
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= nUsage / 2);
+    BOOST_CHECK(cache.Exists(CTransaction(MakeTx(39)).GetHash()));
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(relaycache_mempool_removal)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CRelayCache cache;
+    pool.NotifyEntryRemoved.connect(boost::bind(&CRelayCache::Insert, &cache, _1));
+
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction mtx = MakeTx(1);
+    CTransaction tx(mtx);
+    pool.addUnchecked(tx.GetHash(), entry.Fee(1000).FromTx(mtx, &pool));
+    BOOST_CHECK(!cache.Exists(tx.GetHash()));
+
+    std::list<CTransaction> removed;
+    pool.remove(tx, removed);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK(cache.Exists(tx.GetHash()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,17 +6,21 @@
 #include "rpcclient.h"
 
 #include "base58.h"
+#include "main.h"
 #include "netbase.h"
 
 #include "test/test_bitcoin.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
 
 #include <univalue.h>
 
 using namespace std;
 
+extern void mempoolToJSONStream(const boost::function<void(const std::string&)>& write);
+
 UniValue
 createArgs(int nRequired, const char* address1=NULL, const char* address2=NULL)
 {
@@ -308,4 +312,104 @@ BOOST_AUTO_TEST_CASE(rpc_ban)
     BOOST_CHECK_EQUAL(adr.get_str(), "2001:4d48:ac57:400:cacf:e9ff:fe1d:9c63/128");
 }
 
+
+static void AppendString(std::string& str, const std::string& strPart)
+{
+    str += strPart;
+}
+
+static UniValue GetMempoolPage(bool fVerbose, const std::string& strCursor, int nCount)
+{
+    UniValue params(UniValue::VARR);
+    params.push_back(fVerbose);
+    params.push_back(strCursor);
+    params.push_back(nCount);
+    return getrawmempool(params, false);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_mempool_paging)
+{
+    // Enough transactions for several pages of the streamed dump, with runs
+    // of equal entry times crossing the page boundaries
+    TestMemPoolEntryHelper entry;
+    std::map<std::string, CTransaction> mapTxs;
+    for (int i = 0; i < 2500; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << i;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        tx.vout[0].nValue = COIN;
+        mempool.addUnchecked(tx.GetHash(), entry.Fee(1000 + i).Time(i / 700).FromTx(tx));
+        mapTxs[tx.GetHash().ToString()] = tx;
+    }
+
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("getrawmempool"));
+    BOOST_CHECK_EQUAL(r.size(), 2500U);
+    // Everything after the last entry of time 2 is the 400 entries of time 3
+    BOOST_CHECK_NO_THROW(r = GetMempoolPage(true, "2:" + std::string(64, 'f'), 1000));
+    const UniValue& txs = find_value(r.get_obj(), "transactions");
+    BOOST_CHECK_EQUAL(txs.size(), 400U);
+    BOOST_CHECK_EQUAL(find_value(txs.getValues()[0].get_obj(), "time").get_int64(), 3);
+    BOOST_CHECK(find_value(r.get_obj(), "next").isNull());
+    BOOST_CHECK_NO_THROW(r = GetMempoolPage(false, "", 10));
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "transactions").size(), 10U);
+    BOOST_CHECK(find_value(r.get_obj(), "next").isStr());
+    BOOST_CHECK_THROW(GetMempoolPage(true, "", -1), UniValue);
+    BOOST_CHECK_THROW(GetMempoolPage(true, "3", 10), UniValue);
+    BOOST_CHECK_THROW(GetMempoolPage(true, "x:" + std::string(64, '0'), 10), UniValue);
+    BOOST_CHECK_THROW(CallRPC("getrawmempool true 3:00 10"), runtime_error);
+
+    // Pages in entry time order add up to the whole pool, even when entries
+    // on either side of the cursor leave it between two calls
+    std::set<std::string> setSeen;
+    std::string strCursor;
+    std::string strRemovedUnseen;
+    std::list<CTransaction> removed;
+    for (int nPage = 0; ; nPage++) {
+        r = GetMempoolPage(false, strCursor, 300);
+        const UniValue& page = find_value(r.get_obj(), "transactions");
+        for (size_t i = 0; i < page.size(); i++)
+            BOOST_CHECK(setSeen.insert(page[i].get_str()).second);
+        if (nPage == 0) {
+            // One entry already returned and one not yet returned
+            mempool.remove(mapTxs[page[0].get_str()], removed, false);
+            UniValue all = CallRPC("getrawmempool true");
+            std::vector<std::string> vKeys = all.getKeys();
+            for (size_t i = 0; i < vKeys.size() && strRemovedUnseen.empty(); i++) {
+                if (!setSeen.count(vKeys[i]))
+                    strRemovedUnseen = vKeys[i];
+            }
+            mempool.remove(mapTxs[strRemovedUnseen], removed, false);
+        }
+        const UniValue& next = find_value(r.get_obj(), "next");
+        if (next.isNull())
+            break;
+        strCursor = next.get_str();
+    }
+    BOOST_CHECK_EQUAL(removed.size(), 2U);
+    BOOST_CHECK_EQUAL(setSeen.size(), 2499U);
+    BOOST_CHECK(!setSeen.count(strRemovedUnseen));
+    BOOST_CHECK_EQUAL(mempool.size(), 2498U);
+
+    // The streamed dump is the same object as the unpaged verbose one
+    std::string strStream;
+    mempoolToJSONStream(boost::bind(&AppendString, boost::ref(strStream), _1));
+    UniValue streamed;
+    BOOST_CHECK(streamed.read(strStream));
+    UniValue whole = CallRPC("getrawmempool true");
+    BOOST_CHECK_EQUAL(streamed.size(), 2498U);
+    BOOST_CHECK_EQUAL(streamed.write(), whole.write());
+
+    BOOST_CHECK_NO_THROW(r = CallRPC("getmempoolinfo"));
+    const UniValue& histogram = find_value(r.get_obj(), "feehistogram");
+    BOOST_CHECK_EQUAL(histogram.size(), (size_t)CTxMemPool::FEE_HISTOGRAM_BUCKETS);
+    int64_t nCount = 0;
+    for (size_t i = 0; i < histogram.size(); i++)
+        nCount += find_value(histogram[i].get_obj(), "count").get_int64();
+    BOOST_CHECK_EQUAL(nCount, 2498);
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -94,6 +94,15 @@ void DoTest(const CScript& scriptPubKey, const CScript& scriptSig, int flags, bo
     CMutableTransaction tx2 = tx;
     BOOST_CHECK_MESSAGE(VerifyScript(scriptSig, scriptPubKey, flags, MutableTransactionSignatureChecker(&tx, 0), &err) == expect, message);
     BOOST_CHECK_MESSAGE(expect == (err == SCRIPT_ERR_OK), std::string(ScriptErrorString(err)) + ": " + message);
+    // Stacks left over from all the tests before must not change the outcome
+    static CScriptArena arena;
+    ScriptError errArena;
+    BOOST_CHECK_MESSAGE(VerifyScript(scriptSig, scriptPubKey, flags, MutableTransactionSignatureChecker(&tx, 0), &errArena, &arena) == expect, message);
+    BOOST_CHECK_MESSAGE(errArena == err, std::string(ScriptErrorString(errArena)) + ": " + message);
+    // Neither may leaving out the standard template fast paths
+    ScriptError errInterpreted;
+    BOOST_CHECK_MESSAGE(VerifyScriptInterpreted(scriptSig, scriptPubKey, flags, MutableTransactionSignatureChecker(&tx, 0), &errInterpreted) == expect, message);
+    BOOST_CHECK_MESSAGE(errInterpreted == err, std::string(ScriptErrorString(errInterpreted)) + ": " + message);
 #if defined(HAVE_CONSENSUS_LIB)
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
     stream << tx2;
@@ -951,6 +960,118 @@ BOOST_AUTO_TEST_CASE(script_combineSigs)
     BOOST_CHECK(combined == partial3c);
 }
 
+// Check that VerifyStandardScript agrees with the interpreter on result and
+// error under a range of flags, and that it handles the spend itself if
+// fExpectMatch.
+static void CheckStandardTemplate(const CScript& scriptSig, const CScript& scriptPubKey, const CMutableTransaction& txTo,
+                                  bool fExpectMatch, const std::string& message)
+{
+    static const unsigned int vFlags[] = {
+        SCRIPT_VERIFY_NONE,
+        SCRIPT_VERIFY_P2SH,
+        SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC,
+        SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_NULLDUMMY,
+        SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_LOW_S |
+            SCRIPT_VERIFY_NULLDUMMY | SCRIPT_VERIFY_SIGPUSHONLY | SCRIPT_VERIFY_MINIMALDATA |
+            SCRIPT_VERIFY_CLEANSTACK | SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_NOPS,
+    };
+    for (unsigned int i = 0; i < sizeof(vFlags) / sizeof(vFlags[0]); i++) {
+        const std::string strMessage = message + " (" + FormatScriptFlags(vFlags[i]) + ")";
+        ScriptError err, errInterpreted;
+        bool fResult = false;
+        bool fMatched = VerifyStandardScript(scriptSig, scriptPubKey, vFlags[i], MutableTransactionSignatureChecker(&txTo, 0), fResult, &err);
+        bool fInterpreted = VerifyScriptInterpreted(scriptSig, scriptPubKey, vFlags[i], MutableTransactionSignatureChecker(&txTo, 0), &errInterpreted);
+        // P2SH spends are only recognized under P2SH
+        if (fExpectMatch && (vFlags[i] & SCRIPT_VERIFY_P2SH))
+            BOOST_CHECK_MESSAGE(fMatched, strMessage);
+        if (fMatched) {
+            BOOST_CHECK_MESSAGE(fResult == fInterpreted, strMessage);
+            BOOST_CHECK_MESSAGE(err == errInterpreted, std::string(ScriptErrorString(err)) + " vs " + ScriptErrorString(errInterpreted) + ": " + strMessage);
+        }
+        bool fVerified = VerifyScript(scriptSig, scriptPubKey, vFlags[i], MutableTransactionSignatureChecker(&txTo, 0), &err);
+        BOOST_CHECK_MESSAGE(fVerified == fInterpreted, strMessage);
+        BOOST_CHECK_MESSAGE(err == errInterpreted, strMessage);
+    }
+}
+
+static CScript PushSig(const CScript& scriptSig, const CKey& key, const CScript& scriptCode, const CTransaction& txTo, int nHashType = SIGHASH_ALL)
+{
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(SignatureHash(scriptCode, txTo, 0, nHashType), vchSig));
+    vchSig.push_back((unsigned char)nHashType);
+    return CScript(scriptSig) << vchSig;
+}
+
+BOOST_AUTO_TEST_CASE(script_standard_templates)
+{
+    CKey key1, key2, key3;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(false);
+    key3.MakeNewKey(true);
+
+    // P2PKH
+    for (int i = 0; i < 2; i++) {
+        const CKey& key = i ? key2 : key1;
+        std::vector<unsigned char> vchPubKey = ToByteVector(key.GetPubKey());
+        CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+        CMutableTransaction txTo = BuildSpendingTransaction(CScript(), BuildCreditingTransaction(scriptPubKey));
+
+        CheckStandardTemplate(PushSig(CScript(), key, scriptPubKey, txTo) << vchPubKey, scriptPubKey, txTo, true, "P2PKH");
+        CheckStandardTemplate(PushSig(CScript(), key3, scriptPubKey, txTo) << vchPubKey, scriptPubKey, txTo, true, "P2PKH, wrong key");
+        CheckStandardTemplate(PushSig(CScript(), key, scriptPubKey, txTo) << ToByteVector(key3.GetPubKey()), scriptPubKey, txTo, true, "P2PKH, wrong pubkey");
+        CheckStandardTemplate(PushSig(CScript(), key, scriptPubKey, txTo, 0x21) << vchPubKey, scriptPubKey, txTo, true, "P2PKH, undefined hashtype");
+        CheckStandardTemplate(PushSig(CScript(), key, scriptPubKey, txTo, SIGHASH_NONE) << vchPubKey, scriptPubKey, txTo, true, "P2PKH, SIGHASH_NONE");
+        CheckStandardTemplate(CScript() << OP_0 << vchPubKey, scriptPubKey, txTo, true, "P2PKH, empty sig");
+        CheckStandardTemplate(CScript() << std::vector<unsigned char>(20, 1) << vchPubKey, scriptPubKey, txTo, true, "P2PKH, 20 byte sig");
+        CheckStandardTemplate(CScript() << OP_1 << vchPubKey, scriptPubKey, txTo, false, "P2PKH, sig pushed with OP_1");
+        CheckStandardTemplate(PushSig(CScript() << OP_0, key, scriptPubKey, txTo) << vchPubKey, scriptPubKey, txTo, false, "P2PKH, extra push");
+        CheckStandardTemplate(PushSig(CScript(), key, scriptPubKey, txTo), scriptPubKey, txTo, false, "P2PKH, no pubkey");
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(SignatureHash(scriptPubKey, txTo, 0, SIGHASH_ALL), vchSig));
+        vchSig.push_back(SIGHASH_ALL);
+        CScript scriptSigNonMinimal = CScript() << OP_PUSHDATA1 << (unsigned char)vchSig.size();
+        scriptSigNonMinimal.insert(scriptSigNonMinimal.end(), vchSig.begin(), vchSig.end());
+        CheckStandardTemplate(scriptSigNonMinimal << vchPubKey, scriptPubKey, txTo, false, "P2PKH, non-minimal push");
+        vchSig[1]++;
+        CheckStandardTemplate(CScript() << vchSig << vchPubKey, scriptPubKey, txTo, true, "P2PKH, bad DER length");
+    }
+
+    // Bare and P2SH 2-of-3
+    CScript redeemScript = CScript() << OP_2 << ToByteVector(key1.GetPubKey()) << ToByteVector(key2.GetPubKey())
+                                     << ToByteVector(key3.GetPubKey()) << OP_3 << OP_CHECKMULTISIG;
+    for (int i = 0; i < 2; i++) {
+        bool fP2SH = i;
+        CScript scriptPubKey = fP2SH ? GetScriptForDestination(CScriptID(redeemScript)) : redeemScript;
+        CScript scriptRedeem = fP2SH ? CScript() << std::vector<unsigned char>(redeemScript.begin(), redeemScript.end()) : CScript();
+        CMutableTransaction txTo = BuildSpendingTransaction(CScript(), BuildCreditingTransaction(scriptPubKey));
+        std::string strName = fP2SH ? "P2SH(2-of-3)" : "2-of-3";
+
+        CScript sig12 = PushSig(PushSig(CScript() << OP_0, key1, redeemScript, txTo), key2, redeemScript, txTo);
+        CScript sig13 = PushSig(PushSig(CScript() << OP_0, key1, redeemScript, txTo), key3, redeemScript, txTo);
+        CScript sig21 = PushSig(PushSig(CScript() << OP_0, key2, redeemScript, txTo), key1, redeemScript, txTo);
+        CScript sig1 = PushSig(CScript() << OP_0, key1, redeemScript, txTo);
+        CScript sig123 = PushSig(sig12, key3, redeemScript, txTo);
+        CScript sig12Dummy = PushSig(PushSig(CScript() << OP_1, key1, redeemScript, txTo), key2, redeemScript, txTo);
+        CScript sig12Bad = PushSig(PushSig(CScript() << OP_0, key1, redeemScript, txTo), key2, scriptPubKey, txTo);
+
+        CheckStandardTemplate(sig12 + scriptRedeem, scriptPubKey, txTo, true, strName);
+        CheckStandardTemplate(sig13 + scriptRedeem, scriptPubKey, txTo, true, strName + ", keys 1 and 3");
+        CheckStandardTemplate(sig21 + scriptRedeem, scriptPubKey, txTo, true, strName + ", sigs out of order");
+        CheckStandardTemplate(sig12Bad + scriptRedeem, scriptPubKey, txTo, true, strName + ", bad second sig");
+        CheckStandardTemplate(sig12Dummy + scriptRedeem, scriptPubKey, txTo, false, strName + ", nonzero dummy");
+        CheckStandardTemplate(sig1 + scriptRedeem, scriptPubKey, txTo, false, strName + ", one sig");
+        CheckStandardTemplate(sig123 + scriptRedeem, scriptPubKey, txTo, false, strName + ", three sigs");
+        CheckStandardTemplate((CScript() << OP_0 << OP_0 << OP_0) + scriptRedeem, scriptPubKey, txTo, true, strName + ", empty sigs");
+    }
+
+    // P2SH with a redeemScript that does not match the hash
+    CScript scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+    CMutableTransaction txTo = BuildSpendingTransaction(CScript(), BuildCreditingTransaction(scriptPubKey));
+    CScript sig12 = PushSig(PushSig(CScript() << OP_0, key1, redeemScript, txTo), key2, redeemScript, txTo);
+    CScript redeemOther = CScript() << OP_1 << ToByteVector(key1.GetPubKey()) << OP_1 << OP_CHECKMULTISIG;
+    CheckStandardTemplate(sig12 << std::vector<unsigned char>(redeemOther.begin(), redeemOther.end()), scriptPubKey, txTo, true, "P2SH, wrong redeemScript");
+}
+
 BOOST_AUTO_TEST_CASE(script_standard_push)
 {
     ScriptError err;
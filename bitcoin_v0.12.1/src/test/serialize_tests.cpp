@@ -5,6 +5,7 @@
 #include "serialize.h"
 #include "streams.h"
 #include "hash.h"
+#include "primitives/block.h"
 #include "test/test_bitcoin.h"
 
 #include <stdint.h>
@@ -276,4 +277,58 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     BOOST_CHECK_EQUAL(ss.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(cached_sizes)
+{
+    // A default transaction knows its size without having been hashed
+    CTransaction txNull;
+    BOOST_CHECK_EQUAL(txNull.GetTotalSize(), ::GetSerializeSize(txNull, SER_NETWORK, PROTOCOL_VERSION));
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(2);
+    mtx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(300, 1);
+    mtx.vout.resize(1);
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    CTransaction tx(mtx);
+    BOOST_CHECK_EQUAL(tx.GetTotalSize(), ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(tx.GetTotalSize(), ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION));
+
+    // Deserialized and assigned transactions carry the size along
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx;
+    CTransaction txRead;
+    ss >> txRead;
+    BOOST_CHECK_EQUAL(txRead.GetTotalSize(), tx.GetTotalSize());
+    txNull = tx;
+    BOOST_CHECK_EQUAL(txNull.GetTotalSize(), tx.GetTotalSize());
+
+    CBlock block;
+    BOOST_CHECK_EQUAL(block.GetTotalSize(), ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    block.vtx.resize(300, tx);
+    BOOST_CHECK_EQUAL(block.GetTotalSize(), ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+}
+
+BOOST_AUTO_TEST_CASE(buffered_hash_writer)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vout.resize(3);
+    CTransaction tx(mtx);
+    uint256 prefix = tx.GetHash();
+
+    CBufferedHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    static_cast<CHashWriter&>(hasher) << prefix;
+    hasher << tx;
+
+    // Only the bytes written through the buffered writer are kept
+    CDataStream ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << tx;
+    BOOST_CHECK(hasher.data() == std::vector<char>(ss.begin(), ss.end()));
+    BOOST_CHECK_EQUAL(hasher.size(), prefix.size() + ss.size());
+
+    // ...but all of them are hashed
+    CHashWriter expected(SER_GETHASH, PROTOCOL_VERSION);
+    expected << prefix << tx;
+    BOOST_CHECK(hasher.GetHash() == expected.GetHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "streams.h"
+#include "primitives/block.h"
+#include "script/script.h"
 #include "support/allocators/zeroafterfree.h"
 #include "test/test_bitcoin.h"
 
@@ -64,4 +66,59 @@ BOOST_AUTO_TEST_CASE(streams_serializedata_xor)
             std::string(ds.begin(), ds.end()));  
 }         
 
+BOOST_AUTO_TEST_CASE(streams_block_arena)
+{
+    CBlock block;
+    block.nTime = 1234;
+    for (int i = 0; i < 50; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(2);
+        tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, i) << std::vector<unsigned char>(33, i);
+        tx.vin[1].scriptSig = CScript() << i;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+        block.vtx.push_back(CTransaction(tx));
+    }
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    size_t nSize = ss.size();
+
+    CBlock blockArena;
+    UnserializeBlockWithArena(ss, blockArena, ss.size());
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(blockArena.arena);
+    // Everything fit in the first chunk, sized from the hint
+    BOOST_CHECK_EQUAL(blockArena.arena->NumChunks(), 1U);
+    BOOST_CHECK(blockArena.arena->DynamicMemoryUsage() >= nSize);
+    BOOST_CHECK(blockArena.GetHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(blockArena.vtx.size(), block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        BOOST_CHECK(blockArena.vtx[i].GetHash() == block.vtx[i].GetHash());
+        // Long scripts live in the arena, short ones stay inline
+        BOOST_CHECK_EQUAL(blockArena.vtx[i].vin[0].scriptSig.allocated_memory(), 0U);
+        BOOST_CHECK(blockArena.vtx[i].vin[0].scriptSig == block.vtx[i].vin[0].scriptSig);
+        BOOST_CHECK(blockArena.vtx[i].vin[1].scriptSig == block.vtx[i].vin[1].scriptSig);
+    }
+
+    // Copies own their scripts and outlive the arena
+    CBlock blockCopy(blockArena);
+    CTransaction txCopy = blockArena.vtx[7];
+    CScript scriptGrown = blockArena.vtx[8].vin[0].scriptSig;
+    BOOST_CHECK(txCopy.vin[0].scriptSig.allocated_memory() > 0);
+    blockArena.SetNull();
+    BOOST_CHECK(!blockArena.arena);
+    blockCopy.arena.reset();
+    BOOST_CHECK(txCopy.GetHash() == block.vtx[7].GetHash());
+    BOOST_CHECK(scriptGrown == block.vtx[8].vin[0].scriptSig);
+    BOOST_CHECK(blockCopy.GetHash() == block.GetHash());
+    CDataStream ssCopy(SER_NETWORK, PROTOCOL_VERSION);
+    ssCopy << blockCopy;
+    BOOST_CHECK_EQUAL(ssCopy.size(), nSize);
+
+    // Overlong lengths are left to the usual chunked reads
+    CBlockArena arena;
+    BOOST_CHECK(arena.Allocate(CBlockArena::MAX_ALLOCATION + 1) == NULL);
+    BOOST_CHECK_EQUAL(arena.NumChunks(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -14,6 +14,7 @@
 #include "miner.h"
 #include "pubkey.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -39,6 +40,8 @@ BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
         SetupEnvironment();
         SetupNetworking();
         fPrintToDebugLog = false; // don't want to write to debug.log file
+        InitSignatureCache();
+        InitScriptExecutionCache();
         fCheckBlockIndex = true;
         SelectParams(chainName);
         noui_connect();
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
 #include "consensus/validation.h"
 #include "key.h"
 #include "main.h"
@@ -83,4 +84,153 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+// Spends output n of txPrev to nOutputs outputs of nValue each, signed with key
+static CMutableTransaction
+CreateSpend(const CTransaction& txPrev, unsigned int n, const CKey& key, CAmount nValue, unsigned int nOutputs = 1,
+            uint32_t nSequence = CTxIn::SEQUENCE_FINAL)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), n);
+    tx.vin[0].nSequence = nSequence;
+    tx.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        tx.vout[i].nValue = nValue;
+        tx.vout[i].scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    }
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(txPrev.vout[n].scriptPubKey, tx, 0, SIGHASH_ALL);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_mempool_admission_phases, TestChain100Setup)
+{
+    // Admission split into checks, script verification and commit, with
+    // the mempool changing between the checks and the commit.
+    LOCK(cs_main);
+
+    // Only the first coinbase is mature, split it up
+    CMutableTransaction txFund = CreateSpend(coinbaseTxns[0], 0, coinbaseKey, 1*COIN, 5);
+    BOOST_CHECK(ToMemPool(txFund));
+
+    // Nothing changed in between
+    CTransaction tx1 = CreateSpend(txFund, 0, coinbaseKey, 11*CENT);
+    CValidationState state1;
+    CMemPoolAdmission admission1(tx1, false, GetTime());
+    BOOST_CHECK(PreAcceptToMemoryPool(mempool, state1, admission1));
+    BOOST_CHECK(!mempool.exists(tx1.GetHash()));
+    BOOST_CHECK(CheckMemPoolAdmissionScripts(state1, admission1));
+    BOOST_CHECK(FinishAcceptToMemoryPool(mempool, state1, admission1));
+    BOOST_CHECK(mempool.exists(tx1.GetHash()));
+
+    // A double spend gets in first
+    CTransaction tx2 = CreateSpend(txFund, 1, coinbaseKey, 11*CENT);
+    CMutableTransaction tx2b = CreateSpend(txFund, 1, coinbaseKey, 12*CENT);
+    CValidationState state2;
+    CMemPoolAdmission admission2(tx2, false, GetTime());
+    BOOST_CHECK(PreAcceptToMemoryPool(mempool, state2, admission2));
+    BOOST_CHECK(CheckMemPoolAdmissionScripts(state2, admission2));
+    BOOST_CHECK(ToMemPool(tx2b));
+    BOOST_CHECK(!FinishAcceptToMemoryPool(mempool, state2, admission2));
+    BOOST_CHECK_EQUAL(state2.GetRejectReason(), "txn-mempool-conflict");
+    BOOST_CHECK(!mempool.exists(tx2.GetHash()));
+
+    // An unrelated transaction gets in first, the checks are redone
+    CTransaction tx3 = CreateSpend(txFund, 2, coinbaseKey, 11*CENT);
+    CMutableTransaction tx4 = CreateSpend(txFund, 3, coinbaseKey, 11*CENT);
+    CValidationState state3;
+    CMemPoolAdmission admission3(tx3, false, GetTime());
+    BOOST_CHECK(PreAcceptToMemoryPool(mempool, state3, admission3));
+    BOOST_CHECK(CheckMemPoolAdmissionScripts(state3, admission3));
+    BOOST_CHECK(ToMemPool(tx4));
+    BOOST_CHECK(FinishAcceptToMemoryPool(mempool, state3, admission3));
+    BOOST_CHECK(mempool.exists(tx3.GetHash()));
+
+    // Scripts that fail keep the transaction out
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CTransaction tx5 = CreateSpend(txFund, 4, keyOther, 11*CENT);
+    CValidationState state5;
+    CMemPoolAdmission admission5(tx5, false, GetTime());
+    BOOST_CHECK(PreAcceptToMemoryPool(mempool, state5, admission5));
+    BOOST_CHECK(!CheckMemPoolAdmissionScripts(state5, admission5));
+    BOOST_CHECK_EQUAL(state5.GetRejectReason().find("mandatory-script-verify-flag-failed"), 0U);
+    BOOST_CHECK(!FinishAcceptToMemoryPool(mempool, state5, admission5));
+    BOOST_CHECK(!mempool.exists(tx5.GetHash()));
+    BOOST_CHECK_EQUAL(mempool.size(), 5U);
+
+    // The replaced transaction is prioritised in between, the replacement
+    // no longer pays more than it
+    CMutableTransaction tx6 = CreateSpend(txFund, 4, coinbaseKey, 50*CENT, 1, 0);
+    BOOST_CHECK(ToMemPool(tx6));
+    CTransaction tx6b = CreateSpend(txFund, 4, coinbaseKey, 40*CENT);
+    CValidationState state6;
+    CMemPoolAdmission admission6(tx6b, false, GetTime());
+    BOOST_CHECK(PreAcceptToMemoryPool(mempool, state6, admission6));
+    BOOST_CHECK(CheckMemPoolAdmissionScripts(state6, admission6));
+    uint256 hash6 = tx6.GetHash();
+    mempool.PrioritiseTransaction(hash6, hash6.ToString(), 0, 20*CENT);
+    BOOST_CHECK(!FinishAcceptToMemoryPool(mempool, state6, admission6));
+    BOOST_CHECK_EQUAL(state6.GetRejectReason(), "insufficient fee");
+    BOOST_CHECK(mempool.exists(hash6));
+    mempool.ClearPrioritisation(hash6);
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_script_execution_cache, TestChain100Setup)
+{
+    // Transactions accepted to the mempool have their scripts remembered for
+    // the flags the next block is connected with
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction txSpend = CreateSpend(coinbaseTxns[0], 0, coinbaseKey, 11*CENT);
+    BOOST_CHECK(ToMemPool(txSpend));
+
+    {
+        LOCK(cs_main);
+        unsigned int flags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus());
+        CCoinsViewCache view(pcoinsTip);
+        CValidationState state;
+        std::vector<CScriptCheck> vChecks;
+        const CTransaction txSpendFinal(txSpend);
+        PrecomputedTransactionData txdata;
+
+        // Cached: nothing left to check
+        BOOST_CHECK(CheckInputScripts(txSpendFinal, state, view, flags, false, false, txdata, &vChecks));
+        BOOST_CHECK(vChecks.empty());
+
+        // Other flags still run the scripts
+        BOOST_CHECK(CheckInputScripts(txSpendFinal, state, view, flags | SCRIPT_VERIFY_NULLDUMMY, false, false, txdata, &vChecks));
+        BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+        vChecks.clear();
+
+        // Deferred checks are not remembered, since they have not run yet
+        BOOST_CHECK(CheckInputScripts(txSpendFinal, state, view, flags | SCRIPT_VERIFY_NULLDUMMY, false, true, txdata, &vChecks));
+        BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+        vChecks.clear();
+        BOOST_CHECK(CheckInputScripts(txSpendFinal, state, view, flags | SCRIPT_VERIFY_NULLDUMMY, false, false, txdata, &vChecks));
+        BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+        vChecks.clear();
+
+        // Failures are never remembered
+        CMutableTransaction txBadMutable = txSpend;
+        txBadMutable.vout[0].nValue = 12*CENT;
+        const CTransaction txBad(txBadMutable);
+        PrecomputedTransactionData txdataBad;
+        BOOST_CHECK(!CheckInputScripts(txBad, state, view, flags, false, true, txdataBad));
+        BOOST_CHECK(CheckInputScripts(txBad, state, view, flags, false, false, txdataBad, &vChecks));
+        BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+        BOOST_CHECK(!vChecks[0]());
+    }
+
+    // The block connects using the cached result
+    std::vector<CMutableTransaction> txns;
+    txns.push_back(txSpend);
+    CBlock block = CreateAndProcessBlock(txns, scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,8 @@
 #include "consensus/validation.h"
 #include "main.h"
 #include "policy/fees.h"
+#include "random.h"
+#include "script/interpreter.h"
 #include "streams.h"
 #include "timedata.h"
 #include "util.h"
@@ -17,6 +19,8 @@
 #include "utiltime.h"
 #include "version.h"
 
+#include <algorithm>
+
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -27,7 +31,7 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
     hadNoDependencies(poolHasNoInputsOf), inChainInputValue(_inChainInputValue),
     spendsCoinbase(_spendsCoinbase), sigOpCount(_sigOps), lockPoints(lp)
 {
-    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    nTxSize = tx.GetTotalSize();
     nModSize = tx.CalculateModifiedSize(nTxSize);
     nUsageSize = RecursiveDynamicUsage(tx);
 
@@ -38,6 +42,13 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
     assert(inChainInputValue <= nValueIn);
 
     feeDelta = 0;
+
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nModFeesWithAncestors = nFee;
+    nSigOpCountWithAncestors = sigOpCount;
+
+    nEpochMarker = 0;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -58,6 +69,7 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
 void CTxMemPoolEntry::UpdateFeeDelta(int64_t newFeeDelta)
 {
     nModFeesWithDescendants += newFeeDelta - feeDelta;
+    nModFeesWithAncestors += newFeeDelta - feeDelta;
     feeDelta = newFeeDelta;
 }
 
@@ -67,66 +79,58 @@ void CTxMemPoolEntry::UpdateLockPoints(const LockPoints& lp)
 }
 
 // Update the given tx for any in-mempool descendants.
-// Assumes that setMemPoolChildren is correct for the given tx and all
+// Assumes that vMemPoolChildren is correct for the given tx and all
 // descendants.
-bool CTxMemPool::UpdateForDescendants(txiter updateIt, int maxDescendantsToVisit, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
+void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
 {
-    // Track the number of entries (outside setExclude) that we'd need to visit
-    // (will bail out if it exceeds maxDescendantsToVisit)
-    int nChildrenToVisit = 0;
-
-    setEntries stageEntries, setAllDescendants;
-    stageEntries = GetMemPoolChildren(updateIt);
-
-    while (!stageEntries.empty()) {
-        const txiter cit = *stageEntries.begin();
-        if (cit->IsDirty()) {
-            // Don't consider any more children if any descendant is dirty
-            return false;
+    vecEntries stageEntries, vAllDescendants;
+    {
+        EpochGuard guard(*this);
+        BOOST_FOREACH(const CTxMemPoolEntry* child, GetMemPoolChildren(updateIt)) {
+            txiter childEntry = GetIter(child);
+            if (!visited(childEntry))
+                stageEntries.push_back(childEntry);
         }
-        setAllDescendants.insert(cit);
-        stageEntries.erase(cit);
-        const setEntries &setChildren = GetMemPoolChildren(cit);
-        BOOST_FOREACH(const txiter childEntry, setChildren) {
-            cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
-            if (cacheIt != cachedDescendants.end()) {
-                // We've already calculated this one, just add the entries for this set
-                // but don't traverse again.
-                BOOST_FOREACH(const txiter cacheEntry, cacheIt->second) {
-                    // update visit count only for new child transactions
-                    // (outside of setExclude and stageEntries)
-                    if (setAllDescendants.insert(cacheEntry).second &&
-                            !setExclude.count(cacheEntry->GetTx().GetHash()) &&
-                            !stageEntries.count(cacheEntry)) {
-                        nChildrenToVisit++;
+
+        while (!stageEntries.empty()) {
+            const txiter cit = stageEntries.back();
+            vAllDescendants.push_back(cit);
+            stageEntries.pop_back();
+            BOOST_FOREACH(const CTxMemPoolEntry* child, GetMemPoolChildren(cit)) {
+                txiter childEntry = GetIter(child);
+                if (visited(childEntry))
+                    continue;
+                cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
+                if (cacheIt != cachedDescendants.end()) {
+                    // We've already calculated this one, just add the entries for this set
+                    // but don't traverse again.
+                    BOOST_FOREACH(const txiter cacheEntry, cacheIt->second) {
+                        if (!visited(cacheEntry))
+                            vAllDescendants.push_back(cacheEntry);
                     }
+                } else {
+                    // Schedule for later processing
+                    stageEntries.push_back(childEntry);
                 }
-            } else if (!setAllDescendants.count(childEntry)) {
-                // Schedule for later processing and update our visit count
-                if (stageEntries.insert(childEntry).second && !setExclude.count(childEntry->GetTx().GetHash())) {
-                        nChildrenToVisit++;
-                }
-            }
-            if (nChildrenToVisit > maxDescendantsToVisit) {
-                return false;
             }
         }
     }
-    // setAllDescendants now contains all in-mempool descendants of updateIt.
+    // vAllDescendants now contains all in-mempool descendants of updateIt.
     // Update and add to cached descendant map
     int64_t modifySize = 0;
     CAmount modifyFee = 0;
     int64_t modifyCount = 0;
-    BOOST_FOREACH(txiter cit, setAllDescendants) {
+    BOOST_FOREACH(txiter cit, vAllDescendants) {
         if (!setExclude.count(cit->GetTx().GetHash())) {
             modifySize += cit->GetTxSize();
             modifyFee += cit->GetModifiedFee();
             modifyCount++;
-            cachedDescendants[updateIt].insert(cit);
+            cachedDescendants[updateIt].push_back(cit);
+            // Update ancestor state for each descendant
+            mapTx.modify(cit, update_ancestor_state(updateIt->GetTxSize(), updateIt->GetModifiedFee(), 1, updateIt->GetSigOpCount()));
         }
     }
     mapTx.modify(updateIt, update_descendant_state(modifySize, modifyFee, modifyCount));
-    return true;
 }
 
 // vHashesToUpdate is the set of transaction hashes from a disconnected block
@@ -148,7 +152,7 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
     // Iterate in reverse, so that whenever we are looking at at a transaction
     // we are sure that all in-mempool descendants have already been processed.
     // This maximizes the benefit of the descendant cache and guarantees that
-    // setMemPoolChildren will be updated, an assumption made in
+    // vMemPoolChildren will be updated, an assumption made in
     // UpdateForDescendants.
     BOOST_REVERSE_FOREACH(const uint256 &hash, vHashesToUpdate) {
         // we cache the in-mempool children to avoid duplicate updates
@@ -159,8 +163,8 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
             continue;
         }
         std::map<COutPoint, CInPoint>::iterator iter = mapNextTx.lower_bound(COutPoint(hash, 0));
-        // First calculate the children, and update setMemPoolChildren to
-        // include them, and update their setMemPoolParents to include this tx.
+        // First calculate the children, and update vMemPoolChildren to
+        // include them, and update their vMemPoolParents to include this tx.
         for (; iter != mapNextTx.end() && iter->first.hash == hash; ++iter) {
             const uint256 &childHash = iter->second.ptx->GetHash();
             txiter childIter = mapTx.find(childHash);
@@ -172,27 +176,28 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
                 UpdateParent(childIter, it, true);
             }
         }
-        if (!UpdateForDescendants(it, 100, mapMemPoolDescendantsToUpdate, setAlreadyIncluded)) {
-            // Mark as dirty if we can't do the calculation.
-            mapTx.modify(it, set_dirty());
-        }
+        // Update descendant state of this tx, and the ancestor state of its
+        // descendants.
+        UpdateForDescendants(it, mapMemPoolDescendantsToUpdate, setAlreadyIncluded);
     }
 }
 
-bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */)
+bool CTxMemPool::CalculateAncestors(const CTxMemPoolEntry &entry, vecEntries &vAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents) const
 {
-    setEntries parentHashes;
+    EpochGuard guard(*this);
     const CTransaction &tx = entry.GetTx();
 
+    // vAncestors doubles as the queue of ancestors still to be walked: every
+    // entry before index i has been checked and had its parents queued.
     if (fSearchForParents) {
         // Get parents of this transaction that are in the mempool
         // GetMemPoolParents() is only valid for entries in the mempool, so we
         // iterate mapTx to find parents.
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             txiter piter = mapTx.find(tx.vin[i].prevout.hash);
-            if (piter != mapTx.end()) {
-                parentHashes.insert(piter);
-                if (parentHashes.size() + 1 > limitAncestorCount) {
+            if (piter != mapTx.end() && !visited(piter)) {
+                vAncestors.push_back(piter);
+                if (vAncestors.size() + 1 > limitAncestorCount) {
                     errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
                     return false;
                 }
@@ -202,16 +207,17 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // If we're not searching for parents, we require this to be an
         // entry in the mempool already.
         txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        BOOST_FOREACH(const CTxMemPoolEntry* parent, GetMemPoolParents(it)) {
+            txiter piter = GetIter(parent);
+            if (!visited(piter))
+                vAncestors.push_back(piter);
+        }
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
 
-    while (!parentHashes.empty()) {
-        txiter stageit = *parentHashes.begin();
-
-        setAncestors.insert(stageit);
-        parentHashes.erase(stageit);
+    for (size_t i = 0; i < vAncestors.size(); i++) {
+        txiter stageit = vAncestors[i];
         totalSizeWithAncestors += stageit->GetTxSize();
 
         if (stageit->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
@@ -225,52 +231,100 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
             return false;
         }
 
-        const setEntries & setMemPoolParents = GetMemPoolParents(stageit);
-        BOOST_FOREACH(const txiter &phash, setMemPoolParents) {
+        BOOST_FOREACH(const CTxMemPoolEntry* parent, GetMemPoolParents(stageit)) {
             // If this is a new ancestor, add it.
-            if (setAncestors.count(phash) == 0) {
-                parentHashes.insert(phash);
-            }
-            if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
-                errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
-                return false;
-            }
+            txiter phash = GetIter(parent);
+            if (!visited(phash))
+                vAncestors.push_back(phash);
+        }
+        if (vAncestors.size() + 1 > limitAncestorCount) {
+            errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
+            return false;
         }
     }
 
     return true;
 }
 
-void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
+bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
+{
+    vecEntries vAncestors;
+    bool fResult = CalculateAncestors(entry, vAncestors, limitAncestorCount, limitAncestorSize, limitDescendantCount, limitDescendantSize, errString, fSearchForParents);
+    setAncestors.insert(vAncestors.begin(), vAncestors.end());
+    return fResult;
+}
+
+void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, const vecEntries &vAncestors)
 {
-    setEntries parentIters = GetMemPoolParents(it);
     // add or remove this tx as a child of each parent
-    BOOST_FOREACH(txiter piter, parentIters) {
-        UpdateChild(piter, it, add);
+    BOOST_FOREACH(const CTxMemPoolEntry* parent, GetMemPoolParents(it)) {
+        UpdateChild(GetIter(parent), it, add);
     }
     const int64_t updateCount = (add ? 1 : -1);
     const int64_t updateSize = updateCount * it->GetTxSize();
     const CAmount updateFee = updateCount * it->GetModifiedFee();
-    BOOST_FOREACH(txiter ancestorIt, setAncestors) {
+    BOOST_FOREACH(txiter ancestorIt, vAncestors) {
         mapTx.modify(ancestorIt, update_descendant_state(updateSize, updateFee, updateCount));
     }
 }
 
+void CTxMemPool::UpdateEntryForAncestors(txiter it, const vecEntries &vAncestors)
+{
+    int64_t updateCount = vAncestors.size();
+    int64_t updateSize = 0;
+    CAmount updateFee = 0;
+    int updateSigOps = 0;
+    BOOST_FOREACH(txiter ancestorIt, vAncestors) {
+        updateSize += ancestorIt->GetTxSize();
+        updateFee += ancestorIt->GetModifiedFee();
+        updateSigOps += ancestorIt->GetSigOpCount();
+    }
+    mapTx.modify(it, update_ancestor_state(updateSize, updateFee, updateCount, updateSigOps));
+}
+
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
 {
-    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
-    BOOST_FOREACH(txiter updateIt, setMemPoolChildren) {
-        UpdateParent(updateIt, it, false);
+    BOOST_FOREACH(const CTxMemPoolEntry* child, GetMemPoolChildren(it)) {
+        UpdateParent(GetIter(child), it, false);
     }
 }
 
-void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove)
+// Orders mapTx iterators by the address of their entries, for binary searches
+static bool CompareIteratorByAddress(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b)
+{
+    return &*a < &*b;
+}
+
+void CTxMemPool::UpdateForRemoveFromMempool(const vecEntries &entriesToRemove, bool updateDescendants)
 {
     // For each entry, walk back all ancestors and decrement size associated with this
     // transaction
     const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    // Sorted copy of entriesToRemove to test for membership in
+    vecEntries vSorted(entriesToRemove);
+    std::sort(vSorted.begin(), vSorted.end(), CompareIteratorByAddress);
+    if (updateDescendants) {
+        // updateDescendants should be true whenever we're not recursively
+        // removing a tx and all its descendants, eg when a transaction is
+        // confirmed in a block.
+        // Here we only update statistics and not the entries' links (which
+        // we need to preserve until we're finished with all operations that
+        // need to traverse the mempool).
+        BOOST_FOREACH(txiter removeIt, entriesToRemove) {
+            vecEntries vDescendants;
+            CalculateDescendants(removeIt, vDescendants); // doesn't include self
+            int64_t modifySize = -((int64_t)removeIt->GetTxSize());
+            CAmount modifyFee = -removeIt->GetModifiedFee();
+            int modifySigOps = -removeIt->GetSigOpCount();
+            BOOST_FOREACH(txiter dit, vDescendants) {
+                // Descendants that are removed as well are not worth updating
+                if (!std::binary_search(vSorted.begin(), vSorted.end(), dit, CompareIteratorByAddress))
+                    mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
+            }
+        }
+    }
     BOOST_FOREACH(txiter removeIt, entriesToRemove) {
-        setEntries setAncestors;
+        vecEntries vAncestors;
         const CTxMemPoolEntry &entry = *removeIt;
         std::string dummy;
         // Since this is a tx that is already in the mempool, we can call CMPA
@@ -279,54 +333,93 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove)
         // should be a bit faster.
         // However, if we happen to be in the middle of processing a reorg, then
         // the mempool can be in an inconsistent state.  In this case, the set
-        // of ancestors reachable via mapLinks will be the same as the set of 
+        // of ancestors reachable via the parent links will be the same as the set of
         // ancestors whose packages include this transaction, because when we
         // add a new transaction to the mempool in addUnchecked(), we assume it
         // has no children, and in the case of a reorg where that assumption is
         // false, the in-mempool children aren't linked to the in-block tx's
         // until UpdateTransactionsFromBlock() is called.
         // So if we're being called during a reorg, ie before
-        // UpdateTransactionsFromBlock() has been called, then mapLinks[] will
+        // UpdateTransactionsFromBlock() has been called, then the parent links will
         // differ from the set of mempool parents we'd calculate by searching,
-        // and it's important that we use the mapLinks[] notion of ancestor
+        // and it's important that we use the parent links' notion of ancestor
         // transactions as the set of things to update for removal.
-        CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        CalculateAncestors(entry, vAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        // Ancestors that are removed along with removeIt (eg. its parents in
+        // the same block) are skipped for the same reason.
+        size_t nKeep = 0;
+        for (size_t i = 0; i < vAncestors.size(); i++) {
+            if (!std::binary_search(vSorted.begin(), vSorted.end(), vAncestors[i], CompareIteratorByAddress))
+                vAncestors[nKeep++] = vAncestors[i];
+        }
+        vAncestors.resize(nKeep);
         // Note that UpdateAncestorsOf severs the child links that point to
         // removeIt in the entries for the parents of removeIt.  This is
         // fine since we don't need to use the mempool children of any entries
         // to walk back over our ancestors (but we do need the mempool
         // parents!)
-        UpdateAncestorsOf(false, removeIt, setAncestors);
+        UpdateAncestorsOf(false, removeIt, vAncestors);
     }
     // After updating all the ancestor sizes, we can now sever the link between each
-    // transaction being removed and any mempool children (ie, update setMemPoolParents
+    // transaction being removed and any mempool children (ie, update vMemPoolParents
     // for each direct child of a transaction being removed).
     BOOST_FOREACH(txiter removeIt, entriesToRemove) {
         UpdateChildrenForRemoval(removeIt);
     }
 }
 
-void CTxMemPoolEntry::SetDirty()
+void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
 {
-    nCountWithDescendants = 0;
-    nSizeWithDescendants = nTxSize;
-    nModFeesWithDescendants = GetModifiedFee();
+    nSizeWithDescendants += modifySize;
+    assert(int64_t(nSizeWithDescendants) > 0);
+    nModFeesWithDescendants += modifyFee;
+    nCountWithDescendants += modifyCount;
+    assert(int64_t(nCountWithDescendants) > 0);
 }
 
-void CTxMemPoolEntry::UpdateState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount, int modifySigOps)
 {
-    if (!IsDirty()) {
-        nSizeWithDescendants += modifySize;
-        assert(int64_t(nSizeWithDescendants) > 0);
-        nModFeesWithDescendants += modifyFee;
-        nCountWithDescendants += modifyCount;
-        assert(int64_t(nCountWithDescendants) > 0);
+    nSizeWithAncestors += modifySize;
+    assert(int64_t(nSizeWithAncestors) > 0);
+    nModFeesWithAncestors += modifyFee;
+    nCountWithAncestors += modifyCount;
+    assert(int64_t(nCountWithAncestors) > 0);
+    nSigOpCountWithAncestors += modifySigOps;
+    assert(int(nSigOpCountWithAncestors) >= 0);
+}
+
+SaltedTxidHasher::SaltedTxidHasher() : salt(GetRandHash()) {}
+
+const unsigned int CTxMemPool::FEE_HISTOGRAM_BUCKETS;
+const double CTxMemPool::FEE_HISTOGRAM_SPACING = 1.25;
+
+namespace {
+
+struct CompareFeeRateBucket
+{
+    bool operator()(const CFeeRate& feeRate, const CFeeRateBucket& bucket) const
+    {
+        return feeRate < bucket.feeRateFrom;
     }
+};
+
+// The bucket of vBuckets whose range holds feeRate. Feerates below the
+// start of the first one are counted in it.
+std::vector<CFeeRateBucket>::iterator FindFeeRateBucket(std::vector<CFeeRateBucket>& vBuckets, const CFeeRate& feeRate)
+{
+    return std::upper_bound(vBuckets.begin() + 1, vBuckets.end(), feeRate, CompareFeeRateBucket()) - 1;
+}
+
 }
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), nEpoch(0), fHasEpochGuard(false)
 {
+    vFeeHistogram.push_back(CFeeRateBucket(CFeeRate(0)));
+    double dFeeFrom = 1000;
+    for (unsigned int i = 1; i < FEE_HISTOGRAM_BUCKETS; i++, dFeeFrom *= FEE_HISTOGRAM_SPACING)
+        vFeeHistogram.push_back(CFeeRateBucket(CFeeRate((CAmount)dFeeFrom)));
+
     _clear(); //lock free clear
 
     // Sanity checks off by default for performance, because otherwise
@@ -375,7 +468,6 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // all the appropriate checks.
     LOCK(cs);
     indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
-    mapLinks.insert(make_pair(newit, TxLinks()));
 
     // Update transaction for any feeDelta created by PrioritiseTransaction
     // TODO: refactor so that the fee delta is calculated before inserting
@@ -387,6 +479,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
             mapTx.modify(newit, update_fee_delta(deltas.second));
         }
     }
+    UpdateFeeHistogram(*newit, true);
 
     // Update cachedInnerUsage to include contained transaction's usage.
     // (When we update the entry for in-mempool parents, memory usage will be
@@ -413,55 +506,70 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
             UpdateParent(newit, pit, true);
         }
     }
-    UpdateAncestorsOf(true, newit, setAncestors);
+    vecEntries vAncestors(setAncestors.begin(), setAncestors.end());
+    UpdateAncestorsOf(true, newit, vAncestors);
+    UpdateEntryForAncestors(newit, vAncestors);
 
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
     minerPolicyEstimator->processTransaction(entry, fCurrentEstimate);
+    NotifyEntryAdded(tx);
 
     return true;
 }
 
-void CTxMemPool::removeUnchecked(txiter it)
+void CTxMemPool::removeUnchecked(txiter it, bool fUpdateEstimator)
 {
     const uint256 hash = it->GetTx().GetHash();
+    NotifyEntryRemoved(it->GetTx());
     BOOST_FOREACH(const CTxIn& txin, it->GetTx().vin)
         mapNextTx.erase(txin.prevout);
+    UpdateFeeHistogram(*it, false);
 
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
-    mapLinks.erase(it);
+    cachedInnerUsage -= memusage::DynamicUsage(it->vMemPoolParents) + memusage::DynamicUsage(it->vMemPoolChildren);
     mapTx.erase(it);
     nTransactionsUpdated++;
-    minerPolicyEstimator->removeTx(hash);
-}
-
-// Calculates descendants of entry that are not already in setDescendants, and adds to
-// setDescendants. Assumes entryit is already a tx in the mempool and setMemPoolChildren
-// is correct for tx and all descendants.
-// Also assumes that if an entry is in setDescendants already, then all
-// in-mempool descendants of it are already in setDescendants as well, so that we
-// can save time by not iterating over those entries.
-void CTxMemPool::CalculateDescendants(txiter entryit, setEntries &setDescendants)
-{
-    setEntries stage;
-    if (setDescendants.count(entryit) == 0) {
-        stage.insert(entryit);
-    }
-    // Traverse down the children of entry, only adding children that are not
-    // accounted for in setDescendants already (because those children have either
-    // already been walked, or will be walked in this iteration).
-    while (!stage.empty()) {
-        txiter it = *stage.begin();
-        setDescendants.insert(it);
-        stage.erase(it);
-
-        const setEntries &setChildren = GetMemPoolChildren(it);
-        BOOST_FOREACH(const txiter &childiter, setChildren) {
-            if (!setDescendants.count(childiter)) {
-                stage.insert(childiter);
-            }
+    if (fUpdateEstimator)
+        minerPolicyEstimator->removeTx(hash);
+}
+
+void CTxMemPool::CalculateDescendants(txiter entryit, vecEntries &vDescendants) const
+{
+    EpochGuard guard(*this);
+    visited(entryit);
+    BOOST_FOREACH(const CTxMemPoolEntry* child, GetMemPoolChildren(entryit)) {
+        txiter childiter = GetIter(child);
+        if (!visited(childiter))
+            vDescendants.push_back(childiter);
+    }
+    // vDescendants doubles as the queue of entries whose children are still to be walked
+    for (size_t i = 0; i < vDescendants.size(); i++) {
+        BOOST_FOREACH(const CTxMemPoolEntry* child, GetMemPoolChildren(vDescendants[i])) {
+            txiter childiter = GetIter(child);
+            if (!visited(childiter))
+                vDescendants.push_back(childiter);
+        }
+    }
+}
+
+void CTxMemPool::StageWithDescendants(const vecEntries &vRoots, vecEntries &vStage) const
+{
+    EpochGuard guard(*this);
+    BOOST_FOREACH(txiter it, vStage)
+        visited(it);
+    size_t nBegin = vStage.size();
+    BOOST_FOREACH(txiter it, vRoots) {
+        if (!visited(it))
+            vStage.push_back(it);
+    }
+    // The new part of vStage doubles as the queue of entries whose children are still to be walked
+    for (size_t i = nBegin; i < vStage.size(); i++) {
+        BOOST_FOREACH(const CTxMemPoolEntry* child, GetMemPoolChildren(vStage[i])) {
+            txiter childiter = GetIter(child);
+            if (!visited(childiter))
+                vStage.push_back(childiter);
         }
     }
 }
@@ -471,10 +579,10 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
     // Remove transaction from memory pool
     {
         LOCK(cs);
-        setEntries txToRemove;
+        vecEntries txToRemove;
         txiter origit = mapTx.find(origTx.GetHash());
         if (origit != mapTx.end()) {
-            txToRemove.insert(origit);
+            txToRemove.push_back(origit);
         } else if (fRecursive) {
             // If recursively removing but origTx isn't in the mempool
             // be sure to remove any children that are in the pool. This can
@@ -486,21 +594,19 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                     continue;
                 txiter nextit = mapTx.find(it->second.ptx->GetHash());
                 assert(nextit != mapTx.end());
-                txToRemove.insert(nextit);
+                txToRemove.push_back(nextit);
             }
         }
-        setEntries setAllRemoves;
+        vecEntries vAllRemoves;
         if (fRecursive) {
-            BOOST_FOREACH(txiter it, txToRemove) {
-                CalculateDescendants(it, setAllRemoves);
-            }
+            StageWithDescendants(txToRemove, vAllRemoves);
         } else {
-            setAllRemoves.swap(txToRemove);
+            vAllRemoves.swap(txToRemove);
         }
-        BOOST_FOREACH(txiter it, setAllRemoves) {
+        BOOST_FOREACH(txiter it, vAllRemoves) {
             removed.push_back(it->GetTx());
         }
-        RemoveStaged(setAllRemoves);
+        RemoveStaged(vAllRemoves, !fRecursive);
     }
 }
 
@@ -565,31 +671,60 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
                                 std::list<CTransaction>& conflicts, bool fCurrentEstimate)
 {
     LOCK(cs);
-    std::vector<CTxMemPoolEntry> entries;
+    // Stage the confirmed transactions and everything conflicting with them
+    // first, so ancestor and descendant state is updated in one pass over the
+    // whole set rather than once per block transaction.
+    vecEntries stage;
+    std::vector<const CTxMemPoolEntry*> entries;
     BOOST_FOREACH(const CTransaction& tx, vtx)
     {
-        uint256 hash = tx.GetHash();
-
-        indexed_transaction_set::iterator i = mapTx.find(hash);
-        if (i != mapTx.end())
-            entries.push_back(*i);
+        txiter it = mapTx.find(tx.GetHash());
+        if (it != mapTx.end()) {
+            stage.push_back(it);
+            entries.push_back(&*it);
+        }
     }
+    vecEntries vConflictRoots;
     BOOST_FOREACH(const CTransaction& tx, vtx)
     {
-        std::list<CTransaction> dummy;
-        remove(tx, dummy, false);
-        removeConflicts(tx, conflicts);
+        BOOST_FOREACH(const CTxIn &txin, tx.vin) {
+            std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(txin.prevout);
+            if (it == mapNextTx.end())
+                continue;
+            const CTransaction &txConflict = *it->second.ptx;
+            if (txConflict != tx) {
+                vConflictRoots.push_back(mapTx.find(txConflict.GetHash()));
+                ClearPrioritisation(txConflict.GetHash());
+            }
+        }
         ClearPrioritisation(tx.GetHash());
     }
-    // After the txs in the new block have been removed from the mempool, update policy estimates
+    // A conflict spends an output some block transaction spends as well, so
+    // neither it nor its descendants can be among the confirmed ones
+    size_t nConfirmed = stage.size();
+    StageWithDescendants(vConflictRoots, stage);
+    for (size_t i = nConfirmed; i < stage.size(); i++)
+        conflicts.push_back(stage[i]->GetTx());
+
+    // Conflicts are removed with all their descendants, so updating the
+    // descendants of the whole stage only reaches the confirmed transactions'
+    // children that stay in the pool.
+    UpdateForRemoveFromMempool(stage, true);
+    // The estimator has to drop everything that left the mempool before it
+    // sees the block, and it reads the confirmed entries, so erase them last
+    BOOST_FOREACH(txiter it, stage) {
+        minerPolicyEstimator->removeTx(it->GetTx().GetHash());
+    }
     minerPolicyEstimator->processBlock(nBlockHeight, entries, fCurrentEstimate);
+    BOOST_FOREACH(txiter it, stage) {
+        removeUnchecked(it, false);
+    }
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = true;
 }
 
 void CTxMemPool::_clear()
 {
-    mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
     totalTxSize = 0;
@@ -597,6 +732,11 @@ void CTxMemPool::_clear()
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
+    BOOST_FOREACH(CFeeRateBucket& bucket, vFeeHistogram) {
+        bucket.nCount = 0;
+        bucket.nSize = 0;
+        bucket.nFees = 0;
+    }
     ++nTransactionsUpdated;
 }
 
@@ -628,10 +768,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         checkTotal += it->GetTxSize();
         innerUsage += it->DynamicMemoryUsage();
         const CTransaction& tx = it->GetTx();
-        txlinksMap::const_iterator linksiter = mapLinks.find(it);
-        assert(linksiter != mapLinks.end());
-        const TxLinks &links = linksiter->second;
-        innerUsage += memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
+        innerUsage += memusage::DynamicUsage(it->vMemPoolParents) + memusage::DynamicUsage(it->vMemPoolChildren);
         bool fDependsWait = false;
         setEntries setParentCheck;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
@@ -653,7 +790,11 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             assert(it3->second.n == i);
             i++;
         }
-        assert(setParentCheck == GetMemPoolParents(it));
+        setEntries setParentLinks;
+        BOOST_FOREACH(const CTxMemPoolEntry* parent, GetMemPoolParents(it))
+            setParentLinks.insert(GetIter(parent));
+        assert(setParentLinks.size() == GetMemPoolParents(it).size()); // no duplicate links
+        assert(setParentCheck == setParentLinks);
         // Check children against mapNextTx
         CTxMemPool::setEntries setChildrenCheck;
         std::map<COutPoint, CInPoint>::const_iterator iter = mapNextTx.lower_bound(COutPoint(it->GetTx().GetHash(), 0));
@@ -667,21 +808,40 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 childModFee += childit->GetModifiedFee();
             }
         }
-        assert(setChildrenCheck == GetMemPoolChildren(it));
+        setEntries setChildLinks;
+        BOOST_FOREACH(const CTxMemPoolEntry* child, GetMemPoolChildren(it))
+            setChildLinks.insert(GetIter(child));
+        assert(setChildLinks.size() == GetMemPoolChildren(it).size());
+        assert(setChildrenCheck == setChildLinks);
+        // Verify ancestor state is correct.
+        setEntries setAncestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+        uint64_t nCountCheck = setAncestors.size() + 1;
+        uint64_t nSizeCheck = it->GetTxSize();
+        CAmount nFeesCheck = it->GetModifiedFee();
+        unsigned int nSigOpCheck = it->GetSigOpCount();
+        BOOST_FOREACH(txiter ancestorIt, setAncestors) {
+            nSizeCheck += ancestorIt->GetTxSize();
+            nFeesCheck += ancestorIt->GetModifiedFee();
+            nSigOpCheck += ancestorIt->GetSigOpCount();
+        }
+        assert(it->GetCountWithAncestors() == nCountCheck);
+        assert(it->GetSizeWithAncestors() == nSizeCheck);
+        assert(it->GetSigOpCountWithAncestors() == nSigOpCheck);
+        assert(it->GetModFeesWithAncestors() == nFeesCheck);
+
         // Also check to make sure size is greater than sum with immediate children.
         // just a sanity check, not definitive that this calc is correct...
-        if (!it->IsDirty()) {
-            assert(it->GetSizeWithDescendants() >= childSizes + it->GetTxSize());
-        } else {
-            assert(it->GetSizeWithDescendants() == it->GetTxSize());
-            assert(it->GetModFeesWithDescendants() == it->GetModifiedFee());
-        }
+        assert(it->GetSizeWithDescendants() >= childSizes + it->GetTxSize());
 
         if (fDependsWait)
             waitingOnDependants.push_back(&(*it));
         else {
             CValidationState state;
-            assert(CheckInputs(tx, state, mempoolDuplicate, false, 0, false, NULL));
+            PrecomputedTransactionData txdata;
+            assert(CheckInputs(tx, state, mempoolDuplicate, false, 0, false, false, txdata, NULL));
             UpdateCoins(tx, state, mempoolDuplicate, 1000000);
         }
     }
@@ -695,7 +855,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             stepsSinceLastRemove++;
             assert(stepsSinceLastRemove < waitingOnDependants.size());
         } else {
-            assert(CheckInputs(entry->GetTx(), state, mempoolDuplicate, false, 0, false, NULL));
+            PrecomputedTransactionData txdata;
+            assert(CheckInputs(entry->GetTx(), state, mempoolDuplicate, false, 0, false, false, txdata, NULL));
             UpdateCoins(entry->GetTx(), state, mempoolDuplicate, 1000000);
             stepsSinceLastRemove = 0;
         }
@@ -710,6 +871,21 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         assert(it->first == it->second.ptx->vin[it->second.n].prevout);
     }
 
+    std::vector<CFeeRateBucket> vFeeHistogramCheck;
+    BOOST_FOREACH(const CFeeRateBucket& bucket, vFeeHistogram)
+        vFeeHistogramCheck.push_back(CFeeRateBucket(bucket.feeRateFrom));
+    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        CFeeRateBucket& bucket = *FindFeeRateBucket(vFeeHistogramCheck, CFeeRate(it->GetModifiedFee(), it->GetTxSize()));
+        bucket.nCount++;
+        bucket.nSize += it->GetTxSize();
+        bucket.nFees += it->GetModifiedFee();
+    }
+    for (unsigned int i = 0; i < vFeeHistogram.size(); i++) {
+        assert(vFeeHistogram[i].nCount == vFeeHistogramCheck[i].nCount);
+        assert(vFeeHistogram[i].nSize == vFeeHistogramCheck[i].nSize);
+        assert(vFeeHistogram[i].nFees == vFeeHistogramCheck[i].nFees);
+    }
+
     assert(totalTxSize == checkTotal);
     assert(innerUsage == cachedInnerUsage);
 }
@@ -724,6 +900,49 @@ void CTxMemPool::queryHashes(vector<uint256>& vtxid)
         vtxid.push_back(mi->GetTx().GetHash()); // ȡÿ׹ϣ뽻б
 }
 
+void CTxMemPool::SortForAnnouncement(std::vector<uint256>& vHashes, std::vector<uint256>& vMissing) const
+{
+    LOCK(cs);
+    std::vector<txiter> vIters;
+    vIters.reserve(vHashes.size());
+    BOOST_FOREACH(const uint256& hash, vHashes) {
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end())
+            vIters.push_back(it);
+        else
+            vMissing.push_back(hash);
+    }
+    std::sort(vIters.begin(), vIters.end(), CompareIteratorByScore());
+
+    // Emit in score order, but pull each entry's queued ancestors in front
+    // of it (depth first), so a child never arrives before its parent.
+    setEntries setQueued(vIters.begin(), vIters.end());
+    setEntries setDone;
+    std::vector<std::pair<txiter, bool> > vStack;
+    vHashes.clear();
+    BOOST_FOREACH(txiter it, vIters) {
+        vStack.push_back(std::make_pair(it, false));
+        while (!vStack.empty()) {
+            txiter cur = vStack.back().first;
+            bool fParentsDone = vStack.back().second;
+            vStack.pop_back();
+            if (setDone.count(cur))
+                continue;
+            if (fParentsDone) {
+                setDone.insert(cur);
+                vHashes.push_back(cur->GetTx().GetHash());
+                continue;
+            }
+            vStack.push_back(std::make_pair(cur, true));
+            BOOST_FOREACH(const CTxMemPoolEntry* parentEntry, GetMemPoolParents(cur)) {
+                txiter parent = GetIter(parentEntry);
+                if (setQueued.count(parent) && !setDone.count(parent))
+                    vStack.push_back(std::make_pair(parent, false));
+            }
+        }
+    }
+}
+
 bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
 {
     LOCK(cs);
@@ -738,6 +957,21 @@ CFeeRate CTxMemPool::estimateFee(int nBlocks) const
     LOCK(cs);
     return minerPolicyEstimator->estimateFee(nBlocks);
 }
+CFeeRate CTxMemPool::estimateRawFee(int nBlocks, double dSuccessThreshold, FeeEstimateHorizon horizon) const
+{
+    LOCK(cs);
+    return minerPolicyEstimator->estimateRawFee(nBlocks, dSuccessThreshold, horizon);
+}
+unsigned int CTxMemPool::HighestTargetTracked(FeeEstimateHorizon horizon) const
+{
+    LOCK(cs);
+    return minerPolicyEstimator->HighestTargetTracked(horizon);
+}
+double CTxMemPool::GetFeeEstimateDecay(FeeEstimateHorizon horizon) const
+{
+    LOCK(cs);
+    return minerPolicyEstimator->HorizonDecay(horizon);
+}
 CFeeRate CTxMemPool::estimateSmartFee(int nBlocks, int *answerFoundAtBlocks) const
 {
     LOCK(cs);
@@ -789,6 +1023,12 @@ CTxMemPool::ReadFeeEstimates(CAutoFile& filein)
     return true;
 }
 
+void CTxMemPool::SetFeeEstimatesRecordFile(FILE* pfile)
+{
+    LOCK(cs);
+    minerPolicyEstimator->SetRecordFile(pfile);
+}
+
 void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash, double dPriorityDelta, const CAmount& nFeeDelta)
 {
     {
@@ -798,16 +1038,27 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         deltas.second += nFeeDelta; // ӽ׷
         txiter it = mapTx.find(hash);
         if (it != mapTx.end()) { // ڽӳҵý
+            UpdateFeeHistogram(*it, false);
             mapTx.modify(it, update_fee_delta(deltas.second)); // ¸ý׵ķ
+            UpdateFeeHistogram(*it, true);
             // Now update all ancestors' modified fees with descendants
-            setEntries setAncestors; // ¸ýеȽ׵ķ
+            vecEntries vAncestors; // ¸ýеȽ׵ķ
             uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
             std::string dummy;
-            CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false); // 㽻ڴиý׵
-            BOOST_FOREACH(txiter ancestorIt, setAncestors) { // Ƚ
+            CalculateAncestors(*it, vAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false); // 㽻ڴиý׵
+            BOOST_FOREACH(txiter ancestorIt, vAncestors) { // Ƚ
                 mapTx.modify(ancestorIt, update_descendant_state(0, nFeeDelta, 0)); // ½׷
             }
+            // Now update all descendants' modified fees with ancestors
+            vecEntries vDescendants; // ¸ýеｻ׵ȷ
+            CalculateDescendants(it, vDescendants);
+            BOOST_FOREACH(txiter descendantIt, vDescendants) {
+                mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
+            }
         }
+        // Admissions checked against the old fees have to redo their checks
+        nTransactionsUpdated++;
+        NotifyEntryPrioritised(hash);
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -826,7 +1077,8 @@ void CTxMemPool::ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount
 void CTxMemPool::ClearPrioritisation(const uint256 hash)
 {
     LOCK(cs);
-    mapDeltas.erase(hash);
+    if (mapDeltas.erase(hash))
+        nTransactionsUpdated++;
 }
 
 bool CTxMemPool::HasNoInputsOf(const CTransaction &tx) const
@@ -858,12 +1110,12 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + cachedInnerUsage;
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + cachedInnerUsage;
 }
 
-void CTxMemPool::RemoveStaged(setEntries &stage) {
+void CTxMemPool::RemoveStaged(const vecEntries &stage, bool updateDescendants) {
     AssertLockHeld(cs);
-    UpdateForRemoveFromMempool(stage);
+    UpdateForRemoveFromMempool(stage, updateDescendants);
     BOOST_FOREACH(const txiter& it, stage) {
         removeUnchecked(it);
     }
@@ -872,16 +1124,14 @@ void CTxMemPool::RemoveStaged(setEntries &stage) {
 int CTxMemPool::Expire(int64_t time) {
     LOCK(cs);
     indexed_transaction_set::nth_index<2>::type::iterator it = mapTx.get<2>().begin();
-    setEntries toremove;
+    vecEntries toremove;
     while (it != mapTx.get<2>().end() && it->GetTime() < time) {
-        toremove.insert(mapTx.project<0>(it));
+        toremove.push_back(mapTx.project<0>(it));
         it++;
     }
-    setEntries stage;
-    BOOST_FOREACH(txiter removeit, toremove) {
-        CalculateDescendants(removeit, stage);
-    }
-    RemoveStaged(stage);
+    vecEntries stage;
+    StageWithDescendants(toremove, stage);
+    RemoveStaged(stage, false);
     return stage.size();
 }
 
@@ -895,44 +1145,56 @@ bool CTxMemPool::addUnchecked(const uint256&hash, const CTxMemPoolEntry &entry,
     return addUnchecked(hash, entry, setAncestors, fCurrentEstimate);
 }
 
-void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+// Adds link to, or removes it from, links
+static void UpdateLinks(CTxMemPoolEntry::Links& links, const CTxMemPoolEntry* link, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].children.insert(child).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].children.erase(child)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    for (CTxMemPoolEntry::Links::iterator it = links.begin(); it != links.end(); ++it) {
+        if (*it == link) {
+            if (!add) {
+                // Order doesn't matter, so fill the gap with the last link
+                *it = links.back();
+                links.pop_back();
+            }
+            return;
+        }
     }
+    if (add)
+        links.push_back(link);
+}
+
+void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+{
+    cachedInnerUsage -= memusage::DynamicUsage(entry->vMemPoolChildren);
+    UpdateLinks(entry->vMemPoolChildren, &*child, add);
+    cachedInnerUsage += memusage::DynamicUsage(entry->vMemPoolChildren);
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].parents.insert(parent).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].parents.erase(parent)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
-    }
+    cachedInnerUsage -= memusage::DynamicUsage(entry->vMemPoolParents);
+    UpdateLinks(entry->vMemPoolParents, &*parent, add);
+    cachedInnerUsage += memusage::DynamicUsage(entry->vMemPoolParents);
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
+const CTxMemPoolEntry::Links & CTxMemPool::GetMemPoolParents(txiter entry) const
 {
     assert (entry != mapTx.end());
-    txlinksMap::const_iterator it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.parents;
+    return entry->vMemPoolParents;
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
+const CTxMemPoolEntry::Links & CTxMemPool::GetMemPoolChildren(txiter entry) const
 {
     assert (entry != mapTx.end());
-    txlinksMap::const_iterator it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.children;
+    return entry->vMemPoolChildren;
 }
 
 CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
     LOCK(cs);
+    return std::max(GetRollingMinFee(sizelimit), GetHistogramMinFee(sizelimit));
+}
+
+CFeeRate CTxMemPool::GetRollingMinFee(size_t sizelimit) const {
+    AssertLockHeld(cs);
     if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
         return CFeeRate(rollingMinimumFeeRate);
 
@@ -955,6 +1217,26 @@ CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
     return std::max(CFeeRate(rollingMinimumFeeRate), minReasonableRelayFee);
 }
 
+CFeeRate CTxMemPool::GetHistogramMinFee(size_t sizelimit) const {
+    AssertLockHeld(cs);
+    size_t nUsage = DynamicMemoryUsage();
+    if (nUsage + sizelimit / 10 <= sizelimit || totalTxSize == 0)
+        return CFeeRate(0);
+
+    // The histogram counts serialized sizes, so scale the usage that has to
+    // go by the ratio of the two. Buckets are by the feerate of each entry
+    // rather than of its package, which is close enough for a floor.
+    uint64_t nExcessSize = (uint64_t)((double)(nUsage + sizelimit / 10 - sizelimit) * totalTxSize / nUsage);
+    uint64_t nSize = 0;
+    for (unsigned int i = 0; i + 1 < vFeeHistogram.size(); i++) {
+        nSize += vFeeHistogram[i].nSize;
+        if (nSize > nExcessSize)
+            return vFeeHistogram[i + 1].feeRateFrom;
+    }
+    // The last bucket is open ended, take one more step as its bound
+    return CFeeRate((CAmount)(vFeeHistogram.back().feeRateFrom.GetFeePerK() * FEE_HISTOGRAM_SPACING));
+}
+
 void CTxMemPool::trackPackageRemoved(const CFeeRate& rate) {
     AssertLockHeld(cs);
     if (rate.GetFeePerK() > rollingMinimumFeeRate) {
@@ -963,25 +1245,83 @@ void CTxMemPool::trackPackageRemoved(const CFeeRate& rate) {
     }
 }
 
+void CTxMemPool::UpdateFeeHistogram(const CTxMemPoolEntry& entry, bool fAdd)
+{
+    CFeeRateBucket& bucket = *FindFeeRateBucket(vFeeHistogram, CFeeRate(entry.GetModifiedFee(), entry.GetTxSize()));
+    if (fAdd) {
+        bucket.nCount++;
+        bucket.nSize += entry.GetTxSize();
+        bucket.nFees += entry.GetModifiedFee();
+    } else {
+        bucket.nCount--;
+        bucket.nSize -= entry.GetTxSize();
+        bucket.nFees -= entry.GetModifiedFee();
+    }
+}
+
+std::vector<CFeeRateBucket> CTxMemPool::GetFeeRateHistogram() const
+{
+    LOCK(cs);
+    return vFeeHistogram;
+}
+
+size_t CTxMemPool::GetEntryUsage(txiter it) const
+{
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) + it->DynamicMemoryUsage() +
+           memusage::DynamicUsage(it->vMemPoolParents) + memusage::DynamicUsage(it->vMemPoolChildren) +
+           memusage::MallocUsage(sizeof(memusage::stl_tree_node<std::pair<const COutPoint, CInPoint> >)) * it->GetTx().vin.size();
+}
+
 void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRemaining) {
     LOCK(cs);
 
     unsigned nTxnRemoved = 0;
     CFeeRate maxFeeRateRemoved(0);
-    while (DynamicMemoryUsage() > sizelimit) {
+    size_t nUsage;
+    while (!mapTx.empty() && (nUsage = DynamicMemoryUsage()) > sizelimit) {
+        // Stage the packages with the lowest descendant scores until they
+        // make up for the excess and remove them in one go. Taking a package
+        // out never lowers the descendant scores of its ancestors and leaves
+        // the other scores alone, so this stages the same packages as taking
+        // them out one by one would, up to the first ancestor of a staged
+        // package: its score is stale, so the batch ends there.
+        vecEntries stage;
+        setEntries setStaged;
+        size_t nStagedUsage = 0;
         indexed_transaction_set::nth_index<1>::type::iterator it = mapTx.get<1>().begin();
-
-        // We set the new mempool min fee to the feerate of the removed set, plus the
-        // "minimum reasonable fee rate" (ie some value under which we consider txn
-        // to have 0 fee). This way, we don't allow txn to enter mempool with feerate
-        // equal to txn which were removed with no block in between.
-        CFeeRate removed(it->GetModFeesWithDescendants(), it->GetSizeWithDescendants());
-        removed += minReasonableRelayFee;
-        trackPackageRemoved(removed);
-        maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
-
-        setEntries stage;
-        CalculateDescendants(mapTx.project<0>(it), stage);
+        while (it != mapTx.get<1>().end() && nStagedUsage < nUsage - sizelimit) {
+            txiter rootit = mapTx.project<0>(it++);
+            if (setStaged.count(rootit))
+                continue; // Ϊｻݴ
+
+            vecEntries vPackage;
+            CalculateDescendants(rootit, vPackage);
+            bool fAncestorOfStaged = false;
+            BOOST_FOREACH(txiter descendantit, vPackage) {
+                if (setStaged.count(descendantit)) {
+                    fAncestorOfStaged = true;
+                    break;
+                }
+            }
+            if (fAncestorOfStaged)
+                break;
+
+            // We set the new mempool min fee to the feerate of the removed set, plus the
+            // "minimum reasonable fee rate" (ie some value under which we consider txn
+            // to have 0 fee). This way, we don't allow txn to enter mempool with feerate
+            // equal to txn which were removed with no block in between.
+            CFeeRate removed(rootit->GetModFeesWithDescendants(), rootit->GetSizeWithDescendants());
+            removed += minReasonableRelayFee;
+            trackPackageRemoved(removed);
+            maxFeeRateRemoved = std::max(maxFeeRateRemoved, removed);
+
+            vPackage.push_back(rootit);
+            BOOST_FOREACH(txiter stageit, vPackage) {
+                stage.push_back(stageit);
+                setStaged.insert(stageit);
+                nStagedUsage += GetEntryUsage(stageit);
+            }
+        }
         nTxnRemoved += stage.size();
 
         std::vector<CTransaction> txn;
@@ -990,7 +1330,7 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRe
             BOOST_FOREACH(txiter it, stage)
                 txn.push_back(it->GetTx());
         }
-        RemoveStaged(stage);
+        RemoveStaged(stage, false);
         if (pvNoSpendsRemaining) {
             BOOST_FOREACH(const CTransaction& tx, txn) {
                 BOOST_FOREACH(const CTxIn& txin, tx.vin) {
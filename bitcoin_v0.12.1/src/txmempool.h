@@ -11,13 +11,18 @@
 
 #include "amount.h"
 #include "coins.h"
+#include "policy/fees.h"
+#include "prevector.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 
 #undef foreach
 #include "boost/multi_index_container.hpp"
+#include "boost/multi_index/hashed_index.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 
+#include <boost/signals2/signal.hpp>
+
 class CAutoFile;
 class CBlockIndex;
 
@@ -57,21 +62,23 @@ class CTxMemPool;
  *
  * CTxMemPoolEntry stores data about the correponding transaction, as well
  * as data about all in-mempool transactions that depend on the transaction
- * ("descendant" transactions).
+ * ("descendant" transactions), and all in-mempool transactions it depends on
+ * ("ancestor" transactions).
  *
  * When a new entry is added to the mempool, we update the descendant state
  * (nCountWithDescendants, nSizeWithDescendants, and nModFeesWithDescendants) for
- * all ancestors of the newly added transaction.
- *
- * If updating the descendant state is skipped, we can mark the entry as
- * "dirty", and set nSizeWithDescendants/nModFeesWithDescendants to equal nTxSize/
- * nFee+feeDelta. (This can potentially happen during a reorg, where we limit the
- * amount of work we're willing to do to avoid consuming too much CPU.)
+ * all ancestors of the newly added transaction, and set the ancestor state
+ * (nCountWithAncestors, nSizeWithAncestors, nModFeesWithAncestors and
+ * nSigOpCountWithAncestors) of the new entry itself.
  *
  */
 
 class CTxMemPoolEntry // ׳н׵ĻĿ
 {
+public:
+    //! Direct in-mempool parents or children of an entry
+    typedef prevector<2, const CTxMemPoolEntry*> Links;
+
 private:
     CTransaction tx; // һʽ
     CAmount nFee; //! Cached to avoid expensive parent-transaction lookups // ׷
@@ -90,13 +97,23 @@ private:
 
     // Information about descendants of this transaction that are in the
     // mempool; if we remove this transaction we must remove all of these
-    // descendants as well.  if nCountWithDescendants is 0, treat this entry as
-    // dirty, and nSizeWithDescendants and nModFeesWithDescendants will not be
-    // correct.
+    // descendants as well.
     uint64_t nCountWithDescendants; //! number of descendant transactions // ｻ׵
     uint64_t nSizeWithDescendants;  //! ... and size // ｻ׵ĴС
     CAmount nModFeesWithDescendants;  //! ... and total fees (all including us) // ܷã
 
+    // Analogous statistics for ancestor transactions
+    uint64_t nCountWithAncestors; // Ƚ׵
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    unsigned int nSigOpCountWithAncestors;
+
+    // Links to in-mempool parents and children, maintained by CTxMemPool.
+    // They don't take part in any mapTx index, so the pool updates them in place.
+    mutable Links vMemPoolParents; // ڴеĸ
+    mutable Links vMemPoolChildren; // ڴеӽ
+    friend class CTxMemPool;
+
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                     int64_t _nTime, double _entryPriority, unsigned int _entryHeight,
@@ -120,26 +137,32 @@ public:
     size_t DynamicMemoryUsage() const { return nUsageSize; }
     const LockPoints& GetLockPoints() const { return lockPoints; }
 
-    // Adjusts the descendant state, if this entry is not dirty.
-    void UpdateState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount); // ״̬
+    // Adjusts the descendant state.
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount); // ״̬
+    // Adjusts the ancestor state
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount, int modifySigOps); // ״̬
     // Updates the fee delta used for mining priority score, and the
-    // modified fees with descendants.
-    void UpdateFeeDelta(int64_t feeDelta); //  feeDelta޸ｻ׷
+    // modified fees with descendants and ancestors.
+    void UpdateFeeDelta(int64_t feeDelta); //  feeDelta޸Ƚ׷
     // Update the LockPoints after a reorg
     void UpdateLockPoints(const LockPoints& lp); //  LockPoint
 
-    /** We can set the entry to be dirty if doing the full calculation of in-
-     *  mempool descendants will be too expensive, which can potentially happen
-     *  when re-adding transactions from a block back to the mempool.
-     */
-    void SetDirty();
-    bool IsDirty() const { return nCountWithDescendants == 0; }
-
     uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
     uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
     CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
 
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+    unsigned int GetSigOpCountWithAncestors() const { return nSigOpCountWithAncestors; }
+
     bool GetSpendsCoinbase() const { return spendsCoinbase; }
+
+    const Links& GetMemPoolParents() const { return vMemPoolParents; }
+    const Links& GetMemPoolChildren() const { return vMemPoolChildren; }
+
+    //! Epoch of the last CTxMemPool traversal that visited this entry
+    mutable uint64_t nEpochMarker;
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -150,7 +173,7 @@ struct update_descendant_state
     {}
 
     void operator() (CTxMemPoolEntry &e)
-        { e.UpdateState(modifySize, modifyFee, modifyCount); }
+        { e.UpdateDescendantState(modifySize, modifyFee, modifyCount); }
 
     private:
         int64_t modifySize;
@@ -158,10 +181,20 @@ struct update_descendant_state
         int64_t modifyCount;
 };
 
-struct set_dirty
+struct update_ancestor_state
 {
+    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount, int _modifySigOps) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount), modifySigOps(_modifySigOps)
+    {}
+
     void operator() (CTxMemPoolEntry &e)
-        { e.SetDirty(); }
+        { e.UpdateAncestorState(modifySize, modifyFee, modifyCount, modifySigOps); }
+
+    private:
+        int64_t modifySize;
+        CAmount modifyFee;
+        int64_t modifyCount;
+        int modifySigOps;
 };
 
 struct update_fee_delta
@@ -194,6 +227,20 @@ struct mempoolentry_txid
     }
 };
 
+/** Salted hash of a txid, for the hashed txid index of mapTx */
+class SaltedTxidHasher
+{
+private:
+    uint256 salt;
+
+public:
+    SaltedTxidHasher();
+
+    size_t operator()(const uint256& txid) const {
+        return txid.GetHash(salt);
+    }
+};
+
 /** \class CompareTxMemPoolEntryByDescendantScore
  *
  *  Sort an entry by max(score/size of entry's tx, score/size with all descendants).
@@ -201,7 +248,7 @@ struct mempoolentry_txid
 class CompareTxMemPoolEntryByDescendantScore
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         bool fUseADescendants = UseDescendantScore(a);
         bool fUseBDescendants = UseDescendantScore(b);
@@ -223,7 +270,7 @@ public:
     }
 
     // Calculate which score to use for an entry (avoiding division).
-    bool UseDescendantScore(const CTxMemPoolEntry &a)
+    bool UseDescendantScore(const CTxMemPoolEntry &a) const
     {
         double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
         double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
@@ -238,7 +285,7 @@ public:
 class CompareTxMemPoolEntryByScore
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         double f1 = (double)a.GetModifiedFee() * b.GetTxSize();
         double f2 = (double)b.GetModifiedFee() * a.GetTxSize();
@@ -252,13 +299,43 @@ public:
 class CompareTxMemPoolEntryByEntryTime
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        // Equal times are ordered by txid, so (time, txid) is a stable
+        // position to continue a walk from
+        if (a.GetTime() != b.GetTime())
+            return a.GetTime() < b.GetTime();
+        return a.GetTx().GetHash() < b.GetTx().GetHash();
+    }
+};
+
+/** \class CompareTxMemPoolEntryByAncestorFee
+ *
+ *  Sort by feerate of entry with all its in-mempool ancestors
+ *  ((fees+deltas)/size of the package) in descending order
+ */
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
-        return a.GetTime() < b.GetTime();
+        double aFees = a.GetModFeesWithAncestors();
+        double aSize = a.GetSizeWithAncestors();
+
+        double bFees = b.GetModFeesWithAncestors();
+        double bSize = b.GetSizeWithAncestors();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = aFees * bSize;
+        double f2 = aSize * bFees;
+
+        if (f1 == f2) {
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        }
+        return f1 > f2;
     }
 };
 
-class CBlockPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */ //  - һʽ׺ڲб/ n 
 class CInPoint // 
@@ -274,6 +351,17 @@ public:
     size_t DynamicMemoryUsage() const { return 0; }
 };
 
+/** Mempool totals of the transactions whose modified feerate falls in one range */
+struct CFeeRateBucket
+{
+    CFeeRate feeRateFrom; //! lowest feerate of the range, it ends where the next bucket starts
+    uint64_t nCount;
+    uint64_t nSize;
+    CAmount nFees;
+
+    CFeeRateBucket(const CFeeRate& feeRateFromIn) : feeRateFrom(feeRateFromIn), nCount(0), nSize(0), nFees(0) {}
+};
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -286,11 +374,13 @@ public:
  *
  * CTxMemPool::mapTx, and CTxMemPoolEntry bookkeeping:
  *
- * mapTx is a boost::multi_index that sorts the mempool on 4 criteria:
- * - transaction hash
+ * mapTx is a boost::multi_index that sorts the mempool on 5 criteria:
+ * - transaction hash (hashed, not sorted)
  * - feerate [we use max(feerate of tx, feerate of tx with all descendants)]
  * - time in mempool
  * - mining score (feerate modified by any fee deltas from PrioritiseTransaction)
+ * - ancestor score (modified feerate of tx together with all its in-mempool
+ *   ancestors, used by the block assembler to select packages)
  *
  * Note: the term "descendant" refers to in-mempool transactions that depend on
  * this one, while "ancestor" refers to in-mempool transactions that a given
@@ -298,20 +388,24 @@ public:
  *
  * In order for the feerate sort to remain correct, we must update transactions
  * in the mempool when new descendants arrive.  To facilitate this, we track
- * the set of in-mempool direct parents and direct children in mapLinks.  Within
- * each CTxMemPoolEntry, we track the size and fees of all descendants.
+ * the in-mempool direct parents and direct children of each entry.  Within
+ * each CTxMemPoolEntry, we track the size and fees of all descendants, and
+ * the size, fees and sigops of all ancestors.
  *
  * Usually when a new transaction is added to the mempool, it has no in-mempool
  * children (because any such children would be an orphan).  So in
  * addUnchecked(), we:
- * - update a new entry's setMemPoolParents to include all in-mempool parents
+ * - update a new entry's vMemPoolParents to include all in-mempool parents
  * - update the new entry's direct parents to include the new tx as a child
  * - update all ancestors of the transaction to include the new tx's size/fee
+ * - set the new entry's ancestor state from the size/fee/sigops of its ancestors
  *
  * When a transaction is removed from the mempool, we must:
- * - update all in-mempool parents to not track the tx in setMemPoolChildren
+ * - update all in-mempool parents to not track the tx in vMemPoolChildren
  * - update all ancestors to not include the tx's size/fees in descendant state
  * - update all in-mempool children to not include it as a parent
+ * - if its descendants stay in the mempool (eg. it was included in a block),
+ *   update them to not include the tx in their ancestor state
  *
  * These happen in UpdateForRemoveFromMempool().  (Note that when removing a
  * transaction along with its descendants, we must calculate that set of
@@ -331,7 +425,7 @@ public:
  * state, to account for in-mempool, out-of-block descendants for all the
  * in-block transactions by calling UpdateTransactionsFromBlock().  Note that
  * until this is called, the mempool state is not consistent, and in particular
- * mapLinks may not be correct (and therefore functions like
+ * the parent and child links may not be correct (and therefore functions like
  * CalculateMemPoolAncestors() and CalculateDescendants() that rely
  * on them to walk the mempool are not generally safe to use).
  *
@@ -344,11 +438,9 @@ public:
  *
  * Adding transactions from a disconnected block can be very time consuming,
  * because we don't have a way to limit the number of in-mempool descendants.
- * To bound CPU processing, we limit the amount of work we're willing to do
- * to properly update the descendant information for a tx being added from
- * a disconnected block.  If we would exceed the limit, then we instead mark
- * the entry as "dirty", and set the feerate for sorting purposes to be equal
- * the feerate of the transaction without any descendants.
+ * The descendants' ancestor state has to be exact for block assembly, so
+ * UpdateTransactionsFromBlock() always walks all of them; the amount of work
+ * is instead bounded by the mempool size limit.
  *
  */ // CTxMemPool 洢ܰһĻڵǰЧס
 class CTxMemPool
@@ -367,17 +459,33 @@ private:
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //! minimum fee to get into the pool, decreases exponentially // ڴصС
 
+    mutable uint64_t nEpoch; //! current traversal epoch, see EpochGuard // ǰļԪ
+    mutable bool fHasEpochGuard;
+
+    std::vector<CFeeRateBucket> vFeeHistogram; //! totals by modified feerate, see GetFeeRateHistogram // ʷͰͳ
+
     void trackPackageRemoved(const CFeeRate& rate);
+    /** The decaying feerate of the best package evicted so far */
+    CFeeRate GetRollingMinFee(size_t sizelimit) const;
+    /** The feerate below which the histogram holds as much as has to go to
+     *  keep a tenth of sizelimit free, or 0 if that much is free already */
+    CFeeRate GetHistogramMinFee(size_t sizelimit) const;
 
 public:
 
     static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
 
+    /** Number of feerate histogram buckets. The first one holds everything
+     *  below 1000 satoshis per kB, the bounds of the others grow by a
+     *  factor of FEE_HISTOGRAM_SPACING, the last one is open ended. */
+    static const unsigned int FEE_HISTOGRAM_BUCKETS = 40;
+    static const double FEE_HISTOGRAM_SPACING;
+
     typedef boost::multi_index_container<
         CTxMemPoolEntry,
         boost::multi_index::indexed_by<
-            // sorted by txid // 1.ݽ id/hash 
-            boost::multi_index::ordered_unique<mempoolentry_txid>,
+            // hashed by txid // 1.ݽ id/hash ɢУO(1) 
+            boost::multi_index::hashed_unique<mempoolentry_txid, SaltedTxidHasher>,
             // sorted by fee rate // 2.ݽ׷
             boost::multi_index::ordered_non_unique<
                 boost::multi_index::identity<CTxMemPoolEntry>,
@@ -392,6 +500,11 @@ public:
             boost::multi_index::ordered_unique<
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByScore
+            >,
+            // sorted by fee rate with ancestors // 5.ݰȵķ
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByAncestorFee
             >
         >
     > indexed_transaction_set;
@@ -405,27 +518,71 @@ public:
         }
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
+    typedef std::vector<txiter> vecEntries;
+    struct CompareIteratorByScore {
+        bool operator()(const txiter &a, const txiter &b) const {
+            return CompareTxMemPoolEntryByScore()(*a, *b);
+        }
+    };
 
-    const setEntries & GetMemPoolParents(txiter entry) const;
-    const setEntries & GetMemPoolChildren(txiter entry) const;
+    const CTxMemPoolEntry::Links & GetMemPoolParents(txiter entry) const;
+    const CTxMemPoolEntry::Links & GetMemPoolChildren(txiter entry) const;
+    /** The mapTx iterator for an entry linked from another one */
+    txiter GetIter(const CTxMemPoolEntry* entry) const { return mapTx.iterator_to(*entry); }
 private:
-    typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
+    typedef std::map<txiter, vecEntries, CompareIteratorByHash> cacheMap;
 
-    struct TxLinks {
-        setEntries parents;
-        setEntries children;
+    void UpdateParent(txiter entry, txiter parent, bool add);
+    void UpdateChild(txiter entry, txiter child, bool add);
+
+    /** Starts a new traversal epoch for as long as it is in scope. Entries
+     *  marked by visited() during that time count as visited, all others
+     *  don't, so walks need no set of seen entries. Walks cannot nest.
+     */ // ڿµıԪ
+    class EpochGuard
+    {
+    private:
+        const CTxMemPool& pool;
+    public:
+        EpochGuard(const CTxMemPool& _pool) : pool(_pool)
+        {
+            assert(!pool.fHasEpochGuard);
+            pool.nEpoch++;
+            pool.fHasEpochGuard = true;
+        }
+        ~EpochGuard() { pool.fHasEpochGuard = false; }
     };
 
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
-    txlinksMap mapLinks;
+    /** Mark an entry visited in the current epoch, returning whether it already was */
+    bool visited(txiter it) const
+    {
+        assert(fHasEpochGuard);
+        if (it->nEpochMarker == nEpoch)
+            return true;
+        it->nEpochMarker = nEpoch;
+        return false;
+    }
 
-    void UpdateParent(txiter entry, txiter parent, bool add);
-    void UpdateChild(txiter entry, txiter child, bool add);
+    /** CalculateMemPoolAncestors() into a vector, in breadth-first order */
+    bool CalculateAncestors(const CTxMemPoolEntry &entry, vecEntries &vAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents) const;
 
 public:
+    /** All in-mempool descendants of it, not including it */
+    void CalculateDescendants(txiter it, vecEntries &vDescendants) const;
+    /** Append the entries in vRoots and all their in-mempool descendants to
+     *  vStage, each once, leaving out entries already in vStage. */
+    void StageWithDescendants(const vecEntries &vRoots, vecEntries &vStage) const;
+
     std::map<COutPoint, CInPoint> mapNextTx; // һʽӳб <ʽ㣬±ʽ>
     std::map<uint256, std::pair<double, CAmount> > mapDeltas; // ӳ䣨ϣȼ׷ѣ
 
+    /** Fired for every transaction entering the pool, once it is linked to its in-pool parents. */
+    boost::signals2::signal<void (const CTransaction &)> NotifyEntryAdded;
+    /** Fired for every transaction leaving the pool, while it can still be looked up. */
+    boost::signals2::signal<void (const CTransaction &)> NotifyEntryRemoved;
+    /** Fired when prioritisetransaction changes the deltas of a transaction, in the pool or not. */
+    boost::signals2::signal<void (const uint256 &)> NotifyEntryPrioritised;
+
     /** Create a new CTxMemPool.
      *  minReasonableRelayFee should be a feerate which is, roughly, somewhere
      *  around what it "costs" to relay a transaction around the network and
@@ -475,8 +632,12 @@ public:
 public:
     /** Remove a set of transactions from the mempool.
      *  If a transaction is in this set, then all in-mempool descendants must
-     *  also be in the set.*/ // ڴƳһ׼ϡһʽڸüôӽױڸü
-    void RemoveStaged(setEntries &stage);
+     *  also be in the set, unless this transaction is being removed for being
+     *  in a block.
+     *  Set updateDescendants to true when removing a tx that was in a block, so
+     *  that any in-mempool descendants have their ancestor state updated.
+     */ // ڴƳһ׼ϡһʽڸüôӽױڸü
+    void RemoveStaged(const vecEntries &stage, bool updateDescendants);
 
     /** When adding transactions from a disconnected block back to the mempool,
      *  new mempool entries may have children in the mempool (which is generally
@@ -497,20 +658,18 @@ public:
      *  limitDescendantSize = max size of descendants any ancestor can have
      *  errString = populated with error reason if any limits are hit
      *  fSearchForParents = whether to search a tx's vin for in-mempool parents, or
-     *    look up parents from mapLinks. Must be true for entries not in the mempool
+     *    use the entry's parent links. Must be true for entries not in the mempool
      */ // ԼڴĿ
-    bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true);
-
-    /** Populate setDescendants with all in-mempool descendants of hash.
-     *  Assumes that setDescendants includes all in-mempool descendants of anything
-     *  already in it.  */
-    void CalculateDescendants(txiter it, setEntries &setDescendants);
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
 
     /** The minimum fee to get into the mempool, which may itself not be enough
       *  for larger-sized transactions.
       *  The minReasonableRelayFee constructor arg is used to bound the time it
       *  takes the fee rate to go back down all the way to 0. When the feerate
       *  would otherwise be half of this, it is set to 0 instead.
+      *  Once the pool is within a tenth of sizelimit, the feerate histogram
+      *  raises this to the feerate of the transactions that would be evicted
+      *  next, in time independent of the pool size.
       */ // ȡڴСãִܱ֧ͽס
     CFeeRate GetMinFee(size_t sizelimit) const;
 
@@ -520,6 +679,10 @@ public:
       */ // Ƴڴж̬С sizelimit Ľס
     void TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRemaining=NULL);
 
+    /** Count, size and modified fees of the mempool transactions by feerate.
+     *  Kept up to date as transactions come and go, so this is cheap. */
+    std::vector<CFeeRateBucket> GetFeeRateHistogram() const;
+
     /** Expire all transaction (and their dependencies) in the mempool older than time. Return the number of removed transactions. */
     int Expire(int64_t time); // Ƴڴ time ֮ǰĽ׺ｻסسɹƳ׵
 
@@ -543,6 +706,12 @@ public:
 
     bool lookup(uint256 hash, CTransaction& result) const;
 
+    /** Order vHashes for announcement: highest mining score first, with any
+     *  in-mempool parents that are also in vHashes moved ahead of their
+     *  children. Hashes that are not in the mempool are moved to vMissing.
+     */ // Ϊͨ򣺰ڿҸӽ
+    void SortForAnnouncement(std::vector<uint256>& vHashes, std::vector<uint256>& vMissing) const;
+
     /** Estimate fee rate needed to get into the next nBlocks
      *  If no answer can be given at nBlocks, return an estimate
      *  at the lowest number of blocks where one can be given
@@ -552,6 +721,16 @@ public:
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const; // һҪĽ׷
 
+    /** Estimate fee rate needed to get into the next nBlocks with the given
+     *  success threshold, over one of the estimator's horizons */
+    CFeeRate estimateRawFee(int nBlocks, double dSuccessThreshold, FeeEstimateHorizon horizon) const;
+
+    /** Highest nBlocks estimateRawFee can answer for over horizon */
+    unsigned int HighestTargetTracked(FeeEstimateHorizon horizon) const;
+
+    /** Per block decay of the data estimateRawFee uses over horizon */
+    double GetFeeEstimateDecay(FeeEstimateHorizon horizon) const;
+
     /** Estimate priority needed to get into the next nBlocks
      *  If no answer can be given at nBlocks, return an estimate
      *  at the lowest number of blocks where one can be given
@@ -565,6 +744,9 @@ public:
     bool WriteFeeEstimates(CAutoFile& fileout) const;
     bool ReadFeeEstimates(CAutoFile& filein);
 
+    /** Record what the fee estimator is fed to pfile, see CBlockPolicyEstimator::SetRecordFile */
+    void SetFeeEstimatesRecordFile(FILE* pfile);
+
     size_t DynamicMemoryUsage() const;
 
 private:
@@ -577,33 +759,42 @@ private:
      *  updated and hence their state is already reflected in the parent
      *  state).
      *
-     *  If updating an entry requires looking at more than maxDescendantsToVisit
-     *  transactions, outside of the ones in setExclude, then give up.
+     *  The ancestor state of each descendant outside setExclude is updated to
+     *  include the transaction.
      *
      *  cachedDescendants will be updated with the descendants of the transaction
      *  being updated, so that future invocations don't need to walk the
      *  same transaction again, if encountered in another transaction chain.
      */
-    bool UpdateForDescendants(txiter updateIt,
-            int maxDescendantsToVisit,
+    void UpdateForDescendants(txiter updateIt,
             cacheMap &cachedDescendants,
             const std::set<uint256> &setExclude);
     /** Update ancestors of hash to add/remove it as a descendant transaction. */
-    void UpdateAncestorsOf(bool add, txiter hash, setEntries &setAncestors);
-    /** For each transaction being removed, update ancestors and any direct children. */
-    void UpdateForRemoveFromMempool(const setEntries &entriesToRemove);
+    void UpdateAncestorsOf(bool add, txiter hash, const vecEntries &vAncestors);
+    /** Set ancestor state for an entry */
+    void UpdateEntryForAncestors(txiter it, const vecEntries &vAncestors);
+    /** For each transaction being removed, update ancestors and any direct children.
+      * If updateDescendants is true, then also update in-mempool descendants'
+      * ancestor state. */
+    void UpdateForRemoveFromMempool(const vecEntries &entriesToRemove, bool updateDescendants);
     /** Sever link between specified transaction and direct children. */
     void UpdateChildrenForRemoval(txiter entry);
 
     /** Before calling removeUnchecked for a given transaction,
      *  UpdateForRemoveFromMempool must be called on the entire (dependent) set
      *  of transactions being removed at the same time.  We use each
-     *  CTxMemPoolEntry's setMemPoolParents in order to walk ancestors of a
+     *  CTxMemPoolEntry's vMemPoolParents in order to walk ancestors of a
      *  given transaction that is removed, so we can't remove intermediate
      *  transactions in a chain before we've updated all the state for the
-     *  removal.
+     *  removal. fUpdateEstimator is false when the caller has already told
+     *  the fee estimator about the removal.
      */
-    void removeUnchecked(txiter entry);
+    void removeUnchecked(txiter entry, bool fUpdateEstimator = true);
+
+    /** Add an entry to or take it out of the feerate histogram. */
+    void UpdateFeeHistogram(const CTxMemPoolEntry& entry, bool fAdd);
+    /** Memory that removing an entry frees, as DynamicMemoryUsage() counts it. */
+    size_t GetEntryUsage(txiter it) const;
 };
 
 /** 
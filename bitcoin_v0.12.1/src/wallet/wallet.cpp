@@ -1266,6 +1266,8 @@ bool CWalletTx::RelayWalletTransaction()
     {
         if (GetDepthInMainChain() == 0 && !isAbandoned()) { // Ϊ 0δ δΪ
             LogPrintf("Relaying wtx %s\n", GetHash().ToString()); // ¼м̽׹ϣ
+            if (!InMempool())
+                relayCache.Insert((CTransaction)*this); // ڴУм̻ṩ
             RelayTransaction((CTransaction)*this); // нм
             return true;
         }